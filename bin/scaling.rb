@@ -0,0 +1,212 @@
+#!/usr/bin/env ruby
+
+# Prueba de escalabilidad de los servidores de punta a punta.
+#
+# Inicia server, weather_server y horoscope_server en puertos libres de
+# localhost y, para cada combinación de hilos (-t) y conexiones (-c) del
+# servidor principal, envía consultas con loadgen a concurrencia creciente.
+# Guarda el rendimiento y la latencia p99 de cada punto en un archivo JSON y,
+# si se indica un resultado de referencia, falla cuando algún punto empeora
+# más que la tolerancia. Si la referencia no existe o no tiene ningún punto en
+# común con los medidos, termina con el código 77 (prueba omitida), para que
+# la comparación no pase sin haberse hecho.
+#
+# Por ejemplo, desde la raíz del repositorio:
+#
+#   bin/scaling.rb -b build/src -o scaling.json
+#   bin/scaling.rb -b build/src -o scaling.json -r scaling-base.json -l 15
+
+require 'json'
+require 'optparse'
+require 'ostruct'
+require 'socket'
+require 'time'
+
+# Opciones de línea de comandos
+options = OpenStruct.new(
+  :build => 'build/src',
+  :horoscope_file => File.expand_path('../src/horoscope.txt', __dir__),
+  :threads => [1, 2, 4, 8],
+  :max_conn => [10, 128],
+  :concurrency => [1, 4, 16, 64],
+  :duration => 5,
+  :mode => 'threads',
+  :output => 'scaling.json',
+  :baseline => nil,
+  :tolerance => 10.0
+)
+
+# Obtener opciones
+OptionParser.new do |arg|
+  arg.on '-b', '--build DIR', 'Directorio de los ejecutables (build/src por defecto)' do |val|
+    options.build = val
+  end
+  arg.on '-f', '--horoscope-file FILE', 'Archivo con los datos del horóscopo (src/horoscope.txt por defecto)' do |val|
+    options.horoscope_file = val
+  end
+  arg.on '-t', '--threads LIST', Array, 'Hilos del servidor principal (1,2,4,8 por defecto)' do |val|
+    options.threads = val.map(&:to_i)
+  end
+  arg.on '-c', '--max-conn LIST', Array, 'Conexiones del servidor principal (10,128 por defecto)' do |val|
+    options.max_conn = val.map(&:to_i)
+  end
+  arg.on '-n', '--concurrency LIST', Array, 'Consultas en curso de loadgen (1,4,16,64 por defecto)' do |val|
+    options.concurrency = val.map(&:to_i)
+  end
+  arg.on '-d', '--duration SECONDS', Integer, 'Duración de cada punto en segundos (5 por defecto)' do |val|
+    options.duration = val
+  end
+  arg.on '-m', '--mode MODE', 'Modo del servidor principal: threads, epoll o uring (threads por defecto)' do |val|
+    options.mode = val
+  end
+  arg.on '-o', '--output FILE', 'Archivo JSON de resultados (scaling.json por defecto)' do |val|
+    options.output = val
+  end
+  arg.on '-r', '--baseline FILE', 'Archivo JSON de referencia con el que comparar (ninguno por defecto)' do |val|
+    options.baseline = val
+  end
+  arg.on '-l', '--tolerance PERCENT', Float, 'Empeoramiento admitido respecto de la referencia (10 por defecto)' do |val|
+    options.tolerance = val
+  end
+end.parse!
+
+# Ruta de un ejecutable del directorio de compilación
+def program(options, name)
+  path = File.join(options.build, name)
+  path += '.exe' if Gem.win_platform?
+  abort "No se encontró #{path}" unless File.executable? path
+  path
+end
+
+# Puerto TCP libre de localhost
+def free_port
+  server = TCPServer.new '127.0.0.1', 0
+  server.addr[1]
+ensure
+  server.close
+end
+
+# Iniciar un servidor y esperar que acepte conexiones
+def start(command, port)
+  pid = spawn(*command, :out => File::NULL, :err => File::NULL)
+  100.times do
+    begin
+      TCPSocket.new('127.0.0.1', port).close
+      return pid
+    rescue SystemCallError
+      sleep 0.05
+    end
+  end
+  stop pid
+  abort "El servidor no acepta conexiones: #{command.join ' '}"
+end
+
+# Detener un servidor
+def stop(pid)
+  Process.kill 'TERM', pid
+  Process.wait pid
+rescue SystemCallError
+end
+
+# Clave de un punto, para compararlo con la referencia
+def key(point)
+  point.values_at 'hilos', 'conexiones', 'concurrencia'
+end
+
+loadgen = program options, 'loadgen'
+weather_port = free_port
+horoscope_port = free_port
+pids = []
+
+at_exit { pids.each { |pid| stop pid } }
+
+pids << start([program(options, 'weather_server'), '-p', weather_port.to_s,
+               '-v', 'warning'], weather_port)
+pids << start([program(options, 'horoscope_server'), '-p', horoscope_port.to_s,
+               '-f', options.horoscope_file, '-v', 'warning'], horoscope_port)
+
+points = []
+
+options.threads.each do |threads|
+  options.max_conn.each do |max_conn|
+    port = free_port
+    pid = start([program(options, 'server'), '-p', port.to_s,
+                 '-w', '127.0.0.1', '-W', weather_port.to_s,
+                 '-s', '127.0.0.1', '-S', horoscope_port.to_s,
+                 '-t', threads.to_s, '-c', max_conn.to_s,
+                 '-m', options.mode, '-v', 'warning'], port)
+    pids << pid
+
+    options.concurrency.each do |concurrency|
+      output = IO.popen([loadgen, '-p', port.to_s, '-c', concurrency.to_s,
+                         '-d', options.duration.to_s, '-j'], &:read)
+      abort "Error al ejecutar loadgen (-t #{threads} -c #{max_conn})" unless $?.success?
+
+      # Rendimiento de las consultas respondidas, sin contar los errores
+      result = JSON.parse output.lines.last
+      answered = result['consultas'] - result['errores']
+      point = {
+        'hilos' => threads,
+        'conexiones' => max_conn,
+        'concurrencia' => concurrency,
+        'rendimiento' => (result['rendimiento'] * answered / [result['consultas'], 1].max).round(1),
+        'p99' => result['corregida']['p99'],
+        'errores' => result['errores']
+      }
+      points << point
+      puts format('-t %-3d -c %-4d %4d en curso: %10.1f consultas/s, p99 %8d us, %d errores',
+                  threads, max_conn, concurrency, point['rendimiento'],
+                  point['p99'], point['errores'])
+    end
+
+    stop pids.pop
+  end
+end
+
+File.write options.output, JSON.pretty_generate(
+  'fecha' => Time.now.iso8601,
+  'modo' => options.mode,
+  'duracion' => options.duration,
+  'puntos' => points
+)
+puts "Resultados guardados en #{options.output}"
+
+exit if options.baseline.nil?
+
+# Código de salida de una prueba omitida para Meson
+SKIP = 77
+
+unless File.exist? options.baseline
+  puts "No existe la referencia #{options.baseline}, no se compara"
+  puts "Para crearla, copiar #{options.output} en #{options.baseline}"
+  exit SKIP
+end
+
+# Comparar con la referencia: menos rendimiento o más latencia que lo admitido
+baseline = JSON.parse(File.read(options.baseline))['puntos'].to_h { |p| [key(p), p] }
+if points.none? { |point| baseline.key? key(point) }
+  puts "La referencia #{options.baseline} no tiene puntos en común con los medidos, no se compara"
+  exit SKIP
+end
+
+factor = options.tolerance / 100.0
+failures = points.filter_map do |point|
+  base = baseline[key(point)]
+  next if base.nil?
+
+  label = format('-t %d -c %d, %d en curso', *key(point))
+  if point['rendimiento'] < base['rendimiento'] * (1 - factor)
+    format('%s: rendimiento %.1f < %.1f consultas/s', label,
+           point['rendimiento'], base['rendimiento'])
+  elsif point['p99'] > base['p99'] * (1 + factor)
+    format('%s: p99 %d > %d us', label, point['p99'], base['p99'])
+  end
+end
+
+if failures.empty?
+  puts "Sin regresiones respecto de #{options.baseline} (tolerancia #{options.tolerance}%)"
+else
+  puts "Regresiones respecto de #{options.baseline} (tolerancia #{options.tolerance}%):"
+  failures.each { |failure| puts "  #{failure}" }
+  exit 1
+end
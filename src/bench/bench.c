@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "tcpframe.h"
+
+/* Tamaño de los buffers de lectura */
+#define BENCH_READ_LEN  4096
+/* Longitud máxima de un mensaje */
+#define BENCH_MAX_LEN   65536
+
+/** Conexión con un hilo que ejecuta una función del servidor */
+struct BenchConn
+{
+  /** @privatesection */
+  int             sock;
+  int             peer;
+  TcpServerFunc   func;
+  void           *data;
+  GThread        *thread;
+  TcpFrameReader *reader;
+  GString        *request;
+};
+
+#ifdef __GLIBC__
+/* Asignaciones de memoria de todos los hilos desde el inicio */
+static gint allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+  g_atomic_int_inc(&allocations);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  g_atomic_int_inc(&allocations);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  g_atomic_int_inc(&allocations);
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  g_atomic_int_inc(&allocations);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  *ptr = memalign(alignment, size);
+  return *ptr != NULL ? 0 : ENOMEM;
+}
+#endif
+
+static gint64 run_times(BenchFunc func, void *data, gint64 n)
+{
+  gint64 start = g_get_monotonic_time();
+
+  for (gint64 i = 0; i < n; i++) {
+    func(data);
+  }
+
+  return g_get_monotonic_time() - start;
+}
+
+void bench_run(const char *name, BenchFunc func, void *data)
+{
+  gint64 n = 1, elapsed;
+  gint before, after;
+
+  g_return_if_fail(name != NULL);
+  g_return_if_fail(func != NULL);
+
+  /* Duplicar las repeticiones hasta alcanzar la duración mínima */
+  func(data);
+  while ((elapsed = run_times(func, data, n)) < BENCH_TIME * 1000 / 10) {
+    n *= 2;
+  }
+  n = MAX(n, n * BENCH_TIME * 1000 / MAX(elapsed, 1));
+
+#ifdef __GLIBC__
+  before = g_atomic_int_get(&allocations);
+#endif
+  elapsed = run_times(func, data, n);
+#ifdef __GLIBC__
+  after = g_atomic_int_get(&allocations);
+  printf("%-32s %10" PRId64 " %12.1f ns/op %8.1f allocs/op\n",
+         name, n, elapsed * 1000.0 / n, (double)(guint)(after - before) / n);
+#else
+  (void)before;
+  (void)after;
+  printf("%-32s %10" PRId64 " %12.1f ns/op %8s allocs/op\n",
+         name, n, elapsed * 1000.0 / n, "-");
+#endif
+  fflush(stdout);
+}
+
+static bool write_all(int sock, const char *data, size_t length)
+{
+  ssize_t sent;
+
+  while (length > 0) {
+    sent = write(sock, data, length);
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+
+  return true;
+}
+
+static bool read_frame(int              sock,
+                       TcpFrameReader  *reader,
+                       const char     **frame,
+                       size_t          *length)
+{
+  TcpFrameStatus status;
+  ssize_t recv_len;
+  char *buf;
+
+  while ((status = tcp_frame_reader_next(reader, frame, length))
+         == TCP_FRAME_INCOMPLETE) {
+    buf = tcp_frame_reader_reserve(reader, BENCH_READ_LEN);
+    recv_len = read(sock, buf, BENCH_READ_LEN);
+    if (recv_len == -1 && errno == EINTR) {
+      continue;
+    }
+    if (recv_len <= 0) {
+      return false;
+    }
+    tcp_frame_reader_commit(reader, recv_len);
+  }
+
+  return status == TCP_FRAME_READY;
+}
+
+static void *run_conn(void *data)
+{
+  BenchConn *conn = (BenchConn*)data;
+  TcpFrameReader *reader;
+  TcpServerReply *reply;
+  GString *request = g_string_sized_new(BENCH_READ_LEN);
+  GString *out = g_string_sized_new(BENCH_READ_LEN);
+  const char *frame, *reply_data;
+  size_t frame_len, reply_len, start;
+
+  reader = tcp_frame_reader_new(TCP_FRAMING_LENGTH, BENCH_MAX_LEN);
+  reply = tcp_server_reply_new();
+
+  /* Atender solicitudes como el servidor, hasta que se cierre la conexión */
+  while (read_frame(conn->peer, reader, &frame, &frame_len)) {
+    g_string_truncate(request, 0);
+    g_string_append_len(request, frame, frame_len);
+    tcp_server_reply_clear(reply);
+
+    conn->func(request->str, request->len, reply, conn->data);
+
+    reply_data = tcp_server_reply_get_data(reply, &reply_len);
+    g_string_truncate(out, 0);
+    start = tcp_frame_begin(TCP_FRAMING_LENGTH, 0, out);
+    g_string_append_len(out, reply_data, reply_len);
+    tcp_frame_end(TCP_FRAMING_LENGTH, out, start);
+
+    if (!write_all(conn->peer, out->str, out->len)) {
+      break;
+    }
+  }
+
+  tcp_server_reply_free(reply);
+  tcp_frame_reader_free(reader);
+  g_string_free(request, TRUE);
+  g_string_free(out, TRUE);
+  close(conn->peer);
+
+  return NULL;
+}
+
+BenchConn *bench_conn_new(TcpServerFunc func, void *data)
+{
+  BenchConn *conn;
+  int socks[2];
+
+  g_return_val_if_fail(func != NULL, NULL);
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+    perror("socketpair");
+    exit(EXIT_FAILURE);
+  }
+
+  conn = g_new0(BenchConn, 1);
+  conn->sock = socks[0];
+  conn->peer = socks[1];
+  conn->func = func;
+  conn->data = data;
+  conn->reader = tcp_frame_reader_new(TCP_FRAMING_LENGTH, BENCH_MAX_LEN);
+  conn->request = g_string_sized_new(BENCH_READ_LEN);
+  conn->thread = g_thread_new("bench-conn", run_conn, conn);
+
+  return conn;
+}
+
+size_t bench_conn_call(BenchConn *conn, const char *request)
+{
+  g_return_val_if_fail(request != NULL, 0);
+
+  return bench_conn_call_len(conn, request, strlen(request));
+}
+
+size_t bench_conn_call_len(BenchConn  *conn,
+                           const char *request,
+                           size_t      length)
+{
+  const char *frame;
+  size_t frame_len, start;
+
+  g_return_val_if_fail(conn != NULL, 0);
+  g_return_val_if_fail(request != NULL, 0);
+
+  g_string_truncate(conn->request, 0);
+  start = tcp_frame_begin(TCP_FRAMING_LENGTH, 0, conn->request);
+  g_string_append_len(conn->request, request, length);
+  tcp_frame_end(TCP_FRAMING_LENGTH, conn->request, start);
+
+  if (!write_all(conn->sock, conn->request->str, conn->request->len)
+      || !read_frame(conn->sock, conn->reader, &frame, &frame_len)
+      || frame_len == 0) {
+    fprintf(stderr, "Sin respuesta a la solicitud: %.*s\n", (int)length,
+            request);
+    exit(EXIT_FAILURE);
+  }
+
+  return frame_len;
+}
+
+void bench_conn_free(BenchConn *conn)
+{
+  g_return_if_fail(conn != NULL);
+
+  /* El hilo termina al leer el fin de la conexión */
+  shutdown(conn->sock, SHUT_WR);
+  g_thread_join(conn->thread);
+  close(conn->sock);
+  tcp_frame_reader_free(conn->reader);
+  g_string_free(conn->request, TRUE);
+  g_free(conn);
+}
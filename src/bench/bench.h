@@ -0,0 +1,82 @@
+/**
+ * @file bench.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Pruebas de rendimiento de las funciones de los servidores
+ * @version 0.1
+ * @date 2023-04-19
+ *
+ * Cada prueba ejecuta una operación repetidas veces durante al menos
+ * BENCH_TIME milisegundos y muestra el tiempo (ns/op) y la cantidad de
+ * asignaciones de memoria (allocs/op) por operación. Las asignaciones se
+ * cuentan reemplazando malloc() y sus variantes, solo con la biblioteca de C
+ * de GNU; en otros sistemas se muestra "-".
+ *
+ * Las funciones de los servidores (ver TcpServerFunc) se ejecutan a través de
+ * un par de sockets conectados (socketpair()), con un hilo que atiende las
+ * solicitudes como el servidor, sin usar la red.
+ *
+ * Se ejecutan con "meson test --benchmark -C build -v".
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include "tcpserver.h"
+
+/** Duración mínima de cada prueba (milisegundos) */
+#define BENCH_TIME 500
+
+/** Operación a medir */
+typedef void (*BenchFunc)(void *data);
+
+/** Conexión con un hilo que ejecuta una función del servidor */
+typedef struct BenchConn BenchConn;
+
+/**
+ * Mide una operación y muestra el resultado.
+ *
+ * @param name nombre de la prueba
+ * @param func operación a medir
+ * @param data parámetro adicional opcional para la operación
+ */
+void bench_run(const char *name, BenchFunc func, void *data);
+
+/**
+ * Crea un par de sockets conectados y un hilo que atiende las solicitudes
+ * recibidas con la función dada, con mensajes delimitados por longitud.
+ *
+ * @param func función del servidor
+ * @param data parámetro adicional opcional para la función
+ * @return la conexión, que debe liberarse con bench_conn_free()
+ */
+BenchConn *bench_conn_new(TcpServerFunc func, void *data);
+
+/**
+ * Envía una solicitud y espera la respuesta. Termina el programa si la
+ * conexión falla o la respuesta está vacía.
+ *
+ * @param conn conexión
+ * @param request solicitud a enviar
+ * @return longitud de la respuesta
+ */
+size_t bench_conn_call(BenchConn *conn, const char *request);
+
+/**
+ * Como bench_conn_call(), con una solicitud que puede contener bytes nulos,
+ * como las del protocolo binario.
+ *
+ * @param conn conexión
+ * @param request solicitud a enviar
+ * @param length longitud de la solicitud
+ * @return longitud de la respuesta
+ */
+size_t bench_conn_call_len(BenchConn  *conn,
+                           const char *request,
+                           size_t      length);
+
+/**
+ * Cierra la conexión y espera que termine su hilo.
+ *
+ * @param conn conexión
+ */
+void bench_conn_free(BenchConn *conn);
@@ -0,0 +1,148 @@
+/**
+ * @file bench_horoscope.c
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Pruebas de rendimiento del servidor del horóscopo
+ * @version 0.1
+ * @date 2023-04-19
+ *
+ * Se incluye el código del servidor para medir sus funciones internas. Recibe
+ * como argumento opcional el archivo con los datos del horóscopo.
+ */
+#define main horoscope_server_main
+#include "horoscopeserver.c"
+#undef main
+
+#include "bench.h"
+
+/* Solicitud para el día actual */
+static char request[96];
+
+/* Solicitud del servidor principal con todos los signos de cada fecha válida */
+static char *batch_request;
+
+/* Solicitud para el día actual en el protocolo binario */
+static char wire_request[WIRE_HEADER_SIZE + WIRE_QUERY_SIZE];
+
+static void bench_parse_json(void *data)
+{
+  json_node_free(parse_json(request, strlen(request), json_parser));
+}
+
+static void bench_parse_date(void *data)
+{
+  g_date_free(parse_date("2023-04-19"));
+}
+
+static void bench_get_client_args(void *data)
+{
+  int arg_day, arg_sign;
+  gint64 arg_deadline;
+
+  get_client_args(request, &arg_day, &arg_sign, &arg_deadline);
+}
+
+static void bench_get_batch_args(void *data)
+{
+  int arg_days[SRV_BATCH_MAX];
+  int arg_signs[SRV_BATCH_MAX];
+  gint64 arg_deadline;
+
+  get_batch_args(batch_request, arg_days, arg_signs, &arg_deadline);
+}
+
+static void bench_astro_to_json(void *data)
+{
+  g_free(astro_to_json((AstroInfo*)data, SRV_DATA_TTL));
+}
+
+static void bench_serve_horoscope(void *data)
+{
+  bench_conn_call((BenchConn*)data, request);
+}
+
+static void bench_serve_batch(void *data)
+{
+  bench_conn_call((BenchConn*)data, batch_request);
+}
+
+static void bench_serve_wire(void *data)
+{
+  bench_conn_call_len((BenchConn*)data, wire_request, sizeof(wire_request));
+}
+
+int main(int argc, char **argv)
+{
+  AstroInfo astro_info;
+  WireHeader header = { .type = WIRE_ASTRO_QUERY, .count = 1 };
+  WireQuery query = { .sign = S_SAGITTARIUS };
+  BenchConn *conn;
+  GDateTime *now, *datetime;
+  GString *batch;
+  char *date;
+  char file_buf[H_MOOD_MAX];
+  int file_line = 0;
+  FILE *file;
+
+  tcp_log_set_level(TCP_LOG_WARNING);
+  json_parser = json_parser_new();
+
+  /* Leer datos del horóscopo, para respuestas de longitud real */
+  file = fopen(argc > 1 ? argv[1] : H_FILENAME, "r");
+  if (file != NULL) {
+    memset(file_buf, 0, sizeof(file_buf));
+    while (fgets(file_buf, sizeof(file_buf), file) && file_line < N_SIGNS) {
+      memcpy(&astro_moods[file_line], file_buf, strcspn(file_buf, "\n"));
+      memset(file_buf, 0, sizeof(file_buf));
+      file_line++;
+    }
+    fclose(file);
+  }
+
+  now = g_date_time_new_now_local();
+  date = g_date_time_format(now, "%Y-%m-%d");
+  g_snprintf(request, sizeof(request),
+             "{\"signo\":\"Sagitario\",\"fecha\":\"%s\"}", date);
+  g_free(date);
+
+  query.year = g_date_time_get_year(now);
+  query.month = g_date_time_get_month(now);
+  query.day = g_date_time_get_day_of_month(now);
+  wire_header_pack(wire_request, &header);
+  wire_query_pack(wire_request + WIRE_HEADER_SIZE, &query);
+
+  batch = g_string_new("{\"consultas\":[");
+  for (int day = H_MIN_DAYS; day <= H_MAX_DAYS; day++) {
+    datetime = g_date_time_add_days(now, day);
+    date = g_date_time_format(datetime, "%Y-%m-%d");
+    for (int sign = 0; sign < N_SIGNS; sign++) {
+      g_string_append_printf(batch, "%s{\"signo\":\"%s\",\"fecha\":\"%s\"}",
+                             day > H_MIN_DAYS || sign > 0 ? "," : "",
+                             astro_signs[sign], date);
+    }
+    g_date_time_unref(datetime);
+    g_free(date);
+  }
+  g_string_append(batch, "]}");
+  batch_request = g_string_free(batch, FALSE);
+  g_date_time_unref(now);
+
+  memset(&astro_info, 0, sizeof(AstroInfo));
+  get_horoscope(&astro_info, 0, S_SAGITTARIUS);
+
+  bench_run("horoscope/parse_json", bench_parse_json, NULL);
+  bench_run("horoscope/parse_date", bench_parse_date, NULL);
+  bench_run("horoscope/get_client_args", bench_get_client_args, NULL);
+  bench_run("horoscope/get_batch_args", bench_get_batch_args, NULL);
+  bench_run("horoscope/astro_to_json", bench_astro_to_json, &astro_info);
+
+  conn = bench_conn_new(serve_horoscope, NULL);
+  bench_run("horoscope/serve_horoscope", bench_serve_horoscope, conn);
+  bench_run("horoscope/serve_batch", bench_serve_batch, conn);
+  bench_run("horoscope/serve_wire", bench_serve_wire, conn);
+  bench_conn_free(conn);
+
+  g_object_unref(json_parser);
+  g_free(batch_request);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file bench_server.c
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Pruebas de rendimiento del servidor principal
+ * @version 0.1
+ * @date 2023-04-19
+ *
+ * Se incluye el código del servidor para medir sus funciones internas. Los
+ * servidores del clima y del horóscopo se reemplazan por servidores en el mismo
+ * proceso, en sockets Unix, que responden siempre lo mismo; así se mide el
+ * costo del servidor principal (reenvío, consultas en paralelo y armado de la
+ * respuesta) sin el de los otros servidores. Se mide también la respuesta
+ * desde la caché y la de una solicitud con varias consultas, a la que los
+ * servidores de prueba responden con un elemento por consulta. Los servidores
+ * de prueba también responden en el protocolo binario, para medir las
+ * consultas con -Y binary y las de los clientes en ese protocolo.
+ */
+#define main server_main
+#include "server.c"
+#undef main
+
+#include <unistd.h>
+
+#include "bench.h"
+
+/* Respuestas fijas de los servidores del clima y del horóscopo */
+#define BENCH_WEATHER_REPLY \
+  "{\"fecha\":\"2023-04-19\",\"temperatura\":21.5,\"condicion\":\"Despejado\"," \
+  "\"ttl\":3600}"
+#define BENCH_HOROSCOPE_REPLY \
+  "{\"signo\":\"sagitario\",\"compatible\":\"leo\",\"periodo\":[\"22/11\"," \
+  "\"21/12\"],\"estado\":\"Un buen día para empezar algo nuevo.\",\"ttl\":86400}"
+
+/* Solicitud del cliente */
+#define BENCH_REQUEST "{\"signo\":\"sagitario\",\"fecha\":\"2023-04-19\"}"
+
+/* Fechas y signos de la solicitud con varias consultas */
+#define BENCH_BATCH_DATES 4
+#define BENCH_BATCH_SIGNS 4
+
+/* Intentos de conexión mientras inician los servidores */
+#define BENCH_RETRIES 100
+
+/* Solicitud del cliente con varias consultas */
+static char *batch_request;
+
+/* Solicitud del cliente en el protocolo binario */
+static char wire_request[WIRE_HEADER_SIZE + WIRE_QUERY_SIZE];
+
+/* Respuestas fijas en el protocolo binario */
+static char weather_item[WIRE_WEATHER_SIZE];
+static char astro_item[WIRE_ASTRO_SIZE];
+
+/** Servidor en el mismo proceso, en un socket Unix */
+typedef struct
+{
+  TcpServer  *server;
+  GThread    *thread;
+  const char *response;
+} BenchBackend;
+
+static void serve_fixed(const char     *request,
+                        size_t          length,
+                        TcpServerReply *reply,
+                        void           *data)
+{
+  const char *response = (const char*)data;
+  JsonSlice items[SRV_BATCH_MAX];
+  char head[WIRE_HEADER_SIZE];
+  WireHeader header;
+  const char *array;
+  size_t array_len;
+  gssize n_items;
+
+  /* Un elemento fijo por consulta en el protocolo binario */
+  if (wire_header_unpack(request, length, &header)) {
+    bool weather = header.type == WIRE_WEATHER_QUERY;
+
+    header.type = weather ? WIRE_WEATHER_REPLY : WIRE_ASTRO_REPLY;
+    wire_header_pack(head, &header);
+    tcp_server_reply_append(reply, head, sizeof(head));
+    for (unsigned int i = 0; i < header.count; i++) {
+      tcp_server_reply_append(reply, weather ? weather_item : astro_item,
+                              weather ? sizeof(weather_item)
+                                      : sizeof(astro_item));
+    }
+    return;
+  }
+
+  /* Un elemento por fecha o por consulta en las solicitudes de varias */
+  if (json_array_member(request, length, "\"fechas\"", &array, &array_len)
+      || json_array_member(request, length, "\"consultas\"", &array,
+                           &array_len)) {
+    n_items = split_json_array(array, array_len, items, SRV_BATCH_MAX);
+    tcp_server_reply_append(reply, "[", 1);
+    for (gssize i = 0; i < n_items; i++) {
+      if (i > 0) {
+        tcp_server_reply_append(reply, ",", 1);
+      }
+      tcp_server_reply_append(reply, response, strlen(response));
+    }
+    tcp_server_reply_append(reply, "]", 1);
+    return;
+  }
+
+  tcp_server_reply_append(reply, response, strlen(response));
+}
+
+static void *run_backend(void *data)
+{
+  BenchBackend *backend = (BenchBackend*)data;
+  GError *error = NULL;
+
+  tcp_server_run(backend->server, serve_fixed, (void*)backend->response,
+                 &error);
+  if (error != NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    exit(EXIT_FAILURE);
+  }
+
+  return NULL;
+}
+
+static TcpClient *backend_start(BenchBackend *backend,
+                                const char   *path,
+                                const char   *response)
+{
+  TcpClient *client;
+  char *host;
+
+  backend->server = tcp_server_new(SRV_ADDR, SRV_PORT);
+  backend->response = response;
+  tcp_server_set_unix_path(backend->server, path);
+  tcp_server_set_framing(backend->server, TCP_FRAMING_LENGTH,
+                         SRV_IDLE_TIMEOUT);
+  backend->thread = g_thread_new("bench-backend", run_backend, backend);
+
+  host = g_strconcat("unix:", path, NULL);
+  client = tcp_client_new(host, 0);
+  tcp_client_set_framing(client, TCP_FRAMING_LENGTH);
+  g_free(host);
+
+  return client;
+}
+
+static void backend_stop(BenchBackend *backend)
+{
+  tcp_server_stop(backend->server);
+  g_thread_join(backend->thread);
+  tcp_server_free(backend->server);
+}
+
+static void bench_forward_request(void *data)
+{
+  g_string_free(forward_request(BENCH_REQUEST, strlen(BENCH_REQUEST),
+                                "9f2c4e01a7b3d855", SRV_DEADLINE), TRUE);
+}
+
+static void bench_cache_key(void *data)
+{
+  g_free(cache_key(BENCH_REQUEST, strlen(BENCH_REQUEST)));
+}
+
+static void bench_serve(void *data)
+{
+  bench_conn_call((BenchConn*)data, BENCH_REQUEST);
+}
+
+static void bench_serve_batch(void *data)
+{
+  bench_conn_call((BenchConn*)data, batch_request);
+}
+
+static void bench_serve_wire(void *data)
+{
+  bench_conn_call_len((BenchConn*)data, wire_request, sizeof(wire_request));
+}
+
+int main(int argc, char **argv)
+{
+  BenchBackend weather, horoscope;
+  TcpServerReply *reply;
+  BenchConn *conn;
+  GError *error = NULL;
+  char *dir, *weather_path, *horoscope_path;
+  const char *signs[BENCH_BATCH_SIGNS] = { "aries", "leo", "libra", "sagitario" };
+  WeatherInfo weather_info = { .date = "2023-04-19", .cond = W_CLEAR, .temp = 21.5F };
+  AstroInfo astro_info = {
+    .sign = S_SAGITTARIUS, .sign_compat = S_LEO,
+    .date_range = { "11-22", "12-21" },
+    .mood = "Un buen día para empezar algo nuevo."
+  };
+  WireHeader header = { .type = WIRE_QUERY, .count = 1 };
+  WireQuery query = { .year = 2023, .month = 4, .day = 19, .sign = S_SAGITTARIUS };
+  GString *batch;
+  int retries = 0;
+
+  tcp_log_set_level(TCP_LOG_ERROR);
+
+  dir = g_dir_make_tmp("bench-XXXXXX", &error);
+  if (dir == NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  weather_path = g_build_filename(dir, "weather.sock", NULL);
+  horoscope_path = g_build_filename(dir, "horoscope.sock", NULL);
+
+  weather_backend = tcp_balancer_new(TCP_BALANCE_LEAST);
+  tcp_balancer_add(weather_backend,
+                   backend_start(&weather, weather_path, BENCH_WEATHER_REPLY));
+  horoscope_backend = tcp_balancer_new(TCP_BALANCE_LEAST);
+  tcp_balancer_add(horoscope_backend,
+                   backend_start(&horoscope, horoscope_path,
+                                 BENCH_HOROSCOPE_REPLY));
+
+  /* Esperar que los servidores acepten conexiones */
+  reply = tcp_server_reply_new();
+  do {
+    g_usleep(10000);
+    tcp_server_reply_clear(reply);
+    serve(BENCH_REQUEST, strlen(BENCH_REQUEST), reply, NULL);
+  } while (strstr(tcp_server_reply_get_data(reply, NULL), "null") != NULL
+           && ++retries < BENCH_RETRIES);
+  tcp_server_reply_free(reply);
+
+  if (retries == BENCH_RETRIES) {
+    fprintf(stderr, "No se pudo conectar con los servidores de prueba\n");
+    return EXIT_FAILURE;
+  }
+
+  batch = g_string_new("{\"consultas\":[");
+  for (int day = 0; day < BENCH_BATCH_DATES; day++) {
+    for (int sign = 0; sign < BENCH_BATCH_SIGNS; sign++) {
+      g_string_append_printf(batch,
+                             "%s{\"signo\":\"%s\",\"fecha\":\"2023-04-%02d\"}",
+                             day > 0 || sign > 0 ? "," : "", signs[sign],
+                             19 + day);
+    }
+  }
+  g_string_append(batch, "]}");
+  batch_request = g_string_free(batch, FALSE);
+
+  wire_weather_pack(weather_item, WIRE_OK, &weather_info, 3600);
+  wire_astro_pack(astro_item, WIRE_OK, &astro_info, 86400);
+  wire_header_pack(wire_request, &header);
+  wire_query_pack(wire_request + WIRE_HEADER_SIZE, &query);
+
+  bench_run("server/forward_request", bench_forward_request, NULL);
+  bench_run("server/cache_key", bench_cache_key, NULL);
+
+  conn = bench_conn_new(serve, NULL);
+  bench_run("server/serve", bench_serve, conn);
+  bench_run("server/serve_batch", bench_serve_batch, conn);
+  backend_wire = true;
+  bench_run("server/serve_wire", bench_serve_wire, conn);
+  backend_binary = true;
+  bench_run("server/serve_binary", bench_serve, conn);
+  bench_run("server/serve_batch_binary", bench_serve_batch, conn);
+  backend_binary = false;
+  cache = tcp_cache_new(g_get_num_processors(), SRV_CACHE_SIZE);
+  bench_run("server/serve_cached", bench_serve, conn);
+  bench_conn_free(conn);
+  tcp_cache_free(cache);
+
+  tcp_balancer_free(weather_backend);
+  tcp_balancer_free(horoscope_backend);
+  backend_stop(&weather);
+  backend_stop(&horoscope);
+
+  unlink(weather_path);
+  unlink(horoscope_path);
+  rmdir(dir);
+  g_free(weather_path);
+  g_free(horoscope_path);
+  g_free(dir);
+  g_free(batch_request);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file bench_weather.c
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Pruebas de rendimiento del servidor del clima
+ * @version 0.1
+ * @date 2023-04-19
+ *
+ * Se incluye el código del servidor para medir sus funciones internas.
+ */
+#define main weather_server_main
+#include "weatherserver.c"
+#undef main
+
+#include "bench.h"
+
+/* Solicitud para el día actual */
+static char request[64];
+
+/* Solicitud del servidor principal con todas las fechas válidas */
+static char *batch_request;
+
+/* Solicitud para el día actual en el protocolo binario */
+static char wire_request[WIRE_HEADER_SIZE + WIRE_QUERY_SIZE];
+
+static void bench_parse_json(void *data)
+{
+  json_node_free(parse_json(request, strlen(request), json_parser));
+}
+
+static void bench_parse_date(void *data)
+{
+  g_date_free(parse_date("2023-04-19"));
+}
+
+static void bench_get_client_args(void *data)
+{
+  int arg_day;
+  gint64 arg_deadline;
+
+  get_client_args(request, &arg_day, &arg_deadline);
+}
+
+static void bench_get_batch_args(void *data)
+{
+  int arg_days[SRV_BATCH_MAX];
+  gint64 arg_deadline;
+
+  get_batch_args(batch_request, arg_days, &arg_deadline);
+}
+
+static void bench_weather_to_json(void *data)
+{
+  g_free(weather_to_json((WeatherInfo*)data, SRV_DATA_TTL));
+}
+
+static void bench_serve_weather(void *data)
+{
+  bench_conn_call((BenchConn*)data, request);
+}
+
+static void bench_serve_batch(void *data)
+{
+  bench_conn_call((BenchConn*)data, batch_request);
+}
+
+static void bench_serve_wire(void *data)
+{
+  bench_conn_call_len((BenchConn*)data, wire_request, sizeof(wire_request));
+}
+
+int main(int argc, char **argv)
+{
+  WeatherInfo weather;
+  WireHeader header = { .type = WIRE_WEATHER_QUERY, .count = 1 };
+  WireQuery query = { .sign = WIRE_NO_SIGN };
+  BenchConn *conn;
+  GDateTime *now, *datetime;
+  GString *batch;
+  char *date;
+
+  tcp_log_set_level(TCP_LOG_WARNING);
+  json_parser = json_parser_new();
+
+  now = g_date_time_new_now_local();
+  date = g_date_time_format(now, W_DATE_FORMAT);
+  g_snprintf(request, sizeof(request), "{\"fecha\":\"%s\"}", date);
+  g_free(date);
+
+  query.year = g_date_time_get_year(now);
+  query.month = g_date_time_get_month(now);
+  query.day = g_date_time_get_day_of_month(now);
+  wire_header_pack(wire_request, &header);
+  wire_query_pack(wire_request + WIRE_HEADER_SIZE, &query);
+
+  batch = g_string_new("{\"fechas\":[");
+  for (int day = W_MIN_DAYS; day <= W_MAX_DAYS; day++) {
+    datetime = g_date_time_add_days(now, day);
+    date = g_date_time_format(datetime, W_DATE_FORMAT);
+    g_string_append_printf(batch, "%s\"%s\"", day > W_MIN_DAYS ? "," : "",
+                           date);
+    g_date_time_unref(datetime);
+    g_free(date);
+  }
+  g_string_append(batch, "]}");
+  batch_request = g_string_free(batch, FALSE);
+  g_date_time_unref(now);
+
+  memset(&weather, 0, sizeof(WeatherInfo));
+  get_weather(&weather, 0);
+
+  bench_run("weather/parse_json", bench_parse_json, NULL);
+  bench_run("weather/parse_date", bench_parse_date, NULL);
+  bench_run("weather/get_client_args", bench_get_client_args, NULL);
+  bench_run("weather/get_batch_args", bench_get_batch_args, NULL);
+  bench_run("weather/weather_to_json", bench_weather_to_json, &weather);
+
+  conn = bench_conn_new(serve_weather, NULL);
+  bench_run("weather/serve_weather", bench_serve_weather, conn);
+  bench_run("weather/serve_batch", bench_serve_batch, conn);
+  bench_run("weather/serve_wire", bench_serve_wire, conn);
+  bench_conn_free(conn);
+
+  g_object_unref(json_parser);
+  g_free(batch_request);
+
+  return EXIT_SUCCESS;
+}
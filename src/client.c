@@ -25,12 +25,16 @@
  *   client [OPTION?] - Cliente TCP
  *
  * Opciones de ayuda:
- *   -h, --help       Muestra ayuda de opciones
+ *   -h, --help         Muestra ayuda de opciones
  *
  * Opciones de aplicación:
- *   -H, --host=H     Host del servidor (127.0.0.1 por defecto)
- *   -p, --port=P     Puerto del servidor (24000 por defecto)
+ *   -H, --host=H       Host del servidor (127.0.0.1 por defecto)
+ *   -p, --port=P       Puerto del servidor (24000 por defecto)
+ *   -F, --framing=F    Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)
  * @endcode
+ *
+ * Si se delimitan los mensajes, todas las consultas se envían por la misma
+ * conexión, que debe aceptar el servidor con la misma opción.
  */
 #include <glib.h>
 #include <glib-object.h>
@@ -64,22 +68,26 @@
 #define SRV_PORT 24000
 /** Cantidad máxima de datos a enviar al servidor */
 #define BUF_SEND_MAX 255
-/** Cantidad máxima de datos a leer del servidor */
-#define BUF_RECV_MAX 1023
 /** Cantidad máxima de datos a leer del usuario */
 #define USR_READ_MAX 80
+/** Forma de delimitar mensajes por defecto */
+#define SRV_FRAMING  "none"
 
 /* Host del servidor */
 static char *host = SRV_HOST;
 
 /* Puerto del servidor */
-static uint16_t port = SRV_PORT;
+static int port = SRV_PORT;
+
+/* Forma de delimitar mensajes */
+static char *framing_name = SRV_FRAMING;
 
 /* Opciones de línea de comandos */
 static GOptionEntry options[] =
 {
   { "host", 'H', 0, G_OPTION_ARG_STRING, &host, "Host del servidor (127.0.0.1 por defecto)", "H" },
   { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Puerto del servidor (24000 por defecto)", "P" },
+  { "framing", 'F', 0, G_OPTION_ARG_STRING, &framing_name, "Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)", "F" },
   { NULL }
 };
 
@@ -109,32 +117,29 @@ static void print_json(const char *data)
   }
 }
 
-static void *client_func(int sockfd, void *data)
+static bool send_request(const char *data)
 {
-  g_return_val_if_fail(sockfd != -1, NULL);
-  g_return_val_if_fail(data != NULL, NULL);
-
-  char recv_buf[BUF_RECV_MAX+1];
-  char send_buf[BUF_SEND_MAX+1];
-  int  send_len = MIN(BUF_SEND_MAX, strlen(data));
+  GError *error = NULL;
+  char *response;
 
-  memset(recv_buf, 0, sizeof(recv_buf));
-  memset(send_buf, 0, sizeof(send_buf));
-  memcpy(send_buf, data, send_len);
+  /* Enviar mensaje al servidor y recibir respuesta */
+  printf("Mensaje enviado:\n%s\n", data);
+  response = tcp_client_call(client, data, strlen(data), NULL, &error);
 
-  /* Enviar mensaje al servidor */
-  send(sockfd, send_buf, send_len, 0);
-  printf("Mensaje enviado:\n%s\n", send_buf);
+  if (error != NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return false;
+  }
 
-  /* Recibir respuesta del servidor */
-  recv(sockfd, recv_buf, BUF_RECV_MAX, 0);
-  printf("Mensaje recibido:\n%s\n", recv_buf);
+  printf("Mensaje recibido:\n%s\n", response);
 
   /* Mostrar datos al usuario */
   printf("Datos del clima y el horóscopo:\n");
-  print_json(recv_buf);
+  print_json(response);
+  g_free(response);
 
-  return NULL;
+  return true;
 }
 
 static void read_line(char *buffer, int buffer_limit)
@@ -148,9 +153,6 @@ static int main_loop()
 {
   g_return_val_if_fail(client != NULL, EXIT_FAILURE);
 
-  GError *error = NULL;
-  GThread *client_thread;
-
   bool exit = FALSE;
   char send_buf[BUF_SEND_MAX+1];
   char date_arg[USR_READ_MAX];
@@ -168,19 +170,10 @@ static int main_loop()
     read_line(sign_arg, sizeof(sign_arg));
     sprintf(send_buf, "{\"fecha\":\"%s\",\"signo\":\"%s\"}", date_arg, sign_arg);
 
-    /* Ejecutar función del cliente en un nuevo hilo */
-    client_thread = tcp_client_run(client, client_func, send_buf, &error);
-
-    if (error != NULL) {
-      fprintf(stderr, "%s\n", error->message);
-      g_error_free(error);
+    if (!send_request(send_buf)) {
       return EXIT_FAILURE;
     }
 
-    if (client_thread != NULL) {
-      g_thread_join(client_thread);
-    }
-
     printf("Presionar Entrar para otra consulta / N para salir\n");
     switch (getchar()) {
       case 'N':
@@ -198,6 +191,7 @@ int main(int argc, char **argv)
 {
   GError         *error = NULL;
   GOptionContext *context;
+  TcpFraming      framing;
   int             retval = EXIT_SUCCESS;
 
   context = g_option_context_new("- Cliente TCP");
@@ -211,8 +205,20 @@ int main(int argc, char **argv)
     return EXIT_FAILURE;
   }
 
+  if (port <= 0 || port > G_MAXUINT16) {
+    fprintf(stderr, "Puerto inválido: %d\n", port);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(framing_name, &framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            framing_name);
+    return EXIT_FAILURE;
+  }
+
   json_parser = json_parser_new();
   client = tcp_client_new(host, port);
+  tcp_client_set_framing(client, framing);
   retval = main_loop();
   tcp_client_free(client);
 
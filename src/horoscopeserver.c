@@ -8,7 +8,43 @@
  * Programa del servidor del horóscopo, que recibe consultas por fechas válidas
  * a partir de la fecha actual, hasta siete días en adelante, y por el signo.
  * Los datos del horóscopo se guardan en memoria por 1 día. Si se consulta luego
- * de 1 día generado los datos, se actualizan.
+ * de 1 día generado los datos, se actualizan. Cada respuesta indica en el
+ * miembro "ttl" cuántos segundos más son válidos sus datos, para que el
+ * servidor principal pueda guardarla en su caché hasta entonces. Si la
+ * solicitud indica en el miembro "deadline" cuántos milisegundos espera la
+ * respuesta el servidor principal, y ese plazo vence mientras espera en cola,
+ * se responde con un error sin buscar los datos.
+ *
+ * El servidor principal puede pedir varias consultas de fecha y signo en una
+ * sola solicitud, con el miembro "consultas" (hasta 128); se responde un
+ * arreglo con los datos de cada consulta en el mismo orden, buscados con una
+ * sola toma de la caché.
+ *
+ * Las mismas consultas pueden llegar en el protocolo binario (ver wire.h), con
+ * la fecha y el número de signo en campos de tamaño fijo, que se responden en
+ * ese protocolo sin analizar ni generar JSON. Como los mensajes binarios
+ * pueden contener saltos de línea, requieren delimitar los mensajes por
+ * longitud o con mux.
+ *
+ * Con el miembro "exportar":true se envían los datos de todos los días y
+ * signos, un registro JSON por línea o por mensaje
+ * ({"fecha":...,"horoscopo":{...}}) a medida que se generan, terminados por
+ * {"fin":true,"registros":N}. La respuesta no tiene límite de tamaño ni se
+ * guarda completa en memoria: si el cliente no la lee, el servidor espera.
+ *
+ * Por defecto, cada conexión lleva una sola consulta y su respuesta, sin
+ * delimitar los mensajes. Con -F length, ndjson o mux, la conexión queda
+ * abierta para las consultas siguientes hasta el tiempo máximo de inactividad,
+ * y los clientes (el servidor principal con la opción -B, loadgen o client con
+ * -F) deben delimitar los mensajes de la misma forma. En modo threads, cada
+ * conexión abierta ocupa uno de los hilos del servidor, y las consultas de
+ * las demás conexiones esperan en cola hasta que se cierra; con conexiones
+ * persistentes conviene el modo epoll o uring.
+ *
+ * Al recibir la señal SIGUSR2, el servidor se reinicia sin cortes: ejecuta una
+ * nueva copia del programa con los mismos parámetros, le traspasa el socket de
+ * escucha y la caché de datos del horóscopo, y termina luego de atender las
+ * conexiones abiertas.
  *
  * A continuación se detallan las opciones por parámetros que toma el servidor,
  * que también puede verse al ejecutar el programa con el parámetro -h o --help:
@@ -29,6 +65,17 @@
  * Opciones de aplicación:
  *   -a, --addr=A           Direccion A (0 = INADDR_ANY por defecto)
  *   -p, --port=P           Puerto P > 1024 del servidor (24002 por defecto)
+ *   -u, --unix=U           Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)
+ *   -m, --mode=M           Modo M del servidor: threads, epoll o uring (threads por defecto)
+ *   -F, --framing=F        Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)
+ *   -L, --max-inflight=L   Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)
+ *   -D, --deadlines=R,W,T  Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)
+ *   -k, --workers=K        Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)
+ *   -v, --log-level=V      Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)
+ *   -l, --log-sample=N     Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)
+ *   -M, --admin-port=AP    Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)
+ *   -T, --trace=ARCHIVO    Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)
+ *   -R, --trace-slow=MS    Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)
  *   -f, --horos-file=F     Archivo de datos del horóscopo
  * @endcode
  */
@@ -54,24 +101,52 @@
 #include <ws2tcpip.h>
 #endif
 
+#include "tcplog.h"
+#include "tcpmetrics.h"
 #include "tcpserver.h"
+#include "tcptrace.h"
 #include "types.h"
 #include "util.h"
+#include "wire.h"
 
 /** Nombre del servidor */
-#define SRV_NAME     "Servidor del horóscopo"
+#define SRV_NAME         "Servidor del horóscopo"
 /** Descripción del programa */
-#define SRV_INFO     "- Servidor del horóscopo"
+#define SRV_INFO         "- Servidor del horóscopo"
 /** Dirección del servidor por defecto */
-#define SRV_ADDR     INADDR_ANY
+#define SRV_ADDR         INADDR_ANY
 /** Puerto del servidor por defecto */
-#define SRV_PORT     24002
+#define SRV_PORT         24002
+/** Ruta del socket Unix por defecto (NULL = escuchar en TCP) */
+#define SRV_UNIX_PATH    NULL
+/** Modo del servidor por defecto */
+#define SRV_MODE         "threads"
+/** Forma de delimitar mensajes por defecto */
+#define SRV_FRAMING      "none"
+/** Tiempo máximo de inactividad de una conexión (milisegundos) */
+#define SRV_IDLE_TIMEOUT 30000
+/** Máximo del límite de solicitudes en curso por defecto (0 = sin límite) */
+#define SRV_MAX_INFLIGHT 1024
+/** Plazos de lectura, escritura y total por defecto (milisegundos) */
+#define SRV_DEADLINES    "10000,10000,0"
+/** Procesos de trabajo por defecto (0 = un único proceso) */
+#define SRV_WORKERS      0
+/** Nivel de registro por defecto */
+#define SRV_LOG_LEVEL    "info"
+/** Registrar el contenido de una de cada N solicitudes (0 = ninguna) */
+#define SRV_LOG_SAMPLE   0
+/** Puerto de métricas por defecto (0 = no exponerlas) */
+#define SRV_ADMIN_PORT   0
+/** Archivo de trazas por defecto (NULL = no registrar trazas) */
+#define SRV_TRACE_PATH   NULL
+/** Duración mínima de las solicitudes registradas en las trazas (milisegundos) */
+#define SRV_TRACE_SLOW   0
 /** Cantidad máxima para envío de bytes */
-#define SRV_SEND_MAX 1023
-/** Cantidad máxima para recepción de bytes */
-#define SRV_RECV_MAX 255
+#define SRV_SEND_MAX     1023
 /** TTL para datos del horóscopo (segundos) */
-#define SRV_DATA_TTL 86400
+#define SRV_DATA_TTL     86400
+/** Cantidad máxima de consultas por solicitud */
+#define SRV_BATCH_MAX    128
 
 /** Mímino de días para el horóscopo, a partir de la fecha actual */
 #define H_MIN_DAYS 0
@@ -86,7 +161,40 @@
 static uint32_t addr = SRV_ADDR;
 
 /* Puerto del servidor */
-static uint16_t port = SRV_PORT;
+static int port = SRV_PORT;
+
+/* Ruta del socket Unix */
+static char *unix_path = SRV_UNIX_PATH;
+
+/* Modo del servidor */
+static char *mode_name = SRV_MODE;
+
+/* Forma de delimitar mensajes */
+static char *framing_name = SRV_FRAMING;
+
+/* Máximo del límite de solicitudes en curso */
+static int max_inflight = SRV_MAX_INFLIGHT;
+
+/* Plazos de lectura, escritura y total de las conexiones */
+static char *deadlines_text = SRV_DEADLINES;
+
+/* Cantidad de procesos de trabajo */
+static int workers = SRV_WORKERS;
+
+/* Nivel de registro */
+static char *log_level_name = SRV_LOG_LEVEL;
+
+/* Muestreo del contenido de las solicitudes en el registro */
+static int log_sample = SRV_LOG_SAMPLE;
+
+/* Puerto de métricas */
+static int admin_port = SRV_ADMIN_PORT;
+
+/* Archivo de trazas */
+static char *trace_path = SRV_TRACE_PATH;
+
+/* Duración mínima de las solicitudes registradas en las trazas */
+static int trace_slow = SRV_TRACE_SLOW;
 
 /* Archivo de datos del horóscopo */
 static char *horoscope_file = NULL;
@@ -96,6 +204,17 @@ static GOptionEntry options[] =
 {
   { "addr", 'a', 0, G_OPTION_ARG_INT, &addr, "Direccion A (0 = INADDR_ANY por defecto)", "A" },
   { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Puerto P > 1024 del servidor (24002 por defecto)", "P" },
+  { "unix", 'u', 0, G_OPTION_ARG_FILENAME, &unix_path, "Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)", "U" },
+  { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "Modo M del servidor: threads, epoll o uring (threads por defecto)", "M" },
+  { "framing", 'F', 0, G_OPTION_ARG_STRING, &framing_name, "Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)", "F" },
+  { "max-inflight", 'L', 0, G_OPTION_ARG_INT, &max_inflight, "Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)", "L" },
+  { "deadlines", 'D', 0, G_OPTION_ARG_STRING, &deadlines_text, "Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)", "R,W,T" },
+  { "workers", 'k', 0, G_OPTION_ARG_INT, &workers, "Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)", "K" },
+  { "log-level", 'v', 0, G_OPTION_ARG_STRING, &log_level_name, "Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)", "V" },
+  { "log-sample", 'l', 0, G_OPTION_ARG_INT, &log_sample, "Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)", "N" },
+  { "admin-port", 'M', 0, G_OPTION_ARG_INT, &admin_port, "Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)", "AP" },
+  { "trace", 'T', 0, G_OPTION_ARG_FILENAME, &trace_path, "Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)", "ARCHIVO" },
+  { "trace-slow", 'R', 0, G_OPTION_ARG_INT, &trace_slow, "Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)", "MS" },
   { "horos-file", 'f', 0, G_OPTION_ARG_FILENAME, &horoscope_file, "Archivo de datos del horóscopo", "F"},
   { NULL }
 };
@@ -103,23 +222,6 @@ static GOptionEntry options[] =
 /* Instancia de JsonParser */
 static JsonParser *json_parser = NULL;
 
-/* Signos */
-static const char *astro_signs[N_SIGNS] =
-{
-  [S_ARIES]       = "aries",
-  [S_TAURUS]      = "tauro",
-  [S_GEMINI]      = "geminis",
-  [S_CANCER]      = "cancer",
-  [S_LEO]         = "leo",
-  [S_VIRGO]       = "virgo",
-  [S_LIBRA]       = "libra",
-  [S_SCORPIO]     = "escorpio",
-  [S_SAGITTARIUS] = "sagitario",
-  [S_CAPRICORN]   = "capricornio",
-  [S_AQUARIUS]    = "acuario",
-  [S_PISCES]      = "piscis"
-};
-
 /* Rangos de fechas para los signos */
 static const char astro_date_ranges[N_SIGNS][2][6] =
 {
@@ -141,10 +243,24 @@ static const char astro_date_ranges[N_SIGNS][2][6] =
 static char astro_moods[N_SIGNS][H_MOOD_MAX] = { 0 };
 
 /* Caché de datos del horóscopo */
-static AstroInfo astro_data[H_MAX_DAYS][N_SIGNS] = { 0 };
+static AstroInfo astro_data[H_MAX_DAYS + 1][N_SIGNS] = { 0 };
 
 /* Marcas de tiempo de la caché */
-static time_t astro_cache[H_MAX_DAYS][N_SIGNS] = { 0 };
+static time_t astro_cache[H_MAX_DAYS + 1][N_SIGNS] = { 0 };
+
+/* Exclusión mutua de la caché */
+static GMutex astro_mutex;
+
+/* Aciertos y fallos de la caché */
+static TcpCounter *astro_hits;
+static TcpCounter *astro_misses;
+
+/* Caché traspasada al nuevo proceso en un reinicio sin cortes */
+typedef struct
+{
+  AstroInfo data[H_MAX_DAYS + 1][N_SIGNS];
+  time_t    cache[H_MAX_DAYS + 1][N_SIGNS];
+} AstroState;
 
 static void create_horoscope(AstroInfo *astro_info, unsigned int sign)
 {
@@ -164,138 +280,503 @@ static void create_horoscope(AstroInfo *astro_info, unsigned int sign)
   g_free(rand);
 }
 
-static void get_horoscope(AstroInfo *astro_info, int day, unsigned int sign)
+static time_t lookup_horoscope(AstroInfo    *astro_info,
+                               int           day,
+                               unsigned int  sign,
+                               time_t        now)
+{
+  /* Se llama con astro_mutex tomado */
+  if ((now - astro_cache[day][sign]) > SRV_DATA_TTL) {
+    create_horoscope(&astro_data[day][sign], sign);
+    astro_cache[day][sign] = now;
+    tcp_counter_add(astro_misses, 1);
+  } else {
+    tcp_counter_add(astro_hits, 1);
+  }
+
+  memcpy(astro_info, &astro_data[day][sign], sizeof(AstroInfo));
+
+  return astro_cache[day][sign] + SRV_DATA_TTL - now;
+}
+
+static time_t get_horoscope(AstroInfo *astro_info, int day, unsigned int sign)
+{
+  struct timeval time;
+  time_t ttl;
+
+  g_return_val_if_fail(astro_info != NULL, 0);
+  g_return_val_if_fail(day >= H_MIN_DAYS && day <= H_MAX_DAYS, 0);
+  g_return_val_if_fail(sign < N_SIGNS, 0);
+
+  g_mutex_lock(&astro_mutex);
+  gettimeofday(&time, NULL);
+  ttl = lookup_horoscope(astro_info, day, sign, time.tv_sec);
+  g_mutex_unlock(&astro_mutex);
+
+  return ttl;
+}
+
+static void get_horoscope_all(AstroInfo *astro_info,
+                              time_t    *ttl,
+                              const int *days,
+                              const int *signs,
+                              size_t     n_queries)
 {
-  static GMutex mutex;
   struct timeval time;
 
   g_return_if_fail(astro_info != NULL);
-  g_return_if_fail(day >= H_MIN_DAYS && day <= H_MAX_DAYS);
-  g_return_if_fail(sign < N_SIGNS);
+  g_return_if_fail(ttl != NULL);
+  g_return_if_fail(days != NULL);
+  g_return_if_fail(signs != NULL);
 
-  g_mutex_lock(&mutex);
+  /* Todas las consultas de una solicitud con una sola toma de la caché */
+  g_mutex_lock(&astro_mutex);
   gettimeofday(&time, NULL);
+  for (size_t i = 0; i < n_queries; i++) {
+    if (days[i] != -1 && signs[i] != -1) {
+      ttl[i] = lookup_horoscope(&astro_info[i], days[i], signs[i],
+                                time.tv_sec);
+    }
+  }
+  g_mutex_unlock(&astro_mutex);
+}
 
-  if ((time.tv_sec - astro_cache[day][sign]) > SRV_DATA_TTL) {
-    create_horoscope(&astro_data[day][sign], sign);
-    astro_cache[day][sign] = time.tv_sec;
+static GBytes *save_horoscope(void *data)
+{
+  AstroState state;
+
+  g_mutex_lock(&astro_mutex);
+  memcpy(state.data, astro_data, sizeof(astro_data));
+  memcpy(state.cache, astro_cache, sizeof(astro_cache));
+  g_mutex_unlock(&astro_mutex);
+
+  return g_bytes_new(&state, sizeof(state));
+}
+
+static void restore_horoscope(GBytes *bytes)
+{
+  const AstroState *state;
+  gsize size;
+
+  /* Descartar la caché de una versión con otro formato */
+  state = g_bytes_get_data(bytes, &size);
+  if (size != sizeof(AstroState)) {
+    return;
   }
 
-  memcpy(astro_info, &astro_data[day][sign], sizeof(AstroInfo));
-  g_mutex_unlock(&mutex);
+  g_mutex_lock(&astro_mutex);
+  memcpy(astro_data, state->data, sizeof(astro_data));
+  memcpy(astro_cache, state->cache, sizeof(astro_cache));
+  g_mutex_unlock(&astro_mutex);
 }
 
-static int parse_sign(const char *data)
+static int days_from_today(GDate *date)
 {
-  g_return_val_if_fail(data != NULL, -1);
+  struct timeval time;
+  int day = -1;
+  GDate *today = NULL;
+
+  /* Se libera la fecha recibida */
+  if (date != NULL) {
+    today = g_date_new();
+    gettimeofday(&time, NULL);
+    g_date_set_time_t(today, time.tv_sec);
+    day = g_date_days_between(today, date);
+
+    g_date_free(date);
+    g_date_free(today);
+  }
+
+  return day >= H_MIN_DAYS && day <= H_MAX_DAYS ? day : -1;
+}
 
+static int date_to_day(const char *date_str)
+{
+  return days_from_today(date_str != NULL ? parse_date(date_str) : NULL);
+}
+
+static void get_query_args(JsonObject *json_object,
+                           int        *arg_day,
+                           int        *arg_sign)
+{
+  const char *date_str = NULL;
+  const char *sign_str = NULL;
   int sign = -1;
-  int length = strlen(data);
 
-  for (int i = 0; i < N_SIGNS; i++) {
-    if (g_ascii_strncasecmp(astro_signs[i], data, length) == 0) {
-      sign = i;
-      break;
-    }
+  sign_str = json_object_get_string_member(json_object, "signo");
+  date_str = json_object_get_string_member(json_object, "fecha");
+
+  if (sign_str != NULL)
+    sign = parse_sign(sign_str);
+
+  *arg_day = date_to_day(date_str);
+  *arg_sign = sign >= 0 && sign < N_SIGNS ? sign : -1;
+}
+
+static void get_request_meta(JsonObject *json_object, gint64 *arg_deadline)
+{
+  /* Identificador de la solicitud enviado por el servidor principal */
+  if (json_object_has_member(json_object, "id")) {
+    tcp_trace_set_id(tcp_trace_current(),
+                     json_object_get_string_member(json_object, "id"));
+  }
+
+  /* Tiempo que el servidor principal espera la respuesta (milisegundos) */
+  *arg_deadline = 0;
+  if (json_object_has_member(json_object, "deadline")) {
+    *arg_deadline = json_object_get_int_member(json_object, "deadline");
+  }
+}
+
+static bool get_export_arg(const char *data, size_t length)
+{
+  g_return_val_if_fail(data != NULL, false);
+
+  JsonNode *json_node = NULL;
+  JsonNode *member = NULL;
+  bool export = false;
+
+  /* Solo se analizan las solicitudes que pueden pedir la exportación */
+  if (g_strstr_len(data, length, "\"exportar\"") == NULL) {
+    return false;
+  }
+
+  /* Con "exportar":true en el objeto principal, no en otro miembro */
+  json_node = parse_json(data, length, json_parser);
+  if (json_node != NULL && JSON_NODE_HOLDS_OBJECT(json_node)) {
+    member = json_object_get_member(json_node_get_object(json_node),
+                                    "exportar");
+    export = member != NULL
+          && JSON_NODE_HOLDS_VALUE(member)
+          && json_node_get_value_type(member) == G_TYPE_BOOLEAN
+          && json_node_get_boolean(member);
+  }
+
+  if (json_node != NULL) {
+    json_node_free(json_node);
   }
 
-  return sign;
+  return export;
 }
 
-static void get_client_args(const char *data, int *arg_day, int *arg_sign)
+static void get_client_args(const char *data,
+                            int        *arg_day,
+                            int        *arg_sign,
+                            gint64     *arg_deadline)
 {
   g_return_if_fail(data != NULL);
   g_return_if_fail(arg_day != NULL);
   g_return_if_fail(arg_sign != NULL);
+  g_return_if_fail(arg_deadline != NULL);
 
-  struct timeval time;
-  int day = -1;
-  int sign = -1;
-  const char *date_str = NULL;
-  const char *sign_str = NULL;
-  GDate *date = NULL;
-  GDate *today = NULL;
   JsonNode *json_node = NULL;
   JsonObject *json_object = NULL;
 
   json_node = parse_json(data, strlen(data), json_parser);
   json_object = json_node_get_object(json_node);
-  sign_str = json_object_get_string_member(json_object, "signo");
-  date_str = json_object_get_string_member(json_object, "fecha");
 
-  if (sign_str != NULL)
-    sign = parse_sign(sign_str);
+  get_request_meta(json_object, arg_deadline);
+  get_query_args(json_object, arg_day, arg_sign);
 
-  if (date_str != NULL)
-    date = parse_date(date_str);
+  if (json_node != NULL) {
+    json_node_free(json_node);
+  }
+}
 
-  if (date != NULL) {
-    today = g_date_new();
-    gettimeofday(&time, NULL);
-    g_date_set_time_t(today, time.tv_sec);
-    day = g_date_days_between(today, date);
+static gssize get_batch_args(const char *data,
+                             int        *arg_days,
+                             int        *arg_signs,
+                             gint64     *arg_deadline)
+{
+  g_return_val_if_fail(data != NULL, -1);
+  g_return_val_if_fail(arg_days != NULL, -1);
+  g_return_val_if_fail(arg_signs != NULL, -1);
+  g_return_val_if_fail(arg_deadline != NULL, -1);
 
-    g_date_free(date);
-    g_date_free(today);
+  JsonNode *json_node = NULL;
+  JsonObject *json_object = NULL;
+  JsonArray *json_array = NULL;
+  JsonNode *element;
+  gssize n_queries = -1;
+
+  json_node = parse_json(data, strlen(data), json_parser);
+  if (json_node != NULL && JSON_NODE_HOLDS_OBJECT(json_node)) {
+    json_object = json_node_get_object(json_node);
+    get_request_meta(json_object, arg_deadline);
+
+    if (json_object_has_member(json_object, "consultas")) {
+      json_array = json_object_get_array_member(json_object, "consultas");
+    }
   }
 
-  *arg_day = day >= H_MIN_DAYS && day <= H_MAX_DAYS ? day : -1;
-  *arg_sign = sign >= 0 && sign < N_SIGNS ? sign : -1;
+  /* Día y signo de cada consulta, -1 si no son válidos */
+  if (json_array != NULL && json_array_get_length(json_array) <= SRV_BATCH_MAX) {
+    n_queries = json_array_get_length(json_array);
+    for (gssize i = 0; i < n_queries; i++) {
+      element = json_array_get_element(json_array, i);
+      if (JSON_NODE_HOLDS_OBJECT(element)) {
+        get_query_args(json_node_get_object(element),
+                       &arg_days[i], &arg_signs[i]);
+      } else {
+        arg_days[i] = -1;
+        arg_signs[i] = -1;
+      }
+    }
+  }
+
+  if (json_node != NULL) {
+    json_node_free(json_node);
+  }
+
+  return n_queries;
+}
+
+static void serve_horoscope_batch(const char     *request,
+                                  size_t          length,
+                                  TcpServerReply *reply,
+                                  bool            sampled)
+{
+  AstroInfo astro_info[SRV_BATCH_MAX];
+  time_t ttl[SRV_BATCH_MAX];
+  int days[SRV_BATCH_MAX];
+  int signs[SRV_BATCH_MAX];
+  gint64 arg_deadline = 0;
+  gssize n_queries;
+  char *astro_json;
+  gint64 start;
+
+  /* Analizar datos recibidos */
+  start = g_get_monotonic_time();
+  n_queries = get_batch_args(request, days, signs, &arg_deadline);
+  tcp_trace_span("parse", start);
+
+  if (arg_deadline > 0
+      && start - tcp_server_reply_get_received(reply) >= arg_deadline * 1000) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Plazo vencido");
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+    return;
+  }
+
+  if (n_queries < 0) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Consultas incorrectas");
+    return;
+  }
+
+  memset(astro_info, 0, sizeof(AstroInfo) * n_queries);
+  start = g_get_monotonic_time();
+  get_horoscope_all(astro_info, ttl, days, signs, n_queries);
+  tcp_trace_span("cache", start);
+
+  /* Un elemento por consulta, en el orden de la solicitud */
+  start = g_get_monotonic_time();
+  tcp_server_reply_append(reply, "[", 1);
+  for (gssize i = 0; i < n_queries; i++) {
+    if (i > 0) {
+      tcp_server_reply_append(reply, ",", 1);
+    }
+    if (days[i] != -1 && signs[i] != -1) {
+      astro_json = astro_to_json(&astro_info[i], ttl[i]);
+      tcp_server_reply_append(reply, astro_json, strlen(astro_json));
+      g_free(astro_json);
+    } else {
+      tcp_server_reply_printf(reply, "{\"error\":\"%s\"}",
+                              "Fecha y/o signo incorrectos");
+    }
+  }
+  tcp_server_reply_append(reply, "]", 1);
+  tcp_trace_span("serialize", start);
+
+  if (sampled) {
+    tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s",
+            tcp_server_reply_get_data(reply, NULL));
+  }
+}
+
+static void serve_horoscope_wire(const char     *request,
+                                 size_t          length,
+                                 TcpServerReply *reply)
+{
+  AstroInfo astro_info[SRV_BATCH_MAX];
+  time_t ttl[SRV_BATCH_MAX];
+  int days[SRV_BATCH_MAX];
+  int signs[SRV_BATCH_MAX];
+  char head[WIRE_HEADER_SIZE];
+  char item[WIRE_ASTRO_SIZE];
+  WireHeader header;
+  WireQuery query;
+  gint64 start;
+
+  /* Analizar datos recibidos: campos de tamaño fijo, sin JSON */
+  start = g_get_monotonic_time();
+  if (!wire_header_unpack(request, length, &header)
+      || header.type != WIRE_ASTRO_QUERY
+      || header.count > SRV_BATCH_MAX) {
+    memset(&header, 0, sizeof(WireHeader));
+    header.status = WIRE_BAD_REQUEST;
+  } else {
+    if (header.id[0] != '\0') {
+      tcp_trace_set_id(tcp_trace_current(), header.id);
+    }
+    for (unsigned int i = 0; i < header.count; i++) {
+      wire_query_unpack(request + WIRE_HEADER_SIZE + i * WIRE_QUERY_SIZE,
+                        &query);
+      days[i] = days_from_today(wire_query_date(&query));
+      signs[i] = query.sign < N_SIGNS ? query.sign : -1;
+    }
+  }
+  tcp_trace_span("parse", start);
+
+  if (header.status == WIRE_OK && header.deadline > 0
+      && start - tcp_server_reply_get_received(reply)
+         >= (gint64)header.deadline * 1000) {
+    header.status = WIRE_EXPIRED;
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+  }
+
+  /* Con un error, la respuesta es solo la cabecera */
+  if (header.status != WIRE_OK) {
+    header.count = 0;
+  }
+  header.type = WIRE_ASTRO_REPLY;
+  header.deadline = 0;
+  wire_header_pack(head, &header);
+  tcp_server_reply_append(reply, head, sizeof(head));
+  if (header.status != WIRE_OK) {
+    return;
+  }
+
+  start = g_get_monotonic_time();
+  get_horoscope_all(astro_info, ttl, days, signs, header.count);
+  tcp_trace_span("cache", start);
+
+  /* Un elemento por consulta, en el orden de la solicitud */
+  start = g_get_monotonic_time();
+  for (unsigned int i = 0; i < header.count; i++) {
+    wire_astro_pack(item,
+                    days[i] != -1 && signs[i] != -1 ? WIRE_OK : WIRE_BAD_QUERY,
+                    &astro_info[i], ttl[i]);
+    tcp_server_reply_append(reply, item, sizeof(item));
+  }
+  tcp_trace_span("serialize", start);
 }
 
-static char *astro_to_json(AstroInfo *astro_info)
+static void serve_horoscope_export(TcpServerReply *reply)
 {
-  g_return_val_if_fail(astro_info != NULL, NULL);
-
-  return g_strdup_printf("{\"signo\":\"%s\",\"compatible\":\"%s\",\"periodo\":[\"%s\",\"%s\"],\"estado\":\"%s\"}",
-                         astro_signs[astro_info->sign],
-                         astro_signs[astro_info->sign_compat],
-                         astro_info->date_range[0],
-                         astro_info->date_range[1],
-                         astro_info->mood);
+  GDateTime *now = g_date_time_new_now_local();
+  GDateTime *datetime;
+  AstroInfo astro_info;
+  char *astro_json;
+  char *date;
+  time_t ttl;
+
+  /* Un registro por día y signo, enviado a medida que se genera */
+  for (int day = H_MIN_DAYS; day <= H_MAX_DAYS; day++) {
+    datetime = g_date_time_add_days(now, day);
+    date = g_date_time_format(datetime, "%Y-%m-%d");
+    g_date_time_unref(datetime);
+
+    for (int sign = 0; sign < N_SIGNS; sign++) {
+      memset(&astro_info, 0, sizeof(AstroInfo));
+      ttl = get_horoscope(&astro_info, day, sign);
+      astro_json = astro_to_json(&astro_info, ttl);
+      tcp_server_reply_printf(reply, "{\"fecha\":\"%s\",\"horoscopo\":%s}",
+                              date, astro_json);
+      g_free(astro_json);
+
+      if (!tcp_server_reply_flush(reply)) {
+        tcp_log(TCP_LOG_DEBUG, "Exportación interrumpida por el cliente");
+        g_free(date);
+        g_date_time_unref(now);
+        return;
+      }
+    }
+
+    g_free(date);
+  }
+
+  tcp_server_reply_printf(reply, "{\"fin\":true,\"registros\":%d}",
+                          (H_MAX_DAYS - H_MIN_DAYS + 1) * N_SIGNS);
+  g_date_time_unref(now);
 }
 
-static void serve_horoscope(int connfd, void *data)
+static void serve_horoscope(const char     *request,
+                            size_t          length,
+                            TcpServerReply *reply,
+                            void           *data)
 {
-  g_return_if_fail(connfd != -1);
+  g_return_if_fail(request != NULL);
 
   int arg_day = -1;
   int arg_sign = -1;
-  int send_len = SRV_SEND_MAX;
-  char recv_buff[SRV_RECV_MAX+1];
-  char send_buff[SRV_SEND_MAX+1];
+  gint64 arg_deadline = 0;
+  bool sampled = tcp_log_sample();
+  gint64 start;
+
+  /* Consultas del servidor principal en el protocolo binario */
+  if (wire_is_binary(request, length)) {
+    serve_horoscope_wire(request, length, reply);
+    return;
+  }
+
+  if (sampled) {
+    tcp_log(TCP_LOG_INFO, "Mensaje recibido:\n%s", request);
+  }
 
-  memset(recv_buff, 0, sizeof(recv_buff));
-  memset(send_buff, 0, sizeof(send_buff));
+  /* Todos los días y signos, en una respuesta en partes */
+  if (get_export_arg(request, length)) {
+    serve_horoscope_export(reply);
+    return;
+  }
 
-  /* Leer solicitud del cliente */
-  recv(connfd, recv_buff, SRV_RECV_MAX, 0);
-  printf("Mensaje recibido:\n%s\n", recv_buff);
+  /* Varias consultas en una sola solicitud del servidor principal */
+  if (g_strstr_len(request, length, "\"consultas\"") != NULL) {
+    serve_horoscope_batch(request, length, reply, sampled);
+    return;
+  }
 
   /* Analizar datos recibidos */
-  get_client_args(recv_buff, &arg_day, &arg_sign);
+  start = g_get_monotonic_time();
+  get_client_args(request, &arg_day, &arg_sign, &arg_deadline);
+  tcp_trace_span("parse", start);
+
+  /* Si venció el plazo mientras esperaba en cola, ya nadie espera los datos */
+  if (arg_deadline > 0
+      && start - tcp_server_reply_get_received(reply) >= arg_deadline * 1000) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Plazo vencido");
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+    return;
+  }
 
   /* Preparar datos para el envío */
   if (arg_day != -1 && arg_sign != -1) {
     AstroInfo astro_info;
     char *astro_json;
+    time_t ttl;
 
     memset(&astro_info, 0, sizeof(AstroInfo));
-    get_horoscope(&astro_info, arg_day, arg_sign);
-    astro_json = astro_to_json(&astro_info);
-    send_len = MIN(SRV_SEND_MAX, strlen(astro_json));
-    memcpy(send_buff, astro_json, send_len);
+    start = g_get_monotonic_time();
+    ttl = get_horoscope(&astro_info, arg_day, arg_sign);
+    tcp_trace_span("cache", start);
+    start = g_get_monotonic_time();
+    astro_json = astro_to_json(&astro_info, ttl);
+    tcp_trace_span("serialize", start);
+    tcp_server_reply_append(reply,
+                            astro_json,
+                            MIN(SRV_SEND_MAX, strlen(astro_json)));
+    if (sampled) {
+      tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s", astro_json);
+    }
 
     g_free(astro_json);
   } else {
-    send_len = sprintf(send_buff,
-                       "{\"error\":\"%s\"}",
-                       "Fecha y/o signo incorrectos");
+    tcp_server_reply_printf(reply,
+                            "{\"error\":\"%s\"}",
+                            "Fecha y/o signo incorrectos");
+    if (sampled) {
+      tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s",
+              "Fecha y/o signo incorrectos");
+    }
   }
-
-  /* Enviar datos al cliente */
-  send(connfd, send_buff, send_len, 0);
-  printf("Mensaje enviado:\n%s\n", send_buff);
 }
 
 int main(int argc, char **argv)
@@ -303,7 +784,15 @@ int main(int argc, char **argv)
   GError         *error = NULL;
   GOptionContext *context;
   TcpServer      *server;
-
+  TcpServerMode   mode;
+  TcpFraming      framing;
+  TcpLogLevel     log_level;
+  unsigned int    read_timeout, write_timeout, total_timeout;
+  GBytes         *state;
+  char          **restart_argv;
+
+  /* Argumentos originales, para ejecutar el nuevo proceso al reiniciar */
+  restart_argv = g_strdupv(argv);
   context = g_option_context_new(SRV_INFO);
   g_option_context_add_main_entries(context, options, NULL);
   g_option_context_parse(context, &argc, &argv, &error);
@@ -337,20 +826,94 @@ int main(int argc, char **argv)
     fclose(file);
   }
 
-  if (port <= 1024) {
+  if (port <= 1024 || port > G_MAXUINT16) {
     fprintf(stderr, "El puerto debe ser mayor a 1024\n");
     return EXIT_FAILURE;
   }
 
-  printf("Iniciando %s...\n", SRV_NAME);
+  if (!tcp_server_mode_parse(mode_name, &mode)) {
+    fprintf(stderr, "Modo de servidor desconocido: %s\n", mode_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(framing_name, &framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            framing_name);
+    return EXIT_FAILURE;
+  }
+
+  if (max_inflight < 0) {
+    fprintf(stderr, "El límite de solicitudes en curso debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_server_deadlines_parse(deadlines_text, &read_timeout,
+                                  &write_timeout, &total_timeout)) {
+    fprintf(stderr, "Plazos de conexión inválidos: %s\n", deadlines_text);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_log_level_parse(log_level_name, &log_level)) {
+    fprintf(stderr, "Nivel de registro desconocido: %s\n", log_level_name);
+    return EXIT_FAILURE;
+  }
+
+  if (log_sample < 0) {
+    fprintf(stderr, "El muestreo del registro debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (admin_port != 0 && (admin_port <= 1024 || admin_port > G_MAXUINT16)) {
+    fprintf(stderr, "El puerto de métricas debe ser 0 o mayor a 1024\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_slow < 0) {
+    fprintf(stderr, "La duración mínima de las trazas debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_path != NULL
+      && !tcp_trace_set_output("horoscope", trace_path, trace_slow)) {
+    return EXIT_FAILURE;
+  }
+
+  tcp_log_set_level(log_level);
+  tcp_log_set_sampling(log_sample);
+
+  tcp_log(TCP_LOG_INFO, "Iniciando %s...", SRV_NAME);
+  astro_hits = tcp_metrics_counter("cache.astro.hits");
+  astro_misses = tcp_metrics_counter("cache.astro.misses");
+  tcp_metrics_ratio("cache.astro.hit_ratio", astro_hits, astro_misses);
   json_parser = json_parser_new();
   server = tcp_server_new(addr, port);
+  tcp_server_set_unix_path(server, unix_path);
+  tcp_server_set_restart(server, restart_argv, save_horoscope, NULL);
+  g_strfreev(restart_argv);
+
+  /* Recuperar la caché si el proceso viene de un reinicio sin cortes */
+  state = tcp_server_inherit(server, &error);
+  if (error != NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_clear_error(&error);
+  }
+  if (state != NULL) {
+    restore_horoscope(state);
+    g_bytes_unref(state);
+  }
+
+  tcp_server_set_mode(server, mode);
+  tcp_server_set_framing(server, framing, SRV_IDLE_TIMEOUT);
+  tcp_server_set_deadlines(server, read_timeout, write_timeout, total_timeout);
+  tcp_server_set_workers(server, workers);
+  tcp_server_set_limit(server, max_inflight);
+  tcp_server_set_admin_port(server, admin_port);
   tcp_server_run(server, serve_horoscope, NULL, &error);
   tcp_server_free(server);
   g_object_unref(json_parser);
 
   if (error != NULL) {
-    fprintf(stderr, "%s\n", error->message);
+    tcp_log(TCP_LOG_ERROR, "%s", error->message);
     g_error_free(error);
     return EXIT_FAILURE;
   }
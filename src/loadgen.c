@@ -0,0 +1,550 @@
+/**
+ * @file loadgen.c
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Generador de carga para los servidores
+ * @version 0.1
+ * @date 2023-04-18
+ *
+ * Programa que envía consultas {"fecha","signo"} al servidor principal, al del
+ * clima o al del horóscopo durante un tiempo dado, y al terminar muestra el
+ * rendimiento y los percentiles de latencia. Las claves (fecha y signo) se
+ * eligen entre la fecha actual y los siete días siguientes, el mismo rango que
+ * aceptan el servidor del clima y el del horóscopo, y los 12 signos, con
+ * distribución uniforme o Zipf.
+ *
+ * Tiene dos modos:
+ *
+ * - open: las consultas se envían a una tasa constante, sin esperar las
+ *   respuestas anteriores, con hasta C consultas en curso. La latencia se mide
+ *   desde el momento en que debía enviarse cada consulta, no desde que se
+ *   envió, de modo que la espera de las consultas demoradas por un servidor
+ *   lento también se cuenta ("coordinated omission").
+ * - closed: C clientes envían una consulta, esperan la respuesta y envían la
+ *   siguiente. Con una tasa, cada cliente espera entre consultas para
+ *   respetarla, y cuando una respuesta tarda más que el intervalo se agregan
+ *   las latencias de las consultas que no se pudieron enviar, como en
+ *   HdrHistogram.
+ *
+ * A continuación se detallan las opciones por parámetros que toma el
+ * programa, que también puede verse al ejecutarlo con el parámetro -h o
+ * --help:
+ *
+ * @code{.unparsed}
+ * ./loadgen --help
+ * @endcode
+ *
+ * Resultado:
+ *
+ * @code{.unparsed}
+ * Uso:
+ *   loadgen [OPTION?] - Generador de carga
+ *
+ * Opciones de ayuda:
+ *   -h, --help              Muestra ayuda de opciones
+ *
+ * Opciones de aplicación:
+ *   -H, --host=H            Host del servidor o unix:RUTA de su socket Unix (127.0.0.1 por defecto)
+ *   -p, --port=P            Puerto del servidor (según el destino por defecto)
+ *   -t, --target=T          Destino T: server, weather o horoscope (server por defecto)
+ *   -m, --mode=M            Modo M: open (tasa constante) o closed (C clientes) (closed por defecto)
+ *   -r, --rate=R            Enviar R consultas por segundo, 0 sin límite en modo closed (0 por defecto)
+ *   -c, --concurrency=C     Hasta C consultas en curso (16 por defecto)
+ *   -d, --duration=S        Enviar consultas durante S segundos (10 por defecto)
+ *   -k, --keys=K            Distribución K de las claves: uniform o zipf (uniform por defecto)
+ *   -z, --zipf=Z            Exponente Z de la distribución Zipf (1.0 por defecto)
+ *   -F, --framing=F         Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)
+ *   -j, --json              Mostrar el resultado en una línea en formato JSON (falso por defecto)
+ * @endcode
+ *
+ * Por ejemplo, para enviar 2000 consultas por segundo al servidor del clima
+ * durante 30 segundos, con claves Zipf:
+ *
+ * @code{.unparsed}
+ * ./loadgen -t weather -m open -r 2000 -d 30 -k zipf
+ * @endcode
+ */
+#include <glib.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcpclient.h"
+#include "tcpmetrics.h"
+#include "types.h"
+
+/** Host del servidor por defecto */
+#define LG_HOST        "127.0.0.1"
+/** Destino por defecto */
+#define LG_TARGET      "server"
+/** Modo por defecto */
+#define LG_MODE        "closed"
+/** Consultas por segundo por defecto (0 = sin límite) */
+#define LG_RATE        0
+/** Consultas en curso por defecto */
+#define LG_CONCURRENCY 16
+/** Duración por defecto (segundos) */
+#define LG_DURATION    10
+/** Distribución de las claves por defecto */
+#define LG_KEYS        "uniform"
+/** Exponente de la distribución Zipf por defecto */
+#define LG_ZIPF        1.0
+/** Forma de delimitar mensajes por defecto */
+#define LG_FRAMING     "none"
+/** Máximo de días de las consultas, a partir de la fecha actual; debe
+ *  coincidir con W_MAX_DAYS y H_MAX_DAYS de los servidores */
+#define LG_MAX_DAYS    7
+/** Cantidad de días de las consultas, de hoy a LG_MAX_DAYS inclusive */
+#define LG_DAYS        (LG_MAX_DAYS + 1)
+/** Cantidad de claves distintas */
+#define LG_KEYS_COUNT  (LG_DAYS * N_SIGNS)
+
+/** Servidores a los que se envían las consultas */
+typedef enum
+{
+  TARGET_SERVER,
+  TARGET_WEATHER,
+  TARGET_HOROSCOPE,
+  N_TARGETS
+} LoadTarget;
+
+/** Estado compartido por los hilos del generador */
+typedef struct
+{
+  TcpClient    *client;
+  char         *keys[LG_KEYS_COUNT];
+  double        cdf[LG_KEYS_COUNT];
+  bool          open;
+  gint64        interval;
+  gint64        start;
+  gint64        end;
+  gint          next;
+  TcpHistogram *latency;
+  TcpHistogram *service;
+  TcpCounter   *sent;
+  TcpCounter   *errors;
+} LoadState;
+
+/* Nombres y puertos por defecto de los destinos */
+static const char *target_names[N_TARGETS] = {
+  [TARGET_SERVER]    = "server",
+  [TARGET_WEATHER]   = "weather",
+  [TARGET_HOROSCOPE] = "horoscope",
+};
+
+static const uint16_t target_ports[N_TARGETS] = {
+  [TARGET_SERVER]    = 24000,
+  [TARGET_WEATHER]   = 24001,
+  [TARGET_HOROSCOPE] = 24002,
+};
+
+/* Signos, como los espera el servidor del horóscopo */
+static const char *sign_names[N_SIGNS] = {
+  [S_ARIES]       = "aries",
+  [S_TAURUS]      = "tauro",
+  [S_GEMINI]      = "geminis",
+  [S_CANCER]      = "cancer",
+  [S_LEO]         = "leo",
+  [S_VIRGO]       = "virgo",
+  [S_LIBRA]       = "libra",
+  [S_SCORPIO]     = "escorpio",
+  [S_SAGITTARIUS] = "sagitario",
+  [S_CAPRICORN]   = "capricornio",
+  [S_AQUARIUS]    = "acuario",
+  [S_PISCES]      = "piscis",
+};
+
+/* Host del servidor */
+static char *host = LG_HOST;
+
+/* Puerto del servidor (0 = según el destino) */
+static int port = 0;
+
+/* Destino */
+static char *target_name = LG_TARGET;
+
+/* Modo */
+static char *mode_name = LG_MODE;
+
+/* Consultas por segundo */
+static int rate = LG_RATE;
+
+/* Consultas en curso */
+static int concurrency = LG_CONCURRENCY;
+
+/* Duración */
+static int duration = LG_DURATION;
+
+/* Distribución de las claves */
+static char *keys_name = LG_KEYS;
+
+/* Exponente de la distribución Zipf */
+static double zipf = LG_ZIPF;
+
+/* Forma de delimitar mensajes */
+static char *framing_name = LG_FRAMING;
+
+/* Mostrar el resultado en formato JSON */
+static gboolean json_output = FALSE;
+
+/* Opciones de línea de comandos */
+static GOptionEntry options[] =
+{
+  { "host", 'H', 0, G_OPTION_ARG_STRING, &host, "Host del servidor o unix:RUTA de su socket Unix (127.0.0.1 por defecto)", "H" },
+  { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Puerto del servidor (según el destino por defecto)", "P" },
+  { "target", 't', 0, G_OPTION_ARG_STRING, &target_name, "Destino T: server, weather o horoscope (server por defecto)", "T" },
+  { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "Modo M: open (tasa constante) o closed (C clientes) (closed por defecto)", "M" },
+  { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Enviar R consultas por segundo, 0 sin límite en modo closed (0 por defecto)", "R" },
+  { "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Hasta C consultas en curso (16 por defecto)", "C" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Enviar consultas durante S segundos (10 por defecto)", "S" },
+  { "keys", 'k', 0, G_OPTION_ARG_STRING, &keys_name, "Distribución K de las claves: uniform o zipf (uniform por defecto)", "K" },
+  { "zipf", 'z', 0, G_OPTION_ARG_DOUBLE, &zipf, "Exponente Z de la distribución Zipf (1.0 por defecto)", "Z" },
+  { "framing", 'F', 0, G_OPTION_ARG_STRING, &framing_name, "Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)", "F" },
+  { "json", 'j', 0, G_OPTION_ARG_NONE, &json_output, "Mostrar el resultado en una línea en formato JSON (falso por defecto)", NULL },
+  { NULL }
+};
+
+static bool target_parse(const char *name, LoadTarget *target)
+{
+  for (int i = 0; i < N_TARGETS; i++) {
+    if (g_ascii_strcasecmp(name, target_names[i]) == 0) {
+      *target = (LoadTarget)i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void create_keys(LoadState *state, bool zipf_keys)
+{
+  GDateTime *now = g_date_time_new_now_local();
+  GDateTime *datetime;
+  GRand *rand = g_rand_new_with_seed(LG_KEYS_COUNT);
+  int ranks[LG_KEYS_COUNT];
+  double weight, total = 0;
+  char *date;
+  int swap, j;
+
+  for (int day = 0; day < LG_DAYS; day++) {
+    datetime = g_date_time_add_days(now, day);
+    date = g_date_time_format(datetime, "%Y-%m-%d");
+    for (int sign = 0; sign < N_SIGNS; sign++) {
+      state->keys[day * N_SIGNS + sign] =
+        g_strdup_printf("{\"fecha\":\"%s\",\"signo\":\"%s\"}",
+                        date, sign_names[sign]);
+    }
+    g_free(date);
+    g_date_time_unref(datetime);
+  }
+
+  /* Las claves más frecuentes se reparten entre días y signos al azar */
+  for (int i = 0; i < LG_KEYS_COUNT; i++) {
+    ranks[i] = i;
+  }
+  for (int i = LG_KEYS_COUNT - 1; i > 0; i--) {
+    j = g_rand_int_range(rand, 0, i + 1);
+    swap = ranks[i];
+    ranks[i] = ranks[j];
+    ranks[j] = swap;
+  }
+
+  /* Distribución acumulada: la clave de rango k tiene peso 1 / k^s */
+  for (int i = 0; i < LG_KEYS_COUNT; i++) {
+    weight = zipf_keys ? 1.0 / pow(ranks[i] + 1, zipf) : 1.0;
+    total += weight;
+    state->cdf[i] = total;
+  }
+  for (int i = 0; i < LG_KEYS_COUNT; i++) {
+    state->cdf[i] /= total;
+  }
+
+  g_rand_free(rand);
+  g_date_time_unref(now);
+}
+
+static const char *next_key(LoadState *state, GRand *rand)
+{
+  double value = g_rand_double(rand);
+  int low = 0, high = LG_KEYS_COUNT - 1, middle;
+
+  /* Primera clave cuya probabilidad acumulada supera el valor */
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (state->cdf[middle] <= value) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return state->keys[low];
+}
+
+static bool send_key(LoadState *state, const char *key)
+{
+  GError *error = NULL;
+  char *response;
+  bool ok;
+
+  response = tcp_client_call(state->client, key, strlen(key), NULL, &error);
+  if (error != NULL) {
+    g_error_free(error);
+    return false;
+  }
+
+  /* Un servidor que no pudo responder la consulta lo indica en el JSON */
+  ok = strstr(response, "\"error\"") == NULL
+    && strstr(response, ":null") == NULL;
+  g_free(response);
+
+  return ok;
+}
+
+static void sleep_until(gint64 time)
+{
+  gint64 now = g_get_monotonic_time();
+
+  if (time > now) {
+    g_usleep(time - now);
+  }
+}
+
+static void *run_open(void *data)
+{
+  LoadState *state = (LoadState*)data;
+  GRand *rand = g_rand_new();
+  gint64 intended, sent, done;
+  gint i;
+
+  while (TRUE) {
+    /* Cada consulta tiene su momento de envío, aunque los hilos se demoren */
+    i = g_atomic_int_add(&state->next, 1);
+    intended = state->start + i * state->interval;
+    if (intended >= state->end) {
+      break;
+    }
+
+    sleep_until(intended);
+    sent = g_get_monotonic_time();
+    if (!send_key(state, next_key(state, rand))) {
+      tcp_counter_add(state->errors, 1);
+    }
+    done = g_get_monotonic_time();
+
+    tcp_histogram_record(state->latency, done - intended);
+    tcp_histogram_record(state->service, done - sent);
+    tcp_counter_add(state->sent, 1);
+  }
+
+  g_rand_free(rand);
+
+  return NULL;
+}
+
+static void *run_closed(void *data)
+{
+  LoadState *state = (LoadState*)data;
+  GRand *rand = g_rand_new();
+  gint64 next, sent, elapsed, missed;
+
+  next = state->start;
+
+  while ((sent = g_get_monotonic_time()) < state->end) {
+    if (!send_key(state, next_key(state, rand))) {
+      tcp_counter_add(state->errors, 1);
+    }
+    elapsed = g_get_monotonic_time() - sent;
+
+    tcp_histogram_record(state->latency, elapsed);
+    tcp_histogram_record(state->service, elapsed);
+    tcp_counter_add(state->sent, 1);
+
+    if (state->interval == 0) {
+      continue;
+    }
+
+    /* Latencias de las consultas que debían enviarse durante la espera */
+    for (missed = elapsed - state->interval; missed > 0;
+         missed -= state->interval) {
+      tcp_histogram_record(state->latency, missed);
+    }
+
+    next += state->interval;
+    if (next < g_get_monotonic_time()) {
+      next = g_get_monotonic_time();
+    }
+    sleep_until(next);
+  }
+
+  g_rand_free(rand);
+
+  return NULL;
+}
+
+static void print_histogram_json(const char *name, TcpHistogram *histogram)
+{
+  printf("\"%s\":{\"p50\":%" PRId64 ",\"p90\":%" PRId64 ",\"p99\":%" PRId64
+         ",\"p99.9\":%" PRId64 ",\"max\":%" PRId64 "}",
+         name,
+         tcp_histogram_percentile(histogram, 50),
+         tcp_histogram_percentile(histogram, 90),
+         tcp_histogram_percentile(histogram, 99),
+         tcp_histogram_percentile(histogram, 99.9),
+         tcp_histogram_percentile(histogram, 100));
+}
+
+static void print_histogram(const char *name, TcpHistogram *histogram)
+{
+  printf("%-20s %9" PRId64 " %9" PRId64 " %9" PRId64
+         " %9" PRId64 " %9" PRId64 "\n",
+         name,
+         tcp_histogram_percentile(histogram, 50),
+         tcp_histogram_percentile(histogram, 90),
+         tcp_histogram_percentile(histogram, 99),
+         tcp_histogram_percentile(histogram, 99.9),
+         tcp_histogram_percentile(histogram, 100));
+}
+
+int main(int argc, char **argv)
+{
+  GError         *error = NULL;
+  GOptionContext *context;
+  LoadTarget      target;
+  TcpFraming      framing;
+  LoadState       state;
+  GThread       **threads;
+  gint64          sent, elapsed;
+  bool            zipf_keys;
+
+  context = g_option_context_new("- Generador de carga");
+  g_option_context_add_main_entries(context, options, NULL);
+  g_option_context_parse(context, &argc, &argv, &error);
+  g_option_context_free(context);
+
+  if (error != NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+
+  if (!target_parse(target_name, &target)) {
+    fprintf(stderr, "Destino desconocido: %s\n", target_name);
+    return EXIT_FAILURE;
+  }
+
+  if (port < 0 || port > G_MAXUINT16) {
+    fprintf(stderr, "Puerto inválido: %d\n", port);
+    return EXIT_FAILURE;
+  }
+
+  memset(&state, 0, sizeof(state));
+
+  if (g_ascii_strcasecmp(mode_name, "open") == 0) {
+    state.open = true;
+  } else if (g_ascii_strcasecmp(mode_name, "closed") != 0) {
+    fprintf(stderr, "Modo desconocido: %s\n", mode_name);
+    return EXIT_FAILURE;
+  }
+
+  if (rate < 0 || (state.open && rate == 0)) {
+    fprintf(stderr, "La tasa debe ser mayor a 0 en modo open, o mayor o igual a 0 en modo closed\n");
+    return EXIT_FAILURE;
+  }
+
+  if (concurrency <= 0 || duration <= 0) {
+    fprintf(stderr, "Las consultas en curso y la duración deben ser mayores a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  zipf_keys = g_ascii_strcasecmp(keys_name, "zipf") == 0;
+  if (!zipf_keys && g_ascii_strcasecmp(keys_name, "uniform") != 0) {
+    fprintf(stderr, "Distribución de claves desconocida: %s\n", keys_name);
+    return EXIT_FAILURE;
+  }
+
+  if (zipf <= 0) {
+    fprintf(stderr, "El exponente de la distribución Zipf debe ser mayor a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(framing_name, &framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            framing_name);
+    return EXIT_FAILURE;
+  }
+
+  state.client = tcp_client_new(host, port != 0 ? port : target_ports[target]);
+  if (state.client == NULL) {
+    return EXIT_FAILURE;
+  }
+  tcp_client_set_framing(state.client, framing);
+
+  create_keys(&state, zipf_keys);
+  state.latency = tcp_metrics_histogram("loadgen.latency_us");
+  state.service = tcp_metrics_histogram("loadgen.service_us");
+  state.sent = tcp_metrics_counter("loadgen.sent");
+  state.errors = tcp_metrics_counter("loadgen.errors");
+
+  /* En modo open el intervalo es global; en modo closed, de cada cliente */
+  if (rate > 0) {
+    state.interval = (state.open ? 1 : concurrency) * G_USEC_PER_SEC / rate;
+    state.interval = MAX(state.interval, 1);
+  }
+
+  if (!json_output) {
+    printf("Enviando consultas a %s (%s:%d) durante %d s, modo %s, %d en curso",
+           target_names[target], host, port != 0 ? port : target_ports[target],
+           duration, state.open ? "open" : "closed", concurrency);
+    if (rate > 0) {
+      printf(", %d/s", rate);
+    }
+    printf("...\n");
+  }
+
+  state.start = g_get_monotonic_time();
+  state.end = state.start + (gint64)duration * G_USEC_PER_SEC;
+
+  threads = g_new(GThread*, concurrency);
+  for (int i = 0; i < concurrency; i++) {
+    threads[i] = g_thread_new("loadgen", state.open ? run_open : run_closed,
+                              &state);
+  }
+  for (int i = 0; i < concurrency; i++) {
+    g_thread_join(threads[i]);
+  }
+  elapsed = g_get_monotonic_time() - state.start;
+  g_free(threads);
+
+  sent = tcp_counter_get(state.sent);
+  if (json_output) {
+    /* Latencias en microsegundos */
+    printf("{\"consultas\":%" PRId64 ",\"errores\":%" PRId64
+           ",\"rendimiento\":%.1f,",
+           sent, tcp_counter_get(state.errors),
+           (double)sent * G_USEC_PER_SEC / elapsed);
+    print_histogram_json("corregida", state.latency);
+    printf(",");
+    print_histogram_json("servicio", state.service);
+    printf("}\n");
+  } else {
+    printf("Consultas:    %" PRId64 " (%" PRId64 " errores)\n",
+           sent, tcp_counter_get(state.errors));
+    printf("Rendimiento:  %.1f consultas/s\n",
+           (double)sent * G_USEC_PER_SEC / elapsed);
+    printf("%-20s %9s %9s %9s %9s %9s\n",
+           "Latencia (us)", "p50", "p90", "p99", "p99.9", "max");
+    print_histogram("corregida", state.latency);
+    print_histogram("servicio", state.service);
+  }
+
+  for (int i = 0; i < LG_KEYS_COUNT; i++) {
+    g_free(state.keys[i]);
+  }
+  tcp_client_free(state.client);
+
+  return EXIT_SUCCESS;
+}
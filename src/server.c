@@ -26,12 +26,12 @@
  * activate SC
  *
  * par
- *   SC ->(10) SP : {fecha, signo}
+ *   SC ->(10) SP : {id, fecha, signo}
  *   activate SP
  *   SP -->(10) SC : {clima}
  *   deactivate SP
  * else
- *   SC ->(20) SH : {fecha, signo}
+ *   SC ->(20) SH : {id, fecha, signo}
  *   activate SH
  *   SH -->(20) SC : {horóscopo}
  *   deactivate SH
@@ -50,6 +50,10 @@
  * servidor reutiliza una serie de hilos para satisfacer las consultas de los
  * clientes.
  *
+ * Cada consulta recibe un identificador, que se reenvía a los otros servidores
+ * en el miembro "id". Con la opción --trace, cada servidor registra las etapas
+ * de las consultas lentas con ese identificador (ver tcptrace.h).
+ *
  * A continuación se detallan las opciones por parámetros que toma el servidor,
  * que también puede verse al ejecutar el programa con el parámetro -h o --help:
  *
@@ -69,13 +73,123 @@
  * Opciones de aplicación:
  *   -a, --addr=A                Direccion A (0 = INADDR_ANY por defecto)
  *   -p, --port=P                Puerto P > 1024 del servidor (24000 por defecto)
- *   -w, --weather-host=WH       Host WH del servidor del clima (localhost por defecto)
+ *   -u, --unix=U                Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)
+ *   -w, --weather-host=WH       Hosts WH de las réplicas del servidor del clima, separados por comas, cada uno con :PUERTO opcional o unix:RUTA de su socket Unix (localhost por defecto)
  *   -W, --weather-port=WP       Puerto WP > 1024 del servidor del clima (24001 por defecto)
- *   -s, --horoscope-host=SH     Host SH del servidor del horoscopo (localhost por defecto)
+ *   -s, --horoscope-host=SH     Hosts SH de las réplicas del servidor del horoscopo, separados por comas, cada uno con :PUERTO opcional o unix:RUTA de su socket Unix (localhost por defecto)
  *   -S, --horoscope-port=SP     Puerto SP > 1024 del servidor del horoscopo (24002 por defecto)
  *   -c, --max-conn=C            Aceptar hasta C conexiones (10 por defecto)
  *   -t, --max-threads=T         Usar hasta T hilos o -1 sin limites (usar cantidad de procesadores por defecto)
  *   -e, --exclusive             Usar hilos exclusivos (falso por defecto)
+ *   -m, --mode=M                Modo M del servidor: threads, epoll o uring (threads por defecto)
+ *   -n, --shards=N              Abrir N sockets SO_REUSEPORT o 0 para uno por núcleo (1 por defecto)
+ *   -A, --affinity=AF           Afinidad AF de hilos por socket: none o core (none por defecto)
+ *   -F, --framing=F             Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)
+ *   -B, --backend-framing=BF    Delimitar mensajes con los servidores del clima y horóscopo con BF (none por defecto)
+ *   -P, --backend-pool=BP       Mantener hasta BP conexiones con cada servidor del clima y horóscopo o -1 sin límite (según BF, K y PCT por defecto)
+ *   -Y, --backend-protocol=PR   Consultar a los servidores del clima y horóscopo en el protocolo PR: json o binary (json por defecto)
+ *   -b, --balance=BL            Elegir las réplicas con BL: least o p2c (least por defecto)
+ *   -H, --hedge=PCT             Enviar una copia a otra réplica si la primera no responde en el percentil PCT de sus duraciones o 0 para no enviarla (0 por defecto)
+ *   -E, --ejection=N,MS         Sacar de la rotación por MS milisegundos a las réplicas con N errores seguidos, 0 para no sacarlas (5,10000 por defecto)
+ *   -d, --deadline=MS           Responder en MS milisegundos desde que se recibe la solicitud, con null en los datos que no lleguen a tiempo, o 0 sin plazo (2000 por defecto)
+ *   -K, --breaker=N,MS          Dejar de consultar por MS milisegundos al servidor del clima u horóscopo con N consultas fallidas seguidas, 0 para consultarlo siempre (20,5000 por defecto)
+ *   -C, --cache=N               Guardar hasta N respuestas en caché o 0 para no guardarlas (4096 por defecto)
+ *   -L, --max-inflight=L        Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)
+ *   -D, --deadlines=R,W,T       Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)
+ *   -k, --workers=K             Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)
+ *   -v, --log-level=V           Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)
+ *   -l, --log-sample=N          Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)
+ *   -M, --admin-port=AP         Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)
+ *   -T, --trace=ARCHIVO         Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)
+ *   -R, --trace-slow=MS         Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)
+ * @endcode
+ *
+ * Si se delimitan los mensajes, cada conexión atiende solicitudes hasta que
+ * pasa el tiempo máximo de inactividad. Con -B length, ndjson o mux, las
+ * conexiones con los servidores del clima y del horóscopo quedan abiertas y se
+ * reutilizan entre consultas, hasta BP por servidor (ver
+ * tcp_client_set_pool()); esos servidores deben delimitar los mensajes de la
+ * misma forma (opción -F). En modo threads, los servidores del clima y del
+ * horóscopo ocupan uno de sus hilos por cada conexión abierta, y las consultas
+ * de las demás conexiones esperan en cola, por lo que la suma de las
+ * conexiones de todos sus clientes (cada proceso de trabajo, otros servidores
+ * principales, loadgen) no debe superar su cantidad de hilos; conviene
+ * ejecutarlos en modo epoll o uring. Sin BP, cada proceso mantiene hasta la
+ * cantidad de procesadores dividida por la cantidad de procesos de trabajo, y
+ * por dos con -H. Con -B none (por defecto), cada consulta usa una conexión
+ * nueva y las conexiones no tienen límite.
+ *
+ * Cada uno de los servidores del clima y del horóscopo puede tener varias
+ * réplicas, por ejemplo "-w 10.0.0.1,10.0.0.2:24011" (las réplicas sin puerto
+ * usan el de -W o -S). Cada consulta se envía a la réplica con menos consultas en
+ * curso, o con -b p2c a la que tiene menos entre dos al azar. Con -H, si la
+ * réplica no responde en el percentil dado de sus últimas duraciones, se envía
+ * una copia a otra réplica y se usa la primera respuesta. Las réplicas que
+ * fallan varias veces seguidas salen de la rotación por un tiempo (opción -E;
+ * ver tcpbalancer.h).
+ *
+ * Cada solicitud tiene un plazo desde que se empieza a recibir (opción -d),
+ * que incluye la espera en cola. Las consultas al servidor del clima y del
+ * horóscopo indican en el miembro "deadline" cuántos milisegundos quedan del
+ * plazo, para que las descarten si vencen en su cola. Si un servidor no
+ * responde a tiempo, se responde sin esperarlo, con null en sus datos, por
+ * ejemplo {"clima":{...},"horoscopo":null}. Si un servidor falla varias
+ * consultas seguidas, se deja de consultar por un tiempo y sus datos son null
+ * en el acto (opción -K).
+ *
+ * Las respuestas se guardan en una caché en memoria por fecha y signo, mientras
+ * sigan vigentes los datos del clima y del horóscopo según el miembro "ttl" de
+ * sus respuestas (ver tcpcache.h). Las consultas repetidas se responden desde
+ * la caché, sin consultar a los otros servidores, con el "ttl" de cada servidor
+ * descontado el tiempo que pasó en la caché. Las consultas con secuencias de
+ * escape en el JSON no se guardan.
+ *
+ * Las consultas iguales que llegan al mismo tiempo comparten la consulta en
+ * curso a cada servidor: la misma fecha al servidor del clima, y la misma fecha
+ * y signo al servidor del horóscopo. La primera consulta a los servidores y las
+ * demás esperan su respuesta, por ejemplo cuando muchos clientes piden el clima
+ * del día con la caché vacía.
+ *
+ * Una solicitud puede incluir hasta 128 consultas en lote, por ejemplo todos
+ * los signos de varios días:
+ *
+ * @code{.unparsed}
+ * {"consultas":[{"fecha":"2023-04-20","signo":"aries"},{"fecha":"2023-04-20","signo":"tauro"},...]}
+ * @endcode
+ *
+ * La respuesta tiene un resultado por consulta, en el mismo orden, como la de
+ * una consulta sola: {"resultados":[{"clima":...,"horoscopo":...},...]}. Las
+ * consultas que no están en la caché se agrupan sin repetir fechas ni signos
+ * en una única solicitud a cada servidor, que responde un arreglo con un
+ * resultado por fecha o por fecha y signo. Las solicitudes en lote suelen
+ * superar los 1024 bytes, por lo que requieren delimitar los mensajes con los
+ * clientes y con los servidores del clima y del horóscopo (opciones -F y -B).
+ *
+ * La solicitud {"exportar":true} devuelve en una sola consulta los datos de
+ * todos los días del clima y de todos los días y signos del horóscopo, un
+ * registro JSON por línea (o por mensaje, con -F) a medida que llegan de cada
+ * servidor, terminados por {"fin":true,"registros":N}. Los registros no se
+ * guardan en memoria: si el cliente no los lee, se deja de leer de los
+ * servidores, que a su vez esperan. Requiere que los servidores del clima y
+ * del horóscopo delimiten los mensajes con length o ndjson (opción -B).
+ *
+ * Con -Y binary, las consultas a los servidores del clima y del horóscopo se
+ * envían en el protocolo binario (ver wire.h): la fecha y el signo van en
+ * campos de tamaño fijo, que esos servidores leen sin analizar JSON, y sus
+ * datos vuelven en binario. El JSON de la respuesta se arma una sola vez, en
+ * este servidor. Los clientes también pueden enviar consultas en el protocolo
+ * binario (WIRE_QUERY, hasta 128 por solicitud), y reciben los datos de cada
+ * servidor tal como llegan, sin pasar por JSON, en una respuesta WIRE_REPLY.
+ * Los mensajes binarios pueden contener saltos de línea, por lo que no admiten
+ * delimitar los mensajes con ndjson (opciones -F y -B).
+ *
+ * Si los tres servidores se ejecutan en el mismo equipo, pueden comunicarse
+ * por sockets Unix en lugar de TCP, por ejemplo:
+ *
+ * @code{.unparsed}
+ * weather_server -u /run/weather.sock
+ * horoscope_server -u /run/horoscope.sock
+ * server -w unix:/run/weather.sock -s unix:/run/horoscope.sock
  * @endcode
  */
 #include <glib.h>
@@ -95,10 +209,16 @@
 #include <ws2tcpip.h>
 #endif
 
+#include "tcpbalancer.h"
+#include "tcpcache.h"
+#include "tcplog.h"
+#include "tcpmetrics.h"
 #include "tcpserver.h"
 #include "tcpclient.h"
+#include "tcptrace.h"
 #include "types.h"
 #include "util.h"
+#include "wire.h"
 
 /** Nombre del servidor */
 #define SRV_NAME         "Servidor principal"
@@ -108,6 +228,8 @@
 #define SRV_ADDR         INADDR_ANY
 /** Puerto del servidor por defecto */
 #define SRV_PORT         24000
+/** Ruta del socket Unix por defecto (NULL = escuchar en TCP) */
+#define SRV_UNIX_PATH    NULL
 /** Host del servidor del clima por defecto */
 #define SRV_WEATHER_HOST "127.0.0.1"
 /** Puerto del servidor del clima por defecto */
@@ -122,28 +244,84 @@
 #define SRV_MAX_THREADS  0
 /** Indica si se usan hilos exclusivos (no por defecto) */
 #define SRV_EXC_THREADS  false
-/** Cantidad máxima para envío de bytes */
-#define SRV_SEND_MAX     1024
-/** Cantidad máxima para recepción de bytes */
-#define SRV_RECV_MAX     1024
+/** Modo del servidor por defecto */
+#define SRV_MODE         "threads"
+/** Cantidad de sockets de escucha por defecto (0 = uno por núcleo) */
+#define SRV_SHARDS       1
+/** Política de afinidad de hilos por defecto */
+#define SRV_AFFINITY     "none"
+/** Forma de delimitar mensajes por defecto */
+#define SRV_FRAMING      "none"
+/** Tiempo máximo de inactividad de una conexión (milisegundos) */
+#define SRV_IDLE_TIMEOUT 30000
+/** Forma de delimitar mensajes con los servidores del clima y horóscopo */
+#define SRV_BACK_FRAMING "none"
+/**
+ * Conexiones con cada servidor del clima y horóscopo por defecto
+ * (0 = según la forma de delimitar mensajes, ver backend_pool_size())
+ */
+#define SRV_BACK_POOL    0
+/**
+ * Tiempo máximo sin usar de una conexión con los servidores del clima y
+ * horóscopo (milisegundos), menor que el tiempo de inactividad con el que
+ * ellos la cierran
+ */
+#define SRV_BACK_IDLE    20000
+/** Protocolo con los servidores del clima y horóscopo por defecto */
+#define SRV_BACK_PROTO   "json"
+/** Política de elección de réplicas por defecto */
+#define SRV_BALANCE      "least"
+/** Percentil de duración para enviar copias a otra réplica (0 = no enviar) */
+#define SRV_HEDGE        0
+/** Errores seguidos y tiempo fuera de la rotación de una réplica (milisegundos) */
+#define SRV_EJECTION     "5,10000"
+/** Plazo de respuesta de las solicitudes por defecto (milisegundos, 0 = sin plazo) */
+#define SRV_DEADLINE     2000
+/** Consultas fallidas seguidas y tiempo sin consultar a un servidor (milisegundos) */
+#define SRV_BREAKER      "20,5000"
+/** Cantidad máxima de respuestas en caché por defecto (0 = sin caché) */
+#define SRV_CACHE_SIZE   4096
+/** Cantidad máxima de consultas por solicitud en lote */
+#define SRV_BATCH_MAX    128
+/** Comienzo del último registro de una exportación */
+#define SRV_EXPORT_END   "{\"fin\":true,\"registros\":"
+/** Máximo del límite de solicitudes en curso por defecto (0 = sin límite) */
+#define SRV_MAX_INFLIGHT 1024
+/** Plazos de lectura, escritura y total por defecto (milisegundos) */
+#define SRV_DEADLINES    "10000,10000,0"
+/** Procesos de trabajo por defecto (0 = un único proceso) */
+#define SRV_WORKERS      0
+/** Nivel de registro por defecto */
+#define SRV_LOG_LEVEL    "info"
+/** Registrar el contenido de una de cada N solicitudes (0 = ninguna) */
+#define SRV_LOG_SAMPLE   0
+/** Puerto de métricas por defecto (0 = no exponerlas) */
+#define SRV_ADMIN_PORT   0
+/** Archivo de trazas por defecto (NULL = no registrar trazas) */
+#define SRV_TRACE_PATH   NULL
+/** Duración mínima de las solicitudes registradas en las trazas (milisegundos) */
+#define SRV_TRACE_SLOW   0
 
 /* Dirección del servidor */
 static uint32_t addr = SRV_ADDR;
 
 /* Puerto del servidor */
-static uint16_t port = SRV_PORT;
+static int port = SRV_PORT;
+
+/* Ruta del socket Unix */
+static char *unix_path = SRV_UNIX_PATH;
 
 /* Host del servidor del clima */
 static char *weather_host = SRV_WEATHER_HOST;
 
 /* Puerto del servidor del clima */
-static uint16_t weather_port = SRV_WEATHER_PORT;
+static int weather_port = SRV_WEATHER_PORT;
 
 /* Host del servidor del horóscopo */
 static char *horoscope_host = SRV_HOROS_HOST;
 
 /* Puerto del servidor del horóscopo */
-static uint16_t horoscope_port = SRV_HOROS_PORT;
+static int horoscope_port = SRV_HOROS_PORT;
 
 /* Máximo de conexiones */
 static int max_conn = SRV_MAX_CONN;
@@ -154,107 +332,1370 @@ static int max_threads = SRV_MAX_THREADS;
 /* Usar hilos exclusivos */
 static bool exclusive = SRV_EXC_THREADS;
 
+/* Modo del servidor */
+static char *mode_name = SRV_MODE;
+
+/* Cantidad de sockets de escucha */
+static int shards = SRV_SHARDS;
+
+/* Política de afinidad de hilos */
+static char *affinity_name = SRV_AFFINITY;
+
+/* Forma de delimitar mensajes */
+static char *framing_name = SRV_FRAMING;
+
+/* Forma de delimitar mensajes con los servidores del clima y horóscopo */
+static char *backend_framing_name = SRV_BACK_FRAMING;
+
+/* Conexiones con cada servidor del clima y horóscopo */
+static int backend_pool = SRV_BACK_POOL;
+
+/* Protocolo con los servidores del clima y horóscopo */
+static char *backend_protocol_name = SRV_BACK_PROTO;
+
+/* Política de elección de réplicas */
+static char *balance_name = SRV_BALANCE;
+
+/* Percentil de duración para enviar copias a otra réplica */
+static double hedge = SRV_HEDGE;
+
+/* Errores seguidos y tiempo fuera de la rotación de una réplica */
+static char *ejection_text = SRV_EJECTION;
+
+/* Plazo de respuesta de las solicitudes */
+static int deadline = SRV_DEADLINE;
+
+/* Consultas fallidas seguidas y tiempo sin consultar a un servidor */
+static char *breaker_text = SRV_BREAKER;
+
+/* Cantidad máxima de respuestas en caché */
+static int cache_size = SRV_CACHE_SIZE;
+
+/* Máximo del límite de solicitudes en curso */
+static int max_inflight = SRV_MAX_INFLIGHT;
+
+/* Plazos de lectura, escritura y total de las conexiones */
+static char *deadlines_text = SRV_DEADLINES;
+
+/* Cantidad de procesos de trabajo */
+static int workers = SRV_WORKERS;
+
+/* Nivel de registro */
+static char *log_level_name = SRV_LOG_LEVEL;
+
+/* Muestreo del contenido de las solicitudes en el registro */
+static int log_sample = SRV_LOG_SAMPLE;
+
+/* Puerto de métricas */
+static int admin_port = SRV_ADMIN_PORT;
+
+/* Archivo de trazas */
+static char *trace_path = SRV_TRACE_PATH;
+
+/* Duración mínima de las solicitudes registradas en las trazas */
+static int trace_slow = SRV_TRACE_SLOW;
+
 /* Opciones de línea de comandos */
 static GOptionEntry options[] =
 {
   { "addr", 'a', 0, G_OPTION_ARG_INT, &addr, "Direccion A (0 = INADDR_ANY por defecto)", "A" },
   { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Puerto P > 1024 del servidor (24000 por defecto)", "P" },
-  { "weather-host", 'w', 0, G_OPTION_ARG_STRING, &weather_host, "Host WH del servidor del clima (localhost por defecto)", "WH" },
+  { "unix", 'u', 0, G_OPTION_ARG_FILENAME, &unix_path, "Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)", "U" },
+  { "weather-host", 'w', 0, G_OPTION_ARG_STRING, &weather_host, "Hosts WH de las réplicas del servidor del clima, separados por comas, cada uno con :PUERTO opcional o unix:RUTA de su socket Unix (localhost por defecto)", "WH" },
   { "weather-port", 'W', 0, G_OPTION_ARG_INT, &weather_port, "Puerto WP > 1024 del servidor del clima (24001 por defecto)", "WP" },
-  { "horoscope-host", 's', 0, G_OPTION_ARG_STRING, &horoscope_host, "Host SH del servidor del horoscopo (localhost por defecto)", "SH" },
+  { "horoscope-host", 's', 0, G_OPTION_ARG_STRING, &horoscope_host, "Hosts SH de las réplicas del servidor del horoscopo, separados por comas, cada uno con :PUERTO opcional o unix:RUTA de su socket Unix (localhost por defecto)", "SH" },
   { "horoscope-port", 'S', 0, G_OPTION_ARG_INT, &horoscope_port, "Puerto SP > 1024 del servidor del horoscopo (24002 por defecto)", "SP" },
   { "max-conn", 'c', 0, G_OPTION_ARG_INT, &max_conn, "Aceptar hasta C conexiones (10 por defecto)", "C" },
   { "max-threads", 't', 0, G_OPTION_ARG_INT, &max_threads, "Usar hasta T hilos o -1 sin limites (usar cantidad de procesadores por defecto)", "T" },
   { "exclusive", 'e', 0, G_OPTION_ARG_NONE, &exclusive, "Usar hilos exclusivos (falso por defecto)", NULL },
+  { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "Modo M del servidor: threads, epoll o uring (threads por defecto)", "M" },
+  { "shards", 'n', 0, G_OPTION_ARG_INT, &shards, "Abrir N sockets SO_REUSEPORT o 0 para uno por núcleo (1 por defecto)", "N" },
+  { "affinity", 'A', 0, G_OPTION_ARG_STRING, &affinity_name, "Afinidad AF de hilos por socket: none o core (none por defecto)", "AF" },
+  { "framing", 'F', 0, G_OPTION_ARG_STRING, &framing_name, "Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)", "F" },
+  { "backend-framing", 'B', 0, G_OPTION_ARG_STRING, &backend_framing_name, "Delimitar mensajes con los servidores del clima y horóscopo con BF (none por defecto)", "BF" },
+  { "backend-pool", 'P', 0, G_OPTION_ARG_INT, &backend_pool, "Mantener hasta BP conexiones con cada servidor del clima y horóscopo o -1 sin límite (según BF, K y PCT por defecto)", "BP" },
+  { "backend-protocol", 'Y', 0, G_OPTION_ARG_STRING, &backend_protocol_name, "Consultar a los servidores del clima y horóscopo en el protocolo PR: json o binary (json por defecto)", "PR" },
+  { "balance", 'b', 0, G_OPTION_ARG_STRING, &balance_name, "Elegir las réplicas con BL: least o p2c (least por defecto)", "BL" },
+  { "hedge", 'H', 0, G_OPTION_ARG_DOUBLE, &hedge, "Enviar una copia a otra réplica si la primera no responde en el percentil PCT de sus duraciones o 0 para no enviarla (0 por defecto)", "PCT" },
+  { "ejection", 'E', 0, G_OPTION_ARG_STRING, &ejection_text, "Sacar de la rotación por MS milisegundos a las réplicas con N errores seguidos, 0 para no sacarlas (5,10000 por defecto)", "N,MS" },
+  { "deadline", 'd', 0, G_OPTION_ARG_INT, &deadline, "Responder en MS milisegundos desde que se recibe la solicitud, con null en los datos que no lleguen a tiempo, o 0 sin plazo (2000 por defecto)", "MS" },
+  { "breaker", 'K', 0, G_OPTION_ARG_STRING, &breaker_text, "Dejar de consultar por MS milisegundos al servidor del clima u horóscopo con N consultas fallidas seguidas, 0 para consultarlo siempre (20,5000 por defecto)", "N,MS" },
+  { "cache", 'C', 0, G_OPTION_ARG_INT, &cache_size, "Guardar hasta N respuestas en caché o 0 para no guardarlas (4096 por defecto)", "N" },
+  { "max-inflight", 'L', 0, G_OPTION_ARG_INT, &max_inflight, "Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)", "L" },
+  { "deadlines", 'D', 0, G_OPTION_ARG_STRING, &deadlines_text, "Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)", "R,W,T" },
+  { "workers", 'k', 0, G_OPTION_ARG_INT, &workers, "Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)", "K" },
+  { "log-level", 'v', 0, G_OPTION_ARG_STRING, &log_level_name, "Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)", "V" },
+  { "log-sample", 'l', 0, G_OPTION_ARG_INT, &log_sample, "Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)", "N" },
+  { "admin-port", 'M', 0, G_OPTION_ARG_INT, &admin_port, "Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)", "AP" },
+  { "trace", 'T', 0, G_OPTION_ARG_FILENAME, &trace_path, "Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)", "ARCHIVO" },
+  { "trace-slow", 'R', 0, G_OPTION_ARG_INT, &trace_slow, "Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)", "MS" },
   { NULL }
 };
 
-/* Cliente para el servidor del clima */
-static TcpClient *weather_client = NULL;
+/* Réplicas del servidor del clima */
+static TcpBalancer *weather_backend = NULL;
+
+/* Réplicas del servidor del horóscopo */
+static TcpBalancer *horoscope_backend = NULL;
+
+/* Caché de respuestas */
+static TcpCache *cache = NULL;
+
+/* Consultar a los servidores del clima y horóscopo en el protocolo binario */
+static bool backend_binary = false;
+
+/* Los mensajes con los servidores del clima y horóscopo admiten datos binarios */
+static bool backend_wire = false;
+
+/** Parte de un texto JSON, sin copiarla */
+typedef struct
+{
+  const char *data;
+  size_t      length;
+} JsonSlice;
+
+/** Reenvío al cliente de la exportación de los servidores */
+typedef struct
+{
+  TcpServerReply *reply;
+  unsigned int    records;
+  bool            closed;
+} ExportRelay;
+
+/** Consulta en curso a un servidor, compartida por las solicitudes iguales */
+typedef struct
+{
+  GCond  cond;
+  char  *key;
+  char  *response;
+  bool   done;
+  int    refs;
+} Flight;
+
+/** Consultas en curso a un servidor, por clave */
+typedef struct
+{
+  GMutex      lock;
+  GHashTable *flights;
+  TcpCounter *coalesced;
+} FlightGroup;
+
+/* Consultas en curso al servidor del clima */
+static FlightGroup weather_flights;
+
+/* Consultas en curso al servidor del horóscopo */
+static FlightGroup horoscope_flights;
+
+static GString *forward_request(const char *request,
+                                size_t      length,
+                                const char *id,
+                                gint64      budget)
+{
+  GString *forwarded = g_string_sized_new(length + TCP_TRACE_ID_LEN + 32);
+  size_t start = 0;
+
+  while (start < length && g_ascii_isspace(request[start])) {
+    start++;
+  }
+
+  /* Agregar el identificador como primer miembro del objeto JSON */
+  if (start < length && request[start] == '{') {
+    g_string_append_len(forwarded, request, start + 1);
+    g_string_append_printf(forwarded, "\"id\":\"%s\"", id);
+    if (budget > 0) {
+      g_string_append_printf(forwarded, ",\"deadline\":%ld", (long)budget);
+    }
+
+    start++;
+    while (start < length && g_ascii_isspace(request[start])) {
+      start++;
+    }
+    if (start < length && request[start] != '}') {
+      g_string_append_c(forwarded, ',');
+    }
+    g_string_append_len(forwarded, request + start, length - start);
+  } else {
+    g_string_append_len(forwarded, request, length);
+  }
+
+  return forwarded;
+}
+
+static bool json_string_member(const char *data,
+                               size_t      length,
+                               const char *name,
+                               GString    *value)
+{
+  const char *end = data + length;
+  const char *p = data;
+  const char *start;
+  size_t name_len = strlen(name);
+  bool found = false;
+
+  /* Con varias apariciones del miembro vale la última, como en json-glib */
+  while (p < end && (p = g_strstr_len(p, end - p, name)) != NULL) {
+    p += name_len;
+    while (p < end && g_ascii_isspace(*p)) {
+      p++;
+    }
+    if (p == end || *p != ':') {
+      continue;
+    }
+    p++;
+    while (p < end && g_ascii_isspace(*p)) {
+      p++;
+    }
+    if (p == end || *p != '"') {
+      continue;
+    }
+
+    start = ++p;
+    while (p < end && *p != '"') {
+      p++;
+    }
+    if (p == end) {
+      return false;
+    }
+
+    g_string_truncate(value, 0);
+    g_string_append_len(value, start, p - start);
+    found = true;
+    p++;
+  }
+
+  return found;
+}
+
+static char *cache_key(const char *request, size_t length)
+{
+  GString *date_str = g_string_sized_new(16);
+  GString *sign_str = g_string_sized_new(16);
+  GDate *date = NULL;
+  char *key = NULL;
+
+  /*
+   * Sin secuencias de escape, las comillas siempre delimitan cadenas y los
+   * miembros se encuentran sin analizar todo el JSON
+   */
+  if (memchr(request, '\\', length) == NULL
+      && json_string_member(request, length, "\"fecha\"", date_str)
+      && json_string_member(request, length, "\"signo\"", sign_str)) {
+    date = parse_date(date_str->str);
+  }
+
+  /* La misma fecha escrita de otra forma o el signo en otras mayúsculas */
+  if (date != NULL) {
+    g_strstrip(sign_str->str);
+    for (char *c = sign_str->str; *c != '\0'; c++) {
+      *c = g_ascii_tolower(*c);
+    }
+    key = g_strdup_printf("%04d-%02d-%02d|%s",
+                          g_date_get_year(date),
+                          g_date_get_month(date),
+                          g_date_get_day(date),
+                          sign_str->str);
+    g_date_free(date);
+  }
+
+  g_string_free(date_str, TRUE);
+  g_string_free(sign_str, TRUE);
+
+  return key;
+}
+
+static gint64 response_ttl(const char *response, size_t length)
+{
+  const char *ttl;
+
+  /* Segundos de validez que indican los servidores del clima y horóscopo */
+  ttl = response != NULL ? g_strstr_len(response, length, "\"ttl\":") : NULL;
+  if (ttl == NULL) {
+    return 0;
+  }
+
+  return g_ascii_strtoll(ttl + strlen("\"ttl\":"), NULL, 10);
+}
+
+static void reply_append_cached(TcpServerReply *reply,
+                                GBytes         *cached,
+                                gint64          age)
+{
+  gint64 elapsed = (age + 999) / 1000;
+  const char *data, *ttl;
+  char *end;
+  size_t length;
+  gint64 value;
+
+  /*
+   * Cada "ttl" guardado pasa a ser lo que le queda de vida, para que el
+   * cliente no guarde los datos más tiempo del que siguen vigentes
+   */
+  data = g_bytes_get_data(cached, &length);
+  while ((ttl = g_strstr_len(data, length, "\"ttl\":")) != NULL) {
+    ttl += strlen("\"ttl\":");
+    value = g_ascii_strtoll(ttl, &end, 10);
+    tcp_server_reply_append(reply, data, ttl - data);
+    tcp_server_reply_printf(reply, "%ld", (long)MAX(value - elapsed, 0));
+    length -= end - data;
+    data = end;
+  }
+  tcp_server_reply_append(reply, data, length);
+}
+
+static const char *json_member(const char *data,
+                               size_t      length,
+                               const char *name)
+{
+  const char *end = data + length;
+  const char *p = data;
+  const char *start;
+  size_t name_len = strlen(name);
+  int depth = 0;
+
+  /*
+   * Solo los miembros del objeto principal: se saltean las cadenas (que
+   * pueden contener el nombre) y lo que hay dentro de objetos y arreglos
+   */
+  while (p < end) {
+    if (*p == '{' || *p == '[') {
+      depth++;
+    } else if (*p == '}' || *p == ']') {
+      depth--;
+    } else if (*p == '"') {
+      start = p++;
+      while (p < end && *p != '"') {
+        p += *p == '\\' ? 2 : 1;
+      }
+      if (p >= end) {
+        return NULL;
+      }
+
+      if (depth == 1 && (size_t)(p + 1 - start) == name_len
+          && memcmp(start, name, name_len) == 0) {
+        p++;
+        while (p < end && g_ascii_isspace(*p)) {
+          p++;
+        }
+        if (p < end && *p == ':') {
+          p++;
+          while (p < end && g_ascii_isspace(*p)) {
+            p++;
+          }
+          return p < end ? p : NULL;
+        }
+        continue;
+      }
+    }
+    p++;
+  }
+
+  return NULL;
+}
+
+static bool json_array_member(const char  *data,
+                              size_t       length,
+                              const char  *name,
+                              const char **array,
+                              size_t      *array_len)
+{
+  const char *p = json_member(data, length, name);
+
+  if (p == NULL || *p != '[') {
+    return false;
+  }
+
+  *array = p;
+  *array_len = data + length - p;
+
+  return true;
+}
+
+static bool json_true_member(const char *data, size_t length, const char *name)
+{
+  const char *end = data + length;
+  const char *p = json_member(data, length, name);
+
+  /* El valor true completo, no el comienzo de otra palabra */
+  if (p == NULL || end - p < 4 || memcmp(p, "true", 4) != 0) {
+    return false;
+  }
+  p += 4;
+  while (p < end && g_ascii_isspace(*p)) {
+    p++;
+  }
+
+  return p < end && (*p == ',' || *p == '}');
+}
+
+static gssize split_json_array(const char *array,
+                               size_t      length,
+                               JsonSlice  *items,
+                               size_t      max_items)
+{
+  size_t n_items = 0, depth = 0, start = 1, end;
+  bool in_string = false;
+
+  if (length == 0 || array[0] != '[') {
+    return -1;
+  }
+
+  for (size_t i = 1; i < length; i++) {
+    if (in_string) {
+      if (array[i] == '\\') {
+        i++;
+      } else if (array[i] == '"') {
+        in_string = false;
+      }
+      continue;
+    }
+
+    if (array[i] == '"') {
+      in_string = true;
+    } else if (array[i] == '{' || array[i] == '[') {
+      depth++;
+    } else if ((array[i] == '}' || array[i] == ']') && depth > 0) {
+      depth--;
+    } else if (depth == 0 && (array[i] == ',' || array[i] == ']')) {
+      /* Elemento entre la coma o el corchete anterior y este carácter */
+      while (start < i && g_ascii_isspace(array[start])) {
+        start++;
+      }
+      end = i;
+      while (end > start && g_ascii_isspace(array[end - 1])) {
+        end--;
+      }
+
+      if (array[i] == ']' && n_items == 0 && end == start) {
+        return 0;
+      }
+      if (end == start || n_items == max_items) {
+        return -1;
+      }
+
+      items[n_items].data = array + start;
+      items[n_items].length = end - start;
+      n_items++;
+      start = i + 1;
+
+      if (array[i] == ']') {
+        return n_items;
+      }
+    }
+  }
+
+  return -1;
+}
+
+static Flight *flight_join(FlightGroup *group, const char *key, bool *leader)
+{
+  Flight *flight;
+
+  g_mutex_lock(&group->lock);
+
+  if (group->flights == NULL) {
+    group->flights = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+
+  /* La primera solicitud con la clave consulta al servidor */
+  flight = g_hash_table_lookup(group->flights, key);
+  *leader = flight == NULL;
+  if (flight == NULL) {
+    flight = g_new0(Flight, 1);
+    g_cond_init(&flight->cond);
+    flight->key = g_strdup(key);
+    g_hash_table_insert(group->flights, flight->key, flight);
+  }
+  flight->refs++;
+
+  g_mutex_unlock(&group->lock);
+
+  return flight;
+}
+
+static void flight_unref(Flight *flight)
+{
+  if (--flight->refs == 0) {
+    g_cond_clear(&flight->cond);
+    g_free(flight->key);
+    g_free(flight->response);
+    g_free(flight);
+  }
+}
+
+static void flight_finish(FlightGroup *group,
+                          Flight      *flight,
+                          const char  *response)
+{
+  g_mutex_lock(&group->lock);
+
+  /* Las solicitudes que lleguen desde ahora inician otra consulta */
+  g_hash_table_remove(group->flights, flight->key);
+  if (flight->refs > 1) {
+    flight->response = g_strdup(response);
+  }
+  flight->done = true;
+  g_cond_broadcast(&flight->cond);
+  flight_unref(flight);
+
+  g_mutex_unlock(&group->lock);
+}
+
+static char *flight_wait(FlightGroup *group, Flight *flight)
+{
+  char *response;
+
+  g_mutex_lock(&group->lock);
+
+  while (!flight->done) {
+    g_cond_wait(&flight->cond, &group->lock);
+  }
+  response = g_strdup(flight->response);
+  tcp_counter_add(group->coalesced, 1);
+  flight_unref(flight);
+
+  g_mutex_unlock(&group->lock);
+
+  return response;
+}
+
+/*
+ * Conexiones por defecto con cada servidor del clima y horóscopo: sin
+ * delimitar los mensajes no se reutilizan, y no tienen límite; si no, se
+ * reparten los hilos de esos servidores (tantos como procesadores, en el
+ * mismo equipo) entre los procesos de trabajo, y las copias de -H pueden usar
+ * una segunda conexión por consulta
+ */
+static int backend_pool_size(TcpFraming framing)
+{
+  int pool = g_get_num_processors();
+
+  if (framing == TCP_FRAMING_NONE) {
+    return -1;
+  }
+
+  if (workers != 0) {
+    pool /= workers > 0 ? workers : g_get_num_processors();
+  }
+  if (hedge > 0) {
+    pool /= 2;
+  }
+
+  return MAX(pool, 1);
+}
+
+static TcpBalancer *backend_new(const char       *hosts,
+                                int               default_port,
+                                TcpFraming        framing,
+                                int               pool,
+                                TcpBalancePolicy  policy)
+{
+  TcpBalancer *balancer = tcp_balancer_new(policy);
+  TcpClient *client = NULL;
+  char **entries = g_strsplit(hosts, ",", -1);
+  char *host, *separator, *end;
+  long entry_port;
+
+  for (char **entry = entries; *entry != NULL; entry++) {
+    host = g_strstrip(*entry);
+    entry_port = default_port;
+
+    /* Puerto propio de la réplica, salvo en los sockets Unix */
+    separator = strrchr(host, ':');
+    if (!g_str_has_prefix(host, "unix:") && separator != NULL) {
+      *separator = '\0';
+      entry_port = strtol(separator + 1, &end, 10);
+      if (*end != '\0' || entry_port <= 1024 || entry_port > G_MAXUINT16) {
+        fprintf(stderr, "Los puertos deben ser mayor a 1024: %s\n", separator + 1);
+        client = NULL;
+        break;
+      }
+    }
+
+    client = tcp_client_new(host, entry_port);
+    if (client == NULL) {
+      break;
+    }
+    tcp_client_set_framing(client, framing);
+    tcp_client_set_pool(client, pool, SRV_BACK_IDLE);
+    tcp_balancer_add(balancer, client);
+  }
+
+  if (entries[0] == NULL) {
+    fprintf(stderr, "Falta el host de los servidores del clima u horóscopo\n");
+  }
+  g_strfreev(entries);
+
+  if (client == NULL) {
+    tcp_balancer_free(balancer);
+    return NULL;
+  }
+
+  return balancer;
+}
+
+static void wire_add_query(GString *request, const char *key)
+{
+  char data[WIRE_QUERY_SIZE];
+  const char *sign = strchr(key, '|');
+  WireQuery query;
+
+  /* La clave "AAAA-MM-DD|signo" ya tiene la fecha y el signo normalizados */
+  query.year = g_ascii_strtoull(key, NULL, 10);
+  query.month = g_ascii_strtoull(key + 5, NULL, 10);
+  query.day = g_ascii_strtoull(key + 8, NULL, 10);
+  query.sign = WIRE_NO_SIGN;
+  if (sign != NULL && parse_sign(sign + 1) != -1) {
+    query.sign = parse_sign(sign + 1);
+  }
+
+  wire_query_pack(data, &query);
+  g_string_append_len(request, data, sizeof(data));
+}
+
+static void wire_set_header(GString    *request,
+                            WireType    type,
+                            const char *id,
+                            gint64      expires)
+{
+  WireHeader header = { .type = type, .status = WIRE_OK };
+
+  /* Las consultas se agregan detrás del espacio reservado para la cabecera */
+  header.count = (request->len - WIRE_HEADER_SIZE) / WIRE_QUERY_SIZE;
+  if (expires > 0) {
+    header.deadline = MAX((expires - g_get_monotonic_time()) / 1000, 1);
+  }
+  g_strlcpy(header.id, id, sizeof(header.id));
+  wire_header_pack(request->str, &header);
+}
+
+static const char *wire_items(TcpBalancerRequest *request,
+                              WireType            type,
+                              unsigned int        count,
+                              WireStatus         *status)
+{
+  WireHeader header;
+
+  if (request->error != NULL) {
+    tcp_log(g_error_matches(request->error, TCP_BALANCER_ERROR,
+                            TCP_BALANCER_OPEN_ERROR)
+            ? TCP_LOG_DEBUG : TCP_LOG_ERROR,
+            "%s", request->error->message);
+    g_clear_error(&request->error);
+  }
+
+  *status = WIRE_UNAVAILABLE;
+  if (request->response == NULL) {
+    return NULL;
+  }
+
+  /* Una respuesta JSON, por ejemplo de una versión anterior, no es válida */
+  if (!wire_header_unpack(request->response, request->response_len, &header)
+      || (header.status == WIRE_OK
+          && (header.type != type || header.count != count))) {
+    tcp_log(TCP_LOG_WARNING, "Respuesta binaria incorrecta de %s",
+            type == WIRE_WEATHER_REPLY
+            ? "el servidor del clima" : "el servidor del horóscopo");
+    return NULL;
+  }
+
+  if (header.status != WIRE_OK) {
+    *status = header.status == WIRE_EXPIRED ? WIRE_EXPIRED : WIRE_UNAVAILABLE;
+    return NULL;
+  }
+
+  *status = WIRE_OK;
+
+  return request->response + WIRE_HEADER_SIZE;
+}
+
+static void response_from_wire(TcpBalancerRequest *request,
+                               WireType            type,
+                               unsigned int        count,
+                               bool                array)
+{
+  size_t size = type == WIRE_WEATHER_REPLY ? WIRE_WEATHER_SIZE : WIRE_ASTRO_SIZE;
+  const char *items, *item;
+  WireStatus status;
+  WeatherInfo weather;
+  AstroInfo astro_info;
+  GString *json;
+  char *item_json;
+  time_t ttl;
+
+  /*
+   * La misma respuesta que enviaría el servidor en JSON, de modo que se
+   * comparte, se guarda en la caché y se reenvía al cliente igual que esa
+   */
+  items = wire_items(request, type, count, &status);
+  json = g_string_sized_new(count * 128 + 2);
+  if (status == WIRE_EXPIRED) {
+    g_string_append_printf(json, "{\"error\":\"%s\"}", "Plazo vencido");
+  } else if (items != NULL) {
+    g_string_append(json, array ? "[" : "");
+    for (unsigned int i = 0; i < count; i++) {
+      item = items + i * size;
+      g_string_append(json, i > 0 ? "," : "");
 
-/* Cliente para el servidor del horóscopo */
-static TcpClient *horoscope_client = NULL;
+      status = type == WIRE_WEATHER_REPLY
+               ? wire_weather_unpack(item, &weather, &ttl)
+               : wire_astro_unpack(item, &astro_info, &ttl);
+      if (status == WIRE_OK) {
+        item_json = type == WIRE_WEATHER_REPLY
+                    ? weather_to_json(&weather, ttl)
+                    : astro_to_json(&astro_info, ttl);
+        g_string_append(json, item_json);
+        g_free(item_json);
+      } else if (status == WIRE_BAD_QUERY) {
+        g_string_append_printf(json, "{\"error\":\"%s\"}",
+                               type == WIRE_WEATHER_REPLY
+                               ? "Fecha incorrecta"
+                               : "Fecha y/o signo incorrectos");
+      } else {
+        g_string_append(json, "null");
+      }
+    }
+    g_string_append(json, array ? "]" : "");
+  }
 
-static void *get_info(int sockfd, void *data)
+  g_free(request->response);
+  request->response_len = json->len;
+  request->response = g_string_free(json, FALSE);
+  if (request->response_len == 0) {
+    g_clear_pointer(&request->response, g_free);
+  }
+}
+
+static void batch_reply(TcpServerReply *reply,
+                        JsonSlice       weather,
+                        JsonSlice       horoscope,
+                        const char     *key)
 {
-  char *request = (char*)data;
+  const char *reply_data;
+  size_t start, reply_len;
+  GBytes *cached;
+  gint64 ttl;
+
+  tcp_server_reply_get_data(reply, &start);
+  tcp_server_reply_printf(reply, "{\"clima\":%.*s,\"horoscopo\":%.*s}",
+                          (int)weather.length, weather.data,
+                          (int)horoscope.length, horoscope.data);
+
+  /* Guardar el resultado como el de una consulta sola */
+  ttl = MIN(response_ttl(weather.data, weather.length),
+            response_ttl(horoscope.data, horoscope.length));
+  if (cache != NULL && ttl > 0) {
+    reply_data = tcp_server_reply_get_data(reply, &reply_len);
+    cached = g_bytes_new(reply_data + start, reply_len - start);
+    tcp_cache_insert(cache, key, cached, ttl * 1000);
+    g_bytes_unref(cached);
+  }
+}
+
+static void serve_batch(const char     *array,
+                        size_t          array_len,
+                        TcpServerReply *reply,
+                        const char     *id,
+                        gint64          expires)
+{
+  JsonSlice queries[SRV_BATCH_MAX];
+  JsonSlice weather_items[SRV_BATCH_MAX];
+  JsonSlice horoscope_items[SRV_BATCH_MAX];
+  JsonSlice null_item = { "null", strlen("null") };
+  char *keys[SRV_BATCH_MAX] = { NULL };
+  GBytes *cached[SRV_BATCH_MAX] = { NULL };
+  gint64 ages[SRV_BATCH_MAX];
+  unsigned int weather_index[SRV_BATCH_MAX];
+  unsigned int horoscope_index[SRV_BATCH_MAX];
+  GHashTable *dates = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, NULL);
+  GHashTable *signs = g_hash_table_new(g_str_hash, g_str_equal);
+  GString *weather_request = g_string_sized_new(1024);
+  GString *horoscope_request = g_string_sized_new(4096);
+  gssize n_queries, n_weather = 0, n_horoscope = 0;
+  char *date, *sign;
+  gpointer index;
+  gint64 start;
+
+  n_queries = split_json_array(array, array_len, queries, SRV_BATCH_MAX);
+  if (n_queries < 0) {
+    tcp_server_reply_printf(reply,
+                            "{\"error\":\"Consultas incorrectas (hasta %d por solicitud)\"}",
+                            SRV_BATCH_MAX);
+    g_hash_table_destroy(dates);
+    g_hash_table_destroy(signs);
+    g_string_free(weather_request, TRUE);
+    g_string_free(horoscope_request, TRUE);
+    return;
+  }
+
+  /* En el protocolo binario, la cabecera se escribe al final */
+  if (backend_binary) {
+    g_string_set_size(weather_request, WIRE_HEADER_SIZE);
+    g_string_set_size(horoscope_request, WIRE_HEADER_SIZE);
+  } else {
+    g_string_append_printf(weather_request, "{\"id\":\"%s\",", id);
+    g_string_append_printf(horoscope_request, "{\"id\":\"%s\",", id);
+    if (expires > 0) {
+      g_string_append_printf(weather_request, "\"deadline\":%ld,",
+                             (long)MAX((expires - g_get_monotonic_time()) / 1000, 1));
+      g_string_append_printf(horoscope_request, "\"deadline\":%ld,",
+                             (long)MAX((expires - g_get_monotonic_time()) / 1000, 1));
+    }
+    g_string_append(weather_request, "\"fechas\":[");
+    g_string_append(horoscope_request, "\"consultas\":[");
+  }
+
+  /*
+   * Responder desde la caché y agrupar el resto sin repetir fechas ni signos.
+   * La clave "AAAA-MM-DD|signo" ya tiene la fecha y el signo normalizados.
+   */
+  start = g_get_monotonic_time();
+  for (gssize i = 0; i < n_queries; i++) {
+    keys[i] = cache_key(queries[i].data, queries[i].length);
+    if (keys[i] == NULL) {
+      continue;
+    }
+    if (cache != NULL) {
+      cached[i] = tcp_cache_lookup(cache, keys[i], &ages[i]);
+      if (cached[i] != NULL) {
+        continue;
+      }
+    }
+
+    date = g_strndup(keys[i], strcspn(keys[i], "|"));
+    sign = keys[i] + strlen(date) + 1;
+
+    if (!g_hash_table_lookup_extended(dates, date, NULL, &index)) {
+      index = GUINT_TO_POINTER(n_weather);
+      g_hash_table_insert(dates, date, index);
+      if (backend_binary) {
+        wire_add_query(weather_request, date);
+      } else {
+        g_string_append_printf(weather_request, "%s\"%s\"",
+                               n_weather > 0 ? "," : "", date);
+      }
+      n_weather++;
+    } else {
+      g_free(date);
+    }
+    weather_index[i] = GPOINTER_TO_UINT(index);
+
+    if (!g_hash_table_lookup_extended(signs, keys[i], NULL, &index)) {
+      index = GUINT_TO_POINTER(n_horoscope);
+      g_hash_table_insert(signs, keys[i], index);
+      if (backend_binary) {
+        wire_add_query(horoscope_request, keys[i]);
+      } else {
+        g_string_append_printf(horoscope_request,
+                               "%s{\"fecha\":\"%.*s\",\"signo\":\"%s\"}",
+                               n_horoscope > 0 ? "," : "",
+                               (int)(sign - keys[i] - 1), keys[i], sign);
+      }
+      n_horoscope++;
+    }
+    horoscope_index[i] = GPOINTER_TO_UINT(index);
+  }
+  tcp_trace_span("cache", start);
 
-  g_return_val_if_fail(sockfd != -1, NULL);
-  g_return_val_if_fail(request != NULL, NULL);
+  if (backend_binary) {
+    wire_set_header(weather_request, WIRE_WEATHER_QUERY, id, expires);
+    wire_set_header(horoscope_request, WIRE_ASTRO_QUERY, id, expires);
+  } else {
+    g_string_append(weather_request, "]}");
+    g_string_append(horoscope_request, "]}");
+  }
+
+  TcpBalancerRequest requests[] = {
+    { .balancer = weather_backend, .request = weather_request->str, .length = weather_request->len, .deadline = expires },
+    { .balancer = horoscope_backend, .request = horoscope_request->str, .length = horoscope_request->len, .deadline = expires },
+  };
+  gssize n_items[] = { n_weather, n_horoscope };
+  JsonSlice *items[] = { weather_items, horoscope_items };
+  WireType wire_types[] = { WIRE_WEATHER_REPLY, WIRE_ASTRO_REPLY };
 
-  char recv_buf[SRV_SEND_MAX+1];
-  int send_len = strlen(request);
+  /* Una sola solicitud a cada servidor con todas las consultas */
+  if (n_weather > 0) {
+    tcp_log(TCP_LOG_DEBUG,
+            "Enviando %zd fechas y %zd consultas del mensaje %s a los servidores del clima y del horóscopo...",
+            n_weather, n_horoscope, id);
+    start = g_get_monotonic_time();
+    tcp_balancer_request_all(requests, G_N_ELEMENTS(requests));
+    tcp_trace_span("fanout", start);
+  }
 
-  memset(recv_buf, 0, sizeof(recv_buf));
-  send(sockfd, request, send_len, 0);
-  recv(sockfd, recv_buf, SRV_SEND_MAX, 0);
+  /* Sin una respuesta completa de un servidor, sus datos son null */
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    if (backend_binary && n_items[i] > 0) {
+      response_from_wire(&requests[i], wire_types[i], n_items[i], true);
+    }
+    if (requests[i].error != NULL) {
+      tcp_log(g_error_matches(requests[i].error, TCP_BALANCER_ERROR,
+                              TCP_BALANCER_OPEN_ERROR)
+              ? TCP_LOG_DEBUG : TCP_LOG_ERROR,
+              "%s", requests[i].error->message);
+      g_clear_error(&requests[i].error);
+    }
+    if (n_items[i] > 0
+        && (requests[i].response == NULL
+            || split_json_array(requests[i].response, requests[i].response_len,
+                                items[i], n_items[i]) != n_items[i])) {
+      for (gssize j = 0; j < n_items[i]; j++) {
+        items[i][j] = null_item;
+      }
+    }
+  }
 
-  return g_strdup(recv_buf);
+  /* Armar respuesta, en el orden de las consultas */
+  start = g_get_monotonic_time();
+  tcp_server_reply_append(reply, "{\"resultados\":[", strlen("{\"resultados\":["));
+  for (gssize i = 0; i < n_queries; i++) {
+    if (i > 0) {
+      tcp_server_reply_append(reply, ",", 1);
+    }
+    if (cached[i] != NULL) {
+      reply_append_cached(reply, cached[i], ages[i]);
+      g_bytes_unref(cached[i]);
+    } else if (keys[i] != NULL) {
+      batch_reply(reply, weather_items[weather_index[i]],
+                  horoscope_items[horoscope_index[i]], keys[i]);
+    } else {
+      tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Consulta incorrecta");
+    }
+  }
+  tcp_server_reply_append(reply, "]}", 2);
+  tcp_trace_span("serialize", start);
+
+  g_hash_table_destroy(dates);
+  g_hash_table_destroy(signs);
+  for (gssize i = 0; i < n_queries; i++) {
+    g_free(keys[i]);
+  }
+  g_free(requests[0].response);
+  g_free(requests[1].response);
+  g_string_free(weather_request, TRUE);
+  g_string_free(horoscope_request, TRUE);
 }
 
-static void serve(int connfd, void *data)
+static void serve_wire(const char     *request,
+                       size_t          length,
+                       TcpServerReply *reply,
+                       const char     *id,
+                       gint64          expires)
 {
-  g_return_if_fail(connfd != -1);
+  char *keys[SRV_BATCH_MAX] = { NULL };
+  GBytes *cached[SRV_BATCH_MAX] = { NULL };
+  gint64 ages[SRV_BATCH_MAX];
+  char head[WIRE_HEADER_SIZE];
+  char result[WIRE_RESULT_SIZE];
+  GString *weather_request, *horoscope_request;
+  const char *query_data, *weather_items, *horoscope_items;
+  WireStatus weather_status, horoscope_status;
+  WeatherInfo weather;
+  AstroInfo astro_info;
+  time_t weather_ttl, astro_ttl;
+  WireHeader header;
+  WireQuery query;
+  unsigned int n_misses, miss = 0;
+  gint64 start;
 
+  /* Los servidores reciben las consultas en binario, que ndjson no admite */
+  if (!wire_header_unpack(request, length, &header)
+      || header.type != WIRE_QUERY
+      || header.count > SRV_BATCH_MAX
+      || !backend_wire) {
+    memset(&header, 0, sizeof(WireHeader));
+    header.type = WIRE_REPLY;
+    header.status = backend_wire ? WIRE_BAD_REQUEST : WIRE_UNAVAILABLE;
+    wire_header_pack(head, &header);
+    tcp_server_reply_append(reply, head, sizeof(head));
+    return;
+  }
+
+  weather_request = g_string_sized_new(WIRE_HEADER_SIZE
+                                       + header.count * WIRE_QUERY_SIZE);
+  horoscope_request = g_string_sized_new(WIRE_HEADER_SIZE
+                                         + header.count * WIRE_QUERY_SIZE);
+  g_string_set_size(weather_request, WIRE_HEADER_SIZE);
+  g_string_set_size(horoscope_request, WIRE_HEADER_SIZE);
+
+  /*
+   * Responder desde la caché y consultar el resto en una sola solicitud a cada
+   * servidor. Las claves "AAAA-MM-DD#N" no coinciden con las de las consultas
+   * en JSON, que guardan la respuesta en ese formato.
+   */
+  start = g_get_monotonic_time();
+  for (unsigned int i = 0; i < header.count; i++) {
+    query_data = request + WIRE_HEADER_SIZE + i * WIRE_QUERY_SIZE;
+    wire_query_unpack(query_data, &query);
+    keys[i] = g_strdup_printf("%04u-%02u-%02u#%u", query.year, query.month,
+                              query.day, query.sign);
+    if (cache != NULL) {
+      cached[i] = tcp_cache_lookup(cache, keys[i], &ages[i]);
+      if (cached[i] != NULL) {
+        continue;
+      }
+    }
+
+    g_string_append_len(weather_request, query_data, WIRE_QUERY_SIZE);
+    g_string_append_len(horoscope_request, query_data, WIRE_QUERY_SIZE);
+  }
+  tcp_trace_span("cache", start);
+
+  n_misses = (weather_request->len - WIRE_HEADER_SIZE) / WIRE_QUERY_SIZE;
+  wire_set_header(weather_request, WIRE_WEATHER_QUERY, id, expires);
+  wire_set_header(horoscope_request, WIRE_ASTRO_QUERY, id, expires);
+
+  TcpBalancerRequest requests[] = {
+    { .balancer = weather_backend, .request = weather_request->str, .length = weather_request->len, .deadline = expires },
+    { .balancer = horoscope_backend, .request = horoscope_request->str, .length = horoscope_request->len, .deadline = expires },
+  };
+
+  if (n_misses > 0) {
+    start = g_get_monotonic_time();
+    tcp_balancer_request_all(requests, G_N_ELEMENTS(requests));
+    tcp_trace_span("fanout", start);
+  }
+
+  weather_items = wire_items(&requests[0], WIRE_WEATHER_REPLY, n_misses,
+                             &weather_status);
+  horoscope_items = wire_items(&requests[1], WIRE_ASTRO_REPLY, n_misses,
+                               &horoscope_status);
+
+  /* Los datos de cada servidor se copian sin volver a codificarlos */
+  start = g_get_monotonic_time();
+  header.type = WIRE_REPLY;
+  header.deadline = 0;
+  wire_header_pack(head, &header);
+  tcp_server_reply_append(reply, head, sizeof(head));
+  for (unsigned int i = 0; i < header.count; i++) {
+    /* Los datos guardados se envían con lo que les queda de vida */
+    if (cached[i] != NULL) {
+      memcpy(result, g_bytes_get_data(cached[i], NULL), sizeof(result));
+      g_bytes_unref(cached[i]);
+      wire_weather_unpack(result, &weather, &weather_ttl);
+      wire_astro_unpack(result + WIRE_WEATHER_SIZE, &astro_info, &astro_ttl);
+      wire_weather_pack(result, WIRE_OK, &weather,
+                        weather_ttl - (ages[i] + 999) / 1000);
+      wire_astro_pack(result + WIRE_WEATHER_SIZE, WIRE_OK, &astro_info,
+                      astro_ttl - (ages[i] + 999) / 1000);
+      tcp_server_reply_append(reply, result, sizeof(result));
+      continue;
+    }
+
+    if (weather_items != NULL) {
+      memcpy(result, weather_items + miss * WIRE_WEATHER_SIZE,
+             WIRE_WEATHER_SIZE);
+    } else {
+      wire_weather_pack(result, weather_status, NULL, 0);
+    }
+    if (horoscope_items != NULL) {
+      memcpy(result + WIRE_WEATHER_SIZE,
+             horoscope_items + miss * WIRE_ASTRO_SIZE, WIRE_ASTRO_SIZE);
+    } else {
+      wire_astro_pack(result + WIRE_WEATHER_SIZE, horoscope_status, NULL, 0);
+    }
+    tcp_server_reply_append(reply, result, sizeof(result));
+    miss++;
+
+    /* Guardar el resultado mientras sean válidos los datos de ambos servidores */
+    if (cache != NULL
+        && wire_weather_unpack(result, &weather, &weather_ttl) == WIRE_OK
+        && wire_astro_unpack(result + WIRE_WEATHER_SIZE, &astro_info,
+                             &astro_ttl) == WIRE_OK
+        && MIN(weather_ttl, astro_ttl) > 0) {
+      GBytes *value = g_bytes_new(result, sizeof(result));
+
+      tcp_cache_insert(cache, keys[i], value,
+                       MIN(weather_ttl, astro_ttl) * 1000);
+      g_bytes_unref(value);
+    }
+  }
+  tcp_trace_span("serialize", start);
+
+  for (unsigned int i = 0; i < header.count; i++) {
+    g_free(keys[i]);
+  }
+  g_free(requests[0].response);
+  g_free(requests[1].response);
+  g_string_free(weather_request, TRUE);
+  g_string_free(horoscope_request, TRUE);
+}
+
+static bool is_export_end(const char *part, size_t length)
+{
+  size_t prefix_len = strlen(SRV_EXPORT_END);
+  size_t i = prefix_len;
+
+  /* Exactamente {"fin":true,"registros":N}, como lo envían los servidores */
+  if (length < prefix_len + 2 || memcmp(part, SRV_EXPORT_END, prefix_len) != 0) {
+    return false;
+  }
+  while (i < length - 1 && g_ascii_isdigit(part[i])) {
+    i++;
+  }
+
+  return i > prefix_len && i == length - 1 && part[i] == '}';
+}
+
+static bool relay_part(const char *part, size_t length, void *data)
+{
+  ExportRelay *relay = (ExportRelay*)data;
+
+  /* El último registro de cada servidor no se reenvía */
+  if (is_export_end(part, length)) {
+    return false;
+  }
+
+  /* Sin cliente, leer igual hasta el final para reutilizar la conexión */
+  if (!relay->closed) {
+    tcp_server_reply_append(relay->reply, part, length);
+    relay->closed = !tcp_server_reply_flush(relay->reply);
+    relay->records++;
+  }
+
+  return true;
+}
+
+static void serve_export(TcpServerReply *reply, const char *id)
+{
+  TcpBalancer *backends[] = { weather_backend, horoscope_backend };
+  ExportRelay relay = { .reply = reply };
   GError *error = NULL;
-  GThread *wc_thread = NULL;
-  GThread *hc_thread = NULL;
+  char *request;
+  gint64 start;
+
+  request = g_strdup_printf("{\"id\":\"%s\",\"exportar\":true}", id);
+
+  /* Un servidor tras otro, reenviando cada registro a medida que llega */
+  start = g_get_monotonic_time();
+  for (size_t i = 0; i < G_N_ELEMENTS(backends) && !relay.closed; i++) {
+    if (!tcp_balancer_stream(backends[i], request, strlen(request),
+                             relay_part, &relay, &error)) {
+      tcp_log(TCP_LOG_ERROR, "%s", error->message);
+      tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", error->message);
+      relay.closed = !tcp_server_reply_flush(reply);
+      g_clear_error(&error);
+    }
+  }
+  tcp_trace_span("export", start);
+
+  tcp_server_reply_printf(reply, "{\"fin\":true,\"registros\":%u}",
+                          relay.records);
+  g_free(request);
+}
+
+static void serve(const char     *request,
+                  size_t          length,
+                  TcpServerReply *reply,
+                  void           *data)
+{
+  g_return_if_fail(request != NULL);
+
   char *weather_response = NULL;
   char *horoscope_response = NULL;
-  char recv_buf[SRV_RECV_MAX+1];
-  char send_buf[SRV_SEND_MAX+1];
-  int recv_len = 0;
-  int send_len = 0;
-
-  memset(recv_buf, 0, sizeof(recv_buf));
-  memset(send_buf, 0, sizeof(send_buf));
-
-  /* Leer solicitud del cliente */
-  recv_len = recv(connfd, recv_buf, SRV_RECV_MAX, 0);
-  if (recv_len > 0) {
-    printf("Mensaje recibido:\n%s\n", recv_buf);
-
-    /* Solicitar datos del clima */
-    printf("Enviando mensaje al servidor del clima...\n");
-    wc_thread = tcp_client_run(weather_client, get_info, &recv_buf, &error);
-    if (error != NULL) {
-      fprintf(stderr, "%s\n", error->message);
-      g_clear_error(&error);
+  bool sampled = tcp_log_sample();
+  char id[TCP_TRACE_ID_LEN];
+  char *key = NULL;
+  GString *forwarded, *horoscope_forwarded;
+  GBytes *cached;
+  gint64 start, ttl, age, expires = 0;
+  const char *reply_data, *array;
+  size_t reply_len, array_len;
+
+  if (sampled && !wire_is_binary(request, length)) {
+    tcp_log(TCP_LOG_INFO, "Mensaje recibido:\n%s", request);
+  }
+
+  /* Identificar la solicitud en este servidor y en los que se consultan */
+  tcp_trace_new_id(id);
+  tcp_trace_set_id(tcp_trace_current(), id);
+
+  /* El plazo corre desde que se empezó a recibir la solicitud */
+  if (deadline > 0) {
+    expires = tcp_server_reply_get_received(reply) + (gint64)deadline * 1000;
+  }
+
+  /* Consultas de un cliente en el protocolo binario */
+  if (wire_is_binary(request, length)) {
+    serve_wire(request, length, reply, id, expires);
+    return;
+  }
+
+  /* Todos los datos de ambos servidores, sin plazo */
+  if (json_true_member(request, length, "\"exportar\"")) {
+    serve_export(reply, id);
+    return;
+  }
+
+  /* Varias consultas en una sola solicitud */
+  if (json_array_member(request, length, "\"consultas\"", &array, &array_len)) {
+    serve_batch(array, array_len, reply, id, expires);
+    return;
+  }
+
+  /* Responder desde la caché si los datos siguen vigentes */
+  key = cache_key(request, length);
+  if (cache != NULL && key != NULL) {
+    start = g_get_monotonic_time();
+    cached = tcp_cache_lookup(cache, key, &age);
+    tcp_trace_span("cache", start);
+
+    if (cached != NULL) {
+      reply_append_cached(reply, cached, age);
+      tcp_log(TCP_LOG_DEBUG, "Respuesta a %s obtenida de la caché", key);
+      g_bytes_unref(cached);
+      g_free(key);
+      return;
     }
+  }
 
-    /* Solicitar datos del horóscopo */
-    printf("Enviando mensaje al servidor del horóscopo...\n");
-    hc_thread = tcp_client_run(horoscope_client, get_info, &recv_buf, &error);
-    if (error != NULL) {
-      fprintf(stderr, "%s\n", error->message);
-      g_clear_error(&error);
+  /*
+   * En el protocolo binario van la fecha y el signo de la clave; sin clave
+   * (por ejemplo, con secuencias de escape) la solicitud se reenvía en JSON
+   */
+  if (backend_binary && key != NULL) {
+    forwarded = g_string_sized_new(WIRE_HEADER_SIZE + WIRE_QUERY_SIZE);
+    horoscope_forwarded = g_string_sized_new(WIRE_HEADER_SIZE + WIRE_QUERY_SIZE);
+    g_string_set_size(forwarded, WIRE_HEADER_SIZE);
+    g_string_set_size(horoscope_forwarded, WIRE_HEADER_SIZE);
+    wire_add_query(forwarded, key);
+    wire_add_query(horoscope_forwarded, key);
+    wire_set_header(forwarded, WIRE_WEATHER_QUERY, id, expires);
+    wire_set_header(horoscope_forwarded, WIRE_ASTRO_QUERY, id, expires);
+  } else {
+    forwarded = forward_request(request, length, id,
+                                expires > 0
+                                ? MAX((expires - g_get_monotonic_time()) / 1000, 1)
+                                : 0);
+    horoscope_forwarded = forwarded;
+  }
+
+  TcpBalancerRequest requests[] = {
+    { .balancer = weather_backend, .request = forwarded->str, .length = forwarded->len, .deadline = expires },
+    { .balancer = horoscope_backend, .request = horoscope_forwarded->str, .length = horoscope_forwarded->len, .deadline = expires },
+  };
+  WireType wire_types[] = { WIRE_WEATHER_REPLY, WIRE_ASTRO_REPLY };
+  TcpBalancerRequest calls[G_N_ELEMENTS(requests)];
+  FlightGroup *groups[] = { &weather_flights, &horoscope_flights };
+  Flight *flights[G_N_ELEMENTS(requests)] = { NULL };
+  bool leader[G_N_ELEMENTS(requests)];
+  size_t n_calls = 0;
+
+  /*
+   * Unirse a las consultas iguales en curso: el clima depende solo de la
+   * fecha, que es la primera parte de la clave
+   */
+  if (key != NULL) {
+    char *date_key = g_strndup(key, strcspn(key, "|"));
+
+    flights[0] = flight_join(groups[0], date_key, &leader[0]);
+    flights[1] = flight_join(groups[1], key, &leader[1]);
+    g_free(date_key);
+  }
+
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    if (flights[i] == NULL || leader[i]) {
+      calls[n_calls++] = requests[i];
     }
+  }
+
+  /* Solicitar datos del clima y del horóscopo en paralelo */
+  tcp_log(TCP_LOG_DEBUG,
+          "Enviando mensaje %s a los servidores del clima y del horóscopo...",
+          id);
+  start = g_get_monotonic_time();
+  tcp_balancer_request_all(calls, n_calls);
 
-    if (wc_thread != NULL) {
-      weather_response = g_thread_join(wc_thread);
-      printf("Datos del clima recibidos:\n%s\n", weather_response);
+  /* Compartir las respuestas obtenidas y esperar las de otras solicitudes */
+  n_calls = 0;
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    if (flights[i] == NULL || leader[i]) {
+      requests[i] = calls[n_calls++];
+      if (backend_binary && key != NULL) {
+        response_from_wire(&requests[i], wire_types[i], 1, false);
+      }
+      if (flights[i] != NULL) {
+        flight_finish(groups[i], flights[i], requests[i].response);
+      }
+    }
+  }
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    if (flights[i] != NULL && !leader[i]) {
+      requests[i].response = flight_wait(groups[i], flights[i]);
+      requests[i].elapsed = g_get_monotonic_time() - start;
     }
+  }
+  tcp_trace_span("fanout", start);
+  tcp_trace_add(tcp_trace_current(), "weather", start,
+                start + requests[0].elapsed);
+  tcp_trace_add(tcp_trace_current(), "horoscope", start,
+                start + requests[1].elapsed);
+  if (horoscope_forwarded != forwarded) {
+    g_string_free(horoscope_forwarded, TRUE);
+  }
+  g_string_free(forwarded, TRUE);
 
-    if (hc_thread != NULL) {
-      horoscope_response = g_thread_join(hc_thread);
-      printf("Datos del horóscopo recibidos:\n%s\n", horoscope_response);
+  /* Con un servidor fuera de servicio, no registrar cada consulta */
+  for (size_t i = 0; i < G_N_ELEMENTS(requests); i++) {
+    if (requests[i].error != NULL) {
+      tcp_log(g_error_matches(requests[i].error, TCP_BALANCER_ERROR,
+                              TCP_BALANCER_OPEN_ERROR)
+              ? TCP_LOG_DEBUG : TCP_LOG_ERROR,
+              "%s", requests[i].error->message);
+      g_clear_error(&requests[i].error);
     }
   }
 
-  /* Armar y enviar respuesta */
-  send_len = sprintf(send_buf, "{\"clima\":%s,\"horoscopo\":%s}",
-                     weather_response != NULL ? weather_response : "null",
-                     horoscope_response != NULL ? horoscope_response : "null");
+  weather_response = requests[0].response;
+  if (weather_response != NULL && sampled) {
+    tcp_log(TCP_LOG_INFO, "Datos del clima recibidos:\n%s", weather_response);
+  }
+
+  horoscope_response = requests[1].response;
+  if (horoscope_response != NULL && sampled) {
+    tcp_log(TCP_LOG_INFO, "Datos del horóscopo recibidos:\n%s",
+            horoscope_response);
+  }
+
+  /* Armar respuesta */
+  start = g_get_monotonic_time();
+  tcp_server_reply_printf(reply, "{\"clima\":%s,\"horoscopo\":%s}",
+                          weather_response != NULL ? weather_response : "null",
+                          horoscope_response != NULL ? horoscope_response : "null");
+  tcp_trace_span("serialize", start);
+
+  /* Guardar la respuesta mientras sean válidos los datos de ambos servidores */
+  if (cache != NULL && key != NULL
+      && weather_response != NULL && horoscope_response != NULL) {
+    ttl = MIN(response_ttl(weather_response, strlen(weather_response)),
+              response_ttl(horoscope_response, strlen(horoscope_response)));
+    if (ttl > 0) {
+      reply_data = tcp_server_reply_get_data(reply, &reply_len);
+      cached = g_bytes_new(reply_data, reply_len);
+      tcp_cache_insert(cache, key, cached, ttl * 1000);
+      g_bytes_unref(cached);
+    }
+  }
+
+  g_free(key);
   g_free(weather_response);
   g_free(horoscope_response);
-  send(connfd, send_buf, send_len, 0);
 }
 
 int main(int argc, char **argv)
 {
-  GError         *error = NULL;
-  GOptionContext *context;
-  TcpServer      *server;
+  GError            *error = NULL;
+  GOptionContext    *context;
+  TcpServer         *server;
+  TcpServerMode      mode;
+  TcpServerAffinity  affinity;
+  TcpFraming         framing;
+  TcpFraming         backend_framing;
+  TcpBalancePolicy   balance;
+  unsigned int       eject_errors, eject_duration;
+  unsigned int       breaker_failures, breaker_duration;
+  TcpLogLevel        log_level;
+  unsigned int       read_timeout, write_timeout, total_timeout;
 
   context = g_option_context_new(SRV_INFO);
   g_option_context_add_main_entries(context, options, NULL);
@@ -267,26 +1708,179 @@ int main(int argc, char **argv)
     return EXIT_FAILURE;
   }
 
-  if (port <= 1024 || weather_port <= 1024 || horoscope_port <= 1024) {
+  if (port <= 1024 || port > G_MAXUINT16
+      || weather_port <= 1024 || weather_port > G_MAXUINT16
+      || horoscope_port <= 1024 || horoscope_port > G_MAXUINT16) {
     fprintf(stderr, "Los puertos deben ser mayor a 1024\n");
     return EXIT_FAILURE;
   }
 
+  if (!tcp_server_mode_parse(mode_name, &mode)) {
+    fprintf(stderr, "Modo de servidor desconocido: %s\n", mode_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_server_affinity_parse(affinity_name, &affinity)) {
+    fprintf(stderr, "Afinidad de hilos desconocida: %s\n", affinity_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(framing_name, &framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            framing_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(backend_framing_name, &backend_framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            backend_framing_name);
+    return EXIT_FAILURE;
+  }
+
+  if (g_ascii_strcasecmp(backend_protocol_name, "binary") == 0) {
+    backend_binary = true;
+  } else if (g_ascii_strcasecmp(backend_protocol_name, "json") != 0) {
+    fprintf(stderr, "Protocolo desconocido: %s\n", backend_protocol_name);
+    return EXIT_FAILURE;
+  }
+
+  /* Los mensajes binarios pueden tener saltos de línea */
+  backend_wire = backend_framing != TCP_FRAMING_NDJSON;
+  if (backend_binary && !backend_wire) {
+    fprintf(stderr, "El protocolo binario no admite delimitar los mensajes con ndjson\n");
+    return EXIT_FAILURE;
+  }
+
+  if (backend_pool < -1) {
+    fprintf(stderr, "Las conexiones con los servidores del clima y horóscopo deben ser mayor o igual a -1\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_balance_policy_parse(balance_name, &balance)) {
+    fprintf(stderr, "Política de elección de réplicas desconocida: %s\n",
+            balance_name);
+    return EXIT_FAILURE;
+  }
+
+  if (hedge < 0 || hedge >= 100) {
+    fprintf(stderr, "El percentil para enviar copias debe ser mayor o igual a 0 y menor a 100\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_balancer_ejection_parse(ejection_text, &eject_errors,
+                                   &eject_duration)) {
+    fprintf(stderr, "Parámetros de salida de la rotación inválidos: %s\n",
+            ejection_text);
+    return EXIT_FAILURE;
+  }
+
+  if (deadline < 0) {
+    fprintf(stderr, "El plazo de respuesta debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_balancer_breaker_parse(breaker_text, &breaker_failures,
+                                  &breaker_duration)) {
+    fprintf(stderr, "Parámetros de consultas fallidas inválidos: %s\n",
+            breaker_text);
+    return EXIT_FAILURE;
+  }
+
+  if (cache_size < 0) {
+    fprintf(stderr, "La cantidad de respuestas en caché debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (max_inflight < 0) {
+    fprintf(stderr, "El límite de solicitudes en curso debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_server_deadlines_parse(deadlines_text, &read_timeout,
+                                  &write_timeout, &total_timeout)) {
+    fprintf(stderr, "Plazos de conexión inválidos: %s\n", deadlines_text);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_log_level_parse(log_level_name, &log_level)) {
+    fprintf(stderr, "Nivel de registro desconocido: %s\n", log_level_name);
+    return EXIT_FAILURE;
+  }
+
+  if (log_sample < 0) {
+    fprintf(stderr, "El muestreo del registro debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (admin_port != 0 && (admin_port <= 1024 || admin_port > G_MAXUINT16)) {
+    fprintf(stderr, "El puerto de métricas debe ser 0 o mayor a 1024\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_slow < 0) {
+    fprintf(stderr, "La duración mínima de las trazas debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_path != NULL
+      && !tcp_trace_set_output("server", trace_path, trace_slow)) {
+    return EXIT_FAILURE;
+  }
+
+  tcp_log_set_level(log_level);
+  tcp_log_set_sampling(log_sample);
+
   if (max_threads == 0) {
     max_threads = g_get_num_processors();
   }
 
-  printf("Iniciando %s...\n", SRV_NAME);
-  weather_client = tcp_client_new(weather_host, weather_port);
-  horoscope_client = tcp_client_new(horoscope_host, horoscope_port);
-  server = tcp_server_new_full(addr, port, max_conn, max_threads, exclusive);
+  if (backend_pool == 0) {
+    backend_pool = backend_pool_size(backend_framing);
+  }
+
+  tcp_log(TCP_LOG_INFO, "Iniciando %s...", SRV_NAME);
+  weather_backend = backend_new(weather_host, weather_port, backend_framing,
+                                MAX(backend_pool, 0), balance);
+  horoscope_backend = backend_new(horoscope_host, horoscope_port,
+                                  backend_framing, MAX(backend_pool, 0),
+                                  balance);
+  if (weather_backend == NULL || horoscope_backend == NULL) {
+    return EXIT_FAILURE;
+  }
+  tcp_balancer_set_hedging(weather_backend, hedge);
+  tcp_balancer_set_hedging(horoscope_backend, hedge);
+  tcp_balancer_set_ejection(weather_backend, eject_errors, eject_duration);
+  tcp_balancer_set_ejection(horoscope_backend, eject_errors, eject_duration);
+  tcp_balancer_set_breaker(weather_backend, breaker_failures, breaker_duration);
+  tcp_balancer_set_breaker(horoscope_backend, breaker_failures,
+                           breaker_duration);
+  tcp_balancer_set_metrics(weather_backend, "weather");
+  tcp_balancer_set_metrics(horoscope_backend, "horoscope");
+  weather_flights.coalesced = tcp_metrics_counter("backend.weather.coalesced");
+  horoscope_flights.coalesced = tcp_metrics_counter("backend.horoscope.coalesced");
+  if (cache_size > 0) {
+    cache = tcp_cache_new(g_get_num_processors(), cache_size);
+    tcp_cache_set_metrics(cache, "replies");
+  }
+  server = tcp_server_new_full(addr, port, max_conn, max_threads, exclusive,
+                               mode);
+  tcp_server_set_unix_path(server, unix_path);
+  tcp_server_set_shards(server, shards, affinity);
+  tcp_server_set_framing(server, framing, SRV_IDLE_TIMEOUT);
+  tcp_server_set_deadlines(server, read_timeout, write_timeout, total_timeout);
+  tcp_server_set_workers(server, workers);
+  tcp_server_set_limit(server, max_inflight);
+  tcp_server_set_admin_port(server, admin_port);
   tcp_server_run(server, serve, NULL, &error);
   tcp_server_free(server);
-  tcp_client_free(weather_client);
-  tcp_client_free(horoscope_client);
+  tcp_balancer_free(weather_backend);
+  tcp_balancer_free(horoscope_backend);
+  if (cache != NULL) {
+    tcp_cache_free(cache);
+  }
 
   if (error != NULL) {
-    fprintf(stderr, "%s\n", error->message);
+    tcp_log(TCP_LOG_ERROR, "%s", error->message);
     g_error_free(error);
     return EXIT_FAILURE;
   }
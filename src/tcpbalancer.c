@@ -0,0 +1,762 @@
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcpbalancer.h"
+#include "tcplog.h"
+#include "tcpmetrics.h"
+
+/* Duraciones recientes de cada réplica para calcular el percentil */
+#define LATENCY_WINDOW  256
+/* Duraciones necesarias antes de enviar copias a otra réplica */
+#define LATENCY_MIN     16
+/* Tiempo entre cálculos del percentil de cada réplica (microsegundos) */
+#define HEDGE_REFRESH   100000
+/* Intentos por solicitud: el primero y una copia o reintento */
+#define ATTEMPTS_MAX    2
+
+/** Réplica de un servidor */
+typedef struct
+{
+  /** @privatesection */
+  TcpClient *client;
+  unsigned   index;
+  unsigned   outstanding;
+  unsigned   errors;
+  gint64     ejected_until;
+  gint64     latencies[LATENCY_WINDOW];
+  unsigned   n_latencies;
+  unsigned   next_latency;
+  gint64     hedge_delay;
+  gint64     hedge_updated;
+} TcpReplica;
+
+/** Réplicas de un servidor TCP */
+struct TcpBalancer
+{
+  /** @privatesection */
+  GMutex            lock;
+  GCond             cond;
+  TcpBalancePolicy  policy;
+  GPtrArray        *replicas;
+  unsigned          running;
+  double            hedge_percentile;
+  unsigned          eject_errors;
+  gint64            eject_time;
+  unsigned          breaker_failures;
+  gint64            breaker_time;
+  unsigned          failures;
+  gint64            open_until;
+  bool              probing;
+  TcpHistogram     *latency;
+  TcpCounter       *errors;
+  TcpCounter       *hedges;
+  TcpCounter       *ejections;
+  TcpCounter       *timeouts;
+  TcpCounter       *trips;
+  TcpCounter       *rejections;
+};
+
+/** Estado de una solicitud de tcp_balancer_request_all() */
+typedef struct
+{
+  /** @privatesection */
+  TcpBalancerRequest *request;
+  TcpReplica         *first;
+  gint64              start;
+  gint64              hedge_at;
+  unsigned            attempts;
+  unsigned            running;
+  bool                retry;
+  bool                done;
+  GError             *error;
+} TcpBalancerSlot;
+
+/** Solicitudes de una llamada a tcp_balancer_request_all() */
+typedef struct
+{
+  /** @privatesection */
+  GMutex           lock;
+  GCond            cond;
+  int              refs;
+  size_t           pending;
+  TcpBalancerSlot *slots;
+} TcpBalancerBatch;
+
+/** Envío de una solicitud a una réplica */
+typedef struct
+{
+  /** @privatesection */
+  TcpClientRequest  call;
+  char             *data;
+  TcpBalancer      *balancer;
+  TcpReplica       *replica;
+  TcpBalancerBatch *batch;
+  size_t            index;
+} TcpBalancerAttempt;
+
+/* Define el dominio de errores TCP_BALANCER_ERROR */
+G_DEFINE_QUARK(tcp-balancer-error, tcp_balancer_error)
+
+/* Mensajes de error */
+static const char *error_messages[] = {
+  [TCP_BALANCER_NO_REPLICA_ERROR] = "No hay réplicas del servidor",
+  [TCP_BALANCER_TIMEOUT_ERROR]    = "Plazo de la solicitud vencido",
+  [TCP_BALANCER_OPEN_ERROR]       = "Servidor no disponible luego de varios errores",
+};
+
+bool tcp_balance_policy_parse(const char *name, TcpBalancePolicy *policy)
+{
+  g_return_val_if_fail(name != NULL, false);
+  g_return_val_if_fail(policy != NULL, false);
+
+  if (g_ascii_strcasecmp(name, "least") == 0) {
+    *policy = TCP_BALANCE_LEAST;
+  } else if (g_ascii_strcasecmp(name, "p2c") == 0) {
+    *policy = TCP_BALANCE_P2C;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+bool tcp_balancer_ejection_parse(const char   *text,
+                                 unsigned int *errors,
+                                 unsigned int *duration)
+{
+  char extra;
+
+  g_return_val_if_fail(text != NULL, false);
+  g_return_val_if_fail(errors != NULL, false);
+  g_return_val_if_fail(duration != NULL, false);
+
+  return strchr(text, '-') == NULL
+      && sscanf(text, "%u,%u%c", errors, duration, &extra) == 2;
+}
+
+bool tcp_balancer_breaker_parse(const char   *text,
+                                unsigned int *failures,
+                                unsigned int *duration)
+{
+  return tcp_balancer_ejection_parse(text, failures, duration);
+}
+
+static void replica_free(void *data)
+{
+  TcpReplica *replica = (TcpReplica*)data;
+
+  tcp_client_free(replica->client);
+  g_free(replica);
+}
+
+TcpBalancer *tcp_balancer_new(TcpBalancePolicy policy)
+{
+  TcpBalancer *balancer = g_new0(TcpBalancer, 1);
+
+  g_mutex_init(&balancer->lock);
+  g_cond_init(&balancer->cond);
+  balancer->policy = policy;
+  balancer->replicas = g_ptr_array_new_with_free_func(replica_free);
+
+  return balancer;
+}
+
+void tcp_balancer_add(TcpBalancer *balancer, TcpClient *client)
+{
+  TcpReplica *replica;
+
+  g_return_if_fail(balancer != NULL);
+  g_return_if_fail(client != NULL);
+
+  replica = g_new0(TcpReplica, 1);
+  replica->client = client;
+  replica->index = balancer->replicas->len;
+  g_ptr_array_add(balancer->replicas, replica);
+}
+
+void tcp_balancer_set_hedging(TcpBalancer *balancer, double percentile)
+{
+  g_return_if_fail(balancer != NULL);
+
+  balancer->hedge_percentile = CLAMP(percentile, 0, 100);
+}
+
+void tcp_balancer_set_ejection(TcpBalancer  *balancer,
+                               unsigned int  errors,
+                               unsigned int  duration)
+{
+  g_return_if_fail(balancer != NULL);
+
+  balancer->eject_errors = errors;
+  balancer->eject_time = (gint64)duration * 1000;
+}
+
+void tcp_balancer_set_breaker(TcpBalancer  *balancer,
+                              unsigned int  failures,
+                              unsigned int  duration)
+{
+  g_return_if_fail(balancer != NULL);
+
+  balancer->breaker_failures = failures;
+  balancer->breaker_time = (gint64)duration * 1000;
+}
+
+void tcp_balancer_set_metrics(TcpBalancer *balancer, const char *name)
+{
+  TcpReplica *replica;
+  char *metric;
+
+  g_return_if_fail(balancer != NULL);
+  g_return_if_fail(name != NULL);
+
+  metric = g_strdup_printf("backend.%s.latency_us", name);
+  balancer->latency = tcp_metrics_histogram(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.errors", name);
+  balancer->errors = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.hedges", name);
+  balancer->hedges = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.ejections", name);
+  balancer->ejections = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.timeouts", name);
+  balancer->timeouts = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.breaker_trips", name);
+  balancer->trips = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.breaker_rejections", name);
+  balancer->rejections = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  for (unsigned int i = 0; i < balancer->replicas->len; i++) {
+    replica = g_ptr_array_index(balancer->replicas, i);
+    metric = g_strdup_printf("%s.%u", name, i);
+    tcp_client_set_metrics(replica->client, metric);
+    g_free(metric);
+  }
+}
+
+static bool replica_available(TcpReplica *replica,
+                              TcpReplica *exclude,
+                              gint64      now,
+                              bool        ejected)
+{
+  return replica != exclude && (ejected || replica->ejected_until <= now);
+}
+
+static TcpReplica *pick_available(TcpBalancer *balancer,
+                                  TcpReplica  *exclude,
+                                  gint64       now,
+                                  bool         ejected)
+{
+  TcpReplica *replica, *best = NULL, *second = NULL;
+  unsigned int n = 0, offset, choice[2];
+
+  for (unsigned int i = 0; i < balancer->replicas->len; i++) {
+    replica = g_ptr_array_index(balancer->replicas, i);
+    if (replica_available(replica, exclude, now, ejected)) {
+      n++;
+    }
+  }
+  if (n == 0) {
+    return NULL;
+  }
+
+  if (balancer->policy == TCP_BALANCE_P2C && n > 2) {
+    /* Dos réplicas distintas al azar, por su posición entre las disponibles */
+    choice[0] = g_random_int_range(0, n);
+    choice[1] = (choice[0] + g_random_int_range(1, n)) % n;
+    n = 0;
+    for (unsigned int i = 0; i < balancer->replicas->len; i++) {
+      replica = g_ptr_array_index(balancer->replicas, i);
+      if (!replica_available(replica, exclude, now, ejected)) {
+        continue;
+      }
+      if (n == choice[0]) {
+        best = replica;
+      } else if (n == choice[1]) {
+        second = replica;
+      }
+      n++;
+    }
+
+    return second->outstanding < best->outstanding ? second : best;
+  }
+
+  /* Con empates, empezar por una réplica al azar para repartir la carga */
+  offset = balancer->replicas->len > 1
+    ? g_random_int_range(0, balancer->replicas->len) : 0;
+  for (unsigned int i = 0; i < balancer->replicas->len; i++) {
+    replica = g_ptr_array_index(balancer->replicas,
+                                (i + offset) % balancer->replicas->len);
+    if (replica_available(replica, exclude, now, ejected)
+        && (best == NULL || replica->outstanding < best->outstanding)) {
+      best = replica;
+    }
+  }
+
+  return best;
+}
+
+static TcpReplica *balancer_pick(TcpBalancer *balancer, TcpReplica *exclude)
+{
+  gint64 now = g_get_monotonic_time();
+  TcpReplica *replica;
+
+  /* Si todas están fuera de la rotación, se usan igual */
+  replica = pick_available(balancer, exclude, now, false);
+  if (replica == NULL) {
+    replica = pick_available(balancer, exclude, now, true);
+  }
+
+  if (replica != NULL) {
+    replica->outstanding++;
+    balancer->running++;
+  }
+
+  return replica;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+  gint64 x = *(const gint64*)a;
+  gint64 y = *(const gint64*)b;
+
+  return (x > y) - (x < y);
+}
+
+static gint64 replica_hedge_delay(TcpBalancer *balancer,
+                                  TcpReplica  *replica,
+                                  gint64       now)
+{
+  gint64 sorted[LATENCY_WINDOW];
+  unsigned int rank;
+
+  if (balancer->hedge_percentile <= 0
+      || balancer->replicas->len < 2
+      || replica->n_latencies < LATENCY_MIN) {
+    return 0;
+  }
+
+  /* El percentil se recalcula cada tanto, no en cada solicitud */
+  if (now - replica->hedge_updated >= HEDGE_REFRESH) {
+    memcpy(sorted, replica->latencies, replica->n_latencies * sizeof(gint64));
+    qsort(sorted, replica->n_latencies, sizeof(gint64), compare_latency);
+    rank = balancer->hedge_percentile / 100 * replica->n_latencies;
+    replica->hedge_delay = sorted[MIN(rank, replica->n_latencies - 1)];
+    replica->hedge_updated = now;
+  }
+
+  return replica->hedge_delay;
+}
+
+static void replica_done(TcpBalancer *balancer,
+                         TcpReplica  *replica,
+                         gint64       elapsed,
+                         bool         failed)
+{
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&balancer->lock);
+
+  replica->outstanding--;
+  if (!failed) {
+    /* Las respuestas en partes no tienen una duración comparable (-1) */
+    replica->errors = 0;
+    if (elapsed >= 0) {
+      replica->latencies[replica->next_latency] = elapsed;
+      replica->next_latency = (replica->next_latency + 1) % LATENCY_WINDOW;
+      replica->n_latencies = MIN(replica->n_latencies + 1, LATENCY_WINDOW);
+    }
+  } else if (balancer->eject_errors > 0
+             && ++replica->errors >= balancer->eject_errors
+             && replica->ejected_until <= now) {
+    /* Sacar la réplica de la rotación hasta que pase el tiempo indicado */
+    replica->errors = 0;
+    replica->ejected_until = now + balancer->eject_time;
+    tcp_counter_add(balancer->ejections, 1);
+    tcp_log(TCP_LOG_WARNING,
+            "Réplica %u fuera de la rotación por %u ms luego de %u errores seguidos",
+            replica->index, (unsigned int)(balancer->eject_time / 1000),
+            balancer->eject_errors);
+  }
+
+  if (--balancer->running == 0) {
+    g_cond_broadcast(&balancer->cond);
+  }
+
+  g_mutex_unlock(&balancer->lock);
+}
+
+static bool breaker_allow(TcpBalancer *balancer, gint64 now)
+{
+  bool allow = true;
+
+  g_mutex_lock(&balancer->lock);
+
+  if (balancer->breaker_failures > 0
+      && balancer->failures >= balancer->breaker_failures) {
+    /* Abierto hasta que pase el tiempo indicado, y luego una sola prueba */
+    allow = now >= balancer->open_until && !balancer->probing;
+    balancer->probing = balancer->probing || allow;
+  }
+
+  g_mutex_unlock(&balancer->lock);
+
+  if (!allow) {
+    tcp_counter_add(balancer->rejections, 1);
+  }
+
+  return allow;
+}
+
+static void breaker_done(TcpBalancer *balancer, bool failed)
+{
+  g_mutex_lock(&balancer->lock);
+
+  if (!failed) {
+    balancer->failures = 0;
+    balancer->probing = false;
+  } else if (balancer->breaker_failures > 0
+             && (++balancer->failures == balancer->breaker_failures
+                 || balancer->probing)) {
+    /* Fallar en el acto hasta que pase el tiempo indicado */
+    balancer->failures = MAX(balancer->failures, balancer->breaker_failures);
+    balancer->open_until = g_get_monotonic_time() + balancer->breaker_time;
+    balancer->probing = false;
+    tcp_counter_add(balancer->trips, 1);
+    tcp_log(TCP_LOG_WARNING,
+            "Servidor fuera de servicio por %u ms luego de %u errores seguidos",
+            (unsigned int)(balancer->breaker_time / 1000),
+            balancer->breaker_failures);
+  }
+
+  g_mutex_unlock(&balancer->lock);
+}
+
+static void batch_unref(TcpBalancerBatch *batch)
+{
+  if (g_atomic_int_dec_and_test(&batch->refs)) {
+    g_mutex_clear(&batch->lock);
+    g_cond_clear(&batch->cond);
+    g_free(batch->slots);
+    g_free(batch);
+  }
+}
+
+static void slot_finish(TcpBalancerBatch *batch,
+                        TcpBalancerSlot  *slot,
+                        char             *response,
+                        size_t            response_len,
+                        GError           *error)
+{
+  TcpBalancerRequest *request = slot->request;
+
+  request->response = response;
+  request->response_len = response_len;
+  request->error = error;
+  request->elapsed = g_get_monotonic_time() - slot->start;
+
+  tcp_histogram_record(request->balancer->latency, request->elapsed);
+  if (error != NULL) {
+    tcp_counter_add(request->balancer->errors, 1);
+  }
+  if (g_error_matches(error, TCP_BALANCER_ERROR, TCP_BALANCER_TIMEOUT_ERROR)) {
+    tcp_counter_add(request->balancer->timeouts, 1);
+  }
+
+  /* Las solicitudes sin intentos no dicen nada del estado del servidor */
+  if (slot->attempts > 0) {
+    breaker_done(request->balancer, error != NULL);
+  }
+
+  slot->done = true;
+  batch->pending--;
+  g_cond_signal(&batch->cond);
+}
+
+static void attempt_done(TcpClientRequest *call, void *data)
+{
+  TcpBalancerAttempt *attempt = (TcpBalancerAttempt*)data;
+  TcpBalancerBatch *batch = attempt->batch;
+  TcpBalancerSlot *slot = &batch->slots[attempt->index];
+
+  replica_done(attempt->balancer, attempt->replica, call->elapsed,
+               call->error != NULL);
+
+  g_mutex_lock(&batch->lock);
+  slot->running--;
+
+  if (slot->done) {
+    /* Ya respondió otra réplica */
+  } else if (call->error == NULL) {
+    slot_finish(batch, slot, call->response, call->response_len, NULL);
+    call->response = NULL;
+    g_clear_error(&slot->error);
+  } else if (slot->running > 0) {
+    /* La respuesta de la otra réplica decide */
+  } else if (slot->attempts < ATTEMPTS_MAX) {
+    /* Reintentar en otra réplica desde el hilo que espera */
+    g_clear_error(&slot->error);
+    slot->error = call->error;
+    call->error = NULL;
+    slot->retry = true;
+    g_cond_signal(&batch->cond);
+  } else {
+    slot_finish(batch, slot, NULL, 0, call->error);
+    call->error = NULL;
+  }
+
+  g_mutex_unlock(&batch->lock);
+
+  g_free(call->response);
+  g_clear_error(&call->error);
+  batch_unref(batch);
+  g_free(attempt->data);
+  g_free(attempt);
+}
+
+static bool attempt_start(TcpBalancerBatch *batch,
+                          size_t            index,
+                          TcpReplica       *exclude)
+{
+  TcpBalancerSlot *slot = &batch->slots[index];
+  TcpBalancer *balancer = slot->request->balancer;
+  TcpBalancerAttempt *attempt;
+  TcpReplica *replica;
+
+  g_mutex_lock(&balancer->lock);
+  replica = balancer_pick(balancer, exclude);
+  if (replica != NULL && exclude == NULL) {
+    slot->first = replica;
+    slot->hedge_at = replica_hedge_delay(balancer, replica, slot->start);
+    if (slot->hedge_at > 0) {
+      slot->hedge_at += slot->start;
+    }
+  }
+  g_mutex_unlock(&balancer->lock);
+
+  if (replica == NULL) {
+    return false;
+  }
+
+  /* La copia puede seguir en curso cuando la solicitud ya se respondió */
+  attempt = g_new0(TcpBalancerAttempt, 1);
+  attempt->data = g_memdup2(slot->request->request, slot->request->length);
+  attempt->call.client = replica->client;
+  attempt->call.request = attempt->data;
+  attempt->call.length = slot->request->length;
+  attempt->call.deadline = slot->request->deadline;
+  attempt->balancer = balancer;
+  attempt->replica = replica;
+  attempt->batch = batch;
+  attempt->index = index;
+
+  g_mutex_lock(&batch->lock);
+  slot->attempts++;
+  slot->running++;
+  g_mutex_unlock(&batch->lock);
+
+  g_atomic_int_inc(&batch->refs);
+  tcp_client_start(&attempt->call, attempt_done, attempt);
+
+  return true;
+}
+
+void tcp_balancer_request_all(TcpBalancerRequest *requests, size_t n_requests)
+{
+  TcpBalancerBatch *batch;
+  TcpBalancerSlot *slot;
+  TcpBalancerError code;
+  gint64 now, wake;
+  bool retry, started;
+  GError *error;
+
+  g_return_if_fail(requests != NULL || n_requests == 0);
+
+  if (n_requests == 0) {
+    return;
+  }
+
+  batch = g_new0(TcpBalancerBatch, 1);
+  g_mutex_init(&batch->lock);
+  g_cond_init(&batch->cond);
+  batch->refs = 1;
+  batch->pending = n_requests;
+  batch->slots = g_new0(TcpBalancerSlot, n_requests);
+
+  for (size_t i = 0; i < n_requests; i++) {
+    requests[i].response = NULL;
+    requests[i].response_len = 0;
+    requests[i].error = NULL;
+    requests[i].elapsed = 0;
+    batch->slots[i].request = &requests[i];
+    batch->slots[i].start = g_get_monotonic_time();
+  }
+
+  for (size_t i = 0; i < n_requests; i++) {
+    slot = &batch->slots[i];
+    now = slot->start;
+    if (requests[i].deadline > 0 && requests[i].deadline <= now) {
+      /* La solicitud ya venció: no enviarla */
+      code = TCP_BALANCER_TIMEOUT_ERROR;
+    } else if (!breaker_allow(requests[i].balancer, now)) {
+      code = TCP_BALANCER_OPEN_ERROR;
+    } else if (!attempt_start(batch, i, NULL)) {
+      code = TCP_BALANCER_NO_REPLICA_ERROR;
+    } else {
+      continue;
+    }
+
+    g_mutex_lock(&batch->lock);
+    slot_finish(batch, slot, NULL, 0,
+                g_error_new_literal(TCP_BALANCER_ERROR, code,
+                                    error_messages[code]));
+    g_mutex_unlock(&batch->lock);
+  }
+
+  g_mutex_lock(&batch->lock);
+
+  while (batch->pending > 0) {
+    now = g_get_monotonic_time();
+    wake = G_MAXINT64;
+
+    for (size_t i = 0; i < n_requests; i++) {
+      slot = &batch->slots[i];
+      if (slot->done) {
+        continue;
+      }
+
+      /* Responder con error al vencer el plazo, sin esperar a las réplicas */
+      if (slot->request->deadline > 0 && slot->request->deadline <= now) {
+        g_clear_error(&slot->error);
+        slot_finish(batch, slot, NULL, 0,
+                    g_error_new_literal(TCP_BALANCER_ERROR,
+                                        TCP_BALANCER_TIMEOUT_ERROR,
+                                        error_messages[TCP_BALANCER_TIMEOUT_ERROR]));
+        continue;
+      }
+
+      /* Enviar la copia o el reintento a otra réplica */
+      retry = slot->retry;
+      if (retry || (slot->hedge_at > 0 && slot->hedge_at <= now
+                    && slot->attempts < ATTEMPTS_MAX)) {
+        slot->retry = false;
+        slot->hedge_at = 0;
+        g_mutex_unlock(&batch->lock);
+        started = attempt_start(batch, i, slot->first);
+        if (started) {
+          tcp_counter_add(slot->request->balancer->hedges, 1);
+        }
+        g_mutex_lock(&batch->lock);
+
+        /* Sin otra réplica, el error del primer intento es el resultado */
+        if (!started && retry && !slot->done) {
+          error = slot->error;
+          slot->error = NULL;
+          slot_finish(batch, slot, NULL, 0, error);
+        }
+        now = g_get_monotonic_time();
+      }
+
+      if (!slot->done && slot->hedge_at > 0) {
+        wake = MIN(wake, slot->hedge_at);
+      }
+      if (!slot->done && slot->request->deadline > 0) {
+        wake = MIN(wake, slot->request->deadline);
+      }
+    }
+
+    if (batch->pending == 0) {
+      break;
+    }
+    if (wake == G_MAXINT64) {
+      g_cond_wait(&batch->cond, &batch->lock);
+    } else {
+      g_cond_wait_until(&batch->cond, &batch->lock, wake);
+    }
+  }
+
+  /* Las copias que siguen en curso liberan el lote al terminar */
+  for (size_t i = 0; i < n_requests; i++) {
+    g_clear_error(&batch->slots[i].error);
+  }
+
+  g_mutex_unlock(&batch->lock);
+  batch_unref(batch);
+}
+
+bool tcp_balancer_stream(TcpBalancer          *balancer,
+                         const char           *request,
+                         size_t                length,
+                         TcpClientStreamFunc   func,
+                         void                 *data,
+                         GError              **error)
+{
+  g_return_val_if_fail(balancer != NULL, false);
+  g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+  TcpBalancerError code;
+  TcpReplica *replica;
+  GError *stream_error = NULL;
+  bool done;
+
+  if (!breaker_allow(balancer, g_get_monotonic_time())) {
+    code = TCP_BALANCER_OPEN_ERROR;
+    g_set_error_literal(error, TCP_BALANCER_ERROR, code, error_messages[code]);
+    return false;
+  }
+
+  g_mutex_lock(&balancer->lock);
+  replica = balancer_pick(balancer, NULL);
+  g_mutex_unlock(&balancer->lock);
+
+  if (replica == NULL) {
+    code = TCP_BALANCER_NO_REPLICA_ERROR;
+    g_set_error_literal(error, TCP_BALANCER_ERROR, code, error_messages[code]);
+    breaker_done(balancer, true);
+    return false;
+  }
+
+  /* Sin copias ni reintentos: la función pudo recibir parte de la respuesta */
+  done = tcp_client_stream(replica->client, request, length, func, data,
+                           &stream_error);
+  replica_done(balancer, replica, -1, !done);
+  breaker_done(balancer, !done);
+
+  if (!done) {
+    tcp_counter_add(balancer->errors, 1);
+    g_propagate_error(error, stream_error);
+  }
+
+  return done;
+}
+
+void tcp_balancer_free(TcpBalancer *balancer)
+{
+  g_return_if_fail(balancer != NULL);
+
+  /* Esperar las copias que siguen en curso */
+  g_mutex_lock(&balancer->lock);
+  while (balancer->running > 0) {
+    g_cond_wait(&balancer->cond, &balancer->lock);
+  }
+  g_mutex_unlock(&balancer->lock);
+
+  g_ptr_array_free(balancer->replicas, TRUE);
+  g_mutex_clear(&balancer->lock);
+  g_cond_clear(&balancer->cond);
+  g_free(balancer);
+}
@@ -0,0 +1,214 @@
+/**
+ * @file tcpbalancer.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Balanceo de solicitudes entre réplicas de un servidor TCP
+ * @version 0.1
+ * @date 2023-04-21
+ *
+ * Un balanceador reparte las solicitudes entre varias réplicas del mismo
+ * servidor, cada una con su propio TcpClient. Cada solicitud se envía a la
+ * réplica con menos solicitudes en curso (TCP_BALANCE_LEAST), o a la que tiene
+ * menos entre dos elegidas al azar (TCP_BALANCE_P2C, "power of two choices").
+ *
+ * Con tcp_balancer_set_hedging(), si una réplica no responde en el percentil
+ * dado de sus últimas duraciones, se envía una copia de la solicitud a otra
+ * réplica y se usa la primera respuesta que llegue. Si una réplica falla, la
+ * solicitud se reintenta de la misma forma en otra réplica.
+ *
+ * Con tcp_balancer_set_ejection(), una réplica que falla varias veces seguidas
+ * se saca de la rotación por un tiempo. Si todas las réplicas están fuera de
+ * la rotación, se usan igual.
+ *
+ * Con tcp_balancer_set_breaker(), si fallan varias solicitudes seguidas al
+ * servidor (en todas sus réplicas), las siguientes fallan en el acto por un
+ * tiempo, sin consultarlo ("circuit breaker"). Luego se envía una sola
+ * solicitud de prueba: si responde, se vuelve a consultar normalmente.
+ *
+ * Cada solicitud puede tener un plazo: al vencer, se responde con error sin
+ * esperar a las réplicas, y las copias en curso se cancelan (ver
+ * tcp_client_start()).
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tcpclient.h"
+
+/** Dominio de errores del balanceador */
+#define TCP_BALANCER_ERROR (tcp_balancer_error_quark())
+
+/** Errores del balanceador, además de los de TcpClient */
+typedef enum
+{
+  TCP_BALANCER_NO_REPLICA_ERROR,
+  TCP_BALANCER_TIMEOUT_ERROR,
+  TCP_BALANCER_OPEN_ERROR,
+} TcpBalancerError;
+
+/** Políticas de elección de réplicas */
+typedef enum
+{
+  TCP_BALANCE_LEAST, /**< La réplica con menos solicitudes en curso */
+  TCP_BALANCE_P2C,   /**< La de menos solicitudes en curso entre dos al azar */
+} TcpBalancePolicy;
+
+/** Réplicas de un servidor TCP */
+typedef struct TcpBalancer TcpBalancer;
+
+/** Solicitud a un servidor TCP para tcp_balancer_request_all() */
+typedef struct
+{
+  TcpBalancer *balancer;     /**< Réplicas del servidor a consultar */
+  const char  *request;      /**< Datos a enviar */
+  size_t       length;       /**< Longitud de los datos a enviar */
+  char        *response;     /**< Respuesta recibida (liberar con g_free()) */
+  size_t       response_len; /**< Longitud de la respuesta */
+  GError      *error;        /**< Error de la solicitud, o NULL */
+  gint64       elapsed;      /**< Duración de la solicitud (microsegundos) */
+  gint64       deadline;     /**< Plazo (g_get_monotonic_time()), o 0 sin plazo */
+} TcpBalancerRequest;
+
+/**
+ * Obtiene la política de elección de réplicas a partir de su nombre: "least"
+ * o "p2c".
+ *
+ * @param name nombre de la política
+ * @param policy donde se guarda la política
+ * @return true si el nombre es válido, o false en caso contrario
+ */
+bool tcp_balance_policy_parse(const char *name, TcpBalancePolicy *policy);
+
+/**
+ * Obtiene los parámetros de tcp_balancer_set_ejection() a partir de un texto
+ * de la forma "ERRORES,DURACIÓN", por ejemplo "5,10000".
+ *
+ * @param text texto a analizar
+ * @param errors donde se guarda la cantidad de errores seguidos
+ * @param duration donde se guarda el tiempo fuera de la rotación
+ * (milisegundos)
+ * @return true si el texto es válido, o false en caso contrario
+ */
+bool tcp_balancer_ejection_parse(const char *text, unsigned int *errors, unsigned int *duration);
+
+/**
+ * Obtiene los parámetros de tcp_balancer_set_breaker() a partir de un texto
+ * de la forma "FALLAS,DURACIÓN", por ejemplo "20,5000".
+ *
+ * @param text texto a analizar
+ * @param failures donde se guarda la cantidad de solicitudes fallidas seguidas
+ * @param duration donde se guarda el tiempo sin consultar al servidor
+ * (milisegundos)
+ * @return true si el texto es válido, o false en caso contrario
+ */
+bool tcp_balancer_breaker_parse(const char *text, unsigned int *failures, unsigned int *duration);
+
+/**
+ * Crea un nuevo balanceador, sin réplicas.
+ *
+ * @see tcp_balancer_free()
+ * @param policy política de elección de réplicas
+ * @return puntero a TcpBalancer (debe liberarse con tcp_balancer_free() cuando
+ * ya no se utilice)
+ */
+TcpBalancer *tcp_balancer_new(TcpBalancePolicy policy);
+
+/**
+ * Agrega una réplica. Se deben agregar todas antes de enviar solicitudes.
+ *
+ * @param balancer balanceador
+ * @param client cliente de la réplica, ya configurado; se libera con el
+ * balanceador
+ */
+void tcp_balancer_add(TcpBalancer *balancer, TcpClient *client);
+
+/**
+ * Envía una copia de las solicitudes a otra réplica si la primera no responde
+ * en el percentil dado de sus últimas duraciones.
+ *
+ * @param balancer balanceador
+ * @param percentile percentil (por ejemplo, 95), o 0 para no enviar copias
+ */
+void tcp_balancer_set_hedging(TcpBalancer *balancer, double percentile);
+
+/**
+ * Saca de la rotación por un tiempo a las réplicas que fallan varias veces
+ * seguidas.
+ *
+ * @param balancer balanceador
+ * @param errors cantidad de errores seguidos, o 0 para no sacar réplicas
+ * @param duration tiempo fuera de la rotación (milisegundos)
+ */
+void tcp_balancer_set_ejection(TcpBalancer *balancer, unsigned int errors, unsigned int duration);
+
+/**
+ * Hace fallar en el acto, por un tiempo, las solicitudes al servidor luego de
+ * varias solicitudes fallidas seguidas, incluidas las que vencen su plazo. Las
+ * solicitudes rechazadas terminan con el error TCP_BALANCER_OPEN_ERROR.
+ *
+ * @param balancer balanceador
+ * @param failures cantidad de solicitudes fallidas seguidas, o 0 para no
+ * rechazar solicitudes
+ * @param duration tiempo sin consultar al servidor (milisegundos)
+ */
+void tcp_balancer_set_breaker(TcpBalancer *balancer, unsigned int failures, unsigned int duration);
+
+/**
+ * Registra las métricas del balanceador: backend.NAME.latency_us (duración de
+ * las solicitudes, incluidas las copias), backend.NAME.errors,
+ * backend.NAME.hedges (copias y reintentos enviados), backend.NAME.ejections
+ * (réplicas sacadas de la rotación), backend.NAME.timeouts (solicitudes que
+ * vencieron su plazo), backend.NAME.breaker_trips (veces que se dejó de
+ * consultar al servidor) y backend.NAME.breaker_rejections (solicitudes que
+ * fallaron en el acto). Cada réplica registra las métricas de
+ * TcpClient con el nombre NAME.N, donde N es su posición desde 0 (ver
+ * tcp_client_set_metrics()).
+ *
+ * @param balancer balanceador
+ * @param name nombre del servidor en las métricas
+ */
+void tcp_balancer_set_metrics(TcpBalancer *balancer, const char *name);
+
+/**
+ * Envía varias solicitudes en paralelo, cada una a una réplica de su
+ * balanceador, y espera todas las respuestas. Las solicitudes se inician con
+ * tcp_client_start(), y el hilo actual espera las respuestas y envía las
+ * copias y reintentos. No se espera más allá del plazo de cada solicitud, ni
+ * se envían las que ya vencieron.
+ *
+ * @param requests solicitudes a enviar, donde se guardan las respuestas
+ * @param n_requests cantidad de solicitudes
+ */
+void tcp_balancer_request_all(TcpBalancerRequest *requests, size_t n_requests);
+
+/**
+ * Envía una solicitud cuya respuesta llega en partes a una réplica del
+ * balanceador, como tcp_client_stream(). No se envían copias ni reintentos,
+ * ya que la función pudo recibir parte de la respuesta, y la duración no se
+ * tiene en cuenta para las copias de las demás solicitudes.
+ *
+ * @param balancer balanceador
+ * @param request datos a enviar
+ * @param length longitud de los datos a enviar
+ * @param func función a ejecutar con cada parte
+ * @param data parámetro adicional opcional para la función
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return true si la función recibió la última parte, false en caso de error
+ */
+bool tcp_balancer_stream(TcpBalancer *balancer, const char *request, size_t length, TcpClientStreamFunc func, void *data, GError **error);
+
+/**
+ * Libera los recursos asignados por tcp_balancer_new() y los clientes de las
+ * réplicas, luego de esperar las copias que siguen en curso.
+ *
+ * @param balancer puntero a TcpBalancer
+ */
+void tcp_balancer_free(TcpBalancer *balancer);
+
+/**
+ * Devuelve el dominio de errores del balanceador.
+ *
+ * @return el dominio de errores para utilizar con GError
+ */
+GQuark tcp_balancer_error_quark(void);
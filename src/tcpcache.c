@@ -0,0 +1,192 @@
+#include <glib.h>
+
+#include "tcpcache.h"
+#include "tcpmetrics.h"
+
+/** Respuesta guardada */
+typedef struct
+{
+  /** @privatesection */
+  GList   link;
+  char   *key;
+  GBytes *value;
+  gint64  inserted;
+  gint64  expires;
+} TcpCacheEntry;
+
+/** Partición de la caché */
+typedef struct
+{
+  /** @privatesection */
+  GMutex      lock;
+  GHashTable *entries;
+  GQueue      lru;
+} TcpCacheShard;
+
+/** Caché de respuestas */
+struct TcpCache
+{
+  /** @privatesection */
+  TcpCacheShard *shards;
+  unsigned int   n_shards;
+  unsigned int   shard_capacity;
+  TcpCounter    *hits;
+  TcpCounter    *misses;
+  TcpCounter    *evictions;
+};
+
+static void entry_free(void *data)
+{
+  TcpCacheEntry *entry = (TcpCacheEntry*)data;
+
+  g_bytes_unref(entry->value);
+  g_free(entry->key);
+  g_free(entry);
+}
+
+TcpCache *tcp_cache_new(unsigned int shards, unsigned int capacity)
+{
+  TcpCache *cache;
+
+  g_return_val_if_fail(shards > 0, NULL);
+
+  cache = g_new0(TcpCache, 1);
+  cache->n_shards = shards;
+  cache->shard_capacity = MAX((capacity + shards - 1) / shards, 1);
+  cache->shards = g_new0(TcpCacheShard, shards);
+
+  for (unsigned int i = 0; i < shards; i++) {
+    g_mutex_init(&cache->shards[i].lock);
+    g_queue_init(&cache->shards[i].lru);
+    cache->shards[i].entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                     NULL, entry_free);
+  }
+
+  return cache;
+}
+
+void tcp_cache_set_metrics(TcpCache *cache, const char *name)
+{
+  char *metric;
+
+  g_return_if_fail(cache != NULL);
+  g_return_if_fail(name != NULL);
+
+  metric = g_strdup_printf("cache.%s.hits", name);
+  cache->hits = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("cache.%s.misses", name);
+  cache->misses = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("cache.%s.evictions", name);
+  cache->evictions = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("cache.%s.hit_ratio", name);
+  tcp_metrics_ratio(metric, cache->hits, cache->misses);
+  g_free(metric);
+}
+
+static TcpCacheShard *cache_shard(TcpCache *cache, const char *key)
+{
+  return &cache->shards[g_str_hash(key) % cache->n_shards];
+}
+
+static void shard_remove(TcpCacheShard *shard, TcpCacheEntry *entry)
+{
+  g_queue_unlink(&shard->lru, &entry->link);
+  g_hash_table_remove(shard->entries, entry->key);
+}
+
+GBytes *tcp_cache_lookup(TcpCache *cache, const char *key, gint64 *age)
+{
+  TcpCacheShard *shard;
+  TcpCacheEntry *entry;
+  GBytes *value = NULL;
+  gint64 now = g_get_monotonic_time();
+
+  g_return_val_if_fail(cache != NULL, NULL);
+  g_return_val_if_fail(key != NULL, NULL);
+
+  shard = cache_shard(cache, key);
+  g_mutex_lock(&shard->lock);
+
+  entry = g_hash_table_lookup(shard->entries, key);
+  if (entry != NULL && entry->expires <= now) {
+    shard_remove(shard, entry);
+    entry = NULL;
+  }
+
+  /* La entrada encontrada pasa a ser la usada más recientemente */
+  if (entry != NULL) {
+    g_queue_unlink(&shard->lru, &entry->link);
+    g_queue_push_head_link(&shard->lru, &entry->link);
+    value = g_bytes_ref(entry->value);
+    if (age != NULL) {
+      *age = (now - entry->inserted) / 1000;
+    }
+  }
+
+  g_mutex_unlock(&shard->lock);
+  tcp_counter_add(value != NULL ? cache->hits : cache->misses, 1);
+
+  return value;
+}
+
+void tcp_cache_insert(TcpCache   *cache,
+                      const char *key,
+                      GBytes     *value,
+                      gint64      ttl)
+{
+  TcpCacheShard *shard;
+  TcpCacheEntry *entry, *old;
+
+  g_return_if_fail(cache != NULL);
+  g_return_if_fail(key != NULL);
+  g_return_if_fail(value != NULL);
+
+  if (ttl <= 0) {
+    return;
+  }
+
+  entry = g_new0(TcpCacheEntry, 1);
+  entry->link.data = entry;
+  entry->key = g_strdup(key);
+  entry->value = g_bytes_ref(value);
+  entry->inserted = g_get_monotonic_time();
+  entry->expires = entry->inserted + ttl * 1000;
+
+  shard = cache_shard(cache, key);
+  g_mutex_lock(&shard->lock);
+
+  old = g_hash_table_lookup(shard->entries, key);
+  if (old != NULL) {
+    shard_remove(shard, old);
+  }
+
+  /* Descartar la entrada usada hace más tiempo si la partición está llena */
+  if (shard->lru.length >= cache->shard_capacity) {
+    shard_remove(shard, shard->lru.tail->data);
+    tcp_counter_add(cache->evictions, 1);
+  }
+
+  g_queue_push_head_link(&shard->lru, &entry->link);
+  g_hash_table_insert(shard->entries, entry->key, entry);
+
+  g_mutex_unlock(&shard->lock);
+}
+
+void tcp_cache_free(TcpCache *cache)
+{
+  g_return_if_fail(cache != NULL);
+
+  for (unsigned int i = 0; i < cache->n_shards; i++) {
+    g_hash_table_destroy(cache->shards[i].entries);
+    g_mutex_clear(&cache->shards[i].lock);
+  }
+
+  g_free(cache->shards);
+  g_free(cache);
+}
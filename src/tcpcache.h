@@ -0,0 +1,76 @@
+/**
+ * @file tcpcache.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Caché en memoria de respuestas con tiempo de vida
+ * @version 0.1
+ * @date 2023-04-20
+ *
+ * Guarda respuestas por clave hasta que vence su tiempo de vida, que indica
+ * quien las guarda. La caché está dividida en particiones, cada una con su
+ * propio mutex, para que los hilos que consultan claves distintas no compitan
+ * por el mismo bloqueo. Cada partición admite una cantidad máxima de entradas:
+ * al llenarse, se descarta la usada hace más tiempo.
+ *
+ * Con tcp_cache_set_metrics() se cuentan los aciertos, los fallos y las
+ * entradas descartadas (ver tcpmetrics.h).
+ */
+#pragma once
+
+#include <glib.h>
+
+/** Caché de respuestas */
+typedef struct TcpCache TcpCache;
+
+/**
+ * Crea una nueva caché.
+ *
+ * @see tcp_cache_free()
+ * @param shards cantidad de particiones (al menos 1)
+ * @param capacity cantidad máxima de entradas, repartidas entre las particiones
+ * @return puntero a TcpCache (debe liberarse con tcp_cache_free() cuando ya no
+ * se utilice)
+ */
+TcpCache *tcp_cache_new(unsigned int shards, unsigned int capacity);
+
+/**
+ * Cuenta los aciertos, fallos y descartes de la caché en las métricas
+ * cache.NAME.hits, cache.NAME.misses y cache.NAME.evictions, con la proporción
+ * de aciertos en cache.NAME.hit_ratio.
+ *
+ * @param cache caché
+ * @param name nombre de la caché en las métricas
+ */
+void tcp_cache_set_metrics(TcpCache *cache, const char *name);
+
+/**
+ * Busca una respuesta vigente. Las entradas vencidas se quitan al buscarlas.
+ *
+ * La antigüedad de la respuesta permite descontar, de los tiempos de vida que
+ * incluya, el tiempo que pasó en la caché.
+ *
+ * @param cache caché
+ * @param key clave
+ * @param age puntero donde guardar el tiempo transcurrido desde que se guardó
+ * la respuesta (milisegundos), o NULL
+ * @return la respuesta, que debe liberarse con g_bytes_unref(), o NULL si no
+ * hay una vigente
+ */
+GBytes *tcp_cache_lookup(TcpCache *cache, const char *key, gint64 *age);
+
+/**
+ * Guarda una respuesta, reemplazando la anterior con la misma clave.
+ *
+ * @param cache caché
+ * @param key clave
+ * @param value respuesta (se agrega una referencia)
+ * @param ttl tiempo de vida (milisegundos); si no es mayor a 0, no se guarda
+ */
+void tcp_cache_insert(TcpCache *cache, const char *key, GBytes *value, gint64 ttl);
+
+/**
+ * Libera los recursos asignados por tcp_cache_new() y las respuestas
+ * guardadas.
+ *
+ * @param cache puntero a TcpCache
+ */
+void tcp_cache_free(TcpCache *cache);
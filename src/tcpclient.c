@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <glib.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,27 +10,106 @@
 
 #ifdef G_OS_UNIX
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #endif
 
 #ifdef G_OS_WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#define SHUT_RDWR SD_BOTH
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* Con epoll o io_uring, las solicitudes iniciadas se atienden en un hilo */
+#if defined(HAVE_EPOLL) || defined(HAVE_LIBURING)
+#define HAVE_CLIENT_LOOP
+#include <sys/eventfd.h>
 #endif
 
 #include "tcpclient.h"
+#include "tcplog.h"
+#include "tcpmetrics.h"
+#include "tcptimer.h"
+
+/* Cantidad máxima para recepción de bytes por llamada a recv() */
+#define RECV_MAX      1024
+/* Cantidad máxima de eventos por llamada a epoll_wait() */
+#define LOOP_EVENTS   64
+/* Cantidad de entradas de la cola de io_uring del cliente */
+#define URING_ENTRIES 256
+/* Forma de delimitar mensajes */
+#define FRAMING       TCP_FRAMING_NONE
+/* Prefijo del host para conectar por un socket Unix */
+#define UNIX_PREFIX   "unix:"
+
+/* Evitar SIGPIPE al enviar a un servidor desconectado, si es posible */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS    MSG_NOSIGNAL
+#else
+#define SEND_FLAGS    0
+#endif
 
 /* Define el dominio de errores TCP_CLIENT_ERROR */
 G_DEFINE_QUARK(tcp-client-error, tcp_client_error)
 
+/** @private Conexión compartida por las solicitudes con TCP_FRAMING_MUX */
+typedef struct TcpClientMux
+{
+  GMutex          lock;
+  GCond           cond;
+  GHashTable     *calls;
+  TcpFrameReader *reader;
+  uint32_t        next_id;
+  int             sock;
+  bool            reading;
+} TcpClientMux;
+
+/** @private Conexión abierta sin usar, disponible para otra solicitud */
+typedef struct TcpClientIdleConn
+{
+  int    sock;
+  gint64 since;
+} TcpClientIdleConn;
+
+/** @private Solicitud en curso sobre la conexión compartida */
+typedef struct TcpClientMuxCall
+{
+  char   *response;
+  size_t  response_len;
+  GError *error;
+  bool    done;
+} TcpClientMuxCall;
+
 /** Contiene una configuración para un cliente TCP */
 struct TcpClient
 {
   /** @privatesection */
-  const char *host;
-  uint16_t    port;
+  const char   *host;
+  uint16_t      port;
+  struct sockaddr_storage addr;
+  socklen_t     addr_len;
+  TcpFraming    framing;
+  GMutex        lock;
+  GCond         cond;
+  GQueue        idle;
+  unsigned int  n_conns;
+  unsigned int  max_conns;
+  gint64        idle_timeout;
+  TcpClientMux  mux;
+  TcpHistogram *latency;
+  TcpCounter   *errors;
+  TcpCounter   *connects;
 };
 
 /** @private */
@@ -43,6 +124,10 @@ typedef struct TcpClientThreadArgs
 static const char *error_messages[] = {
   [TCP_CLIENT_SOCK_ERROR]         = "Error al crear socket",
   [TCP_CLIENT_SOCK_CONNECT_ERROR] = "Error al abrir conexión con el socket",
+  [TCP_CLIENT_SOCK_SEND_ERROR]    = "Error al enviar solicitud",
+  [TCP_CLIENT_SOCK_RECV_ERROR]    = "Error al recibir respuesta",
+  [TCP_CLIENT_TIMEOUT_ERROR]      = "Plazo de la solicitud vencido",
+  [TCP_CLIENT_FRAMING_ERROR]      = "La delimitación de mensajes no admite respuestas en partes",
 };
 
 /* Macro para manejar errores */
@@ -52,15 +137,137 @@ static const char *error_messages[] = {
     return NULL;\
   }
 
+static socklen_t set_client_addr(const char              *host,
+                                 uint16_t                 port,
+                                 struct sockaddr_storage *servaddr)
+{
+  struct sockaddr_in *inaddr = (struct sockaddr_in*)servaddr;
+
+  memset(servaddr, 0, sizeof(*servaddr));
+
+#ifdef G_OS_UNIX
+  /* Ruta del socket Unix, sin pasar por la pila TCP/IP */
+  if (g_str_has_prefix(host, UNIX_PREFIX)) {
+    struct sockaddr_un *unaddr = (struct sockaddr_un*)servaddr;
+    const char *path = host + strlen(UNIX_PREFIX);
+
+    if (*path == '\0' || strlen(path) >= sizeof(unaddr->sun_path)) {
+      return 0;
+    }
+    unaddr->sun_family = AF_UNIX;
+    strcpy(unaddr->sun_path, path);
+
+    return sizeof(*unaddr);
+  }
+#endif
+
+  inaddr->sin_family = AF_INET;
+  inaddr->sin_addr.s_addr = inet_addr(host);
+  inaddr->sin_port = htons(port);
+
+  return sizeof(*inaddr);
+}
+
 TcpClient *tcp_client_new(const char *host, uint16_t port)
 {
-  TcpClient *client = (TcpClient*)malloc(sizeof(TcpClient));
+  TcpClient *client;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  g_return_val_if_fail(host != NULL, NULL);
+
+  addr_len = set_client_addr(host, port, &addr);
+  if (addr_len == 0) {
+    tcp_log(TCP_LOG_ERROR, "Ruta de socket Unix inválida: %s", host);
+    return NULL;
+  }
+
+  client = (TcpClient*)malloc(sizeof(TcpClient));
   client->host = host;
   client->port = port;
+  client->addr = addr;
+  client->addr_len = addr_len;
+  client->framing = FRAMING;
+  g_mutex_init(&client->lock);
+  g_cond_init(&client->cond);
+  g_queue_init(&client->idle);
+  client->n_conns = 0;
+  client->max_conns = 0;
+  client->idle_timeout = 0;
+  g_mutex_init(&client->mux.lock);
+  g_cond_init(&client->mux.cond);
+  client->mux.calls = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  client->mux.reader = NULL;
+  client->mux.next_id = 1;
+  client->mux.sock = -1;
+  client->mux.reading = false;
+  client->latency = NULL;
+  client->errors = NULL;
+  client->connects = NULL;
+
+#ifdef G_OS_WIN32
+  WSADATA wsa_data;
+  WSAStartup(MAKEWORD(2,2), &wsa_data);
+#endif
 
   return client;
 }
 
+void tcp_client_set_framing(TcpClient *client, TcpFraming framing)
+{
+  g_return_if_fail(client != NULL);
+
+  client->framing = framing;
+}
+
+void tcp_client_set_pool(TcpClient    *client,
+                         unsigned int  max_conns,
+                         unsigned int  idle_timeout)
+{
+  g_return_if_fail(client != NULL);
+
+  g_mutex_lock(&client->lock);
+  client->max_conns = max_conns;
+  client->idle_timeout = (gint64)idle_timeout * 1000;
+  g_cond_broadcast(&client->cond);
+  g_mutex_unlock(&client->lock);
+}
+
+void tcp_client_set_metrics(TcpClient *client, const char *name)
+{
+  char *metric;
+
+  g_return_if_fail(client != NULL);
+  g_return_if_fail(name != NULL);
+
+  metric = g_strdup_printf("backend.%s.latency_us", name);
+  client->latency = tcp_metrics_histogram(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.errors", name);
+  client->errors = tcp_metrics_counter(metric);
+  g_free(metric);
+
+  metric = g_strdup_printf("backend.%s.connects", name);
+  client->connects = tcp_metrics_counter(metric);
+  g_free(metric);
+}
+
+static void record_call(TcpClient *client, gint64 elapsed, bool failed)
+{
+  tcp_histogram_record(client->latency, elapsed);
+  if (failed) {
+    tcp_counter_add(client->errors, 1);
+  }
+}
+
+static int open_socket(TcpClient *client)
+{
+  tcp_counter_add(client->connects, 1);
+
+  return socket(client->addr.ss_family, SOCK_STREAM, 0);
+}
+
 static void *run_client_thread(void *data)
 {
   void *retval = NULL;
@@ -77,7 +284,7 @@ static void *run_client_thread(void *data)
   WSACleanup();
 #endif
   g_free(args);
-  printf("Desconectado del servidor.\n");
+  tcp_log(TCP_LOG_DEBUG, "Desconectado del servidor.");
 
   return retval;
 }
@@ -91,8 +298,6 @@ GThread *tcp_client_run(TcpClient      *client,
   g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
   int sockfd, connected;
-  struct sockaddr_in servaddr;
-  size_t servaddr_len = sizeof(servaddr);
   TcpClientThreadArgs *thread_args;
 
 #ifdef G_OS_WIN32
@@ -103,26 +308,21 @@ GThread *tcp_client_run(TcpClient      *client,
   WSADATA wsa_data;
   int result = WSAStartup(MAKEWORD(2,2), &wsa_data);
   if (result != 0) {
-    printf("WSAStartup falló: %d\n", result);
+    tcp_log(TCP_LOG_ERROR, "WSAStartup falló: %d", result);
     return NULL;
   }
 #endif
 
-  /* Asignar IP y puerto */
-  memset(&servaddr, 0, servaddr_len);
-  servaddr.sin_family = AF_INET;
-  servaddr.sin_addr.s_addr = inet_addr(client->host);
-  servaddr.sin_port = htons(client->port);
-
   /* Crear socket */
-  sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockfd = open_socket(client);
   return_set_error_if(sockfd == -1, error, TCP_CLIENT_SOCK_ERROR);
-  printf("Socket creado correctamente...\n");
+  tcp_log(TCP_LOG_DEBUG, "Socket creado correctamente...");
 
   /* Conectar socket del cliente al socket del servidor */
-  connected = connect(sockfd, (struct sockaddr*)&servaddr, servaddr_len);
+  connected = connect(sockfd, (struct sockaddr*)&client->addr,
+                      client->addr_len);
   return_set_error_if(connected == -1, error, TCP_CLIENT_SOCK_CONNECT_ERROR);
-  printf("Conectado al servidor...\n");
+  tcp_log(TCP_LOG_DEBUG, "Conectado al servidor...");
 
   /* Preparar parámetros para función del cliente */
   thread_args = g_new0(TcpClientThreadArgs, 1);
@@ -134,7 +334,1415 @@ GThread *tcp_client_run(TcpClient      *client,
   return g_thread_try_new(NULL, run_client_thread, thread_args, error);
 }
 
+static void close_sock(int sock)
+{
+#ifdef G_OS_UNIX
+  close(sock);
+#endif
+#ifdef G_OS_WIN32
+  closesocket(sock);
+#endif
+}
+
+static void set_recv_timeout(int sock, gint64 timeout)
+{
+#ifdef G_OS_UNIX
+  struct timeval tv = {
+    .tv_sec = timeout / G_USEC_PER_SEC,
+    .tv_usec = timeout % G_USEC_PER_SEC,
+  };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+
+#ifdef G_OS_WIN32
+  DWORD tv = (DWORD)((timeout + 999) / 1000);
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+#endif
+}
+
+static int open_conn(TcpClient *client, GError **error)
+{
+  int sockfd;
+
+  sockfd = open_socket(client);
+  if (sockfd == -1) {
+    g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_SOCK_ERROR,
+                        error_messages[TCP_CLIENT_SOCK_ERROR]);
+    return -1;
+  }
+
+  if (connect(sockfd, (struct sockaddr*)&client->addr, client->addr_len)
+      == -1) {
+    g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_SOCK_CONNECT_ERROR,
+                        error_messages[TCP_CLIENT_SOCK_CONNECT_ERROR]);
+    close_sock(sockfd);
+    return -1;
+  }
+
+  return sockfd;
+}
+
+static bool conn_alive(int sock)
+{
+#if defined(G_OS_UNIX) && defined(MSG_DONTWAIT)
+  char byte;
+  int recv_len;
+
+  /*
+   * Sin solicitudes en curso no debería haber nada para leer: si el servidor
+   * cerró la conexión se lee el fin, y si envió datos la conexión quedó
+   * desincronizada. Solo una conexión sin datos está disponible.
+   */
+  recv_len = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  return recv_len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#else
+  return true;
+#endif
+}
+
+static int pool_take(TcpClient *client)
+{
+  TcpClientIdleConn *conn;
+  gint64 now;
+  int sock = -1;
+
+  g_mutex_lock(&client->lock);
+
+  while (true) {
+    now = g_get_monotonic_time();
+
+    /* Cerrar las conexiones sin usar más tiempo que el máximo */
+    while (client->idle_timeout > 0
+           && (conn = g_queue_peek_head(&client->idle)) != NULL
+           && now - conn->since > client->idle_timeout) {
+      g_queue_pop_head(&client->idle);
+      close_sock(conn->sock);
+      g_free(conn);
+      client->n_conns--;
+    }
+
+    /* La conexión usada más recientemente, si el servidor no la cerró */
+    while ((conn = g_queue_pop_tail(&client->idle)) != NULL) {
+      sock = conn->sock;
+      g_free(conn);
+      if (conn_alive(sock)) {
+        break;
+      }
+      close_sock(sock);
+      client->n_conns--;
+      sock = -1;
+    }
+
+    if (sock != -1) {
+      break;
+    }
+
+    /* Reservar lugar para una nueva conexión, o esperar que se libere uno */
+    if (client->max_conns == 0 || client->n_conns < client->max_conns) {
+      client->n_conns++;
+      break;
+    }
+    g_cond_wait(&client->cond, &client->lock);
+  }
+
+  g_mutex_unlock(&client->lock);
+
+  return sock;
+}
+
+static void pool_put(TcpClient *client, int sock, bool reusable)
+{
+  TcpClientIdleConn *conn;
+
+  g_mutex_lock(&client->lock);
+
+  if (sock != -1 && reusable && client->framing != TCP_FRAMING_NONE) {
+    conn = g_new(TcpClientIdleConn, 1);
+    conn->sock = sock;
+    conn->since = g_get_monotonic_time();
+    g_queue_push_tail(&client->idle, conn);
+  } else {
+    if (sock != -1) {
+      close_sock(sock);
+    }
+    client->n_conns--;
+  }
+
+  g_cond_signal(&client->cond);
+  g_mutex_unlock(&client->lock);
+}
+
+static GString *encode_request(TcpClient  *client,
+                               uint32_t    id,
+                               const char *request,
+                               size_t      length)
+{
+  GString *frame = g_string_sized_new(length + 9);
+  size_t start = tcp_frame_begin(client->framing, id, frame);
+
+  g_string_append_len(frame, request, length);
+  tcp_frame_end(client->framing, frame, start);
+
+  return frame;
+}
+
+static TcpFrameReader *new_reader(TcpClient *client)
+{
+  return tcp_frame_reader_new(client->framing,
+                              client->framing == TCP_FRAMING_NONE
+                                ? RECV_MAX
+                                : TCP_FRAME_MAX_LEN);
+}
+
+static char *copy_frame(const char *frame, size_t frame_len)
+{
+  char *copy = g_malloc(frame_len + 1);
+
+  /* Los mensajes binarios pueden tener bytes nulos, que g_strndup() no copia */
+  memcpy(copy, frame, frame_len);
+  copy[frame_len] = '\0';
+
+  return copy;
+}
+
+static char *recv_response(int              sock,
+                           TcpFrameReader  *reader,
+                           size_t          *response_len,
+                           gint64           deadline,
+                           GError         **error)
+{
+  TcpClientError code = TCP_CLIENT_SOCK_RECV_ERROR;
+  TcpFrameStatus status;
+  const char *frame;
+  size_t frame_len;
+  char *recv_buf;
+  int recv_len;
+  gint64 left;
+
+  /* Leer hasta completar un mensaje, que puede llegar en varios segmentos */
+  while ((status = tcp_frame_reader_next(reader, &frame, &frame_len))
+         == TCP_FRAME_INCOMPLETE) {
+    /* Con plazo, cada recv() espera a lo sumo lo que queda de él */
+    if (deadline > 0) {
+      left = deadline - g_get_monotonic_time();
+      if (left <= 0) {
+        code = TCP_CLIENT_TIMEOUT_ERROR;
+        break;
+      }
+      set_recv_timeout(sock, left);
+    }
+
+    recv_buf = tcp_frame_reader_reserve(reader, RECV_MAX);
+    recv_len = recv(sock, recv_buf, RECV_MAX, 0);
+    if (recv_len <= 0) {
+      if (deadline > 0 && g_get_monotonic_time() >= deadline) {
+        code = TCP_CLIENT_TIMEOUT_ERROR;
+      }
+      break;
+    }
+    tcp_frame_reader_commit(reader, recv_len);
+  }
+
+  /* Las conexiones vuelven al "pool" sin tiempo de espera */
+  if (deadline > 0) {
+    set_recv_timeout(sock, 0);
+  }
+
+  if (status != TCP_FRAME_READY) {
+    g_set_error_literal(error, TCP_CLIENT_ERROR, code, error_messages[code]);
+    return NULL;
+  }
+
+  if (response_len != NULL) {
+    *response_len = frame_len;
+  }
+
+  return copy_frame(frame, frame_len);
+}
+
+static bool send_frame(int sock, GString *frame, GError **error)
+{
+  size_t sent = 0;
+  int sent_len;
+
+  while (sent < frame->len) {
+    sent_len = send(sock, frame->str + sent, frame->len - sent, SEND_FLAGS);
+    if (sent_len <= 0) {
+      g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_SOCK_SEND_ERROR,
+                          error_messages[TCP_CLIENT_SOCK_SEND_ERROR]);
+      return false;
+    }
+    sent += sent_len;
+  }
+
+  return true;
+}
+
+static char *exchange(TcpClient  *client,
+                      int         sock,
+                      GString    *frame,
+                      size_t     *response_len,
+                      gint64      deadline,
+                      GError    **error)
+{
+  TcpFrameReader *reader;
+  char *response;
+
+  if (!send_frame(sock, frame, error)) {
+    return NULL;
+  }
+
+  reader = new_reader(client);
+  response = recv_response(sock, reader, response_len, deadline, error);
+  tcp_frame_reader_free(reader);
+
+  return response;
+}
+
+static void mux_reset(TcpClientMux *mux, TcpClientError code)
+{
+  GHashTableIter iter;
+  TcpClientMuxCall *call;
+
+  close_sock(mux->sock);
+  tcp_frame_reader_free(mux->reader);
+  mux->sock = -1;
+  mux->reader = NULL;
+
+  /* Las respuestas pendientes ya no pueden llegar */
+  g_hash_table_iter_init(&iter, mux->calls);
+  while (g_hash_table_iter_next(&iter, NULL, (void**)&call)) {
+    if (!call->done) {
+      g_set_error_literal(&call->error, TCP_CLIENT_ERROR, code,
+                          error_messages[code]);
+      call->done = true;
+    }
+  }
+
+  g_cond_broadcast(&mux->cond);
+}
+
+static uint32_t mux_send(TcpClient   *client,
+                         const char  *request,
+                         size_t       length,
+                         bool        *reused,
+                         GError     **error)
+{
+  TcpClientMux *mux = &client->mux;
+  GString *frame;
+  uint32_t id;
+
+  g_mutex_lock(&mux->lock);
+
+  /* Abrir la conexión compartida con la primera solicitud */
+  *reused = mux->sock != -1;
+  if (!*reused) {
+    mux->sock = open_conn(client, error);
+    if (mux->sock == -1) {
+      g_mutex_unlock(&mux->lock);
+      return 0;
+    }
+    mux->reader = tcp_frame_reader_new(TCP_FRAMING_MUX, TCP_FRAME_MAX_LEN);
+  }
+
+  /* El identificador 0 queda reservado para indicar un error */
+  id = mux->next_id++;
+  if (mux->next_id == 0) {
+    mux->next_id = 1;
+  }
+
+  /* Los mensajes se envían completos, sin intercalarse con otros hilos */
+  frame = encode_request(client, id, request, length);
+  if (send_frame(mux->sock, frame, error)) {
+    g_hash_table_insert(mux->calls, GUINT_TO_POINTER(id),
+                        g_new0(TcpClientMuxCall, 1));
+  } else if (mux->reading) {
+    /* El hilo que recibe las respuestas cierra la conexión */
+    shutdown(mux->sock, SHUT_RDWR);
+    id = 0;
+  } else {
+    mux_reset(mux, TCP_CLIENT_SOCK_SEND_ERROR);
+    id = 0;
+  }
+
+  g_mutex_unlock(&mux->lock);
+  g_string_free(frame, TRUE);
+
+  return id;
+}
+
+static char *mux_wait(TcpClient   *client,
+                      uint32_t     id,
+                      size_t      *response_len,
+                      gint64       deadline,
+                      GError     **error)
+{
+  TcpClientMux *mux = &client->mux;
+  TcpClientMuxCall *call, *owner;
+  TcpFrameReader *reader;
+  GError *recv_error = NULL;
+  char *response, *frame;
+  size_t frame_len;
+  int sock;
+
+  g_mutex_lock(&mux->lock);
+
+  call = g_hash_table_lookup(mux->calls, GUINT_TO_POINTER(id));
+  if (call == NULL) {
+    g_mutex_unlock(&mux->lock);
+    g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_SOCK_RECV_ERROR,
+                        error_messages[TCP_CLIENT_SOCK_RECV_ERROR]);
+    return NULL;
+  }
+
+  while (!call->done) {
+    /* Otro hilo recibe las respuestas: esperar a que llegue la propia */
+    if (mux->reading) {
+      if (deadline == 0) {
+        g_cond_wait(&mux->cond, &mux->lock);
+      } else if (!g_cond_wait_until(&mux->cond, &mux->lock, deadline)
+                 && !call->done) {
+        g_set_error_literal(&call->error, TCP_CLIENT_ERROR,
+                            TCP_CLIENT_TIMEOUT_ERROR,
+                            error_messages[TCP_CLIENT_TIMEOUT_ERROR]);
+        call->done = true;
+      }
+      continue;
+    }
+
+    /* Recibir una respuesta, de cualquier solicitud, sin bloquear los envíos */
+    mux->reading = true;
+    sock = mux->sock;
+    reader = mux->reader;
+    g_mutex_unlock(&mux->lock);
+
+    frame = recv_response(sock, reader, &frame_len, deadline, &recv_error);
+
+    g_mutex_lock(&mux->lock);
+    mux->reading = false;
+
+    /*
+     * Con el plazo vencido, la conexión sigue abierta para las demás
+     * solicitudes: el mensaje a medio recibir queda en el lector compartido
+     */
+    if (g_error_matches(recv_error, TCP_CLIENT_ERROR,
+                        TCP_CLIENT_TIMEOUT_ERROR)) {
+      call->error = recv_error;
+      call->done = true;
+      g_cond_broadcast(&mux->cond);
+      break;
+    }
+    g_clear_error(&recv_error);
+
+    if (frame == NULL) {
+      mux_reset(mux, TCP_CLIENT_SOCK_RECV_ERROR);
+      break;
+    }
+
+    /* Entregar la respuesta a la solicitud con el mismo identificador */
+    owner = g_hash_table_lookup(mux->calls,
+                                GUINT_TO_POINTER(tcp_frame_reader_id(reader)));
+    if (owner != NULL && !owner->done) {
+      owner->response = frame;
+      owner->response_len = frame_len;
+      owner->done = true;
+    } else {
+      g_free(frame);
+    }
+
+    g_cond_broadcast(&mux->cond);
+  }
+
+  response = call->response;
+  if (response != NULL && response_len != NULL) {
+    *response_len = call->response_len;
+  } else if (response == NULL) {
+    g_propagate_error(error, call->error);
+    call->error = NULL;
+  }
+  g_hash_table_remove(mux->calls, GUINT_TO_POINTER(id));
+
+  g_mutex_unlock(&mux->lock);
+
+  return response;
+}
+
+uint32_t tcp_client_send(TcpClient   *client,
+                         const char  *request,
+                         size_t       length,
+                         GError     **error)
+{
+  bool reused;
+
+  g_return_val_if_fail(client != NULL, 0);
+  g_return_val_if_fail(client->framing == TCP_FRAMING_MUX, 0);
+  g_return_val_if_fail(request != NULL, 0);
+  g_return_val_if_fail(error == NULL || *error == NULL, 0);
+
+  return mux_send(client, request, length, &reused, error);
+}
+
+char *tcp_client_wait(TcpClient   *client,
+                      uint32_t     id,
+                      size_t      *response_len,
+                      GError     **error)
+{
+  g_return_val_if_fail(client != NULL, NULL);
+  g_return_val_if_fail(client->framing == TCP_FRAMING_MUX, NULL);
+  g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+  return mux_wait(client, id, response_len, 0, error);
+}
+
+static char *mux_call(TcpClient   *client,
+                      const char  *request,
+                      size_t       length,
+                      size_t      *response_len,
+                      gint64       deadline,
+                      GError     **error)
+{
+  GError *call_error = NULL;
+  char *response = NULL;
+  bool reused = false;
+  uint32_t id;
+
+  /* La conexión compartida pudo cerrarla el servidor: reintentar una vez */
+  for (int attempt = 0; attempt < 2 && response == NULL; attempt++) {
+    if (attempt > 0
+        && (!reused || g_error_matches(call_error, TCP_CLIENT_ERROR,
+                                       TCP_CLIENT_TIMEOUT_ERROR))) {
+      break;
+    }
+
+    g_clear_error(&call_error);
+    id = mux_send(client, request, length, &reused, &call_error);
+    if (id != 0) {
+      response = mux_wait(client, id, response_len, deadline, &call_error);
+    }
+  }
+
+  if (response == NULL) {
+    g_propagate_error(error, call_error);
+  }
+
+  return response;
+}
+
+static char *client_call(TcpClient   *client,
+                         const char  *request,
+                         size_t       length,
+                         size_t      *response_len,
+                         gint64       deadline,
+                         GError     **error)
+{
+  GError *call_error = NULL;
+  GString *frame;
+  char *response = NULL;
+  bool reused, retry;
+  int sock;
+
+  if (client->framing == TCP_FRAMING_MUX) {
+    return mux_call(client, request, length, response_len, deadline, error);
+  }
+
+  frame = encode_request(client, 0, request, length);
+
+  do {
+    sock = pool_take(client);
+    reused = sock != -1;
+    if (!reused) {
+      sock = open_conn(client, error);
+      if (sock == -1) {
+        pool_put(client, -1, false);
+        break;
+      }
+    }
+
+    /*
+     * Una conexión reutilizada pudo cerrarla el servidor: reintentar, salvo
+     * que haya vencido el plazo
+     */
+    response = exchange(client, sock, frame, response_len, deadline,
+                        &call_error);
+    pool_put(client, sock, response != NULL);
+    retry = response == NULL && reused
+         && !g_error_matches(call_error, TCP_CLIENT_ERROR,
+                             TCP_CLIENT_TIMEOUT_ERROR);
+    if (retry) {
+      g_clear_error(&call_error);
+    }
+  } while (retry);
+
+  if (call_error != NULL) {
+    g_propagate_error(error, call_error);
+  }
+  g_string_free(frame, TRUE);
+
+  return response;
+}
+
+char *tcp_client_call(TcpClient   *client,
+                      const char  *request,
+                      size_t       length,
+                      size_t      *response_len,
+                      GError     **error)
+{
+  g_return_val_if_fail(client != NULL, NULL);
+  g_return_val_if_fail(request != NULL, NULL);
+  g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+  gint64 start = g_get_monotonic_time();
+  char *response;
+
+  response = client_call(client, request, length, response_len, 0, error);
+  record_call(client, g_get_monotonic_time() - start, response == NULL);
+
+  return response;
+}
+
+static bool recv_parts(int                  sock,
+                       TcpFrameReader      *reader,
+                       TcpClientStreamFunc  func,
+                       void                *data,
+                       bool                *received,
+                       GError             **error)
+{
+  TcpFrameStatus status;
+  const char *frame;
+  size_t frame_len;
+  char *recv_buf;
+  int recv_len;
+
+  while (true) {
+    status = tcp_frame_reader_next(reader, &frame, &frame_len);
+
+    if (status == TCP_FRAME_READY) {
+      *received = true;
+      if (!func(frame, frame_len, data)) {
+        return true;
+      }
+      continue;
+    }
+
+    /* Leer la siguiente parte solo cuando la función terminó con la anterior */
+    if (status == TCP_FRAME_INCOMPLETE) {
+      recv_buf = tcp_frame_reader_reserve(reader, RECV_MAX);
+      recv_len = recv(sock, recv_buf, RECV_MAX, 0);
+      if (recv_len > 0) {
+        tcp_frame_reader_commit(reader, recv_len);
+        continue;
+      }
+    }
+
+    g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_SOCK_RECV_ERROR,
+                        error_messages[TCP_CLIENT_SOCK_RECV_ERROR]);
+    return false;
+  }
+}
+
+bool tcp_client_stream(TcpClient           *client,
+                       const char          *request,
+                       size_t               length,
+                       TcpClientStreamFunc  func,
+                       void                *data,
+                       GError             **error)
+{
+  g_return_val_if_fail(client != NULL, false);
+  g_return_val_if_fail(request != NULL, false);
+  g_return_val_if_fail(func != NULL, false);
+  g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+  TcpFrameReader *reader;
+  GError *stream_error = NULL;
+  GString *frame;
+  bool done = false, received = false, reused;
+  int sock;
+
+  /* Sin delimitar no se distinguen las partes, y con mux se leen por id */
+  if (client->framing != TCP_FRAMING_LENGTH
+      && client->framing != TCP_FRAMING_NDJSON) {
+    g_set_error_literal(error, TCP_CLIENT_ERROR, TCP_CLIENT_FRAMING_ERROR,
+                        error_messages[TCP_CLIENT_FRAMING_ERROR]);
+    return false;
+  }
+
+  frame = encode_request(client, 0, request, length);
+
+  do {
+    g_clear_error(&stream_error);
+    sock = pool_take(client);
+    reused = sock != -1;
+    if (!reused) {
+      sock = open_conn(client, &stream_error);
+      if (sock == -1) {
+        pool_put(client, -1, false);
+        break;
+      }
+    }
+
+    if (send_frame(sock, frame, &stream_error)) {
+      reader = new_reader(client);
+      done = recv_parts(sock, reader, func, data, &received, &stream_error);
+      tcp_frame_reader_free(reader);
+    }
+    pool_put(client, sock, done);
+  } while (!done && reused && !received);
+
+  g_string_free(frame, TRUE);
+
+  /* La duración depende del tamaño de la respuesta: solo contar errores */
+  if (!done) {
+    tcp_counter_add(client->errors, 1);
+    g_propagate_error(error, stream_error);
+  }
+
+  return done;
+}
+
+/** @private Solicitud iniciada con tcp_client_start() */
+typedef struct TcpClientCall
+{
+  TcpClientRequest  *request;
+  TcpClientCallback  callback;
+  void              *data;
+  gint64             start;
+#ifdef HAVE_CLIENT_LOOP
+  GString           *frame;
+  size_t             sent;
+  TcpFrameReader    *reader;
+  int                sock;
+  bool               reused;
+#endif
+#ifdef HAVE_EPOLL
+  bool               connecting;
+  TcpTimer           timer;
+#endif
+#ifdef HAVE_LIBURING
+  struct __kernel_timespec deadline;
+#endif
+} TcpClientCall;
+
+static void finish_call(TcpClientCall *call)
+{
+  call->request->elapsed = g_get_monotonic_time() - call->start;
+  record_call(call->request->client, call->request->elapsed,
+              call->request->response == NULL);
+  if (call->callback != NULL) {
+    call->callback(call->request, call->data);
+  }
+  g_free(call);
+}
+
+#ifdef HAVE_CLIENT_LOOP
+static bool call_prepare(TcpClientCall *call)
+{
+  TcpClientRequest *request = call->request;
+  TcpClient *client = request->client;
+
+  call->sock = pool_take(client);
+  call->reused = call->sock != -1;
+  call->reader = new_reader(client);
+  call->frame = encode_request(client, 0, request->request, request->length);
+
+  if (!call->reused) {
+    call->sock = open_socket(client);
+  }
+  if (call->sock == -1) {
+    pool_put(client, -1, false);
+    g_set_error_literal(&request->error, TCP_CLIENT_ERROR,
+                        TCP_CLIENT_SOCK_ERROR,
+                        error_messages[TCP_CLIENT_SOCK_ERROR]);
+    g_string_free(call->frame, TRUE);
+    tcp_frame_reader_free(call->reader);
+    finish_call(call);
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+#ifdef HAVE_EPOLL
+/* Instancia de epoll del hilo que atiende las solicitudes iniciadas */
+static int loop_epollfd = -1;
+
+/* Solicitudes iniciadas que el "event loop" todavía no registró */
+static GAsyncQueue *loop_calls = NULL;
+
+/* Aviso al "event loop" de nuevas solicitudes */
+static int loop_eventfd = -1;
+
+/* Plazos de las solicitudes, que solo usa el hilo del "event loop" */
+static TcpTimerWheel *loop_timers = NULL;
+
+static void set_blocking(int sock, bool blocking)
+{
+  int flags = fcntl(sock, F_GETFL, 0);
+
+  fcntl(sock, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+static void call_end(TcpClientCall *call, bool done, TcpClientError code)
+{
+  TcpClientRequest *request = call->request;
+
+  epoll_ctl(loop_epollfd, EPOLL_CTL_DEL, call->sock, NULL);
+  tcp_timer_wheel_remove(loop_timers, &call->timer);
+
+  /* Las conexiones vuelven al "pool" en modo bloqueante, como se usan */
+  if (done) {
+    set_blocking(call->sock, true);
+  } else {
+    g_set_error_literal(&request->error, TCP_CLIENT_ERROR, code,
+                        error_messages[code]);
+  }
+  pool_put(request->client, call->sock, done);
+
+  g_string_free(call->frame, TRUE);
+  tcp_frame_reader_free(call->reader);
+  finish_call(call);
+}
+
+static void call_connect(TcpClientCall *call)
+{
+  TcpClient *client = call->request->client;
+  struct epoll_event event = { .events = EPOLLOUT, .data.ptr = call };
+
+  call->sent = 0;
+  call->connecting = false;
+
+  /* La conexión se completa en el hilo del "event loop" */
+  if (connect(call->sock, (struct sockaddr*)&client->addr, client->addr_len)
+      == -1) {
+    if (errno != EINPROGRESS) {
+      call_end(call, false, TCP_CLIENT_SOCK_CONNECT_ERROR);
+      return;
+    }
+    call->connecting = true;
+  }
+
+  epoll_ctl(loop_epollfd, EPOLL_CTL_ADD, call->sock, &event);
+}
+
+static void call_fail(TcpClientCall *call, TcpClientError code)
+{
+  /* Una conexión reutilizada pudo cerrarla el servidor: reintentar */
+  if (call->reused) {
+    epoll_ctl(loop_epollfd, EPOLL_CTL_DEL, call->sock, NULL);
+    close_sock(call->sock);
+    tcp_frame_reader_free(call->reader);
+    call->reader = new_reader(call->request->client);
+    call->reused = false;
+    call->sock = open_socket(call->request->client);
+    if (call->sock == -1) {
+      tcp_timer_wheel_remove(loop_timers, &call->timer);
+      pool_put(call->request->client, -1, false);
+      g_set_error_literal(&call->request->error, TCP_CLIENT_ERROR,
+                          TCP_CLIENT_SOCK_ERROR,
+                          error_messages[TCP_CLIENT_SOCK_ERROR]);
+      g_string_free(call->frame, TRUE);
+      tcp_frame_reader_free(call->reader);
+      finish_call(call);
+      return;
+    }
+    set_blocking(call->sock, false);
+    call_connect(call);
+    return;
+  }
+
+  call_end(call, false, code);
+}
+
+static void call_send(TcpClientCall *call)
+{
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = call };
+  ssize_t sent_len;
+
+  while (call->sent < call->frame->len) {
+    sent_len = send(call->sock, call->frame->str + call->sent,
+                    call->frame->len - call->sent, SEND_FLAGS);
+    if (sent_len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (sent_len <= 0) {
+      call_fail(call, TCP_CLIENT_SOCK_SEND_ERROR);
+      return;
+    }
+    call->sent += sent_len;
+  }
+
+  /* Solicitud enviada: esperar la respuesta */
+  epoll_ctl(loop_epollfd, EPOLL_CTL_MOD, call->sock, &event);
+}
+
+static void call_recv(TcpClientCall *call)
+{
+  const char *frame;
+  size_t frame_len;
+  char *recv_buf;
+  ssize_t recv_len;
+
+  while (true) {
+    recv_buf = tcp_frame_reader_reserve(call->reader, RECV_MAX);
+    recv_len = recv(call->sock, recv_buf, RECV_MAX, 0);
+    if (recv_len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (recv_len <= 0) {
+      call_fail(call, TCP_CLIENT_SOCK_RECV_ERROR);
+      return;
+    }
+    tcp_frame_reader_commit(call->reader, recv_len);
+
+    switch (tcp_frame_reader_next(call->reader, &frame, &frame_len)) {
+      case TCP_FRAME_READY:
+        call->request->response = copy_frame(frame, frame_len);
+        call->request->response_len = frame_len;
+        call_end(call, true, 0);
+        return;
+      case TCP_FRAME_INCOMPLETE:
+        break;
+      default:
+        call_end(call, false, TCP_CLIENT_SOCK_RECV_ERROR);
+        return;
+    }
+  }
+}
+
+static void call_ready(TcpClientCall *call, uint32_t events)
+{
+  int sock_error = 0;
+  socklen_t error_len = sizeof(sock_error);
+
+  if (call->connecting) {
+    getsockopt(call->sock, SOL_SOCKET, SO_ERROR, &sock_error, &error_len);
+    if (sock_error != 0) {
+      call_fail(call, TCP_CLIENT_SOCK_CONNECT_ERROR);
+      return;
+    }
+    call->connecting = false;
+  }
+
+  if (call->sent < call->frame->len) {
+    call_send(call);
+  } else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    call_recv(call);
+  }
+}
+
+static void call_register(TcpClientCall *call)
+{
+  struct epoll_event event = { .events = EPOLLOUT, .data.ptr = call };
+  gint64 deadline = call->request->deadline;
+
+  /* Una solicitud que ya venció en la cola no se envía */
+  if (deadline > 0 && deadline <= g_get_monotonic_time()) {
+    call_end(call, false, TCP_CLIENT_TIMEOUT_ERROR);
+    return;
+  }
+  if (deadline > 0) {
+    tcp_timer_wheel_add(loop_timers, &call->timer, deadline, call);
+  }
+
+  if (call->reused) {
+    epoll_ctl(loop_epollfd, EPOLL_CTL_ADD, call->sock, &event);
+  } else {
+    call_connect(call);
+  }
+}
+
+static void *run_client_loop(void *data)
+{
+  struct epoll_event events[LOOP_EVENTS];
+  TcpClientCall *call;
+  uint64_t value;
+  int n_events;
+
+  while (true) {
+    n_events = epoll_wait(loop_epollfd, events, LOOP_EVENTS,
+                          tcp_timer_wheel_timeout(loop_timers,
+                                                  g_get_monotonic_time()));
+    if (n_events == -1 && errno != EINTR) {
+      tcp_log(TCP_LOG_ERROR, "epoll_wait: %s", g_strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n_events; i++) {
+      if (events[i].data.ptr != NULL) {
+        call_ready(events[i].data.ptr, events[i].events);
+        continue;
+      }
+
+      /* Registrar las solicitudes iniciadas desde otros hilos */
+      if (read(loop_eventfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+      }
+      while ((call = g_async_queue_try_pop(loop_calls)) != NULL) {
+        call_register(call);
+      }
+    }
+
+    /* Cancelar las solicitudes que no terminaron en plazo */
+    while ((call = tcp_timer_wheel_expire(loop_timers,
+                                          g_get_monotonic_time())) != NULL) {
+      call_end(call, false, TCP_CLIENT_TIMEOUT_ERROR);
+    }
+  }
+
+  return NULL;
+}
+
+static bool start_client_loop(void)
+{
+  static gsize started = 0;
+
+  /* Un único hilo por proceso, iniciado con la primera solicitud */
+  if (g_once_init_enter(&started)) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+
+    loop_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollfd == -1 || loop_eventfd == -1) {
+      tcp_log(TCP_LOG_ERROR, "%s: %s",
+              epollfd == -1 ? "epoll_create1" : "eventfd", g_strerror(errno));
+      if (epollfd != -1) {
+        close(epollfd);
+      }
+    } else {
+      epoll_ctl(epollfd, EPOLL_CTL_ADD, loop_eventfd, &event);
+      loop_calls = g_async_queue_new();
+      loop_timers = tcp_timer_wheel_new(g_get_monotonic_time());
+      loop_epollfd = epollfd;
+      g_thread_unref(g_thread_new("tcp-client-loop", run_client_loop, NULL));
+    }
+    g_once_init_leave(&started, 1);
+  }
+
+  return loop_epollfd != -1;
+}
+
+static bool loop_call_start(TcpClientCall *call)
+{
+  uint64_t value = 1;
+
+  if (!start_client_loop()) {
+    return false;
+  }
+
+  /* El hilo del "event loop" conecta, envía y recibe, y controla el plazo */
+  if (call_prepare(call)) {
+    set_blocking(call->sock, false);
+    g_async_queue_push(loop_calls, call);
+    if (write(loop_eventfd, &value, sizeof(value)) == -1) {
+      tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+    }
+  }
+
+  return true;
+}
+#endif
+
+#ifdef HAVE_LIBURING
+/** @private Operaciones de io_uring del cliente, en los bits bajos del SQE */
+typedef enum
+{
+  RING_CONNECT,
+  RING_SEND,
+  RING_RECV,
+  RING_TIMEOUT,
+  RING_WAKEUP,
+} TcpClientRingOp;
+
+/* Máscara de la operación en el dato de usuario de cada SQE */
+#define RING_OP_MASK 7
+
+/* Instancia de io_uring del hilo que atiende las solicitudes iniciadas */
+static struct io_uring ring;
+
+/* Indica si se pudo crear la instancia de io_uring */
+static bool ring_started = false;
+
+/* Solicitudes iniciadas que el hilo de io_uring todavía no registró */
+static GAsyncQueue *ring_calls = NULL;
+
+/* Aviso al hilo de io_uring de nuevas solicitudes */
+static int ring_eventfd = -1;
+
+/* Valor leído de ring_eventfd */
+static uint64_t ring_wakeup_value;
+
+static struct io_uring_sqe *ring_sqe(TcpClientRingOp op, void *ptr)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+  /* Cola de envío llena: enviar lo acumulado al kernel y reintentar */
+  if (sqe == NULL) {
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+  }
+
+  io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)ptr | op);
+
+  return sqe;
+}
+
+static struct io_uring_sqe *ring_call_sqe(TcpClientCall *call,
+                                          TcpClientRingOp op)
+{
+  struct io_uring_sqe *sqe, *timeout_sqe;
+
+  if (call->request->deadline == 0) {
+    return ring_sqe(op, call);
+  }
+
+  /* La operación y su plazo van juntos en la misma llamada al kernel */
+  if (io_uring_sq_space_left(&ring) < 2) {
+    io_uring_submit(&ring);
+  }
+
+  /*
+   * El plazo se encadena a la operación: si vence antes, el kernel la cancela
+   * y termina con -ECANCELED. Su propio CQE no se usa.
+   */
+  sqe = ring_sqe(op, call);
+  sqe->flags |= IOSQE_IO_LINK;
+  timeout_sqe = ring_sqe(RING_TIMEOUT, NULL);
+  io_uring_prep_link_timeout(timeout_sqe, &call->deadline, IORING_TIMEOUT_ABS);
+
+  return sqe;
+}
+
+static void ring_connect(TcpClientCall *call)
+{
+  TcpClient *client = call->request->client;
+  struct io_uring_sqe *sqe = ring_call_sqe(call, RING_CONNECT);
+
+  call->sent = 0;
+  io_uring_prep_connect(sqe, call->sock, (struct sockaddr*)&client->addr,
+                        client->addr_len);
+}
+
+static void ring_send(TcpClientCall *call)
+{
+  struct io_uring_sqe *sqe = ring_call_sqe(call, RING_SEND);
+
+  io_uring_prep_send(sqe, call->sock, call->frame->str + call->sent,
+                     call->frame->len - call->sent, SEND_FLAGS);
+}
+
+static void ring_recv(TcpClientCall *call)
+{
+  struct io_uring_sqe *sqe = ring_call_sqe(call, RING_RECV);
+
+  io_uring_prep_recv(sqe, call->sock,
+                     tcp_frame_reader_reserve(call->reader, RECV_MAX),
+                     RECV_MAX, 0);
+}
+
+static void ring_wakeup(void)
+{
+  struct io_uring_sqe *sqe = ring_sqe(RING_WAKEUP, NULL);
+
+  io_uring_prep_read(sqe, ring_eventfd, &ring_wakeup_value,
+                     sizeof(ring_wakeup_value), 0);
+}
+
+static void ring_end(TcpClientCall *call, bool done, TcpClientError code)
+{
+  TcpClientRequest *request = call->request;
+
+  if (!done) {
+    g_set_error_literal(&request->error, TCP_CLIENT_ERROR, code,
+                        error_messages[code]);
+  }
+  pool_put(request->client, call->sock, done);
+
+  g_string_free(call->frame, TRUE);
+  tcp_frame_reader_free(call->reader);
+  finish_call(call);
+}
+
+static void ring_fail(TcpClientCall *call, int result, TcpClientError code)
+{
+  /* Una operación cancelada por su plazo no se reintenta */
+  if (result == -ECANCELED) {
+    ring_end(call, false, TCP_CLIENT_TIMEOUT_ERROR);
+    return;
+  }
+
+  /* Una conexión reutilizada pudo cerrarla el servidor: reintentar */
+  if (call->reused) {
+    close_sock(call->sock);
+    tcp_frame_reader_free(call->reader);
+    call->reader = new_reader(call->request->client);
+    call->reused = false;
+    call->sock = open_socket(call->request->client);
+    if (call->sock == -1) {
+      ring_end(call, false, TCP_CLIENT_SOCK_ERROR);
+      return;
+    }
+    ring_connect(call);
+    return;
+  }
+
+  ring_end(call, false, code);
+}
+
+static void ring_recv_done(TcpClientCall *call, int result)
+{
+  const char *frame;
+  size_t frame_len;
+
+  if (result <= 0) {
+    ring_fail(call, result, TCP_CLIENT_SOCK_RECV_ERROR);
+    return;
+  }
+  tcp_frame_reader_commit(call->reader, result);
+
+  switch (tcp_frame_reader_next(call->reader, &frame, &frame_len)) {
+    case TCP_FRAME_READY:
+      call->request->response = copy_frame(frame, frame_len);
+      call->request->response_len = frame_len;
+      ring_end(call, true, 0);
+      break;
+    case TCP_FRAME_INCOMPLETE:
+      ring_recv(call);
+      break;
+    default:
+      ring_end(call, false, TCP_CLIENT_SOCK_RECV_ERROR);
+      break;
+  }
+}
+
+static void ring_register(TcpClientCall *call)
+{
+  gint64 deadline = call->request->deadline;
+
+  /* Una solicitud que ya venció en la cola no se envía */
+  if (deadline > 0 && deadline <= g_get_monotonic_time()) {
+    ring_end(call, false, TCP_CLIENT_TIMEOUT_ERROR);
+    return;
+  }
+
+  /* El reloj de los plazos de io_uring es el de g_get_monotonic_time() */
+  call->deadline.tv_sec = deadline / G_USEC_PER_SEC;
+  call->deadline.tv_nsec = (deadline % G_USEC_PER_SEC) * 1000;
+
+  if (call->reused) {
+    ring_send(call);
+  } else {
+    ring_connect(call);
+  }
+}
+
+static void ring_complete(struct io_uring_cqe *cqe)
+{
+  uint64_t user_data = io_uring_cqe_get_data64(cqe);
+  TcpClientCall *call = (TcpClientCall*)(uintptr_t)(user_data & ~(uint64_t)RING_OP_MASK);
+
+  switch (user_data & RING_OP_MASK) {
+    case RING_CONNECT:
+      if (cqe->res < 0) {
+        ring_fail(call, cqe->res, TCP_CLIENT_SOCK_CONNECT_ERROR);
+      } else {
+        ring_send(call);
+      }
+      break;
+    case RING_SEND:
+      if (cqe->res <= 0) {
+        ring_fail(call, cqe->res, TCP_CLIENT_SOCK_SEND_ERROR);
+        break;
+      }
+      call->sent += cqe->res;
+      if (call->sent < call->frame->len) {
+        ring_send(call);
+      } else {
+        ring_recv(call);
+      }
+      break;
+    case RING_RECV:
+      ring_recv_done(call, cqe->res);
+      break;
+    case RING_WAKEUP:
+      /* Registrar las solicitudes iniciadas desde otros hilos */
+      while ((call = g_async_queue_try_pop(ring_calls)) != NULL) {
+        ring_register(call);
+      }
+      ring_wakeup();
+      break;
+    case RING_TIMEOUT:
+      break;
+  }
+}
+
+static void *run_client_ring(void *data)
+{
+  struct io_uring_cqe *cqe;
+  unsigned int head, n_cqes;
+  int result;
+
+  ring_wakeup();
+
+  while (true) {
+    /* Enviar todas las operaciones acumuladas en una sola llamada */
+    result = io_uring_submit_and_wait(&ring, 1);
+    if (result < 0 && result != -EINTR) {
+      tcp_log(TCP_LOG_ERROR, "io_uring_submit_and_wait: %s",
+              g_strerror(-result));
+      break;
+    }
+
+    n_cqes = 0;
+    io_uring_for_each_cqe(&ring, head, cqe) {
+      ring_complete(cqe);
+      n_cqes++;
+    }
+    io_uring_cq_advance(&ring, n_cqes);
+  }
+
+  return NULL;
+}
+
+static bool start_client_ring(void)
+{
+  static gsize started = 0;
+
+  /* Un único hilo por proceso; si io_uring no está disponible, se usa epoll */
+  if (g_once_init_enter(&started)) {
+    int result = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+
+    ring_eventfd = result < 0 ? -1 : eventfd(0, EFD_CLOEXEC);
+    if (result < 0 || ring_eventfd == -1) {
+      tcp_log(TCP_LOG_WARNING, "%s: %s",
+              result < 0 ? "io_uring_queue_init" : "eventfd",
+              g_strerror(result < 0 ? -result : errno));
+      if (result >= 0) {
+        io_uring_queue_exit(&ring);
+      }
+    } else {
+      ring_calls = g_async_queue_new();
+      ring_started = true;
+      g_thread_unref(g_thread_new("tcp-client-ring", run_client_ring, NULL));
+    }
+    g_once_init_leave(&started, 1);
+  }
+
+  return ring_started;
+}
+
+static bool ring_call_start(TcpClientCall *call)
+{
+  uint64_t value = 1;
+
+  if (!start_client_ring()) {
+    return false;
+  }
+
+  /* El hilo de io_uring conecta, envía y recibe, y el kernel aplica el plazo */
+  if (call_prepare(call)) {
+    g_async_queue_push(ring_calls, call);
+    if (write(ring_eventfd, &value, sizeof(value)) == -1) {
+      tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+    }
+  }
+
+  return true;
+}
+#endif
+
+static bool call_start(TcpClientCall *call)
+{
+  if (call->request->client->framing == TCP_FRAMING_MUX) {
+    return false;
+  }
+
+#ifdef HAVE_LIBURING
+  if (ring_call_start(call)) {
+    return true;
+  }
+#endif
+
+#ifdef HAVE_EPOLL
+  if (loop_call_start(call)) {
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+static void *run_call(void *data)
+{
+  TcpClientCall *call = (TcpClientCall*)data;
+  TcpClientRequest *request = call->request;
+
+  request->response = client_call(request->client,
+                                  request->request,
+                                  request->length,
+                                  &request->response_len,
+                                  request->deadline,
+                                  &request->error);
+  finish_call(call);
+
+  return NULL;
+}
+
+void tcp_client_start(TcpClientRequest  *request,
+                      TcpClientCallback  callback,
+                      void              *data)
+{
+  TcpClientCall *call;
+  GThread *thread;
+
+  g_return_if_fail(request != NULL);
+  g_return_if_fail(request->client != NULL);
+  g_return_if_fail(request->request != NULL);
+
+  call = g_new0(TcpClientCall, 1);
+  call->request = request;
+  call->callback = callback;
+  call->data = data;
+  call->start = g_get_monotonic_time();
+  request->response = NULL;
+  request->response_len = 0;
+  request->error = NULL;
+
+  /* Sin epoll ni io_uring, o con TCP_FRAMING_MUX, se espera en otro hilo */
+  if (!call_start(call)) {
+    thread = g_thread_try_new(NULL, run_call, call, &request->error);
+    if (thread != NULL) {
+      g_thread_unref(thread);
+    } else {
+      finish_call(call);
+    }
+  }
+}
+
 void tcp_client_free(TcpClient *client)
 {
+  TcpClientIdleConn *conn;
+
+  g_return_if_fail(client != NULL);
+
+  while ((conn = g_queue_pop_head(&client->idle)) != NULL) {
+    close_sock(conn->sock);
+    g_free(conn);
+  }
+  g_cond_clear(&client->cond);
+  g_mutex_clear(&client->lock);
+
+  if (client->mux.sock != -1) {
+    close_sock(client->mux.sock);
+  }
+  tcp_frame_reader_free(client->mux.reader);
+  g_hash_table_destroy(client->mux.calls);
+  g_cond_clear(&client->mux.cond);
+  g_mutex_clear(&client->mux.lock);
+
+#ifdef G_OS_WIN32
+  WSACleanup();
+#endif
+
   free(client);
 }
@@ -8,8 +8,11 @@
 #pragma once
 
 #include <glib.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "tcpframe.h"
+
 /** Dominio de errores para funciones de TcpClient */
 #define TCP_CLIENT_ERROR (tcp_client_error_quark())
 
@@ -18,11 +21,38 @@ typedef enum
 {
   TCP_CLIENT_SOCK_ERROR,
   TCP_CLIENT_SOCK_CONNECT_ERROR,
+  TCP_CLIENT_SOCK_SEND_ERROR,
+  TCP_CLIENT_SOCK_RECV_ERROR,
+  TCP_CLIENT_TIMEOUT_ERROR,
+  TCP_CLIENT_FRAMING_ERROR,
 } TcpClientError;
 
 /** Contiene una configuración para un cliente TCP */
 typedef struct TcpClient TcpClient;
 
+/** Solicitud a un servidor TCP para tcp_client_start() */
+typedef struct
+{
+  TcpClient  *client;       /**< Cliente del servidor a consultar */
+  const char *request;      /**< Datos a enviar */
+  size_t      length;       /**< Longitud de los datos a enviar */
+  char       *response;     /**< Respuesta recibida (liberar con g_free()) */
+  size_t      response_len; /**< Longitud de la respuesta */
+  GError     *error;        /**< Error de la solicitud, o NULL */
+  gint64      elapsed;      /**< Duración de la solicitud (microsegundos) */
+  gint64      deadline;     /**< Plazo (g_get_monotonic_time()), o 0 sin plazo */
+} TcpClientRequest;
+
+/**
+ * Tipo de función que se ejecuta al terminar una solicitud iniciada con
+ * tcp_client_start().
+ *
+ * @see tcp_client_start()
+ * @param request la solicitud, con la respuesta o el error
+ * @param data puntero a datos adicionales
+ */
+typedef void (*TcpClientCallback)(TcpClientRequest *request, void *data);
+
 /**
  * Tipo de función para ejecutar en tcp_client_run().
  *
@@ -33,17 +63,157 @@ typedef struct TcpClient TcpClient;
  */
 typedef void *(*TcpClientFunc)(int sockfd, void *data);
 
+/**
+ * Tipo de función que recibe cada parte de una respuesta en
+ * tcp_client_stream().
+ *
+ * @see tcp_client_stream()
+ * @param part parte recibida (no terminada en '\0')
+ * @param length longitud de la parte
+ * @param data puntero a datos adicionales
+ * @return true para seguir recibiendo partes, false al recibir la última
+ */
+typedef bool (*TcpClientStreamFunc)(const char *part, size_t length, void *data);
+
 /**
  * Crea una nueva configuración para un cliente TCP.
  *
+ * Si el host tiene la forma "unix:RUTA", el cliente se conecta al socket Unix
+ * (AF_UNIX) de esa ruta y se ignora el puerto. Con el servidor en el mismo
+ * equipo, así se evita la pila TCP/IP, el agotamiento de puertos locales y las
+ * conexiones en TIME_WAIT. Solo disponible en sistemas Unix.
+ *
  * @see tcp_client_free()
- * @param host el nombre del host
+ * @see tcp_server_set_unix_path()
+ * @param host el nombre del host, o "unix:" seguido de la ruta del socket
  * @param port el puerto del host
  * @return puntero a TcpClient, NULL en caso de error (debe liberarse con
  * tcp_client_free() cuando ya no se utilice)
  */
 TcpClient *tcp_client_new(const char *host, uint16_t port);
 
+/**
+ * Establece la forma de delimitar mensajes con el servidor.
+ *
+ * Con TCP_FRAMING_NONE (por defecto), cada solicitud abre una nueva conexión.
+ * Con TCP_FRAMING_LENGTH o TCP_FRAMING_NDJSON, las conexiones quedan abiertas
+ * al terminar una solicitud y se reutilizan en las siguientes, sin repetir el
+ * "handshake" TCP. Con TCP_FRAMING_MUX, todas las solicitudes comparten una
+ * conexión, con varias solicitudes en curso a la vez (ver tcp_client_send()).
+ * El servidor debe delimitar los mensajes de la misma forma.
+ *
+ * @see tcp_server_set_framing()
+ * @param client el cliente TCP
+ * @param framing forma de delimitar los mensajes
+ */
+void tcp_client_set_framing(TcpClient *client, TcpFraming framing);
+
+/**
+ * Limita las conexiones con el servidor y el tiempo que una conexión abierta
+ * puede quedar sin usar.
+ *
+ * Las conexiones forman un "pool": cada solicitud toma una conexión abierta
+ * sin usar (la usada más recientemente) o abre una nueva, y al terminar la
+ * devuelve para las siguientes solicitudes. Antes de reutilizar una conexión se
+ * comprueba que el servidor no la haya cerrado, y las que pasan más de
+ * idle_timeout sin usar se cierran, para no reutilizar las que el servidor está
+ * por cerrar por inactividad. Con max_conns conexiones en uso, las solicitudes
+ * esperan que se devuelva una. Las conexiones solo se reutilizan si se
+ * delimitan los mensajes (ver tcp_client_set_framing()); con
+ * TCP_FRAMING_MUX, el límite no se aplica.
+ *
+ * @param client el cliente TCP
+ * @param max_conns cantidad máxima de conexiones, o 0 sin límite (por defecto)
+ * @param idle_timeout tiempo máximo sin usar de una conexión abierta
+ * (milisegundos), o 0 sin límite (por defecto)
+ */
+void tcp_client_set_pool(TcpClient *client, unsigned int max_conns, unsigned int idle_timeout);
+
+/**
+ * Registra la latencia de las llamadas del cliente (en microsegundos), la
+ * cantidad de llamadas fallidas y la cantidad de conexiones abiertas, como las
+ * métricas "backend.NOMBRE.latency_us", "backend.NOMBRE.errors" y
+ * "backend.NOMBRE.connects".
+ *
+ * @see tcp_metrics_format()
+ * @param client el cliente TCP
+ * @param name nombre del servidor en las métricas (por ejemplo, "weather")
+ */
+void tcp_client_set_metrics(TcpClient *client, const char *name);
+
+/**
+ * Envía una solicitud y espera la respuesta desde el hilo actual.
+ *
+ * Si los mensajes se delimitan, se reutiliza una conexión abierta con el
+ * servidor, si la hay. Si el servidor la cerró por inactividad, la solicitud se
+ * reintenta una vez con una conexión nueva.
+ *
+ * @see tcp_client_set_framing()
+ * @see tcp_client_set_pool()
+ * @param client el cliente TCP
+ * @param request datos a enviar
+ * @param length longitud de los datos a enviar
+ * @param response_len puntero donde guardar la longitud de la respuesta
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return la respuesta recibida (terminada en '\0', debe liberarse con
+ * g_free()), o NULL en caso de error
+ */
+char *tcp_client_call(TcpClient *client, const char *request, size_t length, size_t *response_len, GError **error);
+
+/**
+ * Envía una solicitud cuya respuesta llega en partes (ver
+ * tcp_server_reply_flush()) y ejecuta la función con cada parte a medida que
+ * se recibe, hasta que la función devuelve false.
+ *
+ * Las partes se leen de la conexión solo cuando la función termina con la
+ * anterior, por lo que un cliente lento detiene al servidor en lugar de
+ * acumular la respuesta en memoria. Requiere TCP_FRAMING_LENGTH o
+ * TCP_FRAMING_NDJSON. Una conexión reutilizada que cerró el servidor se
+ * reintenta una vez, solo si todavía no se recibió ninguna parte.
+ *
+ * @param client el cliente TCP
+ * @param request datos a enviar
+ * @param length longitud de los datos a enviar
+ * @param func función a ejecutar con cada parte
+ * @param data parámetro adicional opcional para la función
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return true si la función recibió la última parte, false en caso de error
+ */
+bool tcp_client_stream(TcpClient *client, const char *request, size_t length, TcpClientStreamFunc func, void *data, GError **error);
+
+/**
+ * Envía una solicitud por la conexión compartida, sin esperar la respuesta.
+ *
+ * Requiere TCP_FRAMING_MUX. El servidor responde las solicitudes a medida que
+ * terminan, en cualquier orden; cada respuesta se obtiene con
+ * tcp_client_wait() y el identificador devuelto, que debe llamarse una vez por
+ * cada solicitud enviada. Se puede llamar desde varios hilos.
+ *
+ * @see tcp_client_wait()
+ * @param client el cliente TCP
+ * @param request datos a enviar
+ * @param length longitud de los datos a enviar
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return el identificador de la solicitud, 0 en caso de error
+ */
+uint32_t tcp_client_send(TcpClient *client, const char *request, size_t length, GError **error);
+
+/**
+ * Espera la respuesta a una solicitud enviada con tcp_client_send().
+ *
+ * Mientras espera, el hilo puede recibir respuestas de otras solicitudes, que
+ * quedan disponibles para los hilos que las esperan.
+ *
+ * @see tcp_client_send()
+ * @param client el cliente TCP
+ * @param id identificador de la solicitud
+ * @param response_len puntero donde guardar la longitud de la respuesta
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return la respuesta recibida (terminada en '\0', debe liberarse con
+ * g_free()), o NULL en caso de error
+ */
+char *tcp_client_wait(TcpClient *client, uint32_t id, size_t *response_len, GError **error);
+
 /**
  * Abre una conexión TCP y ejecuta la función dada en un nuevo hilo.
  *
@@ -55,6 +225,35 @@ TcpClient *tcp_client_new(const char *host, uint16_t port);
  */
 GThread *tcp_client_run(TcpClient *client, TcpClientFunc func, void *data, GError **error);
 
+/**
+ * Inicia una solicitud sin esperar la respuesta.
+ *
+ * La solicitud se atiende en un único hilo compartido por todas las solicitudes
+ * del proceso, que se inicia con la primera solicitud, sin crear un hilo por
+ * solicitud: con io_uring, si está disponible, ese hilo envía al kernel las
+ * operaciones connect, send y recv de todas las solicitudes juntas; si no, con
+ * epoll (un "event loop"). Al terminar, se guardan la respuesta o el error y la
+ * duración en la solicitud y se ejecuta la función dada en ese hilo, por lo que
+ * no debe bloquearse. La solicitud debe seguir existiendo hasta entonces. Sin
+ * io_uring ni epoll, o con TCP_FRAMING_MUX, la solicitud se ejecuta como con
+ * tcp_client_call() en un nuevo hilo.
+ *
+ * Si el cliente tiene un límite de conexiones y están todas en uso, se espera
+ * en el hilo actual que se libere una (ver tcp_client_set_pool()).
+ *
+ * Si la solicitud tiene plazo y no termina antes, se cierra la conexión y
+ * termina con el error TCP_CLIENT_TIMEOUT_ERROR. Con io_uring, cada operación
+ * lleva encadenado el plazo y el kernel la cancela al vencer. En un hilo
+ * propio, el plazo limita la espera de la respuesta (no la de conectar); con
+ * TCP_FRAMING_MUX, la conexión compartida sigue abierta para las demás
+ * solicitudes.
+ *
+ * @param request solicitud a enviar, donde se guarda la respuesta
+ * @param callback función a ejecutar al terminar, o NULL
+ * @param data parámetro adicional opcional para la función
+ */
+void tcp_client_start(TcpClientRequest *request, TcpClientCallback callback, void *data);
+
 /**
  * Libera los recursos asignados por tcp_client_new().
  *
@@ -0,0 +1,299 @@
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tcpframe.h"
+
+/* Longitud del prefijo con la longitud del mensaje (bytes) */
+#define LENGTH_PREFIX 4
+/* Longitud del prefijo con la longitud y el identificador del mensaje */
+#define MUX_PREFIX    8
+
+/** Lector incremental de mensajes delimitados */
+struct TcpFrameReader
+{
+  /** @privatesection */
+  TcpFraming  framing;
+  size_t      max_len;
+  GString    *buf;
+  size_t      pos;
+  size_t      scan;
+  uint32_t    id;
+};
+
+TcpFrameReader *tcp_frame_reader_new(TcpFraming framing, size_t max_len)
+{
+  TcpFrameReader *reader = g_new0(TcpFrameReader, 1);
+
+  reader->framing = framing;
+  reader->max_len = max_len;
+  reader->buf = g_string_sized_new(MIN(max_len, 4096));
+
+  return reader;
+}
+
+static void reader_compact(TcpFrameReader *reader)
+{
+  GString *buf = reader->buf;
+
+  if (reader->pos == 0) {
+    return;
+  }
+
+  /* Descartar los mensajes ya leídos */
+  memmove(buf->str, buf->str + reader->pos, buf->len - reader->pos);
+  g_string_truncate(buf, buf->len - reader->pos);
+  reader->scan -= reader->pos;
+  reader->pos = 0;
+}
+
+char *tcp_frame_reader_reserve(TcpFrameReader *reader, size_t size)
+{
+  GString *buf;
+  size_t len;
+
+  g_return_val_if_fail(reader != NULL, NULL);
+
+  reader_compact(reader);
+  buf = reader->buf;
+  len = buf->len;
+  g_string_set_size(buf, len + size);
+  g_string_truncate(buf, len);
+
+  return buf->str + len;
+}
+
+void tcp_frame_reader_commit(TcpFrameReader *reader, size_t length)
+{
+  g_return_if_fail(reader != NULL);
+
+  g_string_set_size(reader->buf, reader->buf->len + length);
+}
+
+void tcp_frame_reader_feed(TcpFrameReader *reader,
+                           const char     *data,
+                           size_t          length)
+{
+  g_return_if_fail(reader != NULL);
+  g_return_if_fail(data != NULL);
+
+  reader_compact(reader);
+  g_string_append_len(reader->buf, data, length);
+}
+
+static uint32_t get_uint32(const unsigned char *data)
+{
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16
+       | (uint32_t)data[2] << 8 | (uint32_t)data[3];
+}
+
+static void set_uint32(unsigned char *data, uint32_t value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static TcpFrameStatus next_length(TcpFrameReader  *reader,
+                                  size_t           prefix_len,
+                                  const char     **frame,
+                                  size_t          *length)
+{
+  const unsigned char *prefix;
+  size_t available = reader->buf->len - reader->pos;
+  uint32_t frame_len;
+
+  if (available < prefix_len) {
+    return TCP_FRAME_INCOMPLETE;
+  }
+
+  prefix = (const unsigned char*)reader->buf->str + reader->pos;
+  frame_len = get_uint32(prefix);
+
+  if (frame_len > reader->max_len) {
+    return TCP_FRAME_TOO_LONG;
+  }
+
+  if (available - prefix_len < frame_len) {
+    return TCP_FRAME_INCOMPLETE;
+  }
+
+  /* El identificador sigue a la longitud */
+  if (prefix_len == MUX_PREFIX) {
+    reader->id = get_uint32(prefix + LENGTH_PREFIX);
+  }
+
+  *frame = (const char*)prefix + prefix_len;
+  *length = frame_len;
+  reader->pos += prefix_len + frame_len;
+  reader->scan = reader->pos;
+
+  return TCP_FRAME_READY;
+}
+
+static TcpFrameStatus next_line(TcpFrameReader  *reader,
+                                const char     **frame,
+                                size_t          *length)
+{
+  GString *buf = reader->buf;
+  const char *start, *end;
+
+  while (TRUE) {
+    /* Buscar el fin de línea solo en los datos no revisados */
+    end = memchr(buf->str + reader->scan, '\n', buf->len - reader->scan);
+    if (end == NULL) {
+      reader->scan = buf->len;
+      return buf->len - reader->pos > reader->max_len ? TCP_FRAME_TOO_LONG
+                                                       : TCP_FRAME_INCOMPLETE;
+    }
+
+    start = buf->str + reader->pos;
+    reader->pos = end - buf->str + 1;
+    reader->scan = reader->pos;
+
+    if (end > start && end[-1] == '\r') {
+      end--;
+    }
+
+    if ((size_t)(end - start) > reader->max_len) {
+      return TCP_FRAME_TOO_LONG;
+    }
+
+    /* Las líneas vacías se ignoran */
+    if (end > start) {
+      *frame = start;
+      *length = end - start;
+      return TCP_FRAME_READY;
+    }
+  }
+}
+
+TcpFrameStatus tcp_frame_reader_next(TcpFrameReader  *reader,
+                                     const char     **frame,
+                                     size_t          *length)
+{
+  size_t available;
+
+  g_return_val_if_fail(reader != NULL, TCP_FRAME_INCOMPLETE);
+  g_return_val_if_fail(frame != NULL, TCP_FRAME_INCOMPLETE);
+  g_return_val_if_fail(length != NULL, TCP_FRAME_INCOMPLETE);
+
+  switch (reader->framing) {
+    case TCP_FRAMING_LENGTH:
+      return next_length(reader, LENGTH_PREFIX, frame, length);
+    case TCP_FRAMING_MUX:
+      return next_length(reader, MUX_PREFIX, frame, length);
+    case TCP_FRAMING_NDJSON:
+      return next_line(reader, frame, length);
+    default:
+      break;
+  }
+
+  /* Sin delimitar, el mensaje es todo lo recibido */
+  available = reader->buf->len - reader->pos;
+  if (available == 0) {
+    return TCP_FRAME_INCOMPLETE;
+  }
+
+  *frame = reader->buf->str + reader->pos;
+  *length = MIN(available, reader->max_len);
+  reader->pos = reader->buf->len;
+  reader->scan = reader->pos;
+
+  return TCP_FRAME_READY;
+}
+
+uint32_t tcp_frame_reader_id(TcpFrameReader *reader)
+{
+  g_return_val_if_fail(reader != NULL, 0);
+
+  return reader->id;
+}
+
+size_t tcp_frame_reader_pending(TcpFrameReader *reader)
+{
+  g_return_val_if_fail(reader != NULL, 0);
+
+  return reader->buf->len - reader->pos;
+}
+
+void tcp_frame_reader_free(TcpFrameReader *reader)
+{
+  if (reader == NULL) {
+    return;
+  }
+
+  g_string_free(reader->buf, TRUE);
+  g_free(reader);
+}
+
+size_t tcp_frame_begin(TcpFraming framing, uint32_t id, GString *out)
+{
+  size_t start;
+
+  g_return_val_if_fail(out != NULL, 0);
+
+  start = out->len;
+
+  /* Reservar el prefijo, cuya longitud se completa en tcp_frame_end() */
+  if (framing == TCP_FRAMING_LENGTH) {
+    g_string_append_len(out, "\0\0\0\0", LENGTH_PREFIX);
+  } else if (framing == TCP_FRAMING_MUX) {
+    g_string_append_len(out, "\0\0\0\0\0\0\0\0", MUX_PREFIX);
+    set_uint32((unsigned char*)out->str + start + LENGTH_PREFIX, id);
+  }
+
+  return start;
+}
+
+void tcp_frame_end(TcpFraming framing, GString *out, size_t start)
+{
+  char *newline;
+
+  g_return_if_fail(out != NULL);
+  g_return_if_fail(start <= out->len);
+
+  switch (framing) {
+    case TCP_FRAMING_LENGTH:
+      g_return_if_fail(out->len - start >= LENGTH_PREFIX);
+      set_uint32((unsigned char*)out->str + start,
+                 out->len - start - LENGTH_PREFIX);
+      break;
+    case TCP_FRAMING_MUX:
+      g_return_if_fail(out->len - start >= MUX_PREFIX);
+      set_uint32((unsigned char*)out->str + start,
+                 out->len - start - MUX_PREFIX);
+      break;
+    case TCP_FRAMING_NDJSON:
+      newline = out->str + start;
+      while ((newline = memchr(newline, '\n', out->str + out->len - newline)) != NULL) {
+        *newline++ = ' ';
+      }
+      g_string_append_c(out, '\n');
+      break;
+    default:
+      break;
+  }
+}
+
+bool tcp_framing_parse(const char *name, TcpFraming *framing)
+{
+  g_return_val_if_fail(name != NULL, false);
+  g_return_val_if_fail(framing != NULL, false);
+
+  if (g_ascii_strcasecmp(name, "none") == 0) {
+    *framing = TCP_FRAMING_NONE;
+  } else if (g_ascii_strcasecmp(name, "length") == 0) {
+    *framing = TCP_FRAMING_LENGTH;
+  } else if (g_ascii_strcasecmp(name, "ndjson") == 0) {
+    *framing = TCP_FRAMING_NDJSON;
+  } else if (g_ascii_strcasecmp(name, "mux") == 0) {
+    *framing = TCP_FRAMING_MUX;
+  } else {
+    return false;
+  }
+
+  return true;
+}
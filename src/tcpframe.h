@@ -0,0 +1,164 @@
+/**
+ * @file tcpframe.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Delimitación de mensajes sobre conexiones TCP persistentes
+ * @version 0.1
+ * @date 2023-04-10
+ *
+ * Un flujo TCP no conserva los límites de los mensajes: una solicitud puede
+ * llegar dividida en varios segmentos, o varias solicitudes en un mismo
+ * segmento. Para que una conexión pueda transportar muchas solicitudes, cada
+ * mensaje se delimita con un prefijo de longitud o con un salto de línea
+ * (JSON delimitado por líneas), y se lee de forma incremental con
+ * TcpFrameReader, tanto en el servidor como en el cliente.
+ *
+ * Con TCP_FRAMING_MUX, cada mensaje lleva además un identificador de solicitud,
+ * que se repite en la respuesta. Así, una conexión puede tener varias
+ * solicitudes en curso y las respuestas pueden llegar en cualquier orden.
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Longitud máxima de un mensaje delimitado (bytes) */
+#define TCP_FRAME_MAX_LEN (64 * 1024)
+
+/** Formas de delimitar mensajes en una conexión */
+typedef enum
+{
+  TCP_FRAMING_NONE,   /**< Sin delimitar: un mensaje por conexión */
+  TCP_FRAMING_LENGTH, /**< Prefijo de 4 bytes con la longitud (big-endian) */
+  TCP_FRAMING_NDJSON, /**< Un mensaje JSON por línea, terminado en '\n' */
+  TCP_FRAMING_MUX,    /**< Prefijo de longitud e identificador (4 bytes cada uno) */
+} TcpFraming;
+
+/** Resultado de tcp_frame_reader_next() */
+typedef enum
+{
+  TCP_FRAME_INCOMPLETE, /**< Faltan datos para completar el mensaje */
+  TCP_FRAME_READY,      /**< Hay un mensaje completo */
+  TCP_FRAME_TOO_LONG,   /**< El mensaje supera la longitud máxima */
+} TcpFrameStatus;
+
+/** Lector incremental de mensajes delimitados */
+typedef struct TcpFrameReader TcpFrameReader;
+
+/**
+ * Crea un nuevo lector de mensajes.
+ *
+ * Con TCP_FRAMING_NONE, el lector devuelve como mensaje todos los datos
+ * recibidos hasta el momento, hasta la longitud máxima.
+ *
+ * @see tcp_frame_reader_free()
+ * @param framing forma de delimitar los mensajes
+ * @param max_len longitud máxima de un mensaje
+ * @return puntero a TcpFrameReader (debe liberarse con tcp_frame_reader_free()
+ * cuando ya no se utilice)
+ */
+TcpFrameReader *tcp_frame_reader_new(TcpFraming framing, size_t max_len);
+
+/**
+ * Reserva espacio al final del lector para recibir datos directamente.
+ *
+ * Los datos escritos en el espacio reservado se agregan al lector con
+ * tcp_frame_reader_commit().
+ *
+ * @param reader lector de mensajes
+ * @param size cantidad de bytes a reservar
+ * @return puntero al espacio reservado
+ */
+char *tcp_frame_reader_reserve(TcpFrameReader *reader, size_t size);
+
+/**
+ * Agrega al lector los datos escritos en el espacio reservado.
+ *
+ * @see tcp_frame_reader_reserve()
+ * @param reader lector de mensajes
+ * @param length cantidad de bytes escritos
+ */
+void tcp_frame_reader_commit(TcpFrameReader *reader, size_t length);
+
+/**
+ * Agrega datos recibidos al lector.
+ *
+ * @param reader lector de mensajes
+ * @param data datos recibidos
+ * @param length longitud de los datos
+ */
+void tcp_frame_reader_feed(TcpFrameReader *reader, const char *data, size_t length);
+
+/**
+ * Obtiene el siguiente mensaje completo del lector.
+ *
+ * El mensaje no incluye el prefijo ni el salto de línea, y solo es válido hasta
+ * la próxima llamada a una función del lector.
+ *
+ * @param reader lector de mensajes
+ * @param frame puntero donde guardar el inicio del mensaje
+ * @param length puntero donde guardar la longitud del mensaje
+ * @return TCP_FRAME_READY si se obtuvo un mensaje, TCP_FRAME_INCOMPLETE si
+ * faltan datos o TCP_FRAME_TOO_LONG si el mensaje supera la longitud máxima
+ */
+TcpFrameStatus tcp_frame_reader_next(TcpFrameReader *reader, const char **frame, size_t *length);
+
+/**
+ * Devuelve el identificador del último mensaje obtenido con
+ * tcp_frame_reader_next(), o 0 si la forma de delimitar no es TCP_FRAMING_MUX.
+ *
+ * @param reader lector de mensajes
+ * @return identificador del mensaje
+ */
+uint32_t tcp_frame_reader_id(TcpFrameReader *reader);
+
+/**
+ * Devuelve la cantidad de bytes recibidos que todavía no se leyeron.
+ *
+ * @param reader lector de mensajes
+ * @return cantidad de bytes pendientes
+ */
+size_t tcp_frame_reader_pending(TcpFrameReader *reader);
+
+/**
+ * Libera los recursos asignados por tcp_frame_reader_new().
+ *
+ * @param reader puntero a TcpFrameReader
+ */
+void tcp_frame_reader_free(TcpFrameReader *reader);
+
+/**
+ * Comienza un mensaje delimitado al final de out.
+ *
+ * Luego de agregar el contenido del mensaje, debe llamarse a tcp_frame_end()
+ * con la posición devuelta.
+ *
+ * @param framing forma de delimitar el mensaje
+ * @param id identificador del mensaje (solo con TCP_FRAMING_MUX)
+ * @param out buffer de salida
+ * @return posición del mensaje en out
+ */
+size_t tcp_frame_begin(TcpFraming framing, uint32_t id, GString *out);
+
+/**
+ * Termina un mensaje delimitado comenzado con tcp_frame_begin().
+ *
+ * Con TCP_FRAMING_NDJSON, los saltos de línea del contenido se reemplazan por
+ * espacios, que son equivalentes fuera de las cadenas JSON.
+ *
+ * @param framing forma de delimitar el mensaje
+ * @param out buffer de salida
+ * @param start posición devuelta por tcp_frame_begin()
+ */
+void tcp_frame_end(TcpFraming framing, GString *out, size_t start);
+
+/**
+ * Obtiene la forma de delimitar mensajes a partir de su nombre ("none",
+ * "length", "ndjson" o "mux").
+ *
+ * @param name nombre de la forma de delimitar mensajes
+ * @param framing puntero donde guardar la forma de delimitar mensajes
+ * @return true si el nombre es válido, false en caso contrario
+ */
+bool tcp_framing_parse(const char *name, TcpFraming *framing);
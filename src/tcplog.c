@@ -0,0 +1,414 @@
+#include <glib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <pthread.h>
+#endif
+
+#include "tcplog.h"
+
+/* Longitud de un registro, con su encabezado (bytes) */
+#define LOG_RECORD_LEN 256
+/* Cantidad de registros del buffer de cada hilo (potencia de 2) */
+#define LOG_RING_SIZE  1024
+/* Intervalo de escritura de los registros pendientes (milisegundos) */
+#define LOG_INTERVAL   10
+/* Nivel de registro por defecto */
+#define LOG_LEVEL      TCP_LOG_INFO
+
+/** @private Mensaje de registro */
+typedef struct TcpLogRecord
+{
+  gint64   time;
+  uint16_t length;
+  uint8_t  level;
+  char     text[LOG_RECORD_LEN - sizeof(gint64) - sizeof(uint32_t)];
+} TcpLogRecord;
+
+/**
+ * @private Buffer circular de un hilo: solo el hilo agrega registros (tail) y
+ * solo el hilo de escritura los quita (head), sin bloqueos.
+ */
+typedef struct TcpLogRing
+{
+  TcpLogRecord       records[LOG_RING_SIZE];
+  guint              head;
+  guint              tail;
+  guint              dropped;
+  guint              sampled;
+  gint               closed;
+  struct TcpLogRing *next;
+} TcpLogRing;
+
+static void ring_close(void *data);
+
+/* Nivel de registro y muestreo del contenido de las solicitudes */
+static gint log_level = LOG_LEVEL;
+static gint log_sampling = 0;
+
+/* Buffer del hilo actual, que se libera al terminar el hilo */
+static GPrivate log_ring = G_PRIVATE_INIT(ring_close);
+
+/* Buffers de todos los hilos y estado del hilo de escritura */
+static GMutex      log_lock;
+static GCond       log_cond;
+static GCond       log_flushed;
+static TcpLogRing *log_rings;
+static GThread    *log_writer;
+static bool        log_stopping;
+static gint        log_stopped;
+static guint       flush_requested;
+static guint       flush_done;
+
+/* Nombres de los niveles de registro */
+static const char *level_names[] = {
+  [TCP_LOG_ERROR]   = "error",
+  [TCP_LOG_WARNING] = "warning",
+  [TCP_LOG_INFO]    = "info",
+  [TCP_LOG_DEBUG]   = "debug",
+};
+
+void tcp_log_set_level(TcpLogLevel level)
+{
+  g_atomic_int_set(&log_level, level);
+}
+
+void tcp_log_set_sampling(unsigned int every)
+{
+  g_atomic_int_set(&log_sampling, MIN(every, G_MAXINT));
+}
+
+bool tcp_log_enabled(TcpLogLevel level)
+{
+  return (gint)level <= g_atomic_int_get(&log_level);
+}
+
+static void ring_close(void *data)
+{
+  TcpLogRing *ring = (TcpLogRing*)data;
+
+  /* El hilo de escritura libera el buffer una vez vacío */
+  g_atomic_int_set(&ring->closed, TRUE);
+}
+
+static TcpLogRing *ring_get(void)
+{
+  TcpLogRing *ring = g_private_get(&log_ring);
+
+  if (G_LIKELY(ring != NULL)) {
+    return ring;
+  }
+
+  ring = g_new0(TcpLogRing, 1);
+  g_private_set(&log_ring, ring);
+
+  g_mutex_lock(&log_lock);
+  ring->next = log_rings;
+  log_rings = ring;
+  g_mutex_unlock(&log_lock);
+
+  return ring;
+}
+
+bool tcp_log_sample(void)
+{
+  guint every = g_atomic_int_get(&log_sampling);
+  TcpLogRing *ring;
+
+  if (G_LIKELY(every == 0)) {
+    return false;
+  }
+
+  /* Contador propio de cada hilo, sin sincronizar */
+  ring = ring_get();
+  if (++ring->sampled < every) {
+    return false;
+  }
+  ring->sampled = 0;
+
+  return true;
+}
+
+static void write_record(GString *out, TcpLogRecord *record)
+{
+  static gint64 cached_second = -1;
+  static char cached_time[16];
+  GDateTime *date_time;
+  gint64 second = record->time / G_USEC_PER_SEC;
+  char *formatted;
+
+  /* La hora se formatea a lo sumo una vez por segundo */
+  if (second != cached_second) {
+    date_time = g_date_time_new_from_unix_local(second);
+    formatted = g_date_time_format(date_time, "%H:%M:%S");
+    g_strlcpy(cached_time, formatted, sizeof(cached_time));
+    g_free(formatted);
+    g_date_time_unref(date_time);
+    cached_second = second;
+  }
+
+  g_string_append_printf(out, "%s.%03d %s: %.*s\n",
+                         cached_time,
+                         (int)(record->time % G_USEC_PER_SEC / 1000),
+                         level_names[record->level],
+                         (int)record->length, record->text);
+}
+
+static void write_pending(void)
+{
+  GString *out = g_string_new(NULL);
+  GString *err = g_string_new(NULL);
+  TcpLogRing *rings, *ring, *first, **link;
+  TcpLogRecord *record;
+  guint dropped = 0;
+  guint count;
+
+  /* Los buffers nuevos se agregan al principio y solo este hilo los quita */
+  g_mutex_lock(&log_lock);
+  rings = log_rings;
+  g_mutex_unlock(&log_lock);
+
+  /* Mezclar los registros de todos los hilos en orden de hora */
+  while (TRUE) {
+    first = NULL;
+    for (ring = rings; ring != NULL; ring = ring->next) {
+      if (ring->head != (guint)g_atomic_int_get(&ring->tail)
+          && (first == NULL
+              || ring->records[ring->head % LOG_RING_SIZE].time
+                 < first->records[first->head % LOG_RING_SIZE].time)) {
+        first = ring;
+      }
+    }
+    if (first == NULL) {
+      break;
+    }
+
+    record = &first->records[first->head % LOG_RING_SIZE];
+    write_record(record->level <= TCP_LOG_WARNING ? err : out, record);
+    g_atomic_int_set(&first->head, first->head + 1);
+  }
+
+  for (ring = rings; ring != NULL; ring = ring->next) {
+    count = g_atomic_int_get(&ring->dropped);
+    if (count > 0) {
+      g_atomic_int_add(&ring->dropped, -(gint)count);
+      dropped += count;
+    }
+  }
+  if (dropped > 0) {
+    g_string_append_printf(err, "Mensajes de registro descartados: %u\n",
+                           dropped);
+  }
+
+  fwrite(out->str, 1, out->len, stdout);
+  fwrite(err->str, 1, err->len, stderr);
+  fflush(stdout);
+  fflush(stderr);
+  g_string_free(out, TRUE);
+  g_string_free(err, TRUE);
+
+  /* Liberar los buffers vacíos de los hilos que terminaron */
+  g_mutex_lock(&log_lock);
+  for (link = &log_rings; (ring = *link) != NULL;) {
+    if (g_atomic_int_get(&ring->closed)
+        && ring->head == (guint)g_atomic_int_get(&ring->tail)) {
+      *link = ring->next;
+      g_free(ring);
+    } else {
+      link = &ring->next;
+    }
+  }
+  g_mutex_unlock(&log_lock);
+}
+
+static void *run_writer(void *data)
+{
+  guint requested;
+  bool stopping;
+
+  g_mutex_lock(&log_lock);
+
+  do {
+    requested = flush_requested;
+    stopping = log_stopping;
+    g_mutex_unlock(&log_lock);
+
+    write_pending();
+
+    g_mutex_lock(&log_lock);
+    flush_done = requested;
+    g_cond_broadcast(&log_flushed);
+
+    if (!stopping && flush_requested == requested) {
+      g_cond_wait_until(&log_cond, &log_lock,
+                        g_get_monotonic_time() + LOG_INTERVAL * 1000);
+    }
+  } while (!stopping);
+
+  g_mutex_unlock(&log_lock);
+
+  return NULL;
+}
+
+static void log_exit(void)
+{
+  GThread *writer;
+
+  /* Escribir lo pendiente; luego, los mensajes se escriben en el acto */
+  g_mutex_lock(&log_lock);
+  writer = log_writer;
+  log_stopping = true;
+  g_cond_signal(&log_cond);
+  g_mutex_unlock(&log_lock);
+
+  if (writer != NULL) {
+    g_thread_join(writer);
+  }
+
+  g_mutex_lock(&log_lock);
+  log_writer = NULL;
+  g_atomic_int_set(&log_stopped, TRUE);
+  g_mutex_unlock(&log_lock);
+}
+
+#ifdef G_OS_UNIX
+static void fork_prepare(void)
+{
+  g_mutex_lock(&log_lock);
+}
+
+static void fork_parent(void)
+{
+  g_mutex_unlock(&log_lock);
+}
+
+static void fork_child(void)
+{
+  TcpLogRing *current = g_private_get(&log_ring);
+  TcpLogRing *ring, *next;
+
+  /* El proceso original escribe lo pendiente; los otros hilos no existen */
+  for (ring = log_rings; ring != NULL; ring = next) {
+    next = ring->next;
+    if (ring != current) {
+      g_free(ring);
+    }
+  }
+
+  log_rings = current;
+  if (current != NULL) {
+    current->head = current->tail;
+    current->next = NULL;
+  }
+
+  /* El hilo de escritura se crea de nuevo con el próximo mensaje */
+  log_writer = NULL;
+  g_mutex_unlock(&log_lock);
+}
+#endif
+
+static void writer_start(void)
+{
+  static bool registered = false;
+
+  g_mutex_lock(&log_lock);
+
+  if (log_writer == NULL && !log_stopping) {
+    if (!registered) {
+      atexit(log_exit);
+#ifdef G_OS_UNIX
+      pthread_atfork(fork_prepare, fork_parent, fork_child);
+#endif
+      registered = true;
+    }
+    log_stopping = false;
+    log_writer = g_thread_new("tcp-log", run_writer, NULL);
+  }
+
+  g_mutex_unlock(&log_lock);
+}
+
+void tcp_log(TcpLogLevel level, const char *format, ...)
+{
+  TcpLogRing *ring;
+  TcpLogRecord *record;
+  va_list args;
+  guint tail;
+  int length;
+
+  g_return_if_fail(format != NULL);
+
+  if (!tcp_log_enabled(level)) {
+    return;
+  }
+
+  if (G_UNLIKELY(g_atomic_pointer_get(&log_writer) == NULL)) {
+    writer_start();
+  }
+
+  /* Al terminar el programa, escribir directamente */
+  if (G_UNLIKELY(g_atomic_int_get(&log_stopped))) {
+    va_start(args, format);
+    vfprintf(level <= TCP_LOG_WARNING ? stderr : stdout, format, args);
+    va_end(args);
+    fputc('\n', level <= TCP_LOG_WARNING ? stderr : stdout);
+    return;
+  }
+
+  /* Con el buffer lleno, descartar en lugar de esperar */
+  ring = ring_get();
+  tail = ring->tail;
+  if (tail - (guint)g_atomic_int_get(&ring->head) >= LOG_RING_SIZE) {
+    g_atomic_int_inc(&ring->dropped);
+    return;
+  }
+
+  record = &ring->records[tail % LOG_RING_SIZE];
+  va_start(args, format);
+  length = g_vsnprintf(record->text, sizeof(record->text), format, args);
+  va_end(args);
+
+  record->time = g_get_real_time();
+  record->level = level;
+  record->length = CLAMP(length, 0, (int)sizeof(record->text) - 1);
+
+  /* El registro queda visible para el hilo de escritura */
+  g_atomic_int_set(&ring->tail, tail + 1);
+}
+
+void tcp_log_flush(void)
+{
+  guint requested;
+
+  g_mutex_lock(&log_lock);
+
+  if (log_writer != NULL) {
+    requested = ++flush_requested;
+    g_cond_signal(&log_cond);
+    while ((gint)(flush_done - requested) < 0 && log_writer != NULL) {
+      g_cond_wait(&log_flushed, &log_lock);
+    }
+  }
+
+  g_mutex_unlock(&log_lock);
+}
+
+bool tcp_log_level_parse(const char *name, TcpLogLevel *level)
+{
+  g_return_val_if_fail(name != NULL, false);
+  g_return_val_if_fail(level != NULL, false);
+
+  for (int i = 0; i < (int)G_N_ELEMENTS(level_names); i++) {
+    if (g_ascii_strcasecmp(name, level_names[i]) == 0) {
+      *level = (TcpLogLevel)i;
+      return true;
+    }
+  }
+
+  return false;
+}
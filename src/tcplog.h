@@ -0,0 +1,93 @@
+/**
+ * @file tcplog.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Registro de mensajes asincrónico para los servidores
+ * @version 0.1
+ * @date 2023-04-14
+ *
+ * Escribir con printf() en cada solicitud serializa a todos los hilos en el
+ * bloqueo de stdio y los detiene si la terminal o la tubería de salida es
+ * lenta. Con tcp_log(), cada hilo copia el mensaje en su propio buffer
+ * circular, sin bloqueos, y un hilo aparte los escribe en orden cada pocos
+ * milisegundos. Los mensajes de un nivel deshabilitado cuestan una
+ * comparación, sin formatear nada; si el buffer de un hilo se llena, sus
+ * mensajes se descartan (y se cuentan) en lugar de detener al hilo.
+ *
+ * El contenido de las solicitudes y respuestas no se registra por defecto, y
+ * puede registrarse solo para una de cada N solicitudes con tcp_log_sample().
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+
+/** Niveles de los mensajes de registro, de mayor a menor importancia */
+typedef enum
+{
+  TCP_LOG_ERROR,   /**< Errores (se escriben en stderr) */
+  TCP_LOG_WARNING, /**< Avisos, como la sobrecarga (se escriben en stderr) */
+  TCP_LOG_INFO,    /**< Inicio, detención y contenido muestreado */
+  TCP_LOG_DEBUG,   /**< Eventos de cada conexión */
+} TcpLogLevel;
+
+/**
+ * Establece el nivel de registro: se escriben los mensajes de ese nivel y de
+ * los más importantes. Por defecto, TCP_LOG_INFO.
+ *
+ * @param level nivel de registro
+ */
+void tcp_log_set_level(TcpLogLevel level);
+
+/**
+ * Establece cada cuántas solicitudes se registra su contenido.
+ *
+ * @see tcp_log_sample()
+ * @param every registrar una de cada every solicitudes, o 0 para ninguna (por
+ * defecto)
+ */
+void tcp_log_set_sampling(unsigned int every);
+
+/**
+ * Indica si se escriben los mensajes de un nivel.
+ *
+ * @param level nivel del mensaje
+ * @return true si el nivel está habilitado, false en caso contrario
+ */
+bool tcp_log_enabled(TcpLogLevel level);
+
+/**
+ * Indica si se registra el contenido de la solicitud actual, según el
+ * muestreo configurado con tcp_log_set_sampling(). Se debe llamar una vez por
+ * solicitud.
+ *
+ * @return true si se registra el contenido, false en caso contrario
+ */
+bool tcp_log_sample(void);
+
+/**
+ * Registra un mensaje con formato, si su nivel está habilitado.
+ *
+ * El mensaje se escribe más tarde desde otro hilo, con la hora y el nivel, y
+ * se recorta si supera la longitud de un registro (alrededor de 240 bytes). No
+ * hace falta agregar un salto de línea al final.
+ *
+ * @param level nivel del mensaje
+ * @param format formato al estilo printf()
+ */
+void tcp_log(TcpLogLevel level, const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+/**
+ * Escribe los mensajes pendientes de todos los hilos y espera a que se
+ * terminen de escribir. Se llama automáticamente al terminar el programa.
+ */
+void tcp_log_flush(void);
+
+/**
+ * Obtiene el nivel de registro a partir de su nombre ("error", "warning",
+ * "info" o "debug").
+ *
+ * @param name nombre del nivel
+ * @param level puntero donde guardar el nivel
+ * @return true si el nombre es válido, false en caso contrario
+ */
+bool tcp_log_level_parse(const char *name, TcpLogLevel *level);
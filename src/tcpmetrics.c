@@ -0,0 +1,320 @@
+#include <glib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#include "tcpmetrics.h"
+
+/* Cantidad máxima de métricas registradas */
+#define METRICS_MAX     64
+/* Longitud máxima del nombre de una métrica */
+#define METRIC_NAME_LEN 64
+/* Subdivisiones de cada potencia de 2 en los histogramas */
+#define SUB_BITS        4
+#define SUB_BUCKETS     (1 << SUB_BITS)
+/* Mayor potencia de 2 de los histogramas: los valores mayores se acotan */
+#define MAX_EXPONENT    40
+#define MAX_VALUE       (((gint64)1 << (MAX_EXPONENT + 1)) - 1)
+#define BUCKETS         ((MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS)
+
+/** Contador o valor instantáneo */
+struct TcpCounter
+{
+  /** @privatesection */
+  gssize value;
+};
+
+/** Histograma de valores */
+struct TcpHistogram
+{
+  /** @privatesection */
+  gssize count;
+  gssize sum;
+  gssize buckets[BUCKETS];
+};
+
+/** @private Tipos de métricas */
+typedef enum
+{
+  METRIC_COUNTER,
+  METRIC_HISTOGRAM,
+  METRIC_RATIO,
+} TcpMetricKind;
+
+/** @private Métrica registrada */
+typedef struct TcpMetric
+{
+  char          name[METRIC_NAME_LEN];
+  TcpMetricKind kind;
+  union
+  {
+    TcpCounter   counter;
+    TcpHistogram histogram;
+    struct
+    {
+      TcpCounter *hits;
+      TcpCounter *misses;
+    } ratio;
+  };
+} TcpMetric;
+
+/**
+ * @private Métricas de todos los procesos, en memoria compartida: los
+ * procesos creados con fork() actualizan las mismas métricas.
+ */
+typedef struct TcpMetrics
+{
+  int       n_metrics;
+  TcpMetric metrics[METRICS_MAX];
+} TcpMetrics;
+
+/* Registro de métricas */
+static GMutex      metrics_lock;
+static TcpMetrics *metrics;
+
+static TcpMetrics *metrics_get(void)
+{
+  if (metrics != NULL) {
+    return metrics;
+  }
+
+#ifdef G_OS_UNIX
+  metrics = mmap(NULL, sizeof(TcpMetrics), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (metrics == MAP_FAILED) {
+    metrics = NULL;
+  }
+#endif
+
+  /* Sin memoria compartida, las métricas son solo de este proceso */
+  if (metrics == NULL) {
+    metrics = g_new0(TcpMetrics, 1);
+  }
+
+  return metrics;
+}
+
+static TcpMetric *metrics_register(const char *name, TcpMetricKind kind)
+{
+  TcpMetrics *all;
+  TcpMetric *metric = NULL;
+
+  g_return_val_if_fail(name != NULL, NULL);
+
+  g_mutex_lock(&metrics_lock);
+  all = metrics_get();
+
+  for (int i = 0; i < all->n_metrics; i++) {
+    if (all->metrics[i].kind == kind
+        && strcmp(all->metrics[i].name, name) == 0) {
+      metric = &all->metrics[i];
+      break;
+    }
+  }
+
+  if (metric == NULL && all->n_metrics < METRICS_MAX) {
+    metric = &all->metrics[all->n_metrics++];
+    g_strlcpy(metric->name, name, sizeof(metric->name));
+    metric->kind = kind;
+  }
+
+  g_mutex_unlock(&metrics_lock);
+
+  return metric;
+}
+
+TcpCounter *tcp_metrics_counter(const char *name)
+{
+  TcpMetric *metric = metrics_register(name, METRIC_COUNTER);
+
+  return metric != NULL ? &metric->counter : NULL;
+}
+
+TcpHistogram *tcp_metrics_histogram(const char *name)
+{
+  TcpMetric *metric = metrics_register(name, METRIC_HISTOGRAM);
+
+  return metric != NULL ? &metric->histogram : NULL;
+}
+
+void tcp_metrics_ratio(const char *name, TcpCounter *hits, TcpCounter *misses)
+{
+  TcpMetric *metric = metrics_register(name, METRIC_RATIO);
+
+  if (metric != NULL) {
+    metric->ratio.hits = hits;
+    metric->ratio.misses = misses;
+  }
+}
+
+void tcp_counter_add(TcpCounter *counter, gint64 delta)
+{
+  if (counter != NULL) {
+    g_atomic_pointer_add(&counter->value, delta);
+  }
+}
+
+gint64 tcp_counter_get(TcpCounter *counter)
+{
+  return counter != NULL
+       ? (gint64)(gssize)g_atomic_pointer_get(&counter->value)
+       : 0;
+}
+
+static int last_bit(uint64_t bits)
+{
+#ifdef __GNUC__
+  return 63 - __builtin_clzll(bits);
+#else
+  int n = 0;
+
+  while (bits >>= 1) {
+    n++;
+  }
+
+  return n;
+#endif
+}
+
+static int bucket_index(gint64 value)
+{
+  int exponent;
+
+  if (value < SUB_BUCKETS) {
+    return (int)value;
+  }
+
+  /* Potencia de 2 y subdivisión lineal dentro de ella */
+  exponent = last_bit(value);
+
+  return (exponent - SUB_BITS + 1) * SUB_BUCKETS
+       + (int)((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static gint64 bucket_highest(int index)
+{
+  int shift;
+
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+
+  shift = index / SUB_BUCKETS - 1;
+
+  return ((gint64)(SUB_BUCKETS + index % SUB_BUCKETS) << shift)
+       + ((gint64)1 << shift) - 1;
+}
+
+void tcp_histogram_record(TcpHistogram *histogram, gint64 value)
+{
+  if (histogram == NULL) {
+    return;
+  }
+
+  value = CLAMP(value, 0, MAX_VALUE);
+  g_atomic_pointer_add(&histogram->buckets[bucket_index(value)], 1);
+  g_atomic_pointer_add(&histogram->sum, value);
+  g_atomic_pointer_add(&histogram->count, 1);
+}
+
+gint64 tcp_histogram_percentile(TcpHistogram *histogram, double percentile)
+{
+  gssize counts[BUCKETS];
+  gint64 total = 0, target, seen = 0;
+  double rank;
+
+  if (histogram == NULL) {
+    return 0;
+  }
+
+  /* Las cubetas se copian primero, ya que otros hilos siguen agregando */
+  for (int i = 0; i < BUCKETS; i++) {
+    counts[i] = (gssize)g_atomic_pointer_get(&histogram->buckets[i]);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  /* Posición del percentil entre los valores, redondeada hacia arriba */
+  rank = CLAMP(percentile, 0, 100) / 100 * total;
+  target = (gint64)rank;
+  if (target < rank || target == 0) {
+    target++;
+  }
+
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= target) {
+      return bucket_highest(i);
+    }
+  }
+
+  return MAX_VALUE;
+}
+
+static void format_histogram(GString *out, TcpMetric *metric)
+{
+  TcpHistogram *histogram = &metric->histogram;
+  gint64 count = (gssize)g_atomic_pointer_get(&histogram->count);
+  gint64 sum = (gssize)g_atomic_pointer_get(&histogram->sum);
+
+  g_string_append_printf(out, "%s.count %" PRId64 "\n",
+                         metric->name, count);
+  g_string_append_printf(out, "%s.mean %" PRId64 "\n",
+                         metric->name, count > 0 ? sum / count : 0);
+  g_string_append_printf(out, "%s.p50 %" PRId64 "\n",
+                         metric->name, tcp_histogram_percentile(histogram, 50));
+  g_string_append_printf(out, "%s.p99 %" PRId64 "\n",
+                         metric->name, tcp_histogram_percentile(histogram, 99));
+  g_string_append_printf(out, "%s.p999 %" PRId64 "\n",
+                         metric->name,
+                         tcp_histogram_percentile(histogram, 99.9));
+}
+
+static void format_ratio(GString *out, TcpMetric *metric)
+{
+  gint64 hits = tcp_counter_get(metric->ratio.hits);
+  gint64 misses = tcp_counter_get(metric->ratio.misses);
+
+  g_string_append_printf(out, "%s %.4f\n", metric->name,
+                         hits + misses > 0
+                           ? (double)hits / (hits + misses)
+                           : 0.0);
+}
+
+void tcp_metrics_format(GString *out)
+{
+  TcpMetrics *all;
+  TcpMetric *metric;
+  int n_metrics;
+
+  g_return_if_fail(out != NULL);
+
+  g_mutex_lock(&metrics_lock);
+  all = metrics_get();
+  n_metrics = all->n_metrics;
+  g_mutex_unlock(&metrics_lock);
+
+  for (int i = 0; i < n_metrics; i++) {
+    metric = &all->metrics[i];
+
+    switch (metric->kind) {
+      case METRIC_COUNTER:
+        g_string_append_printf(out, "%s %" PRId64 "\n", metric->name,
+                               tcp_counter_get(&metric->counter));
+        break;
+      case METRIC_HISTOGRAM:
+        format_histogram(out, metric);
+        break;
+      case METRIC_RATIO:
+        format_ratio(out, metric);
+        break;
+    }
+  }
+}
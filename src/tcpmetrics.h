@@ -0,0 +1,102 @@
+/**
+ * @file tcpmetrics.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Contadores e histogramas de latencia para exponer el estado de los
+ * servidores
+ * @version 0.1
+ * @date 2023-04-16
+ *
+ * Las métricas se registran por nombre una sola vez y luego se actualizan con
+ * operaciones atómicas, sin bloqueos. Los histogramas tienen cubetas
+ * logarítmicas con 16 subdivisiones por potencia de 2 (al estilo HDR), de modo
+ * que los percentiles tienen un error relativo menor al 7% en todo el rango,
+ * desde microsegundos hasta horas.
+ *
+ * Las métricas viven en memoria compartida: las que se registran antes de
+ * crear los procesos de trabajo (ver tcp_server_set_workers()) suman los
+ * valores de todos los procesos. Por eso deben registrarse antes de
+ * tcp_server_run().
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Contador o valor instantáneo (por ejemplo, conexiones abiertas) */
+typedef struct TcpCounter TcpCounter;
+
+/** Histograma de valores, como latencias en microsegundos */
+typedef struct TcpHistogram TcpHistogram;
+
+/**
+ * Obtiene el contador con un nombre, y lo registra si no existe.
+ *
+ * @param name nombre del contador (por ejemplo, "server.connections")
+ * @return el contador, o NULL si no hay lugar para más métricas (las
+ * funciones de TcpCounter aceptan NULL y no hacen nada)
+ */
+TcpCounter *tcp_metrics_counter(const char *name);
+
+/**
+ * Obtiene el histograma con un nombre, y lo registra si no existe.
+ *
+ * @param name nombre del histograma (por ejemplo, "server.handler_us")
+ * @return el histograma, o NULL si no hay lugar para más métricas (las
+ * funciones de TcpHistogram aceptan NULL y no hacen nada)
+ */
+TcpHistogram *tcp_metrics_histogram(const char *name);
+
+/**
+ * Registra la proporción de aciertos de un par de contadores, que se calcula
+ * al exponer las métricas como hits / (hits + misses).
+ *
+ * @param name nombre de la proporción (por ejemplo, "cache.weather.hit_ratio")
+ * @param hits contador de aciertos
+ * @param misses contador de fallos
+ */
+void tcp_metrics_ratio(const char *name, TcpCounter *hits, TcpCounter *misses);
+
+/**
+ * Suma un valor a un contador; con un valor negativo, lo resta.
+ *
+ * @param counter contador
+ * @param delta valor a sumar
+ */
+void tcp_counter_add(TcpCounter *counter, gint64 delta);
+
+/**
+ * Obtiene el valor actual de un contador.
+ *
+ * @param counter contador
+ * @return valor del contador, o 0 si es NULL
+ */
+gint64 tcp_counter_get(TcpCounter *counter);
+
+/**
+ * Agrega un valor a un histograma.
+ *
+ * @param histogram histograma
+ * @param value valor a agregar (los negativos se cuentan como 0)
+ */
+void tcp_histogram_record(TcpHistogram *histogram, gint64 value);
+
+/**
+ * Obtiene un percentil de los valores agregados a un histograma.
+ *
+ * @param histogram histograma
+ * @param percentile percentil entre 0 y 100 (por ejemplo, 99.9)
+ * @return el mayor valor equivalente de la cubeta del percentil, o 0 si el
+ * histograma está vacío
+ */
+gint64 tcp_histogram_percentile(TcpHistogram *histogram, double percentile);
+
+/**
+ * Escribe todas las métricas registradas en texto plano, una por línea con la
+ * forma "nombre valor". De cada histograma se escriben la cantidad de valores,
+ * el promedio y los percentiles 50, 99 y 99.9 ("nombre.count", "nombre.mean",
+ * "nombre.p50", "nombre.p99" y "nombre.p999").
+ *
+ * @param out texto donde agregar las métricas
+ */
+void tcp_metrics_format(GString *out);
@@ -1,4 +1,6 @@
 #include <glib.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,9 +10,36 @@
 #include <unistd.h>
 
 #ifdef G_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* Modos con reactor: las conexiones se atienden desde un único hilo */
+#if defined(HAVE_EPOLL) || defined(HAVE_LIBURING)
+#define HAVE_REACTOR
+#include <sys/eventfd.h>
 #endif
 
 #ifdef G_OS_WIN32
@@ -18,7 +47,11 @@
 #include <ws2tcpip.h>
 #endif
 
+#include "tcplog.h"
+#include "tcpmetrics.h"
 #include "tcpserver.h"
+#include "tcptimer.h"
+#include "tcptrace.h"
 
 /* Cantidad máxima de conexiones */
 #define MAX_CONN      10
@@ -28,34 +61,345 @@
 #define MAX_THREADS   g_get_num_processors()
 /* Utilizar threads exclusivos o no */
 #define EXC_THREADS   false
+/* Modo de atención de conexiones */
+#define SERVER_MODE   TCP_SERVER_MODE_THREADS
+/* Cantidad de sockets de escucha (SO_REUSEPORT) */
+#define SHARDS        1
+/* Política de afinidad de hilos */
+#define AFFINITY      TCP_SERVER_AFFINITY_NONE
+/* Forma de delimitar mensajes */
+#define FRAMING       TCP_FRAMING_NONE
+/* Tiempo máximo de inactividad de una conexión (milisegundos) */
+#define IDLE_TIMEOUT  30000
+/* Plazos de lectura de una solicitud y de escritura de una respuesta */
+#define READ_TIMEOUT  10000
+#define WRITE_TIMEOUT 10000
+/* Plazo total de una conexión (0 sin plazo) */
+#define TOTAL_TIMEOUT 0
+/* Longitud máxima de una solicitud sin delimitar (bytes) */
+#define MAX_MSG_LEN   1024
+/* Solicitudes en curso por conexión con TCP_FRAMING_MUX */
+#define MAX_INFLIGHT  64
+/* Límite máximo de solicitudes en curso en todo el servidor */
+#define LIMIT_MAX     1024
+/* Límite mínimo y límite inicial de solicitudes en curso */
+#define LIMIT_MIN     4
+#define LIMIT_INITIAL 128
+/* Factor de reducción del límite al detectar congestión */
+#define LIMIT_BACKOFF 0.9
+/* Latencia tolerada: múltiplo de la mínima más un margen (microsegundos) */
+#define LIMIT_TOLERANCE 2
+#define LIMIT_SLACK   1000
+/* Cantidad de muestras tras las que se renueva la latencia mínima */
+#define LIMIT_WINDOW  1000
+/* Intervalo mínimo entre avisos de sobrecarga (microsegundos) */
+#define LIMIT_REPORT  G_USEC_PER_SEC
+/* Tiempo máximo para leer la solicitud de una conexión rechazada */
+#define REJECT_TIMEOUT 1000
+/* Respuesta a las solicitudes rechazadas por sobrecarga */
+#define OVERLOADED_REPLY "{\"error\":\"overloaded\"}"
+/* Partes acumuladas de una respuesta antes de enviarlas (bytes) */
+#define STREAM_CHUNK  16384
+/* Partes sin enviar por conexión antes de pausar la función (bytes) */
+#define STREAM_WINDOW 65536
+/* Cantidad máxima de eventos por llamada a epoll_wait() */
+#define MAX_EVENTS    256
+/* Cantidad de entradas de la cola de envío de io_uring */
+#define URING_ENTRIES 1024
+/* Cantidad de buffers provistos al kernel para recibir (potencia de 2) */
+#define URING_BUFS    1024
+/* Identificador del grupo de buffers provistos */
+#define URING_BGID    0
+/* Señal que inicia el reinicio sin cortes */
+#define RESTART_SIGNAL SIGUSR2
+/* Variable de entorno con el socket para recibir los sockets de escucha */
+#define HANDOFF_ENV   "TCP_SERVER_HANDOFF_FD"
+/* Tiempo máximo de espera a que el nuevo proceso esté listo (milisegundos) */
+#define HANDOFF_TIMEOUT 10000
+/* Cantidad máxima de sockets de escucha que se traspasan */
+#define HANDOFF_MAX_FDS 64
+/* Procesos de trabajo del modo pre-fork (0 = un único proceso) */
+#define WORKERS       0
+/* Intervalo de revisión de los procesos de trabajo (milisegundos) */
+#define WORKER_POLL   100
+/* Tiempo mínimo entre dos inicios de un mismo proceso de trabajo */
+#define WORKER_RESPAWN_DELAY 1000
+/* Puerto de administración para exponer métricas (0 = deshabilitado) */
+#define ADMIN_PORT    0
+/* Intervalo de revisión de la detención del puerto de administración */
+#define ADMIN_POLL    100
+/* Tiempo máximo de espera de la solicitud de métricas (milisegundos) */
+#define ADMIN_TIMEOUT 100
+
+/* Evitar SIGPIPE al enviar a un cliente desconectado, si es posible */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS    MSG_NOSIGNAL
+#else
+#define SEND_FLAGS    0
+#endif
+
+#ifdef G_OS_WIN32
+#define SHUT_RDWR     SD_BOTH
+#endif
 
 /* Define el dominio de errores TCP_SERVER_ERROR */
 G_DEFINE_QUARK(tcp-server-error, tcp_server_error)
 
+/**
+ * @private Límite adaptativo de solicitudes en curso.
+ *
+ * Crece en una solicitud cada vez que se completan tantas solicitudes como el
+ * límite, mientras la latencia se mantiene cerca de la mínima observada, y se
+ * reduce en forma multiplicativa cuando la supera (AIMD), a lo sumo una vez
+ * por cada tanda de solicitudes en curso, como el control de congestión de TCP
+ * Vegas.
+ */
+typedef struct TcpServerLimiter
+{
+  GMutex   lock;
+  double   limit;
+  int      min_limit;
+  int      max_limit;
+  int      inflight;
+  int      backoff_wait;
+  gint64   min_latency;
+  gint64   window_min;
+  int      window_len;
+  gint64   reported;
+  uint64_t accepted;
+  uint64_t rejected;
+  TcpServerStats *shared;
+} TcpServerLimiter;
+
+/**
+ * @private Proceso de trabajo del modo pre-fork, en memoria compartida con el
+ * supervisor: el proceso solo escribe su estado y el supervisor lo lee.
+ */
+typedef struct TcpServerWorker
+{
+  pid_t          pid;
+  gint64         started;
+  TcpServerStats stats;
+} TcpServerWorker;
+
+/** @private Métricas del servidor, ver tcp_server_set_admin_port() */
+typedef struct TcpServerMetrics
+{
+  TcpHistogram *queue_wait;
+  TcpHistogram *handler;
+  TcpCounter   *connections;
+  TcpCounter   *queued;
+  TcpCounter   *running;
+} TcpServerMetrics;
+
 /** Contiene una configuración para un servidor TCP */
 struct TcpServer
 {
   /** @privatesection */
   uint32_t addr;
   uint16_t port;
+  char    *unix_path;
   int      max_conn;
   int      max_threads;
   bool     exclusive;
+  TcpServerMode mode;
+  int      shards;
+  TcpServerAffinity affinity;
+  TcpFraming framing;
+  unsigned int idle_timeout;
+  unsigned int read_timeout;
+  unsigned int write_timeout;
+  unsigned int total_timeout;
+  TcpServerLimiter limiter;
+  char   **restart_argv;
+  TcpServerSaveFunc save_state;
+  void    *save_data;
+  int     *listeners;
+  int      n_listeners;
+  int     *inherited;
+  int      n_inherited;
+  int      handoff;
+  int      stop_pipe[2];
+  gint     running;
+  int      workers;
+  TcpServerWorker *worker_slots;
+  TcpServerMetrics metrics;
+  uint16_t admin_port;
+  int      admin_sock;
+  GThread *admin_thread;
+};
+
+/** Respuesta a una solicitud, que se envía al cliente al finalizar la función */
+struct TcpServerReply
+{
+  /** @privatesection */
+  GString    *data;
+  gint64      received;
+  TcpFraming  framing;
+  uint32_t    id;
+  size_t      start;
+  size_t      payload;
+  bool        parts;
+  bool      (*send)(TcpServerReply *reply, void *data);
+  void       *send_data;
 };
 
+/** @private Socket de escucha con su propio bucle de aceptación e hilos */
+typedef struct TcpServerShard
+{
+  TcpServer     *server;
+  TcpServerFunc  func;
+  void          *data;
+  GThread       *thread;
+  GError        *error;
+  int            sockfd;
+  int            cpu;
+} TcpServerShard;
+
+/** @private Plazos de las conexiones en modo TCP_SERVER_MODE_THREADS */
+typedef struct TcpServerTimers
+{
+  GMutex         lock;
+  GCond          cond;
+  GThread       *thread;
+  TcpTimerWheel *wheel;
+  gint64         wakeup;
+  bool           running;
+} TcpServerTimers;
+
 /** @private */
 typedef struct TcpServerThreadArgs
 {
+  TcpServer       *server;
+  TcpServerTimers *timers;
   TcpServerFunc  func;
   void          *data;
+  int            cpu;
+  bool           reject;
 } TcpServerThreadArgs;
 
+/** @private Conexión aceptada en modo TCP_SERVER_MODE_THREADS */
+typedef struct TcpServerThreadConn
+{
+  int       sock;
+  gint64    accepted;
+  TcpTimer  timer;
+  TcpServerThreadArgs *args;
+} TcpServerThreadConn;
+
+#ifdef HAVE_REACTOR
+/** @private Estado del reactor (epoll o io_uring) */
+typedef struct TcpServerLoop
+{
+  TcpServerFunc     func;
+  void             *data;
+  GThreadPool      *thread_pool;
+  GAsyncQueue      *done;
+  int               sockfd;
+  int               cpu;
+  int               epollfd;
+  int               eventfd;
+  int               stopfd;
+  bool              draining;
+  TcpFraming        framing;
+  size_t            max_len;
+  TcpServerMetrics *metrics;
+  unsigned int      idle_timeout;
+  unsigned int      read_timeout;
+  unsigned int      write_timeout;
+  unsigned int      total_timeout;
+  GQueue            conns;
+  TcpTimerWheel    *timers;
+  TcpServerLimiter *limiter;
+#ifdef HAVE_LIBURING
+  struct io_uring          *ring;
+  struct io_uring_buf_ring *buf_ring;
+  char                     *bufs;
+  uint64_t                  wakeup;
+#endif
+} TcpServerLoop;
+
+/** @private Estado de una conexión del reactor, que determina su plazo */
+typedef enum
+{
+  CONN_READ,  /* Recibiendo una solicitud */
+  CONN_IDLE,  /* Esperando la siguiente solicitud */
+  CONN_RUN,   /* Ejecutando solicitudes, sin respuestas para enviar */
+  CONN_WRITE, /* Enviando respuestas */
+} TcpServerConnPhase;
+
+/** @private Conexión atendida por el reactor */
+typedef struct TcpServerConn
+{
+  TcpServerLoop  *loop;
+  TcpFrameReader *reader;
+  GString        *out;
+  GString        *queued;
+  size_t          sent;
+  int             running;
+  bool            served;
+  bool            hangup;
+  bool            eof;
+  int             sock;
+  int             pending;
+  bool            sending;
+  bool            closing;
+  GList           link;
+  TcpTimer        timer;
+  TcpServerConnPhase phase;
+  gint64          since;
+  gint64          accepted;
+  GQueue          traces;
+  GQueue          streams;
+} TcpServerConn;
+
+/** @private Solicitud de una conexión, ejecutada en el "pool" de hilos */
+typedef struct TcpServerJob
+{
+  TcpServerConn  *conn;
+  uint32_t        id;
+  gint64          start;
+  GString        *request;
+  TcpServerReply  reply;
+  TcpTrace       *trace;
+  GString        *part;
+  GAsyncQueue    *resume;
+} TcpServerJob;
+
+/** @private Estado de una respuesta en partes al reanudar la función */
+typedef enum
+{
+  STREAM_SENT = 1, /* La parte se envió o hay lugar para más */
+  STREAM_CLOSED,   /* La conexión se cerró */
+} TcpServerStreamStatus;
+#endif
+
+#ifdef HAVE_LIBURING
+/** @private Operaciones de io_uring, guardadas en los bits bajos de user_data */
+typedef enum
+{
+  URING_ACCEPT,
+  URING_RECV,
+  URING_SEND,
+  URING_WAKEUP,
+  URING_SHUTDOWN,
+  URING_STOP,
+  URING_CANCEL,
+} TcpServerUringOp;
+
+/* Máscara de la operación en user_data (las conexiones se alinean a 8) */
+#define URING_OP_MASK 7
+#endif
+
 /* Mensajes de error */
 static const char *error_messages[] = {
   [TCP_SERVER_SOCK_ERROR]        = "Error al crear socket",
   [TCP_SERVER_SOCK_BIND_ERROR]   = "Error al enlazar socket",
   [TCP_SERVER_SOCK_LISTEN_ERROR] = "Error al escuchar socket",
   [TCP_SERVER_SOCK_ACCEPT_ERROR] = "Error al aceptar conexión",
+  [TCP_SERVER_EPOLL_ERROR]       = "Error al crear instancia de epoll",
+  [TCP_SERVER_URING_ERROR]       = "Error al crear instancia de io_uring",
+  [TCP_SERVER_HANDOFF_ERROR]     = "Error al recibir los sockets del proceso anterior",
 };
 
 /* Macro para manejar errores */
@@ -69,7 +413,8 @@ TcpServer *tcp_server_new_full(uint32_t addr,
                                uint16_t port,
                                int      max_conn,
                                int      max_threads,
-                               bool     exclusive)
+                               bool     exclusive,
+                               TcpServerMode mode)
 {
   TcpServer *server = (TcpServer*)malloc(sizeof(TcpServer));
 
@@ -77,133 +422,2836 @@ TcpServer *tcp_server_new_full(uint32_t addr,
 
   server->addr = addr;
   server->port = port;
+  server->unix_path = NULL;
   server->max_conn = max_conn;
   server->max_threads = max_threads;
   server->exclusive = exclusive;
+  server->shards = SHARDS;
+  server->affinity = AFFINITY;
+  server->framing = FRAMING;
+  server->idle_timeout = IDLE_TIMEOUT;
+  server->read_timeout = READ_TIMEOUT;
+  server->write_timeout = WRITE_TIMEOUT;
+  server->total_timeout = TOTAL_TIMEOUT;
+  memset(&server->limiter, 0, sizeof(server->limiter));
+  g_mutex_init(&server->limiter.lock);
+  server->restart_argv = NULL;
+  server->save_state = NULL;
+  server->save_data = NULL;
+  server->listeners = NULL;
+  server->n_listeners = 0;
+  server->inherited = NULL;
+  server->n_inherited = 0;
+  server->handoff = -1;
+  server->stop_pipe[0] = server->stop_pipe[1] = -1;
+  server->running = FALSE;
+  server->workers = WORKERS;
+  server->worker_slots = NULL;
+  server->admin_port = ADMIN_PORT;
+  server->admin_sock = -1;
+  server->admin_thread = NULL;
+
+  /* Se registran antes de crear procesos de trabajo, para sumar los de todos */
+  server->metrics.queue_wait = tcp_metrics_histogram("server.queue_wait_us");
+  server->metrics.handler = tcp_metrics_histogram("server.handler_us");
+  server->metrics.connections = tcp_metrics_counter("server.connections");
+  server->metrics.queued = tcp_metrics_counter("server.pool.queued");
+  server->metrics.running = tcp_metrics_counter("server.pool.running");
+  tcp_server_set_mode(server, mode);
+  tcp_server_set_limit(server, LIMIT_MAX);
 
   return server;
 }
 
 TcpServer *tcp_server_new(uint32_t addr, uint16_t port)
 {
-  return tcp_server_new_full(addr, port, MAX_CONN, MAX_THREADS, EXC_THREADS);
+  return tcp_server_new_full(addr, port, MAX_CONN, MAX_THREADS, EXC_THREADS,
+                             SERVER_MODE);
 }
 
-static void run_server_thread(void *sock_ptr, void *data)
+void tcp_server_set_unix_path(TcpServer *server, const char *path)
 {
-  int sock = GPOINTER_TO_INT(sock_ptr);
-  TcpServerThreadArgs *args = (TcpServerThreadArgs*)data;
+  g_return_if_fail(server != NULL);
 
-  g_return_if_fail(sock != -1);
-  g_return_if_fail(args != NULL);
+#ifdef G_OS_UNIX
+  g_free(server->unix_path);
+  server->unix_path = g_strdup(path);
+#else
+  if (path != NULL) {
+    tcp_log(TCP_LOG_WARNING, "Sockets Unix no disponibles, se utiliza TCP...");
+  }
+#endif
+}
 
-  args->func(sock, args->data);
+void tcp_server_set_mode(TcpServer *server, TcpServerMode mode)
+{
+  g_return_if_fail(server != NULL);
 
-#ifdef G_OS_UNIX
-  close(sock);
+  server->mode = mode;
+
+#ifndef HAVE_LIBURING
+  if (server->mode == TCP_SERVER_MODE_URING) {
+    tcp_log(TCP_LOG_WARNING, "io_uring no disponible, se utiliza epoll...");
+    server->mode = TCP_SERVER_MODE_EPOLL;
+  }
 #endif
 
-#ifdef G_OS_WIN32
-  closesocket(sock);
+#ifndef HAVE_EPOLL
+  if (server->mode == TCP_SERVER_MODE_EPOLL) {
+    tcp_log(TCP_LOG_WARNING,
+            "epoll no disponible, se utilizan hilos bloqueantes...");
+    server->mode = TCP_SERVER_MODE_THREADS;
+  }
+#endif
+}
+
+void tcp_server_set_shards(TcpServer         *server,
+                           int                shards,
+                           TcpServerAffinity  affinity)
+{
+  g_return_if_fail(server != NULL);
+
+  server->shards = shards > 0 ? shards : (int)g_get_num_processors();
+  server->affinity = affinity;
+
+#ifndef SO_REUSEPORT
+  if (server->shards > 1) {
+    tcp_log(TCP_LOG_WARNING,
+            "SO_REUSEPORT no disponible, se utiliza un único socket...");
+    server->shards = 1;
+  }
 #endif
 
-  printf("Desconectado del cliente.\n");
+#ifndef HAVE_SCHED_SETAFFINITY
+  if (affinity != TCP_SERVER_AFFINITY_NONE) {
+    tcp_log(TCP_LOG_WARNING, "Afinidad de hilos no disponible...");
+    server->affinity = TCP_SERVER_AFFINITY_NONE;
+  }
+#endif
 }
 
-void tcp_server_run(TcpServer      *server,
-                    TcpServerFunc   func,
-                    void           *data,
-                    GError        **error)
+void tcp_server_set_workers(TcpServer *server, int workers)
 {
-  struct sockaddr_in srvaddr, cliaddr;
-  socklen_t srvaddr_len = sizeof(srvaddr);
-  socklen_t cliaddr_len = sizeof(cliaddr);
-  int sockfd, connfd, binded, listening;
-  unsigned int prev_max_idle_time;
-  GThreadPool *thread_pool;
-  TcpServerThreadArgs *thread_args;
+  g_return_if_fail(server != NULL);
 
-#ifdef G_OS_WIN32
-  /**
-   * Inicializar Winsock
-   * https://learn.microsoft.com/es-es/windows/win32/winsock/initializing-winsock
-   */
-  WSADATA wsa_data;
-  int result = WSAStartup(MAKEWORD(2,2), &wsa_data);
-  if (result != 0) {
-    printf("WSAStartup error: %d\n", result);
+  server->workers = workers >= 0 ? workers : (int)g_get_num_processors();
+
+#ifndef G_OS_UNIX
+  if (server->workers > 0) {
+    tcp_log(TCP_LOG_WARNING,
+            "fork() no disponible, se utiliza un único proceso...");
+    server->workers = 0;
+  }
+#endif
+}
+
+void tcp_server_set_framing(TcpServer    *server,
+                            TcpFraming    framing,
+                            unsigned int  idle_timeout)
+{
+  g_return_if_fail(server != NULL);
+
+  server->framing = framing;
+  server->idle_timeout = idle_timeout;
+}
+
+void tcp_server_set_deadlines(TcpServer    *server,
+                              unsigned int  read_timeout,
+                              unsigned int  write_timeout,
+                              unsigned int  total_timeout)
+{
+  g_return_if_fail(server != NULL);
+
+  server->read_timeout = read_timeout;
+  server->write_timeout = write_timeout;
+  server->total_timeout = total_timeout;
+}
+
+void tcp_server_set_admin_port(TcpServer *server, uint16_t port)
+{
+  g_return_if_fail(server != NULL);
+
+  server->admin_port = port;
+
+#ifndef G_OS_UNIX
+  if (port != 0) {
+    tcp_log(TCP_LOG_WARNING, "Puerto de administración no disponible...");
+    server->admin_port = 0;
+  }
+#endif
+}
+
+void tcp_server_set_limit(TcpServer *server, unsigned int max_inflight)
+{
+  TcpServerLimiter *limiter;
+
+  g_return_if_fail(server != NULL);
+
+  limiter = &server->limiter;
+  g_mutex_lock(&limiter->lock);
+  limiter->max_limit = MIN(max_inflight, G_MAXINT);
+  limiter->min_limit = MIN(LIMIT_MIN, limiter->max_limit);
+  limiter->limit = MIN(LIMIT_INITIAL, limiter->max_limit);
+  g_mutex_unlock(&limiter->lock);
+}
+
+static void limiter_stats(TcpServerLimiter *limiter, TcpServerStats *stats)
+{
+  stats->limit = limiter->max_limit > 0 ? (unsigned int)limiter->limit : 0;
+  stats->inflight = limiter->inflight;
+  stats->accepted = limiter->accepted;
+  stats->rejected = limiter->rejected;
+}
+
+void tcp_server_get_stats(TcpServer *server, TcpServerStats *stats)
+{
+  TcpServerLimiter *limiter;
+  TcpServerStats *worker;
+
+  g_return_if_fail(server != NULL);
+  g_return_if_fail(stats != NULL);
+
+  limiter = &server->limiter;
+  g_mutex_lock(&limiter->lock);
+  limiter_stats(limiter, stats);
+
+  /* El supervisor suma el estado de sus procesos de trabajo */
+  if (server->worker_slots != NULL) {
+    stats->limit = 0;
+    for (int i = 0; i < server->workers; i++) {
+      worker = &server->worker_slots[i].stats;
+      stats->limit += worker->limit;
+      stats->inflight += worker->inflight;
+      stats->accepted += worker->accepted;
+      stats->rejected += worker->rejected;
+    }
+  }
+  g_mutex_unlock(&limiter->lock);
+}
+
+bool tcp_server_affinity_parse(const char *name, TcpServerAffinity *affinity)
+{
+  g_return_val_if_fail(name != NULL, false);
+  g_return_val_if_fail(affinity != NULL, false);
+
+  if (g_ascii_strcasecmp(name, "none") == 0) {
+    *affinity = TCP_SERVER_AFFINITY_NONE;
+  } else if (g_ascii_strcasecmp(name, "core") == 0) {
+    *affinity = TCP_SERVER_AFFINITY_CORE;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+bool tcp_server_deadlines_parse(const char   *text,
+                                unsigned int *read_timeout,
+                                unsigned int *write_timeout,
+                                unsigned int *total_timeout)
+{
+  char extra;
+
+  g_return_val_if_fail(text != NULL, false);
+  g_return_val_if_fail(read_timeout != NULL, false);
+  g_return_val_if_fail(write_timeout != NULL, false);
+  g_return_val_if_fail(total_timeout != NULL, false);
+
+  return strchr(text, '-') == NULL
+      && sscanf(text, "%u,%u,%u%c",
+                read_timeout, write_timeout, total_timeout, &extra) == 3;
+}
+
+bool tcp_server_mode_parse(const char *name, TcpServerMode *mode)
+{
+  g_return_val_if_fail(name != NULL, false);
+  g_return_val_if_fail(mode != NULL, false);
+
+  if (g_ascii_strcasecmp(name, "threads") == 0) {
+    *mode = TCP_SERVER_MODE_THREADS;
+  } else if (g_ascii_strcasecmp(name, "epoll") == 0) {
+    *mode = TCP_SERVER_MODE_EPOLL;
+  } else if (g_ascii_strcasecmp(name, "uring") == 0) {
+    *mode = TCP_SERVER_MODE_URING;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void tcp_server_reply_append(TcpServerReply *reply,
+                             const char     *data,
+                             size_t          length)
+{
+  g_return_if_fail(reply != NULL);
+  g_return_if_fail(data != NULL);
+
+  g_string_append_len(reply->data, data, length);
+}
+
+void tcp_server_reply_printf(TcpServerReply *reply, const char *format, ...)
+{
+  va_list args;
+
+  g_return_if_fail(reply != NULL);
+  g_return_if_fail(format != NULL);
+
+  va_start(args, format);
+  g_string_append_vprintf(reply->data, format, args);
+  va_end(args);
+}
+
+bool tcp_server_reply_flush(TcpServerReply *reply)
+{
+  bool sent = true;
+
+  g_return_val_if_fail(reply != NULL, false);
+
+  /* Cada parte es un mensaje; sin delimitar, una línea */
+  tcp_frame_end(reply->framing, reply->data, reply->start);
+  if (reply->framing == TCP_FRAMING_NONE) {
+    g_string_append_c(reply->data, '\n');
+  }
+  reply->parts = true;
+
+  if (reply->send != NULL && reply->data->len >= STREAM_CHUNK) {
+    sent = reply->send(reply, reply->send_data);
+    g_string_truncate(reply->data, 0);
+  }
+
+  reply->start = tcp_frame_begin(reply->framing, reply->id, reply->data);
+  reply->payload = reply->data->len;
+
+  return sent;
+}
+
+TcpServerReply *tcp_server_reply_new(void)
+{
+  TcpServerReply *reply = g_new0(TcpServerReply, 1);
+
+  reply->data = g_string_sized_new(MAX_MSG_LEN);
+  reply->framing = TCP_FRAMING_NONE;
+
+  return reply;
+}
+
+const char *tcp_server_reply_get_data(TcpServerReply *reply, size_t *length)
+{
+  g_return_val_if_fail(reply != NULL, NULL);
+
+  if (length != NULL) {
+    *length = reply->data->len;
+  }
+
+  return reply->data->str;
+}
+
+gint64 tcp_server_reply_get_received(TcpServerReply *reply)
+{
+  g_return_val_if_fail(reply != NULL, 0);
+
+  return reply->received != 0 ? reply->received : g_get_monotonic_time();
+}
+
+void tcp_server_reply_clear(TcpServerReply *reply)
+{
+  g_return_if_fail(reply != NULL);
+
+  g_string_truncate(reply->data, 0);
+  reply->start = 0;
+  reply->payload = 0;
+  reply->parts = false;
+}
+
+void tcp_server_reply_free(TcpServerReply *reply)
+{
+  g_return_if_fail(reply != NULL);
+
+  g_string_free(reply->data, TRUE);
+  g_free(reply);
+}
+
+static void pin_thread(int cpu)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+  /* Núcleo fijado al hilo actual más uno, o 0 si todavía no se fijó */
+  static GPrivate pinned_cpu;
+  cpu_set_t cpus;
+
+  if (cpu < 0 || GPOINTER_TO_INT(g_private_get(&pinned_cpu)) == cpu + 1) {
     return;
   }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) == 0) {
+    g_private_set(&pinned_cpu, GINT_TO_POINTER(cpu + 1));
+  }
 #endif
+}
 
-  /* Asignar IP y puerto */
-  memset(&srvaddr, 0, srvaddr_len);
-  srvaddr.sin_family = AF_INET;
-  srvaddr.sin_addr.s_addr = htonl(server->addr);
-  srvaddr.sin_port = htons(server->port);
+static size_t server_max_len(TcpServer *server)
+{
+  return server->framing == TCP_FRAMING_NONE ? MAX_MSG_LEN : TCP_FRAME_MAX_LEN;
+}
 
-  /* Crear socket */
-  sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  return_set_error_if(sockfd == -1, error, TCP_SERVER_SOCK_ERROR);
-  printf("Socket creado correctamente...\n");
+static void limiter_publish(TcpServerLimiter *limiter)
+{
+  /* Estado de un proceso de trabajo, para el supervisor */
+  if (limiter->shared != NULL) {
+    limiter_stats(limiter, limiter->shared);
+  }
+}
 
-  /* Enlazar socket creado a IP/puerto */
-  binded = bind(sockfd, (struct sockaddr*)&srvaddr, srvaddr_len);
-  return_set_error_if(binded == -1, error, TCP_SERVER_SOCK_BIND_ERROR);
-  printf("Socket enlazado correctamente...\n");
+static bool limiter_acquire(TcpServerLimiter *limiter)
+{
+  gint64 now;
+  uint64_t rejected;
+  int limit;
 
-  /* Escuchar puerto */
-  listening = listen(sockfd, server->max_conn);
-  return_set_error_if(listening == -1, error, TCP_SERVER_SOCK_LISTEN_ERROR);
-  printf("Servidor escuchando puerto %d...\n", server->port);
+  g_mutex_lock(&limiter->lock);
 
-  /* Inicializar thread pool */
-  thread_args = g_new0(TcpServerThreadArgs, 1);
-  thread_args->func = func;
-  thread_args->data = data;
-  thread_pool = g_thread_pool_new(run_server_thread,
-                                  thread_args,
-                                  server->max_threads,
-                                  server->exclusive,
-                                  error);
-  if (*error != NULL) {
+  /* Sin límite (0), solo se cuentan las solicitudes */
+  if (limiter->max_limit == 0 || limiter->inflight < (int)limiter->limit) {
+    limiter->inflight++;
+    limiter->accepted++;
+    limiter_publish(limiter);
+    g_mutex_unlock(&limiter->lock);
+    return true;
+  }
+
+  limiter->rejected++;
+  limiter_publish(limiter);
+  rejected = limiter->rejected;
+  limit = (int)limiter->limit;
+
+  /* Avisar de la sobrecarga sin escribir una línea por solicitud */
+  now = g_get_monotonic_time();
+  if (now - limiter->reported < LIMIT_REPORT) {
+    g_mutex_unlock(&limiter->lock);
+    return false;
+  }
+  limiter->reported = now;
+  g_mutex_unlock(&limiter->lock);
+
+  tcp_log(TCP_LOG_WARNING, "Servidor sobrecargado: límite de %d solicitudes en "
+          "curso, %" PRIu64 " rechazadas...", limit, rejected);
+
+  return false;
+}
+
+static void limiter_sample(TcpServerLimiter *limiter, gint64 latency)
+{
+  g_mutex_lock(&limiter->lock);
+
+  if (limiter->max_limit == 0) {
+    g_mutex_unlock(&limiter->lock);
     return;
   }
 
-  prev_max_idle_time = g_thread_pool_get_max_idle_time();
-  g_thread_pool_set_max_idle_time(MAX_IDLE_TIME);
+  /* La latencia mínima se renueva por ventanas, por si cambia la carga base */
+  if (limiter->window_len == 0 || latency < limiter->window_min) {
+    limiter->window_min = latency;
+  }
+  if (limiter->min_latency == 0 || latency < limiter->min_latency) {
+    limiter->min_latency = latency;
+  }
+  if (++limiter->window_len >= LIMIT_WINDOW) {
+    limiter->min_latency = limiter->window_min;
+    limiter->window_len = 0;
+  }
 
-  do {
-    /* Aceptar conexión de cliente */
-    connfd = accept(sockfd, (struct sockaddr*)&cliaddr, &cliaddr_len);
-    return_set_error_if(connfd == -1, error, TCP_SERVER_SOCK_ACCEPT_ERROR);
-    printf("Conexión aceptada...\n");
+  if (limiter->backoff_wait > 0) {
+    limiter->backoff_wait--;
+  }
 
-    /* Ejecutar función del servidor en otro hilo */
-    g_thread_pool_push(thread_pool, GINT_TO_POINTER(connfd), error);
-    if (*error != NULL) {
-      break;
+  if (latency > limiter->min_latency * LIMIT_TOLERANCE + LIMIT_SLACK) {
+    /* Las solicitudes en cola demoran: reducir una vez por tanda en curso */
+    if (limiter->backoff_wait == 0) {
+      limiter->limit = MAX(limiter->min_limit, limiter->limit * LIMIT_BACKOFF);
+      limiter->backoff_wait = limiter->inflight;
     }
+  } else if (limiter->inflight * 2 >= limiter->limit) {
+    /* Crecer solo si el límite actual se está utilizando */
+    limiter->limit = MIN(limiter->max_limit, limiter->limit + 1 / limiter->limit);
+  }
 
-  } while (TRUE);
+  limiter_publish(limiter);
+  g_mutex_unlock(&limiter->lock);
+}
 
-  g_thread_pool_free(thread_pool, FALSE, TRUE);
-  g_thread_pool_set_max_idle_time(prev_max_idle_time);
-  g_free(thread_args);
+static void limiter_release(TcpServerLimiter *limiter)
+{
+  g_mutex_lock(&limiter->lock);
+  limiter->inflight--;
+  limiter_publish(limiter);
+  g_mutex_unlock(&limiter->lock);
+}
+
+static void reply_overloaded(const char     *request,
+                             size_t          length,
+                             TcpServerReply *reply,
+                             void           *data)
+{
+  tcp_server_reply_append(reply, OVERLOADED_REPLY, strlen(OVERLOADED_REPLY));
+}
+
+static void run_func(TcpServerFunc   func,
+                     void           *data,
+                     TcpFraming      framing,
+                     uint32_t        id,
+                     GString        *request,
+                     TcpServerReply *reply)
+{
+  /* La respuesta se delimita igual que la solicitud, con su identificador */
+  reply->framing = framing;
+  reply->id = id;
+  reply->parts = false;
+  reply->start = tcp_frame_begin(framing, id, reply->data);
+  reply->payload = reply->data->len;
+
+  func(request->str, request->len, reply, data);
+
+  /* Luego de enviar partes, no agregar un último mensaje vacío */
+  if (reply->parts && reply->data->len == reply->payload) {
+    g_string_truncate(reply->data, reply->start);
+  } else {
+    tcp_frame_end(framing, reply->data, reply->start);
+  }
+}
+
+static void run_func_timed(TcpServerMetrics *metrics,
+                           TcpServerFunc     func,
+                           void             *data,
+                           TcpFraming        framing,
+                           uint32_t          id,
+                           GString          *request,
+                           TcpServerReply   *reply)
+{
+  gint64 start = g_get_monotonic_time();
+
+  run_func(func, data, framing, id, request, reply);
+  tcp_histogram_record(metrics->handler, g_get_monotonic_time() - start);
+}
 
+static void set_recv_timeout(int sock, unsigned int timeout)
+{
 #ifdef G_OS_UNIX
-  close(sockfd);
+  struct timeval tv = {
+    .tv_sec = timeout / 1000,
+    .tv_usec = (timeout % 1000) * 1000,
+  };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 #endif
 
 #ifdef G_OS_WIN32
-  closesocket(sockfd);
-  WSACleanup();
+  DWORD tv = timeout;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
 #endif
+}
+
+static bool send_all(int sock, const char *data, size_t length)
+{
+  size_t sent = 0;
+  int sent_len;
+
+  while (sent < length) {
+    sent_len = send(sock, data + sent, length - sent, SEND_FLAGS);
+    if (sent_len <= 0) {
+      return false;
+    }
+    sent += sent_len;
+  }
 
-  printf("Servidor desconectado.\n");
+  return true;
 }
 
-void tcp_server_free(TcpServer *server)
+static void close_sock(int sock)
 {
+#ifdef G_OS_UNIX
+  close(sock);
+#endif
+
+#ifdef G_OS_WIN32
+  closesocket(sock);
+#endif
+}
+
+#ifdef G_OS_UNIX
+static bool wait_readable(int sock, int stop_fd, int timeout)
+{
+  struct pollfd fds[2] = {
+    { .fd = sock, .events = POLLIN },
+    { .fd = stop_fd, .events = POLLIN },
+  };
+  int ready;
+
+  do {
+    ready = poll(fds, 2, timeout);
+  } while (ready == -1 && errno == EINTR);
+
+  /* Venció el tiempo de espera, o el servidor o su supervisor se detienen */
+  return ready != 0 && !(fds[1].revents & (POLLIN | POLLHUP));
+}
+#endif
+
+static gint64 deadline_at(gint64       since,
+                          unsigned int timeout,
+                          gint64       accepted,
+                          unsigned int total_timeout)
+{
+  gint64 deadline = timeout > 0 ? since + (gint64)timeout * 1000 : 0;
+  gint64 total;
+
+  /* El plazo total de la conexión acota a todos los demás */
+  if (total_timeout > 0) {
+    total = accepted + (gint64)total_timeout * 1000;
+    deadline = deadline > 0 ? MIN(deadline, total) : total;
+  }
+
+  return deadline;
+}
+
+static void thread_deadline(TcpServerTimers     *timers,
+                            TcpServerThreadConn *conn,
+                            gint64               since,
+                            unsigned int         timeout,
+                            unsigned int         total_timeout)
+{
+  gint64 deadline = deadline_at(since, timeout, conn->accepted, total_timeout);
+
+  g_mutex_lock(&timers->lock);
+  if (deadline == 0) {
+    tcp_timer_wheel_remove(timers->wheel, &conn->timer);
+  } else {
+    tcp_timer_wheel_add(timers->wheel, &conn->timer, deadline, conn);
+
+    /* Despertar al hilo de plazos solo si tiene que vencer antes */
+    if (deadline < timers->wakeup) {
+      g_cond_signal(&timers->cond);
+    }
+  }
+  g_mutex_unlock(&timers->lock);
+}
+
+static void *run_timer_thread(void *data)
+{
+  TcpServerTimers *timers = (TcpServerTimers*)data;
+  TcpServerThreadConn *conn;
+  gint64 now;
+  int wait;
+
+  g_mutex_lock(&timers->lock);
+
+  while (timers->running) {
+    now = g_get_monotonic_time();
+    while ((conn = tcp_timer_wheel_expire(timers->wheel, now)) != NULL) {
+      /* Desbloquear al hilo que atiende la conexión */
+      tcp_log(TCP_LOG_DEBUG, "Plazo vencido, cerrando conexión...");
+      shutdown(conn->sock, SHUT_RDWR);
+    }
+
+    wait = tcp_timer_wheel_timeout(timers->wheel, now);
+    if (wait < 0) {
+      timers->wakeup = G_MAXINT64;
+      g_cond_wait(&timers->cond, &timers->lock);
+    } else {
+      timers->wakeup = now + (gint64)wait * 1000;
+      g_cond_wait_until(&timers->cond, &timers->lock, timers->wakeup);
+    }
+  }
+
+  g_mutex_unlock(&timers->lock);
+
+  return NULL;
+}
+
+static void timers_start(TcpServerTimers *timers)
+{
+  g_mutex_init(&timers->lock);
+  g_cond_init(&timers->cond);
+  timers->wheel = tcp_timer_wheel_new(g_get_monotonic_time());
+  timers->wakeup = G_MAXINT64;
+  timers->running = true;
+  timers->thread = g_thread_new("tcp-server-timers", run_timer_thread, timers);
+}
+
+static void timers_stop(TcpServerTimers *timers)
+{
+  g_mutex_lock(&timers->lock);
+  timers->running = false;
+  g_cond_signal(&timers->cond);
+  g_mutex_unlock(&timers->lock);
+
+  g_thread_join(timers->thread);
+  tcp_timer_wheel_free(timers->wheel);
+  g_cond_clear(&timers->cond);
+  g_mutex_clear(&timers->lock);
+}
+
+static bool thread_send_part(TcpServerReply *reply, void *data)
+{
+  TcpServerThreadConn *conn = (TcpServerThreadConn*)data;
+  TcpServer *server = conn->args->server;
+  bool sent;
+
+  /*
+   * Cada parte se envía en el plazo de escritura; send() bloquea mientras el
+   * cliente no lea, lo que detiene a la función
+   */
+  thread_deadline(conn->args->timers, conn, g_get_monotonic_time(),
+                  server->write_timeout, server->total_timeout);
+  sent = send_all(conn->sock, reply->data->str, reply->data->len);
+  thread_deadline(conn->args->timers, conn, g_get_monotonic_time(), 0,
+                  server->total_timeout);
+
+  return sent;
+}
+
+static void run_server_thread(void *conn_ptr, void *data)
+{
+  TcpServerThreadConn *conn = (TcpServerThreadConn*)conn_ptr;
+  TcpServerThreadArgs *args = (TcpServerThreadArgs*)data;
+  TcpServer *server;
+  TcpFrameReader *reader;
+  TcpFrameStatus status;
+  TcpServerReply reply;
+  GString *request;
+  const char *frame;
+  size_t frame_len;
+  char *recv_buf;
+  int recv_len;
+  int sock;
+  gint64 start, accepted, received;
+  unsigned int read_timeout, total_timeout;
+  bool reading = true;
+  bool sent;
+  TcpTrace *trace;
+
+  g_return_if_fail(conn != NULL);
+  g_return_if_fail(args != NULL);
+
+  pin_thread(args->cpu);
+
+  /* La primera solicitud incluye la espera en la cola del "pool" */
+  sock = conn->sock;
+  start = conn->accepted;
+  accepted = conn->accepted;
+  received = g_get_monotonic_time();
+
+  server = args->server;
+  tcp_counter_add(server->metrics.queued, -1);
+  tcp_counter_add(server->metrics.running, 1);
+  if (!args->reject) {
+    tcp_histogram_record(server->metrics.queue_wait, received - accepted);
+  }
+
+  read_timeout = args->reject ? REJECT_TIMEOUT : server->read_timeout;
+  total_timeout = server->total_timeout;
+
+  /* La primera solicitud se lee en plazo desde que se aceptó la conexión */
+  thread_deadline(args->timers, conn, conn->accepted, read_timeout,
+                  total_timeout);
+
+  reader = tcp_frame_reader_new(server->framing, server_max_len(server));
+  request = g_string_sized_new(MAX_MSG_LEN);
+  memset(&reply, 0, sizeof(reply));
+  reply.data = g_string_sized_new(MAX_MSG_LEN);
+  conn->args = args;
+  if (!args->reject) {
+    reply.send = thread_send_part;
+    reply.send_data = conn;
+  }
+
+  /* Leer solicitud, ejecutar función y enviar respuesta */
+  while (TRUE) {
+    status = tcp_frame_reader_next(reader, &frame, &frame_len);
+
+    if (status == TCP_FRAME_INCOMPLETE) {
+      if (!reading && tcp_frame_reader_pending(reader) > 0) {
+        received = g_get_monotonic_time();
+        thread_deadline(args->timers, conn, received, read_timeout,
+                        total_timeout);
+        reading = true;
+      } else if (!reading) {
+        /* Entre solicitudes rige el plazo de inactividad */
+        thread_deadline(args->timers, conn, g_get_monotonic_time(),
+                        server->idle_timeout, total_timeout);
+#ifdef G_OS_UNIX
+        /* Cerrar si el servidor se detiene */
+        if (!wait_readable(sock, server->stop_pipe[0], -1)) {
+          break;
+        }
+#endif
+      }
+
+      recv_buf = tcp_frame_reader_reserve(reader, MAX_MSG_LEN);
+      recv_len = recv(sock, recv_buf, MAX_MSG_LEN, 0);
+      if (recv_len <= 0) {
+        break;
+      }
+      tcp_frame_reader_commit(reader, recv_len);
+
+      /* Desde que llega la solicitud rige el plazo de lectura */
+      if (!reading) {
+        received = g_get_monotonic_time();
+        thread_deadline(args->timers, conn, received, read_timeout,
+                        total_timeout);
+        reading = true;
+      }
+      continue;
+    }
+
+    if (status == TCP_FRAME_TOO_LONG) {
+      break;
+    }
+
+    if (start == 0) {
+      start = g_get_monotonic_time();
+    }
+
+    /* La primera solicitud incluye la espera de la conexión en la cola */
+    reply.received = accepted != 0 ? accepted : received;
+    trace = tcp_trace_begin(reply.received);
+    if (accepted != 0) {
+      tcp_trace_add(trace, "queue", accepted, received);
+      accepted = 0;
+    }
+    tcp_trace_add(trace, "recv", received, g_get_monotonic_time());
+
+    /* La función no tiene plazo propio, solo el total */
+    thread_deadline(args->timers, conn, g_get_monotonic_time(), 0,
+                    total_timeout);
+    reading = false;
+
+    g_string_truncate(request, 0);
+    g_string_append_len(request, frame, frame_len);
+    g_string_truncate(reply.data, 0);
+    tcp_trace_attach(trace);
+    run_func_timed(&server->metrics, args->func, args->data, server->framing,
+                   tcp_frame_reader_id(reader), request, &reply);
+    tcp_trace_attach(NULL);
+
+    if (!args->reject) {
+      limiter_sample(&server->limiter, g_get_monotonic_time() - start);
+    }
+    start = 0;
+
+    /* Sin delimitar mensajes, se atiende una única solicitud */
+    thread_deadline(args->timers, conn, g_get_monotonic_time(),
+                    server->write_timeout, total_timeout);
+    tcp_trace_add(trace, "send", g_get_monotonic_time(), 0);
+    sent = send_all(sock, reply.data->str, reply.data->len);
+    tcp_trace_end(trace);
+    if (!sent || server->framing == TCP_FRAMING_NONE || args->reject) {
+      break;
+    }
+  }
+
+  g_string_free(reply.data, TRUE);
+  g_string_free(request, TRUE);
+  tcp_frame_reader_free(reader);
+
+  if (!args->reject) {
+    limiter_release(&server->limiter);
+  }
+
+  /* Quitar el plazo antes de cerrar, ya que el hilo de plazos usa el socket */
+  g_mutex_lock(&args->timers->lock);
+  tcp_timer_wheel_remove(args->timers->wheel, &conn->timer);
+  g_mutex_unlock(&args->timers->lock);
+  g_free(conn);
+
+  close_sock(sock);
+  tcp_counter_add(server->metrics.running, -1);
+  tcp_counter_add(server->metrics.connections, -1);
+
+  tcp_log(TCP_LOG_DEBUG, "Desconectado del cliente.");
+}
+
+static int shard_max_threads(TcpServer *server)
+{
+  if (server->max_threads <= 0 || server->shards <= 1) {
+    return server->max_threads;
+  }
+
+  return MAX(1, server->max_threads / server->shards);
+}
+
+static bool shard_exclusive(TcpServer *server)
+{
+  /* Para fijar los hilos a un núcleo no pueden compartirse entre sockets */
+  return server->exclusive
+      || (server->affinity != TCP_SERVER_AFFINITY_NONE
+          && server->max_threads != -1);
+}
+
+static void run_threads_loop(TcpServerShard *shard, GError **error)
+{
+  struct sockaddr_storage cliaddr;
+  socklen_t cliaddr_len;
+  int connfd;
+  GThreadPool *thread_pool, *reject_pool;
+  TcpServerThreadArgs *thread_args, *reject_args;
+  TcpServerThreadConn *conn;
+  TcpServerTimers timers;
+  bool accepted;
+
+  /* Inicializar thread pool */
+  thread_args = g_new0(TcpServerThreadArgs, 1);
+  thread_args->server = shard->server;
+  thread_args->timers = &timers;
+  thread_args->func = shard->func;
+  thread_args->data = shard->data;
+  thread_args->cpu = shard->cpu;
+  thread_pool = g_thread_pool_new(run_server_thread,
+                                  thread_args,
+                                  shard_max_threads(shard->server),
+                                  shard_exclusive(shard->server),
+                                  error);
+  if (*error != NULL) {
+    g_free(thread_args);
+    return;
+  }
+
+  /* Las conexiones sobre el límite se responden en un único hilo aparte */
+  reject_args = g_new(TcpServerThreadArgs, 1);
+  *reject_args = *thread_args;
+  reject_args->func = reply_overloaded;
+  reject_args->data = NULL;
+  reject_args->reject = true;
+  reject_pool = g_thread_pool_new(run_server_thread, reject_args, 1, FALSE,
+                                  error);
+  if (*error != NULL) {
+    g_thread_pool_free(thread_pool, FALSE, TRUE);
+    g_free(reject_args);
+    g_free(thread_args);
+    return;
+  }
+
+  /* Un único hilo vence los plazos de todas las conexiones del socket */
+  timers_start(&timers);
+
+  do {
+#ifdef G_OS_UNIX
+    /* Esperar una conexión o la detención del servidor */
+    if (!wait_readable(shard->sockfd, shard->server->stop_pipe[0], -1)) {
+      break;
+    }
+#endif
+
+    /* Aceptar conexión de cliente */
+    cliaddr_len = sizeof(cliaddr);
+    connfd = accept(shard->sockfd, (struct sockaddr*)&cliaddr, &cliaddr_len);
+    if (connfd == -1) {
+#ifdef G_OS_UNIX
+      /* Otro proceso aceptó la conexión o el cliente la abortó */
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+          || errno == ECONNABORTED) {
+        continue;
+      }
+#endif
+      g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_SOCK_ACCEPT_ERROR,
+                          error_messages[TCP_SERVER_SOCK_ACCEPT_ERROR]);
+      break;
+    }
+    tcp_log(TCP_LOG_DEBUG, "Conexión aceptada...");
+
+#ifdef G_OS_UNIX
+    /* El socket de escucha no es bloqueante, pero las conexiones sí */
+    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) & ~O_NONBLOCK);
+    fcntl(connfd, F_SETFD, FD_CLOEXEC);
+#endif
+
+    /* Sobre el límite, rechazar en lugar de encolar la conexión */
+    accepted = limiter_acquire(&shard->server->limiter);
+    if (!accepted
+        && g_thread_pool_unprocessed(reject_pool) >= (guint)shard->server->max_conn) {
+      close_sock(connfd);
+      continue;
+    }
+
+    conn = g_new0(TcpServerThreadConn, 1);
+    conn->sock = connfd;
+    conn->accepted = g_get_monotonic_time();
+
+    /* Ejecutar función del servidor en otro hilo */
+    tcp_counter_add(shard->server->metrics.connections, 1);
+    tcp_counter_add(shard->server->metrics.queued, 1);
+    g_thread_pool_push(accepted ? thread_pool : reject_pool, conn, error);
+    if (*error != NULL) {
+      break;
+    }
+
+  } while (TRUE);
+
+  g_thread_pool_free(reject_pool, FALSE, TRUE);
+  g_thread_pool_free(thread_pool, FALSE, TRUE);
+  timers_stop(&timers);
+  g_free(reject_args);
+  g_free(thread_args);
+}
+
+#ifdef HAVE_REACTOR
+static TcpServerConn *conn_new(TcpServerLoop *loop, int sock)
+{
+  TcpServerConn *conn = g_new0(TcpServerConn, 1);
+
+  conn->loop = loop;
+  conn->sock = sock;
+  conn->phase = CONN_READ;
+  conn->accepted = g_get_monotonic_time();
+  conn->since = conn->accepted;
+  conn->link.data = conn;
+  g_queue_push_tail_link(&loop->conns, &conn->link);
+  tcp_counter_add(loop->metrics->connections, 1);
+
+  return conn;
+}
+
+static void conn_end_traces(TcpServerConn *conn)
+{
+  TcpTrace *trace;
+
+  /* El envío de las respuestas termina con la traza */
+  while ((trace = g_queue_pop_head(&conn->traces)) != NULL) {
+    tcp_trace_end(trace);
+  }
+}
+
+static void conn_free(TcpServerConn *conn)
+{
+  conn_end_traces(conn);
+  tcp_timer_wheel_remove(conn->loop->timers, &conn->timer);
+  g_queue_unlink(&conn->loop->conns, &conn->link);
+  close(conn->sock);
+
+  if (conn->reader != NULL) {
+    tcp_frame_reader_free(conn->reader);
+  }
+
+  if (conn->out != NULL) {
+    g_string_free(conn->out, TRUE);
+  }
+
+  if (conn->queued != NULL) {
+    g_string_free(conn->queued, TRUE);
+  }
+
+  tcp_counter_add(conn->loop->metrics->connections, -1);
+  g_free(conn);
+  tcp_log(TCP_LOG_DEBUG, "Desconectado del cliente.");
+}
+
+static TcpFrameReader *conn_reader(TcpServerConn *conn)
+{
+  /* Los buffers se asignan al recibir datos, no por cada conexión inactiva */
+  if (conn->reader == NULL) {
+    conn->reader = tcp_frame_reader_new(conn->loop->framing,
+                                        conn->loop->max_len);
+  }
+
+  return conn->reader;
+}
+
+static size_t conn_output(TcpServerConn *conn)
+{
+  return (conn->out != NULL ? conn->out->len - conn->sent : 0)
+       + (conn->queued != NULL ? conn->queued->len : 0);
+}
+
+static bool conn_busy(TcpServerConn *conn)
+{
+  return conn->running > 0 || conn_output(conn) > 0;
+}
+
+static bool conn_can_dispatch(TcpServerConn *conn)
+{
+  if (conn->hangup || conn->closing) {
+    return false;
+  }
+
+  /* Varias solicitudes en curso, mientras el cliente lea las respuestas */
+  if (conn->loop->framing == TCP_FRAMING_MUX) {
+    return conn->running < MAX_INFLIGHT
+        && conn_output(conn) < TCP_FRAME_MAX_LEN;
+  }
+
+  /* Una solicitud a la vez, y una sola si no se delimitan los mensajes */
+  return !conn_busy(conn)
+      && !(conn->loop->framing == TCP_FRAMING_NONE && conn->served);
+}
+
+static bool conn_finished(TcpServerConn *conn)
+{
+  if (conn->running > 0) {
+    return false;
+  }
+
+  if (conn->hangup) {
+    return true;
+  }
+
+  if (conn_output(conn) > 0) {
+    return false;
+  }
+
+  /* Al detener el servidor, cerrar entre solicitudes */
+  if (conn->loop->draining && conn->served
+      && (conn->reader == NULL || tcp_frame_reader_pending(conn->reader) == 0)) {
+    return true;
+  }
+
+  return conn->eof
+      || (conn->loop->framing == TCP_FRAMING_NONE && conn->served);
+}
+
+static void conn_resume_streams(TcpServerConn *conn)
+{
+  TcpServerJob *job;
+  TcpServerStreamStatus status;
+
+  /* Las funciones que envían partes siguen mientras el cliente las lea */
+  if (!conn->hangup && conn_output(conn) >= STREAM_WINDOW) {
+    return;
+  }
+
+  status = conn->hangup ? STREAM_CLOSED : STREAM_SENT;
+  while ((job = g_queue_pop_head(&conn->streams)) != NULL) {
+    g_async_queue_push(job->resume, GINT_TO_POINTER(status));
+  }
+}
+
+static void conn_schedule(TcpServerConn *conn)
+{
+  TcpServerLoop *loop = conn->loop;
+  TcpServerConnPhase phase;
+  unsigned int timeout;
+  gint64 deadline;
+
+  conn_resume_streams(conn);
+
+  if (conn_output(conn) == 0) {
+    conn_end_traces(conn);
+  }
+
+  /* Descartada, solo espera que terminen sus solicitudes en curso */
+  if (conn->hangup) {
+    tcp_timer_wheel_remove(loop->timers, &conn->timer);
+    return;
+  }
+
+  if (conn_output(conn) > 0) {
+    phase = CONN_WRITE;
+  } else if (conn->running > 0) {
+    phase = CONN_RUN;
+  } else if (conn->served
+             && (conn->reader == NULL
+                 || tcp_frame_reader_pending(conn->reader) == 0)) {
+    phase = CONN_IDLE;
+  } else {
+    phase = CONN_READ;
+  }
+
+  /* Cada plazo cuenta desde que la conexión pasa a ese estado */
+  if (phase != conn->phase) {
+    conn->phase = phase;
+    conn->since = g_get_monotonic_time();
+  }
+
+  switch (phase) {
+    case CONN_READ:
+      timeout = loop->read_timeout;
+      break;
+    case CONN_IDLE:
+      timeout = loop->idle_timeout;
+      break;
+    case CONN_WRITE:
+      timeout = loop->write_timeout;
+      break;
+    default:
+      timeout = 0;
+      break;
+  }
+
+  deadline = deadline_at(conn->since, timeout, conn->accepted,
+                         loop->total_timeout);
+  if (deadline == 0) {
+    tcp_timer_wheel_remove(loop->timers, &conn->timer);
+  } else {
+    tcp_timer_wheel_add(loop->timers, &conn->timer, deadline, conn);
+  }
+}
+
+static bool conn_expire(TcpServerConn *conn)
+{
+  tcp_log(TCP_LOG_DEBUG, "Plazo vencido, cerrando conexión...");
+
+  /* Con solicitudes en curso, se libera cuando terminan */
+  conn->hangup = true;
+  conn_resume_streams(conn);
+
+  return conn_finished(conn);
+}
+
+static void conns_close_finished(TcpServerLoop *loop,
+                                 void (*release)(TcpServerConn*))
+{
+  GList *link = loop->conns.head;
+  GList *next;
+
+  /* Al detener el servidor, las conexiones inactivas ya se pueden cerrar */
+  while (link != NULL) {
+    next = link->next;
+    if (conn_finished(link->data)) {
+      release(link->data);
+    }
+    link = next;
+  }
+}
+
+static void conn_finish_job(TcpServerJob *job)
+{
+  TcpServerConn *conn = job->conn;
+  GString *reply = job->reply.data;
+
+  /* Una parte de la respuesta, mientras la función espera en su hilo */
+  if (job->part != NULL) {
+    if (!conn->hangup) {
+      if (conn->queued == NULL) {
+        conn->queued = g_string_sized_new(job->part->len);
+      }
+      g_string_append_len(conn->queued, job->part->str, job->part->len);
+    }
+    g_string_free(job->part, TRUE);
+    job->part = NULL;
+    g_queue_push_tail(&conn->streams, job);
+    return;
+  }
+
+  conn->running--;
+
+  /* Las respuestas se envían en el orden en que terminan */
+  if (!conn->hangup) {
+    if (conn->queued == NULL) {
+      conn->queued = g_string_sized_new(reply->len);
+    }
+    g_string_append_len(conn->queued, reply->str, reply->len);
+  }
+
+  /* La traza termina cuando se envían todas las respuestas pendientes */
+  if (job->trace != NULL) {
+    tcp_trace_add(job->trace, "send", g_get_monotonic_time(), 0);
+    g_queue_push_tail(&conn->traces, job->trace);
+  }
+
+  if (job->resume != NULL) {
+    g_async_queue_unref(job->resume);
+  }
+  g_string_free(job->request, TRUE);
+  g_string_free(reply, TRUE);
+  g_free(job);
+}
+
+static bool job_send_part(TcpServerReply *reply, void *data)
+{
+  TcpServerJob *job = (TcpServerJob*)data;
+  TcpServerLoop *loop = job->conn->loop;
+  uint64_t done = 1;
+
+  /* El reactor envía la parte y reanuda la función cuando hay lugar */
+  if (job->resume == NULL) {
+    job->resume = g_async_queue_new();
+  }
+  job->part = g_string_new_len(reply->data->str, reply->data->len);
+
+  g_async_queue_push(loop->done, job);
+  if (write(loop->eventfd, &done, sizeof(done)) == -1) {
+    tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+  }
+
+  return GPOINTER_TO_INT(g_async_queue_pop(job->resume)) == STREAM_SENT;
+}
+
+static void conn_dispatch(TcpServerConn *conn)
+{
+  TcpFrameStatus status;
+  TcpServerJob *job;
+  const char *frame;
+  size_t frame_len;
+  gint64 now, received;
+
+  while (conn->reader != NULL && conn_can_dispatch(conn)) {
+    status = tcp_frame_reader_next(conn->reader, &frame, &frame_len);
+    if (status != TCP_FRAME_READY) {
+      conn->hangup = status == TCP_FRAME_TOO_LONG;
+      return;
+    }
+
+    /* El hilo trabaja sobre una copia, ya que el lector sigue recibiendo */
+    job = g_new0(TcpServerJob, 1);
+    job->conn = conn;
+    job->id = tcp_frame_reader_id(conn->reader);
+    job->request = g_string_new_len(frame, frame_len);
+    job->reply.data = g_string_sized_new(MAX_MSG_LEN);
+    job->reply.send = job_send_part;
+    job->reply.send_data = job;
+
+    /* Se recibe desde que la conexión espera la solicitud, o desde ahora */
+    now = g_get_monotonic_time();
+    received = conn->phase == CONN_READ ? conn->since : now;
+    job->reply.received = received;
+    job->trace = tcp_trace_begin(received);
+    tcp_trace_add(job->trace, "recv", received, now);
+
+    conn->running++;
+    conn->served = true;
+
+    /* Sobre el límite, responder en el acto en lugar de encolar */
+    if (!limiter_acquire(conn->loop->limiter)) {
+      run_func(reply_overloaded, NULL, conn->loop->framing, job->id,
+               job->request, &job->reply);
+      conn_finish_job(job);
+      continue;
+    }
+
+    /* Ejecutar función del servidor en otro hilo */
+    job->start = now;
+    tcp_counter_add(conn->loop->metrics->queued, 1);
+    g_thread_pool_push(conn->loop->thread_pool, job, NULL);
+  }
+}
+
+static bool conn_next_output(TcpServerConn *conn)
+{
+  GString *out = conn->out;
+
+  if (out != NULL && conn->sent < out->len) {
+    return true;
+  }
+
+  if (conn->queued == NULL || conn->queued->len == 0) {
+    return false;
+  }
+
+  /* Enviar las respuestas acumuladas mientras se enviaban las anteriores */
+  conn->out = conn->queued;
+  conn->queued = out != NULL ? out : g_string_sized_new(MAX_MSG_LEN);
+  g_string_truncate(conn->queued, 0);
+  conn->sent = 0;
+
+  return true;
+}
+
+static void run_loop_job(void *job_ptr, void *data)
+{
+  TcpServerJob *job = (TcpServerJob*)job_ptr;
+  TcpServerLoop *loop = (TcpServerLoop*)data;
+  uint64_t done = 1;
+  gint64 now;
+
+  pin_thread(loop->cpu);
+  now = g_get_monotonic_time();
+  tcp_counter_add(loop->metrics->queued, -1);
+  tcp_counter_add(loop->metrics->running, 1);
+  tcp_histogram_record(loop->metrics->queue_wait, now - job->start);
+  tcp_trace_add(job->trace, "queue", job->start, now);
+  tcp_trace_attach(job->trace);
+  run_func_timed(loop->metrics, loop->func, loop->data, loop->framing, job->id,
+                 job->request, &job->reply);
+  tcp_trace_attach(NULL);
+  limiter_sample(loop->limiter, g_get_monotonic_time() - job->start);
+  limiter_release(loop->limiter);
+  tcp_counter_add(loop->metrics->running, -1);
+
+  /* Devolver la solicitud al reactor para enviar la respuesta */
+  g_async_queue_push(loop->done, job);
+  if (write(loop->eventfd, &done, sizeof(done)) == -1) {
+    tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+  }
+}
+#endif
+
+#ifdef HAVE_EPOLL
+static void conn_flush(TcpServerConn *conn)
+{
+  ssize_t sent;
+
+  while (!conn->hangup && conn_next_output(conn)) {
+    sent = send(conn->sock,
+                conn->out->str + conn->sent,
+                conn->out->len - conn->sent,
+                MSG_NOSIGNAL);
+
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      /* Esperar a que el socket admita más datos (EPOLLOUT) */
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn->hangup = true;
+      }
+
+      return;
+    }
+
+    /* El plazo de escritura se renueva mientras el cliente lea */
+    conn->sent += sent;
+    conn->since = g_get_monotonic_time();
+  }
+}
+
+static void conn_process(TcpServerConn *conn)
+{
+  TcpFrameReader *reader = conn_reader(conn);
+  ssize_t recv_len;
+  char *recv_buf;
+
+  conn_flush(conn);
+
+  /* Atender primero las solicitudes ya recibidas */
+  conn_dispatch(conn);
+
+  /* Leer solo mientras se puedan atender nuevas solicitudes */
+  while (!conn->eof && conn_can_dispatch(conn)) {
+    recv_buf = tcp_frame_reader_reserve(reader, MAX_MSG_LEN);
+    recv_len = recv(conn->sock, recv_buf, MAX_MSG_LEN, 0);
+
+    if (recv_len > 0) {
+      tcp_frame_reader_commit(reader, recv_len);
+      conn_dispatch(conn);
+      continue;
+    }
+
+    if (recv_len == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (recv_len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+
+    conn->eof = true;
+    conn->hangup = recv_len == -1;
+  }
+
+  /* Enviar las respuestas generadas sin pasar por el "pool" de hilos */
+  conn_flush(conn);
+
+  if (conn_finished(conn)) {
+    conn_free(conn);
+  } else {
+    conn_schedule(conn);
+  }
+}
+
+static void conn_event(TcpServerConn *conn, uint32_t events)
+{
+  /* Con solicitudes en curso, se descartan al terminar */
+  if ((events & (EPOLLHUP | EPOLLERR)) && conn_busy(conn)) {
+    conn->hangup = true;
+  }
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || conn_output(conn) > 0) {
+    conn_process(conn);
+  }
+}
+
+static void accept_conns(TcpServerLoop *loop)
+{
+  struct epoll_event event;
+  TcpServerConn *conn;
+  int connfd;
+
+  /* Edge-triggered: aceptar hasta vaciar la cola del socket */
+  while (!loop->draining) {
+    connfd = accept4(loop->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        tcp_log(TCP_LOG_ERROR, "%s: %s",
+                error_messages[TCP_SERVER_SOCK_ACCEPT_ERROR], g_strerror(errno));
+      }
+      break;
+    }
+    tcp_log(TCP_LOG_DEBUG, "Conexión aceptada...");
+
+    conn = conn_new(loop, connfd);
+
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = conn;
+    if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, connfd, &event) == -1) {
+      conn_free(conn);
+    } else {
+      conn_schedule(conn);
+    }
+  }
+}
+
+static void finish_jobs(TcpServerLoop *loop)
+{
+  TcpServerConn *conn;
+  TcpServerJob *job;
+  uint64_t done;
+
+  if (read(loop->eventfd, &done, sizeof(done)) == -1 && errno != EAGAIN) {
+    tcp_log(TCP_LOG_ERROR, "eventfd: %s", g_strerror(errno));
+  }
+
+  while ((job = g_async_queue_try_pop(loop->done)) != NULL) {
+    conn = job->conn;
+    conn_finish_job(job);
+    conn_process(conn);
+  }
+}
+
+static void run_epoll_loop(TcpServerShard *shard, GError **error)
+{
+  struct epoll_event event;
+  struct epoll_event events[MAX_EVENTS];
+  TcpServerConn *conn;
+  bool jobs_done;
+  gint64 now;
+  int n_events;
+  int sockfd = shard->sockfd;
+  TcpServerLoop loop = {
+    .func = shard->func,
+    .data = shard->data,
+    .sockfd = sockfd,
+    .cpu = shard->cpu,
+    .framing = shard->server->framing,
+    .max_len = server_max_len(shard->server),
+    .metrics = &shard->server->metrics,
+    .idle_timeout = shard->server->idle_timeout,
+    .read_timeout = shard->server->read_timeout,
+    .write_timeout = shard->server->write_timeout,
+    .total_timeout = shard->server->total_timeout,
+    .stopfd = shard->server->stop_pipe[0],
+    .conns = G_QUEUE_INIT,
+    .limiter = &shard->server->limiter,
+  };
+
+  /* Crear instancia de epoll y eventfd para las respuestas de los hilos */
+  loop.epollfd = epoll_create1(EPOLL_CLOEXEC);
+  return_set_error_if(loop.epollfd == -1, error, TCP_SERVER_EPOLL_ERROR);
+  loop.eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop.eventfd == -1) {
+    close(loop.epollfd);
+  }
+  return_set_error_if(loop.eventfd == -1, error, TCP_SERVER_EPOLL_ERROR);
+
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &loop.sockfd;
+  epoll_ctl(loop.epollfd, EPOLL_CTL_ADD, sockfd, &event);
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &loop.eventfd;
+  epoll_ctl(loop.epollfd, EPOLL_CTL_ADD, loop.eventfd, &event);
+  if (loop.stopfd != -1) {
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &loop.stopfd;
+    epoll_ctl(loop.epollfd, EPOLL_CTL_ADD, loop.stopfd, &event);
+  }
+
+  /* Inicializar thread pool */
+  loop.done = g_async_queue_new();
+  loop.thread_pool = g_thread_pool_new(run_loop_job,
+                                       &loop,
+                                       shard_max_threads(shard->server),
+                                       shard_exclusive(shard->server),
+                                       error);
+  if (*error != NULL) {
+    g_async_queue_unref(loop.done);
+    close(loop.eventfd);
+    close(loop.epollfd);
+    return;
+  }
+
+  /* Plazos de todas las conexiones del reactor */
+  loop.timers = tcp_timer_wheel_new(g_get_monotonic_time());
+
+  do {
+    n_events = epoll_wait(loop.epollfd, events, MAX_EVENTS,
+                          tcp_timer_wheel_timeout(loop.timers,
+                                                  g_get_monotonic_time()));
+    if (n_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_EPOLL_ERROR,
+                          error_messages[TCP_SERVER_EPOLL_ERROR]);
+      break;
+    }
+
+    jobs_done = false;
+    for (int i = 0; i < n_events; i++) {
+      if (events[i].data.ptr == &loop.sockfd) {
+        accept_conns(&loop);
+      } else if (events[i].data.ptr == &loop.stopfd) {
+        /* Dejar de aceptar y terminar de atender las conexiones abiertas */
+        loop.draining = true;
+        epoll_ctl(loop.epollfd, EPOLL_CTL_DEL, sockfd, NULL);
+        conns_close_finished(&loop, conn_free);
+      } else if (events[i].data.ptr == &loop.eventfd) {
+        jobs_done = true;
+      } else {
+        conn_event(events[i].data.ptr, events[i].events);
+      }
+    }
+
+    /*
+     * Las respuestas se procesan al final, ya que pueden liberar conexiones
+     * que todavía tengan eventos pendientes en este lote.
+     */
+    if (jobs_done) {
+      finish_jobs(&loop);
+    }
+
+    /* Cerrar conexiones con el plazo vencido */
+    now = g_get_monotonic_time();
+    while ((conn = tcp_timer_wheel_expire(loop.timers, now)) != NULL) {
+      if (conn_expire(conn)) {
+        conn_free(conn);
+      }
+    }
+
+  } while (!loop.draining || loop.conns.length > 0);
+
+  g_thread_pool_free(loop.thread_pool, FALSE, TRUE);
+  tcp_timer_wheel_free(loop.timers);
+  g_async_queue_unref(loop.done);
+  close(loop.eventfd);
+  close(loop.epollfd);
+}
+#endif
+
+#ifdef HAVE_LIBURING
+static struct io_uring_sqe *uring_sqe(TcpServerLoop *loop,
+                                      TcpServerUringOp op,
+                                      void *ptr)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(loop->ring);
+
+  /* Cola de envío llena: enviar lo acumulado al kernel y reintentar */
+  if (sqe == NULL) {
+    io_uring_submit(loop->ring);
+    sqe = io_uring_get_sqe(loop->ring);
+  }
+
+  io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)ptr | op);
+
+  return sqe;
+}
+
+static void uring_accept(TcpServerLoop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop, URING_ACCEPT, NULL);
+
+  /* Un solo SQE acepta conexiones hasta que el kernel lo cancele */
+  io_uring_prep_multishot_accept(sqe, loop->sockfd, NULL, NULL, SOCK_CLOEXEC);
+}
+
+static void uring_recv(TcpServerConn *conn)
+{
+  struct io_uring_sqe *sqe = uring_sqe(conn->loop, URING_RECV, conn);
+
+  /* El kernel elige un buffer del grupo provisto al recibir datos */
+  io_uring_prep_recv_multishot(sqe, conn->sock, NULL, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  conn->pending++;
+}
+
+static void uring_send(TcpServerConn *conn)
+{
+  struct io_uring_sqe *sqe = uring_sqe(conn->loop, URING_SEND, conn);
+
+  io_uring_prep_send(sqe,
+                     conn->sock,
+                     conn->out->str + conn->sent,
+                     conn->out->len - conn->sent,
+                     MSG_NOSIGNAL);
+  conn->sending = true;
+  conn->pending++;
+}
+
+static void uring_wakeup(TcpServerLoop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop, URING_WAKEUP, NULL);
+
+  io_uring_prep_read(sqe, loop->eventfd, &loop->wakeup, sizeof(loop->wakeup), 0);
+}
+
+static void uring_stop(TcpServerLoop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop, URING_STOP, NULL);
+
+  io_uring_prep_poll_add(sqe, loop->stopfd, POLLIN);
+}
+
+static void uring_drain(TcpServerLoop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop, URING_CANCEL, NULL);
+
+  /* Dejar de aceptar y terminar de atender las conexiones abiertas */
+  loop->draining = true;
+  io_uring_prep_cancel64(sqe, URING_ACCEPT, 0);
+}
+
+static void uring_release(TcpServerConn *conn)
+{
+  struct io_uring_sqe *sqe;
+
+  tcp_timer_wheel_remove(conn->loop->timers, &conn->timer);
+
+  /* Se libera cuando no quedan operaciones del kernel sobre la conexión */
+  if (conn->pending == 0) {
+    conn_free(conn);
+    return;
+  }
+
+  /* Terminar la recepción "multishot" pendiente */
+  if (!conn->closing) {
+    conn->closing = true;
+    sqe = uring_sqe(conn->loop, URING_SHUTDOWN, conn);
+    io_uring_prep_shutdown(sqe, conn->sock, SHUT_RDWR);
+    conn->pending++;
+  }
+}
+
+static void uring_process(TcpServerConn *conn)
+{
+  TcpServerLoop *loop = conn->loop;
+
+  if (conn->closing) {
+    return;
+  }
+
+  conn_dispatch(conn);
+
+  /* El cliente envía más de lo que se atiende: descartar la conexión */
+  if (conn->reader != NULL
+      && tcp_frame_reader_pending(conn->reader) > 2 * loop->max_len) {
+    conn->hangup = true;
+  }
+
+  if (conn_finished(conn)) {
+    uring_release(conn);
+    return;
+  }
+
+  /* Un solo envío en curso por conexión, para conservar el orden */
+  if (!conn->sending && !conn->hangup && conn_next_output(conn)) {
+    uring_send(conn);
+  }
+
+  conn_schedule(conn);
+}
+
+static void uring_recv_done(TcpServerConn *conn, struct io_uring_cqe *cqe)
+{
+  TcpServerLoop *loop = conn->loop;
+  unsigned short bid;
+  char *buf;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    conn->pending--;
+  }
+
+  if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = loop->bufs + (size_t)bid * MAX_MSG_LEN;
+
+    /* Los datos que no se pueden atender todavía quedan en espera */
+    if (!conn->closing && !conn->hangup) {
+      tcp_frame_reader_feed(conn_reader(conn), buf, cqe->res);
+    }
+
+    /* Devolver el buffer al grupo provisto */
+    io_uring_buf_ring_add(loop->buf_ring, buf, MAX_MSG_LEN, bid,
+                          io_uring_buf_ring_mask(URING_BUFS), 0);
+    io_uring_buf_ring_advance(loop->buf_ring, 1);
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    if (conn->closing) {
+      uring_release(conn);
+      return;
+    }
+
+    /* Sin buffers libres el kernel termina la recepción: volver a armarla */
+    if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+      uring_recv(conn);
+    } else {
+      /* El cliente terminó de enviar (0) o la conexión falló (< 0) */
+      conn->eof = true;
+      conn->hangup = conn->hangup || cqe->res < 0;
+    }
+  }
+
+  uring_process(conn);
+}
+
+static void uring_send_done(TcpServerConn *conn, struct io_uring_cqe *cqe)
+{
+  conn->pending--;
+  conn->sending = false;
+
+  if (conn->closing) {
+    uring_release(conn);
+    return;
+  }
+
+  /* El plazo de escritura se renueva mientras el cliente lea */
+  if (cqe->res > 0) {
+    conn->sent += cqe->res;
+    conn->since = g_get_monotonic_time();
+  } else {
+    conn->hangup = true;
+  }
+
+  uring_process(conn);
+}
+
+static void uring_finish_jobs(TcpServerLoop *loop)
+{
+  TcpServerConn *conn;
+  TcpServerJob *job;
+
+  while ((job = g_async_queue_try_pop(loop->done)) != NULL) {
+    conn = job->conn;
+    conn_finish_job(job);
+    uring_process(conn);
+  }
+
+  uring_wakeup(loop);
+}
+
+static void uring_complete(TcpServerLoop *loop, struct io_uring_cqe *cqe)
+{
+  uint64_t user_data = io_uring_cqe_get_data64(cqe);
+  TcpServerConn *conn = (TcpServerConn*)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+
+  switch (user_data & URING_OP_MASK) {
+    case URING_ACCEPT:
+      if (cqe->res >= 0) {
+        tcp_log(TCP_LOG_DEBUG, "Conexión aceptada...");
+        conn = conn_new(loop, cqe->res);
+        uring_recv(conn);
+        conn_schedule(conn);
+      } else if (!loop->draining) {
+        tcp_log(TCP_LOG_ERROR, "%s: %s",
+                error_messages[TCP_SERVER_SOCK_ACCEPT_ERROR],
+                strerror(-cqe->res));
+      }
+      if (!(cqe->flags & IORING_CQE_F_MORE) && !loop->draining) {
+        uring_accept(loop);
+      }
+      break;
+    case URING_RECV:
+      uring_recv_done(conn, cqe);
+      break;
+    case URING_SEND:
+      uring_send_done(conn, cqe);
+      break;
+    case URING_SHUTDOWN:
+      conn->pending--;
+      uring_release(conn);
+      break;
+    case URING_WAKEUP:
+      uring_finish_jobs(loop);
+      break;
+    case URING_STOP:
+      uring_drain(loop);
+      conns_close_finished(loop, uring_release);
+      break;
+    case URING_CANCEL:
+      break;
+  }
+}
+
+static void run_uring_loop(TcpServerShard *shard, GError **error)
+{
+  struct io_uring ring;
+  struct io_uring_cqe *cqe;
+  struct __kernel_timespec timeout;
+  TcpServerConn *conn;
+  unsigned int head, n_cqes;
+  gint64 now;
+  int result, wait;
+  TcpServerLoop loop = {
+    .func = shard->func,
+    .data = shard->data,
+    .sockfd = shard->sockfd,
+    .cpu = shard->cpu,
+    .epollfd = -1,
+    .framing = shard->server->framing,
+    .max_len = server_max_len(shard->server),
+    .metrics = &shard->server->metrics,
+    .idle_timeout = shard->server->idle_timeout,
+    .read_timeout = shard->server->read_timeout,
+    .write_timeout = shard->server->write_timeout,
+    .total_timeout = shard->server->total_timeout,
+    .stopfd = shard->server->stop_pipe[0],
+    .conns = G_QUEUE_INIT,
+    .limiter = &shard->server->limiter,
+    .ring = &ring,
+  };
+
+  /* Crear instancia de io_uring */
+  result = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+  return_set_error_if(result < 0, error, TCP_SERVER_URING_ERROR);
+
+  /* Proveer al kernel buffers para recibir sin una llamada por conexión */
+  loop.buf_ring = io_uring_setup_buf_ring(&ring, URING_BUFS, URING_BGID, 0,
+                                          &result);
+  loop.eventfd = eventfd(0, EFD_CLOEXEC);
+  if (loop.buf_ring == NULL || loop.eventfd == -1) {
+    if (loop.eventfd != -1) {
+      close(loop.eventfd);
+    }
+    io_uring_queue_exit(&ring);
+  }
+  return_set_error_if(loop.buf_ring == NULL || loop.eventfd == -1,
+                      error, TCP_SERVER_URING_ERROR);
+
+  loop.bufs = g_malloc((size_t)URING_BUFS * MAX_MSG_LEN);
+  for (int i = 0; i < URING_BUFS; i++) {
+    io_uring_buf_ring_add(loop.buf_ring, loop.bufs + (size_t)i * MAX_MSG_LEN,
+                          MAX_MSG_LEN, i, io_uring_buf_ring_mask(URING_BUFS), i);
+  }
+  io_uring_buf_ring_advance(loop.buf_ring, URING_BUFS);
+
+  /* Plazos de todas las conexiones del reactor */
+  loop.timers = tcp_timer_wheel_new(g_get_monotonic_time());
+
+  /* Inicializar thread pool */
+  loop.done = g_async_queue_new();
+  loop.thread_pool = g_thread_pool_new(run_loop_job,
+                                       &loop,
+                                       shard_max_threads(shard->server),
+                                       shard_exclusive(shard->server),
+                                       error);
+
+  if (*error == NULL) {
+    uring_accept(&loop);
+    uring_wakeup(&loop);
+    if (loop.stopfd != -1) {
+      uring_stop(&loop);
+    }
+
+    do {
+      /* Enviar todas las operaciones acumuladas en una sola llamada */
+      wait = tcp_timer_wheel_timeout(loop.timers, g_get_monotonic_time());
+      if (wait < 0) {
+        result = io_uring_submit_and_wait(&ring, 1);
+      } else {
+        timeout.tv_sec = wait / 1000;
+        timeout.tv_nsec = (long long)(wait % 1000) * 1000000;
+        result = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &timeout,
+                                                  NULL);
+      }
+      if (result < 0 && result != -EINTR && result != -ETIME) {
+        g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_URING_ERROR,
+                            error_messages[TCP_SERVER_URING_ERROR]);
+        break;
+      }
+
+      n_cqes = 0;
+      io_uring_for_each_cqe(&ring, head, cqe) {
+        uring_complete(&loop, cqe);
+        n_cqes++;
+      }
+      io_uring_cq_advance(&ring, n_cqes);
+
+      /* Cerrar conexiones con el plazo vencido */
+      now = g_get_monotonic_time();
+      while ((conn = tcp_timer_wheel_expire(loop.timers, now)) != NULL) {
+        if (conn_expire(conn)) {
+          uring_release(conn);
+        }
+      }
+
+    } while (!loop.draining || loop.conns.length > 0);
+
+    g_thread_pool_free(loop.thread_pool, FALSE, TRUE);
+  }
+
+  tcp_timer_wheel_free(loop.timers);
+
+  g_async_queue_unref(loop.done);
+  io_uring_free_buf_ring(&ring, loop.buf_ring, URING_BUFS, URING_BGID);
+  io_uring_queue_exit(&ring);
+  g_free(loop.bufs);
+  close(loop.eventfd);
+}
+#endif
+
+static socklen_t set_server_addr(TcpServer               *server,
+                                 struct sockaddr_storage *srvaddr)
+{
+  struct sockaddr_in *inaddr = (struct sockaddr_in*)srvaddr;
+
+  memset(srvaddr, 0, sizeof(*srvaddr));
+
+#ifdef G_OS_UNIX
+  if (server->unix_path != NULL) {
+    struct sockaddr_un *unaddr = (struct sockaddr_un*)srvaddr;
+
+    if (*server->unix_path == '\0'
+        || strlen(server->unix_path) >= sizeof(unaddr->sun_path)) {
+      return 0;
+    }
+    unaddr->sun_family = AF_UNIX;
+    strcpy(unaddr->sun_path, server->unix_path);
+
+    return sizeof(*unaddr);
+  }
+#endif
+
+  inaddr->sin_family = AF_INET;
+  inaddr->sin_addr.s_addr = htonl(server->addr);
+  inaddr->sin_port = htons(server->port);
+
+  return sizeof(*inaddr);
+}
+
+#ifdef G_OS_UNIX
+static void remove_stale_socket(struct sockaddr_un *unaddr)
+{
+  struct stat st;
+  int sock;
+  bool listening;
+
+  if (stat(unaddr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode)) {
+    return;
+  }
+
+  /* Solo se borra el socket de un servidor que ya no escucha */
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1) {
+    return;
+  }
+  listening = connect(sock, (struct sockaddr*)unaddr, sizeof(*unaddr)) == 0
+           || errno != ECONNREFUSED;
+  close(sock);
+
+  if (!listening) {
+    unlink(unaddr->sun_path);
+  }
+}
+#endif
+
+static int open_listener(TcpServer *server, GError **error)
+{
+  struct sockaddr_storage srvaddr;
+  socklen_t srvaddr_len;
+  int sockfd, binded, listening;
+  TcpServerError code;
+
+  /* Asignar IP y puerto, o la ruta del socket Unix */
+  srvaddr_len = set_server_addr(server, &srvaddr);
+  if (srvaddr_len == 0) {
+    g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_SOCK_BIND_ERROR,
+                        error_messages[TCP_SERVER_SOCK_BIND_ERROR]);
+    return -1;
+  }
+
+  /* Crear socket */
+  sockfd = socket(srvaddr.ss_family, SOCK_STREAM, 0);
+  if (sockfd == -1) {
+    g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_SOCK_ERROR,
+                        error_messages[TCP_SERVER_SOCK_ERROR]);
+    return -1;
+  }
+  tcp_log(TCP_LOG_INFO, "Socket creado correctamente...");
+
+#ifdef G_OS_UNIX
+  /* No bloqueante para poder detener la aceptación, y sin heredarse */
+  fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(sockfd, F_SETFD, FD_CLOEXEC);
+#endif
+
+#ifdef SO_REUSEPORT
+  /* Varios sockets en el mismo puerto, el kernel reparte las conexiones */
+  if (server->shards > 1) {
+    int reuseport = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport));
+  }
+#endif
+
+#ifdef G_OS_UNIX
+  if (srvaddr.ss_family == AF_UNIX) {
+    remove_stale_socket((struct sockaddr_un*)&srvaddr);
+  }
+#endif
+
+  /* Enlazar socket creado a IP/puerto y escuchar puerto */
+  binded = bind(sockfd, (struct sockaddr*)&srvaddr, srvaddr_len);
+  listening = binded == -1 ? -1 : listen(sockfd, server->max_conn);
+  if (listening == -1) {
+    code = binded == -1 ? TCP_SERVER_SOCK_BIND_ERROR
+                        : TCP_SERVER_SOCK_LISTEN_ERROR;
+    g_set_error_literal(error, TCP_SERVER_ERROR, code, error_messages[code]);
+#ifdef G_OS_UNIX
+    close(sockfd);
+#endif
+#ifdef G_OS_WIN32
+    closesocket(sockfd);
+#endif
+    return -1;
+  }
+  if (server->unix_path != NULL) {
+    tcp_log(TCP_LOG_INFO, "Servidor escuchando %s...", server->unix_path);
+  } else {
+    tcp_log(TCP_LOG_INFO, "Servidor escuchando puerto %d...", server->port);
+  }
+
+  return sockfd;
+}
+
+#ifdef G_OS_UNIX
+static bool send_listeners(int sock, int *fds, int n_fds, GBytes *state)
+{
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  uint32_t header[2];
+  const char *state_data = NULL;
+  gsize state_len = 0;
+
+  if (state != NULL) {
+    state_data = g_bytes_get_data(state, &state_len);
+  }
+
+  /* Cantidad de sockets y longitud del estado, con los sockets adjuntos */
+  n_fds = MIN(n_fds, HANDOFF_MAX_FDS);
+  header[0] = n_fds;
+  header[1] = state_len;
+  iov.iov_base = header;
+  iov.iov_len = sizeof(header);
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+
+  if (sendmsg(sock, &msg, SEND_FLAGS) != sizeof(header)) {
+    return false;
+  }
+
+  return send_all(sock, state_data, state_len);
+}
+
+static bool restart_server(TcpServer *server)
+{
+  GError *error = NULL;
+  GBytes *state = NULL;
+  char **envp;
+  char fd_str[16];
+  char ready;
+  int pair[2];
+  bool done;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+    tcp_log(TCP_LOG_ERROR, "socketpair: %s", g_strerror(errno));
+    return false;
+  }
+  fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+
+  /* El nuevo proceso recibe su extremo del par de sockets por el entorno */
+  g_snprintf(fd_str, sizeof(fd_str), "%d", pair[1]);
+  envp = g_environ_setenv(g_get_environ(), HANDOFF_ENV, fd_str, TRUE);
+  done = g_spawn_async(NULL, server->restart_argv, envp,
+                       G_SPAWN_SEARCH_PATH | G_SPAWN_LEAVE_DESCRIPTORS_OPEN,
+                       NULL, NULL, NULL, &error);
+  g_strfreev(envp);
+  close(pair[1]);
+
+  /* El estado se guarda lo más tarde posible, con el nuevo proceso listo */
+  if (done) {
+    if (server->save_state != NULL) {
+      state = server->save_state(server->save_data);
+    }
+    done = send_listeners(pair[0], server->listeners, server->n_listeners,
+                          state);
+    if (state != NULL) {
+      g_bytes_unref(state);
+    }
+  }
+
+  /* Esperar a que el nuevo proceso confirme que atiende los sockets */
+  if (done) {
+    set_recv_timeout(pair[0], HANDOFF_TIMEOUT);
+    done = recv(pair[0], &ready, 1, 0) == 1;
+  }
+  close(pair[0]);
+
+  if (error != NULL) {
+    tcp_log(TCP_LOG_ERROR, "Error al reiniciar el servidor: %s",
+            error->message);
+    g_error_free(error);
+  } else if (!done) {
+    tcp_log(TCP_LOG_ERROR, "Error al reiniciar el servidor: el nuevo proceso "
+                           "no respondió");
+  }
+
+  return done;
+}
+
+static void *run_restart_thread(void *data)
+{
+  TcpServer *server = (TcpServer*)data;
+  sigset_t signals;
+  int signum;
+
+  sigemptyset(&signals);
+  sigaddset(&signals, RESTART_SIGNAL);
+
+  while (sigwait(&signals, &signum) == 0
+         && g_atomic_int_get(&server->running)) {
+    tcp_log(TCP_LOG_INFO, "Reiniciando servidor...");
+    if (restart_server(server)) {
+      tcp_log(TCP_LOG_INFO,
+              "Nuevo proceso listo, terminando las conexiones abiertas...");
+      tcp_server_stop(server);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static GThread *restart_begin(TcpServer      *server,
+                              TcpServerShard *shards,
+                              int             n_shards)
+{
+  /* Tubería para detener los bucles de aceptación desde otro hilo */
+  if (pipe(server->stop_pipe) == 0) {
+    fcntl(server->stop_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(server->stop_pipe[1], F_SETFD, FD_CLOEXEC);
+  } else {
+    server->stop_pipe[0] = server->stop_pipe[1] = -1;
+  }
+
+  server->listeners = g_new(int, n_shards);
+  server->n_listeners = n_shards;
+  for (int i = 0; i < n_shards; i++) {
+    server->listeners[i] = shards[i].sockfd;
+  }
+  g_atomic_int_set(&server->running, TRUE);
+
+  /* Avisar al proceso anterior que ya puede dejar de aceptar conexiones */
+  if (server->handoff != -1) {
+    if (send(server->handoff, "", 1, SEND_FLAGS) != 1) {
+      tcp_log(TCP_LOG_ERROR, "%s: %s",
+              error_messages[TCP_SERVER_HANDOFF_ERROR], g_strerror(errno));
+    }
+    close(server->handoff);
+    server->handoff = -1;
+  }
+
+  if (server->restart_argv == NULL) {
+    return NULL;
+  }
+
+  return g_thread_new("tcp-server-restart", run_restart_thread, server);
+}
+
+static void restart_end(TcpServer *server, GThread *restart_thread)
+{
+  g_atomic_int_set(&server->running, FALSE);
+
+  /* Despertar al hilo que espera la señal para que termine */
+  if (restart_thread != NULL) {
+    kill(getpid(), RESTART_SIGNAL);
+    g_thread_join(restart_thread);
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (server->stop_pipe[i] != -1) {
+      close(server->stop_pipe[i]);
+      server->stop_pipe[i] = -1;
+    }
+  }
+
+  g_free(server->listeners);
+  server->listeners = NULL;
+  server->n_listeners = 0;
+}
+
+static void admin_reply(TcpServer *server, int sock)
+{
+  GString *out = g_string_sized_new(4096);
+  TcpServerStats stats;
+  char request[MAX_MSG_LEN];
+  int recv_len;
+  bool http;
+
+  /* La solicitud es opcional: con "GET" se responde como HTTP */
+  set_recv_timeout(sock, ADMIN_TIMEOUT);
+  recv_len = recv(sock, request, sizeof(request), 0);
+  http = recv_len >= 4 && memcmp(request, "GET ", 4) == 0;
+
+  tcp_server_get_stats(server, &stats);
+  g_string_append_printf(out, "server.limit %u\n", stats.limit);
+  g_string_append_printf(out, "server.inflight %u\n", stats.inflight);
+  g_string_append_printf(out, "server.accepted %" PRIu64 "\n", stats.accepted);
+  g_string_append_printf(out, "server.rejected %" PRIu64 "\n", stats.rejected);
+  tcp_metrics_format(out);
+
+  if (http) {
+    char *header = g_strdup_printf("HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: text/plain\r\n"
+                                   "Content-Length: %zu\r\n\r\n", out->len);
+    g_string_prepend(out, header);
+    g_free(header);
+  }
+
+  send_all(sock, out->str, out->len);
+  g_string_free(out, TRUE);
+}
+
+static void *run_admin_thread(void *data)
+{
+  TcpServer *server = (TcpServer*)data;
+  struct pollfd admin = { .fd = server->admin_sock, .events = POLLIN };
+  int sock;
+
+  /* Se sigue atendiendo mientras terminan las conexiones abiertas */
+  while (g_atomic_int_get(&server->running)) {
+    if (poll(&admin, 1, ADMIN_POLL) <= 0) {
+      continue;
+    }
+
+    sock = accept(server->admin_sock, NULL, NULL);
+    if (sock == -1) {
+      continue;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+
+    admin_reply(server, sock);
+    close(sock);
+  }
+
+  return NULL;
+}
+
+static void admin_begin(TcpServer *server)
+{
+  struct sockaddr_in addr;
+  int sock, enable = 1;
+
+  if (server->admin_port == 0) {
+    return;
+  }
+
+  /* Solo para procesos locales, como un recolector de métricas */
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(server->admin_port);
+
+  sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    tcp_log(TCP_LOG_ERROR, "%s: %s", error_messages[TCP_SERVER_SOCK_ERROR],
+            g_strerror(errno));
+    return;
+  }
+
+  /* Durante un reinicio sin cortes, ambos procesos abren el mismo puerto */
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+#ifdef SO_REUSEPORT
+  setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+#endif
+
+  if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1
+      || listen(sock, MAX_CONN) == -1) {
+    tcp_log(TCP_LOG_ERROR, "%s %d: %s",
+            error_messages[TCP_SERVER_SOCK_BIND_ERROR], server->admin_port,
+            g_strerror(errno));
+    close(sock);
+    return;
+  }
+
+  server->admin_sock = sock;
+  server->admin_thread = g_thread_new("tcp-server-admin", run_admin_thread,
+                                      server);
+  tcp_log(TCP_LOG_INFO, "Métricas en el puerto %d...", server->admin_port);
+}
+
+static void admin_end(TcpServer *server)
+{
+  if (server->admin_thread != NULL) {
+    g_thread_join(server->admin_thread);
+    server->admin_thread = NULL;
+  }
+
+  if (server->admin_sock != -1) {
+    close(server->admin_sock);
+    server->admin_sock = -1;
+  }
+}
+#endif
+
+void tcp_server_set_restart(TcpServer         *server,
+                            char             **argv,
+                            TcpServerSaveFunc  save,
+                            void              *data)
+{
+#ifdef G_OS_UNIX
+  sigset_t signals;
+#endif
+
+  g_return_if_fail(server != NULL);
+  g_return_if_fail(argv != NULL && argv[0] != NULL);
+
+#ifdef G_OS_UNIX
+  /* La señal se recibe con sigwait() en un hilo aparte */
+  sigemptyset(&signals);
+  sigaddset(&signals, RESTART_SIGNAL);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  g_strfreev(server->restart_argv);
+  server->restart_argv = g_strdupv(argv);
+  server->save_state = save;
+  server->save_data = data;
+#endif
+}
+
+GBytes *tcp_server_inherit(TcpServer *server, GError **error)
+{
+#ifdef G_OS_UNIX
+  char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  uint32_t header[2];
+  const char *fd_str;
+  char *state;
+  size_t received;
+  ssize_t recv_len;
+  int sock, n_fds;
+  int flags = 0;
+
+  g_return_val_if_fail(server != NULL, NULL);
+
+  /* Sin la variable de entorno, el proceso no viene de un reinicio */
+  fd_str = g_getenv(HANDOFF_ENV);
+  if (fd_str == NULL) {
+    return NULL;
+  }
+  sock = atoi(fd_str);
+  g_unsetenv(HANDOFF_ENV);
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+  iov.iov_base = header;
+  iov.iov_len = sizeof(header);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+#ifdef MSG_CMSG_CLOEXEC
+  flags = MSG_CMSG_CLOEXEC;
+#endif
+
+  set_recv_timeout(sock, HANDOFF_TIMEOUT);
+  recv_len = recvmsg(sock, &msg, flags);
+  cmsg = recv_len == sizeof(header) ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg == NULL
+      || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len <= CMSG_LEN(0)) {
+    close(sock);
+    g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_HANDOFF_ERROR,
+                        error_messages[TCP_SERVER_HANDOFF_ERROR]);
+    return NULL;
+  }
+
+  /* Atender los mismos sockets de escucha que el proceso anterior */
+  n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  g_free(server->inherited);
+  server->inherited = g_new(int, n_fds);
+  server->n_inherited = n_fds;
+  server->shards = n_fds;
+  server->handoff = sock;
+  memcpy(server->inherited, CMSG_DATA(cmsg), sizeof(int) * n_fds);
+  for (int i = 0; i < n_fds; i++) {
+    fcntl(server->inherited[i], F_SETFD, FD_CLOEXEC);
+  }
+  tcp_log(TCP_LOG_INFO, "Sockets de escucha recibidos del proceso anterior...");
+
+  if (header[1] == 0) {
+    return NULL;
+  }
+
+  /* Estado guardado por el proceso anterior */
+  state = g_malloc(header[1]);
+  for (received = 0; received < header[1]; received += recv_len) {
+    recv_len = recv(sock, state + received, header[1] - received, 0);
+    if (recv_len <= 0) {
+      g_free(state);
+      g_set_error_literal(error, TCP_SERVER_ERROR, TCP_SERVER_HANDOFF_ERROR,
+                          error_messages[TCP_SERVER_HANDOFF_ERROR]);
+      return NULL;
+    }
+  }
+
+  return g_bytes_new_take(state, header[1]);
+#else
+  return NULL;
+#endif
+}
+
+void tcp_server_stop(TcpServer *server)
+{
+  g_return_if_fail(server != NULL);
+
+#ifdef G_OS_UNIX
+  /* La tubería queda legible: todos los bucles ven la detención */
+  if (server->stop_pipe[1] != -1
+      && write(server->stop_pipe[1], "", 1) == -1) {
+    tcp_log(TCP_LOG_ERROR, "pipe: %s", g_strerror(errno));
+  }
+#endif
+}
+
+static void *run_shard(void *data)
+{
+  TcpServerShard *shard = (TcpServerShard*)data;
+
+  pin_thread(shard->cpu);
+
+  /* Atender conexiones según el modo configurado */
+  switch (shard->server->mode) {
+#ifdef HAVE_EPOLL
+    case TCP_SERVER_MODE_EPOLL:
+      run_epoll_loop(shard, &shard->error);
+      break;
+#endif
+#ifdef HAVE_LIBURING
+    case TCP_SERVER_MODE_URING:
+      run_uring_loop(shard, &shard->error);
+      break;
+#endif
+    default:
+      run_threads_loop(shard, &shard->error);
+      break;
+  }
+
+  return NULL;
+}
+
+static void run_shards(TcpServer *server, TcpServerShard *shards, int n_shards)
+{
+  unsigned int prev_max_idle_time;
+
+  prev_max_idle_time = g_thread_pool_get_max_idle_time();
+  g_thread_pool_set_max_idle_time(MAX_IDLE_TIME);
+
+  if (n_shards == 1) {
+    /* Un único socket se atiende desde el hilo actual */
+    run_shard(&shards[0]);
+  } else {
+    tcp_log(TCP_LOG_INFO, "Atendiendo con %d sockets SO_REUSEPORT...",
+            n_shards);
+    for (int i = 0; i < n_shards; i++) {
+      shards[i].thread = g_thread_new("tcp-server-shard", run_shard, &shards[i]);
+    }
+    for (int i = 0; i < n_shards; i++) {
+      g_thread_join(shards[i].thread);
+    }
+  }
+
+  g_thread_pool_set_max_idle_time(prev_max_idle_time);
+}
+
+#ifdef G_OS_UNIX
+static void run_worker(TcpServer      *server,
+                       TcpServerShard *shards,
+                       int             n_shards,
+                       int             index)
+{
+  TcpServerLimiter *limiter = &server->limiter;
+  int n_cpus = g_get_num_processors();
+  int status = EXIT_SUCCESS;
+
+  /* Solo el supervisor detiene el servidor: sin él, la tubería se cierra */
+  close(server->stop_pipe[1]);
+  server->stop_pipe[1] = -1;
+
+  /* Las métricas de todos los procesos las expone el supervisor */
+  if (server->admin_sock != -1) {
+    close(server->admin_sock);
+    server->admin_sock = -1;
+    server->admin_thread = NULL;
+  }
+
+  /* Límite propio, cuyo estado se publica en la memoria compartida */
+  g_mutex_init(&limiter->lock);
+  limiter->inflight = 0;
+  limiter->accepted = 0;
+  limiter->rejected = 0;
+  limiter->shared = &server->worker_slots[index].stats;
+  limiter_stats(limiter, limiter->shared);
+  server->worker_slots = NULL;
+
+  /* Repartir los núcleos entre los sockets de todos los procesos */
+  for (int i = 0; i < n_shards; i++) {
+    if (server->affinity == TCP_SERVER_AFFINITY_CORE) {
+      shards[i].cpu = (index * n_shards + i) % n_cpus;
+    }
+  }
+
+  run_shards(server, shards, n_shards);
+
+  for (int i = 0; i < n_shards; i++) {
+    if (shards[i].error != NULL) {
+      tcp_log(TCP_LOG_ERROR, "%s", shards[i].error->message);
+      status = EXIT_FAILURE;
+    }
+  }
+
+  exit(status);
+}
+
+static void spawn_worker(TcpServer      *server,
+                         TcpServerShard *shards,
+                         int             n_shards,
+                         int             index)
+{
+  TcpServerWorker *worker = &server->worker_slots[index];
+  pid_t pid;
+
+  /* Evitar que el proceso nuevo repita la salida pendiente */
+  fflush(stdout);
+  fflush(stderr);
+
+  worker->started = g_get_monotonic_time();
+  pid = fork();
+  if (pid == -1) {
+    tcp_log(TCP_LOG_ERROR, "fork: %s", g_strerror(errno));
+    return;
+  }
+
+  if (pid == 0) {
+    run_worker(server, shards, n_shards, index);
+  }
+
+  worker->pid = pid;
+  tcp_log(TCP_LOG_INFO, "Proceso de trabajo %d iniciado...", (int)pid);
+}
+
+static void retire_worker(TcpServer *server, int index, int status)
+{
+  TcpServerWorker *worker = &server->worker_slots[index];
+  TcpServerLimiter *limiter = &server->limiter;
+
+  if (WIFSIGNALED(status)) {
+    tcp_log(TCP_LOG_ERROR, "Proceso de trabajo %d terminado por la señal %d",
+            (int)worker->pid, WTERMSIG(status));
+  } else if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+    tcp_log(TCP_LOG_ERROR, "Proceso de trabajo %d finalizado con estado %d",
+            (int)worker->pid, WEXITSTATUS(status));
+  }
+
+  /* El supervisor conserva las solicitudes atendidas por el proceso */
+  g_mutex_lock(&limiter->lock);
+  limiter->accepted += worker->stats.accepted;
+  limiter->rejected += worker->stats.rejected;
+  memset(&worker->stats, 0, sizeof(worker->stats));
+  g_mutex_unlock(&limiter->lock);
+
+  worker->pid = 0;
+}
+
+static void run_supervisor(TcpServer      *server,
+                           TcpServerShard *shards,
+                           int             n_shards)
+{
+  TcpServerWorker *workers;
+  struct pollfd stop = { .fd = server->stop_pipe[0], .events = POLLIN };
+  size_t size = sizeof(TcpServerWorker) * server->workers;
+  bool stopping = false;
+  bool running;
+  int status;
+
+  /* El estado de los procesos de trabajo se comparte con el supervisor */
+  workers = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (workers == MAP_FAILED) {
+    tcp_log(TCP_LOG_ERROR, "mmap: %s", g_strerror(errno));
+    run_shards(server, shards, n_shards);
+    return;
+  }
+  memset(workers, 0, size);
+  server->worker_slots = workers;
+  tcp_log(TCP_LOG_INFO, "Atendiendo con %d procesos de trabajo...",
+          server->workers);
+
+  do {
+    /* Iniciar los procesos que faltan, sin reiniciar en ciclo a los que fallan */
+    for (int i = 0; i < server->workers && !stopping; i++) {
+      if (workers[i].pid == 0
+          && g_get_monotonic_time() - workers[i].started
+             >= (gint64)WORKER_RESPAWN_DELAY * 1000) {
+        spawn_worker(server, shards, n_shards, i);
+      }
+    }
+
+    if (!stopping && poll(&stop, 1, WORKER_POLL) > 0) {
+      tcp_log(TCP_LOG_INFO, "Deteniendo los procesos de trabajo...");
+      stopping = true;
+    }
+
+    /* Recoger los procesos terminados; al detener, esperar a todos */
+    running = false;
+    for (int i = 0; i < server->workers; i++) {
+      if (workers[i].pid == 0) {
+        continue;
+      }
+      if (waitpid(workers[i].pid, &status, stopping ? 0 : WNOHANG)
+          == workers[i].pid) {
+        retire_worker(server, i, status);
+      } else {
+        running = true;
+      }
+    }
+  } while (!stopping || running);
+
+  g_mutex_lock(&server->limiter.lock);
+  server->worker_slots = NULL;
+  g_mutex_unlock(&server->limiter.lock);
+  munmap(workers, size);
+}
+#endif
+
+void tcp_server_run(TcpServer      *server,
+                    TcpServerFunc   func,
+                    void           *data,
+                    GError        **error)
+{
+  TcpServerShard *shards;
+#ifdef G_OS_UNIX
+  GThread *restart_thread = NULL;
+#endif
+  int n_shards;
+  int n_cpus = g_get_num_processors();
+  int n_open = 0;
+
+  /* Una ruta de socket Unix solo se puede enlazar una vez */
+  if (server->unix_path != NULL && server->n_inherited == 0
+      && server->shards > 1) {
+    tcp_log(TCP_LOG_WARNING,
+            "SO_REUSEPORT no disponible con sockets Unix, se utiliza un único "
+            "socket...");
+    server->shards = 1;
+  }
+  n_shards = server->shards;
+
+#ifdef G_OS_WIN32
+  /**
+   * Inicializar Winsock
+   * https://learn.microsoft.com/es-es/windows/win32/winsock/initializing-winsock
+   */
+  WSADATA wsa_data;
+  int result = WSAStartup(MAKEWORD(2,2), &wsa_data);
+  if (result != 0) {
+    tcp_log(TCP_LOG_ERROR, "WSAStartup error: %d", result);
+    return;
+  }
+#endif
+
+  /* Abrir un socket de escucha por cada "shard" */
+  shards = g_new0(TcpServerShard, n_shards);
+  for (n_open = 0; n_open < n_shards; n_open++) {
+    shards[n_open].server = server;
+    shards[n_open].func = func;
+    shards[n_open].data = data;
+    shards[n_open].cpu = server->affinity == TCP_SERVER_AFFINITY_CORE
+                       ? n_open % n_cpus
+                       : -1;
+    shards[n_open].sockfd = n_open < server->n_inherited
+                          ? server->inherited[n_open]
+                          : open_listener(server, error);
+    if (shards[n_open].sockfd == -1) {
+      break;
+    }
+  }
+
+#ifdef G_OS_UNIX
+  if (n_open == n_shards) {
+    restart_thread = restart_begin(server, shards, n_shards);
+    admin_begin(server);
+  }
+#endif
+
+  /*
+   * Si no se pudo abrir algún socket, no se atiende con una parte de ellos: se
+   * cierran los abiertos y se devuelve el error
+   */
+  if (n_open == n_shards && server->workers > 0) {
+#ifdef G_OS_UNIX
+    /* Con pre-fork, los procesos de trabajo atienden los mismos sockets */
+    run_supervisor(server, shards, n_shards);
+#endif
+  } else if (n_open == n_shards) {
+    run_shards(server, shards, n_open);
+  }
+
+#ifdef G_OS_UNIX
+  restart_end(server, restart_thread);
+  admin_end(server);
+#endif
+
+  for (int i = 0; i < n_open; i++) {
+    if (shards[i].error != NULL) {
+      if (*error == NULL) {
+        g_propagate_error(error, shards[i].error);
+      } else {
+        g_error_free(shards[i].error);
+      }
+    }
+
+#ifdef G_OS_UNIX
+    close(shards[i].sockfd);
+#endif
+
+#ifdef G_OS_WIN32
+    closesocket(shards[i].sockfd);
+#endif
+  }
+
+  g_free(shards);
+
+#ifdef G_OS_WIN32
+  WSACleanup();
+#endif
+
+  tcp_log(TCP_LOG_INFO, "Servidor desconectado.");
+}
+
+void tcp_server_free(TcpServer *server)
+{
+  g_return_if_fail(server != NULL);
+
+  g_mutex_clear(&server->limiter.lock);
+  g_free(server->unix_path);
+  g_strfreev(server->restart_argv);
+  g_free(server->inherited);
   free(server);
 }
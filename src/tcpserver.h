@@ -11,6 +11,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "tcpframe.h"
+
 /** Dominio de errores para funciones de TcpServer */
 #define TCP_SERVER_ERROR (tcp_server_error_quark())
 
@@ -21,26 +23,73 @@ typedef enum
   TCP_SERVER_SOCK_BIND_ERROR,
   TCP_SERVER_SOCK_LISTEN_ERROR,
   TCP_SERVER_SOCK_ACCEPT_ERROR,
+  TCP_SERVER_EPOLL_ERROR,
+  TCP_SERVER_URING_ERROR,
+  TCP_SERVER_HANDOFF_ERROR,
 } TcpServerError;
 
+/** Modos de atención de conexiones */
+typedef enum
+{
+  TCP_SERVER_MODE_THREADS, /**< Un hilo bloqueante por conexión */
+  TCP_SERVER_MODE_EPOLL,   /**< Reactor epoll no bloqueante (edge-triggered) */
+  TCP_SERVER_MODE_URING,   /**< Reactor io_uring con envíos agrupados */
+} TcpServerMode;
+
+/** Políticas de afinidad de hilos a núcleos del procesador */
+typedef enum
+{
+  TCP_SERVER_AFFINITY_NONE, /**< Los hilos se ejecutan en cualquier núcleo */
+  TCP_SERVER_AFFINITY_CORE, /**< Los hilos de cada socket se fijan a un núcleo */
+} TcpServerAffinity;
+
 /** Contiene una configuración para un servidor TCP */
 typedef struct TcpServer TcpServer;
 
+/** Respuesta a una solicitud, que se envía al cliente al finalizar la función */
+typedef struct TcpServerReply TcpServerReply;
+
+/** Estado del límite de solicitudes en curso, ver tcp_server_get_stats() */
+typedef struct
+{
+  unsigned int limit;    /**< Límite actual, o 0 si no hay límite */
+  unsigned int inflight; /**< Solicitudes en curso */
+  uint64_t     accepted; /**< Solicitudes aceptadas */
+  uint64_t     rejected; /**< Solicitudes rechazadas por sobrecarga */
+} TcpServerStats;
+
 /**
  * Tipo de función para ejecutar en tcp_server_run().
  *
+ * La función recibe la solicitud completa del cliente y escribe la respuesta
+ * en reply, ya que la lectura y escritura del socket las realiza el servidor
+ * según el modo configurado.
+ *
  * @see tcp_server_run()
- * @param sockfd conexión TCP
+ * @param request solicitud recibida (terminada en '\0')
+ * @param length longitud de la solicitud
+ * @param reply respuesta para el cliente
  * @param data puntero a datos adicionales
  */
-typedef void (*TcpServerFunc)(int sockfd, void *data);
+typedef void (*TcpServerFunc)(const char *request, size_t length, TcpServerReply *reply, void *data);
+
+/**
+ * Tipo de función para guardar el estado que se traspasa al nuevo proceso en
+ * un reinicio sin cortes.
+ *
+ * @see tcp_server_set_restart()
+ * @param data puntero a datos adicionales
+ * @return estado a traspasar, o NULL si no hay estado
+ */
+typedef GBytes *(*TcpServerSaveFunc)(void *data);
 
 /**
  * Crea una nueva configuración para un servidor TCP.
  *
  * La configuración se crea llamando a tcp_server_new_full() con el resto de las
  * opciones con los valores por defecto: máximo de conexiones en 10, máximo de
- * hilos igual a la cantidad de núcleos del procesador, e hilos no exclusivos.
+ * hilos igual a la cantidad de núcleos del procesador, hilos no exclusivos y
+ * modo TCP_SERVER_MODE_THREADS.
  *
  * @see tcp_server_free()
  * @param addr la dirección del servidor
@@ -61,6 +110,17 @@ TcpServer *tcp_server_new(uint32_t addr, uint16_t port);
  * Se debe usar con precaución, ya que si se establece a verdadero con -1 en la
  * cantidad de hilos, puede llegar a consumir recursos en exceso.
  *
+ * El modo TCP_SERVER_MODE_EPOLL atiende todas las conexiones desde un único
+ * hilo con sockets no bloqueantes, y solo utiliza el "pool" de hilos para
+ * ejecutar la función una vez recibida la solicitud completa. Así, clientes
+ * lentos o inactivos no ocupan hilos. Si el sistema no soporta epoll, se
+ * utiliza TCP_SERVER_MODE_THREADS.
+ *
+ * El modo TCP_SERVER_MODE_URING funciona igual que el anterior, pero con
+ * io_uring: acepta y recibe con operaciones "multishot" sobre buffers provistos
+ * al kernel, y envía todas las operaciones de una iteración en una sola
+ * llamada al sistema. Si no se compiló con liburing, se utiliza epoll.
+ *
  * @see tcp_server_new()
  * @see tcp_server_free()
  * @param addr dirección del servidor
@@ -68,17 +128,243 @@ TcpServer *tcp_server_new(uint32_t addr, uint16_t port);
  * @param max_conn máximo de conexiones en cola
  * @param max_threads máximo de hilos para ejecutar las solicitudes
  * @param exclusive usar hilos exclusivos o no
+ * @param mode modo de atención de conexiones
  * @return puntero a TcpServer, NULL en caso de error (debe liberarse con
  * tcp_server_free() cuando ya no se utilice)
  */
-TcpServer *tcp_server_new_full(uint32_t addr, uint16_t port, int max_conn, int max_threads, bool exclusive);
+TcpServer *tcp_server_new_full(uint32_t addr, uint16_t port, int max_conn, int max_threads, bool exclusive, TcpServerMode mode);
+
+/**
+ * Establece la ruta de un socket Unix (AF_UNIX) donde escuchar, en lugar de la
+ * dirección y el puerto TCP.
+ *
+ * Con los clientes en el mismo equipo (ver tcp_client_new() con un host
+ * "unix:RUTA"), las conexiones no pasan por la pila TCP/IP y no agotan puertos
+ * locales ni quedan en TIME_WAIT. Si la ruta existe y ningún servidor escucha
+ * en ella, se reemplaza; la ruta no se borra al terminar, para que un reinicio
+ * sin cortes la conserve. Una ruta solo se puede enlazar una vez, por lo que se
+ * utiliza un único socket de escucha (ver tcp_server_set_shards()). Solo
+ * disponible en sistemas Unix.
+ *
+ * @param server configuración del servidor TCP
+ * @param path ruta del socket (se copia), o NULL para escuchar en TCP
+ */
+void tcp_server_set_unix_path(TcpServer *server, const char *path);
+
+/**
+ * Establece el modo de atención de conexiones del servidor.
+ *
+ * @see tcp_server_new_full()
+ * @param server configuración del servidor TCP
+ * @param mode modo de atención de conexiones
+ */
+void tcp_server_set_mode(TcpServer *server, TcpServerMode mode);
+
+/**
+ * Establece la cantidad de sockets de escucha y la afinidad de sus hilos.
+ *
+ * Con más de un socket, cada uno se abre con SO_REUSEPORT en el mismo puerto y
+ * tiene su propio bucle de aceptación y su propio "pool" de hilos (el máximo de
+ * hilos se reparte entre los sockets), de modo que el kernel distribuye las
+ * conexiones sin una cola compartida. Con TCP_SERVER_AFFINITY_CORE, los hilos
+ * del socket i se fijan al núcleo i (módulo la cantidad de núcleos).
+ *
+ * @param server configuración del servidor TCP
+ * @param shards cantidad de sockets, o 0 para uno por núcleo
+ * @param affinity política de afinidad de hilos
+ */
+void tcp_server_set_shards(TcpServer *server, int shards, TcpServerAffinity affinity);
+
+/**
+ * Establece la cantidad de procesos de trabajo (modo pre-fork).
+ *
+ * Con procesos de trabajo, tcp_server_run() abre los sockets de escucha una
+ * sola vez y crea los procesos con fork(); cada proceso atiende los mismos
+ * sockets según el modo configurado, con sus propios hilos, su propio límite
+ * de solicitudes en curso y su propia memoria. El proceso original queda como
+ * supervisor: reinicia los procesos que terminan (a lo sumo uno por segundo
+ * cada uno) y suma su estado en tcp_server_get_stats(). Así, la falla de un
+ * proceso no detiene el servicio y los bloqueos globales de cada proceso no
+ * limitan el uso de varios núcleos.
+ *
+ * Los datos cargados antes de tcp_server_run() se comparten entre los procesos
+ * (copia al escribir); los que se cargan al atender, como los cachés, son
+ * propios de cada proceso. Si el supervisor termina, los procesos de trabajo
+ * dejan de aceptar y terminan de atender sus conexiones. Solo disponible en
+ * sistemas Unix.
+ *
+ * @param server configuración del servidor TCP
+ * @param workers cantidad de procesos, 0 para atender en un único proceso (por
+ * defecto) o un número negativo para uno por núcleo
+ */
+void tcp_server_set_workers(TcpServer *server, int workers);
+
+/**
+ * Establece la forma de delimitar mensajes y el tiempo máximo de inactividad
+ * de las conexiones.
+ *
+ * Con TCP_FRAMING_NONE (por defecto), cada conexión atiende una única solicitud
+ * y luego se cierra. Con TCP_FRAMING_LENGTH o TCP_FRAMING_NDJSON, una conexión
+ * atiende solicitudes sucesivas, que pueden llegar divididas en varios
+ * segmentos o varias en un mismo segmento, y cada respuesta se envía delimitada
+ * de la misma forma. Con TCP_FRAMING_MUX, además, una conexión puede tener
+ * varias solicitudes en curso y cada respuesta se envía apenas termina, con el
+ * identificador de su solicitud; las respuestas fuera de orden requieren los
+ * modos TCP_SERVER_MODE_EPOLL o TCP_SERVER_MODE_URING, ya que con hilos las
+ * solicitudes de una conexión se atienden en orden. En todos los casos, la
+ * conexión se cierra si pasa el tiempo máximo de inactividad esperando una
+ * solicitud.
+ *
+ * @param server configuración del servidor TCP
+ * @param framing forma de delimitar los mensajes
+ * @param idle_timeout tiempo máximo de inactividad (milisegundos), o 0 para
+ * esperar indefinidamente
+ */
+void tcp_server_set_framing(TcpServer *server, TcpFraming framing, unsigned int idle_timeout);
+
+/**
+ * Establece los plazos de lectura, escritura y total de cada conexión.
+ *
+ * El plazo de lectura cuenta desde que se acepta la conexión, o desde que
+ * llegan los primeros datos de una solicitud en una conexión persistente,
+ * hasta recibir la solicitud completa. El plazo de escritura es el tiempo
+ * máximo que el cliente puede demorar en leer la respuesta sin que el envío
+ * avance. El plazo total acota la duración de la conexión, incluso mientras se
+ * ejecuta la función. La conexión que no cumple un plazo se cierra.
+ *
+ * Los plazos se llevan en una rueda de temporizadores jerárquica, con costo
+ * constante por conexión: en los modos con reactor, cada reactor tiene la suya;
+ * en modo TCP_SERVER_MODE_THREADS, un hilo por socket de escucha cierra las
+ * conexiones vencidas, lo que desbloquea al hilo que las atiende. Por
+ * defecto, los plazos de lectura y escritura son de 10 segundos y no hay plazo
+ * total.
+ *
+ * @see tcp_server_set_framing()
+ * @param server configuración del servidor TCP
+ * @param read_timeout plazo de lectura (milisegundos), o 0 sin plazo
+ * @param write_timeout plazo de escritura (milisegundos), o 0 sin plazo
+ * @param total_timeout plazo total (milisegundos), o 0 sin plazo
+ */
+void tcp_server_set_deadlines(TcpServer *server, unsigned int read_timeout, unsigned int write_timeout, unsigned int total_timeout);
+
+/**
+ * Establece el máximo del límite adaptativo de solicitudes en curso.
+ *
+ * El servidor limita la cantidad de solicitudes en curso (en cola o en
+ * ejecución) en todos sus sockets. El límite se ajusta según la latencia
+ * medida de las solicitudes: crece de a poco mientras la latencia se mantiene
+ * cerca de la mínima observada y se reduce en forma multiplicativa cuando
+ * aumenta, es decir, cuando las solicitudes empiezan a esperar en cola. Las
+ * solicitudes sobre el límite no se encolan: se responden en el acto con
+ * {"error":"overloaded"}, delimitado como cualquier otra respuesta.
+ *
+ * En modo TCP_SERVER_MODE_THREADS, el límite se aplica a las conexiones, ya
+ * que cada una ocupa un hilo del "pool" mientras está abierta; las conexiones
+ * rechazadas se cierran luego de responder a su primera solicitud. Con
+ * procesos de trabajo, cada proceso tiene su propio límite. Por defecto, el
+ * máximo es 1024.
+ *
+ * @see tcp_server_get_stats()
+ * @param server configuración del servidor TCP
+ * @param max_inflight máximo del límite, o 0 para no limitar las solicitudes
+ */
+void tcp_server_set_limit(TcpServer *server, unsigned int max_inflight);
+
+/**
+ * Obtiene el límite actual de solicitudes en curso y la cantidad de
+ * solicitudes aceptadas y rechazadas. Se puede llamar mientras el servidor se
+ * ejecuta, desde cualquier hilo. Con procesos de trabajo, el supervisor
+ * devuelve la suma de todos sus procesos.
+ *
+ * @see tcp_server_set_limit()
+ * @param server configuración del servidor TCP
+ * @param stats puntero donde guardar el estado del límite
+ */
+void tcp_server_get_stats(TcpServer *server, TcpServerStats *stats);
+
+/**
+ * Establece el puerto de administración, donde se exponen las métricas del
+ * servidor para un recolector local.
+ *
+ * El puerto escucha solo en 127.0.0.1. A cada conexión se le responde con las
+ * métricas en texto plano, una por línea con la forma "nombre valor" (ver
+ * tcp_metrics_format()), y se cierra; si la conexión envía una solicitud
+ * "GET", la respuesta es HTTP. Se incluyen el estado del límite de solicitudes
+ * en curso (ver tcp_server_get_stats()), las conexiones abiertas, las
+ * solicitudes en cola y en ejecución en los "pools" de hilos, y los
+ * histogramas de la espera en cola desde que se acepta la conexión o se recibe
+ * la solicitud hasta que un hilo la toma ("server.queue_wait_us") y del tiempo
+ * de la función ("server.handler_us"), además de las métricas registradas por
+ * la aplicación, como las de tcp_client_set_metrics(). Con procesos de
+ * trabajo, el supervisor expone la suma de todos los procesos. Solo
+ * disponible en sistemas Unix.
+ *
+ * @see tcp_metrics_counter()
+ * @see tcp_metrics_histogram()
+ * @param server configuración del servidor TCP
+ * @param port puerto de administración, o 0 para no exponer las métricas (por
+ * defecto)
+ */
+void tcp_server_set_admin_port(TcpServer *server, uint16_t port);
+
+/**
+ * Habilita el reinicio sin cortes del servidor con la señal SIGUSR2.
+ *
+ * Al recibir la señal, el servidor ejecuta una nueva copia del programa con
+ * los argumentos argv y le traspasa sus sockets de escucha (SCM_RIGHTS) junto
+ * con el estado devuelto por save. Cuando el nuevo proceso está listo para
+ * aceptar conexiones, el servidor deja de aceptar, termina de atender las
+ * conexiones abiertas y tcp_server_run() retorna. Las conexiones que llegan
+ * durante el reinicio esperan en la cola del socket, que nunca se cierra. Si
+ * el nuevo proceso falla, el servidor sigue atendiendo normalmente.
+ *
+ * Debe llamarse antes de crear otros hilos, ya que la señal se bloquea en el
+ * hilo actual para recibirla en un hilo aparte. Solo disponible en sistemas
+ * Unix.
+ *
+ * @see tcp_server_inherit()
+ * @param server configuración del servidor TCP
+ * @param argv argumentos para ejecutar el nuevo proceso (se copian)
+ * @param save función para guardar el estado, o NULL
+ * @param data parámetro adicional opcional para la función
+ */
+void tcp_server_set_restart(TcpServer *server, char **argv, TcpServerSaveFunc save, void *data);
+
+/**
+ * Recibe los sockets de escucha y el estado del proceso anterior, si el
+ * proceso se inició con un reinicio sin cortes.
+ *
+ * Los sockets recibidos se utilizan en tcp_server_run() en lugar de abrir
+ * nuevos, con la misma cantidad de sockets de escucha que el proceso anterior.
+ *
+ * @see tcp_server_set_restart()
+ * @param server configuración del servidor TCP
+ * @param error puntero a error recuperable, debe estar inicializado a NULL
+ * @return estado guardado por el proceso anterior, o NULL si no hay estado
+ * (debe liberarse con g_bytes_unref())
+ */
+GBytes *tcp_server_inherit(TcpServer *server, GError **error);
+
+/**
+ * Detiene un servidor en ejecución: deja de aceptar conexiones, termina de
+ * atender las conexiones abiertas y tcp_server_run() retorna. Se puede llamar
+ * desde cualquier hilo. Solo disponible en sistemas Unix.
+ *
+ * @param server configuración del servidor TCP
+ */
+void tcp_server_stop(TcpServer *server);
 
 /**
  * Inicia el servidor TCP y ejecuta la función en un nuevo hilo por solicitud.
  *
  * Las solicitudes aceptadas se ejecutan en otro hilo, obtenido de un "pool" de
- * hilos según la configuración data.
+ * hilos según la configuración data. Una vez ejecutada la función, se envía la
+ * respuesta al cliente y se cierra la conexión, o se espera la siguiente
+ * solicitud si los mensajes se delimitan. Si no se puede abrir alguno de los
+ * sockets de escucha (ver tcp_server_set_shards()), se cierran los demás y se
+ * retorna con el error, sin atender solicitudes.
  *
+ * @see tcp_server_set_framing()
  * @param server configuración del servidor TCP
  * @param func función a ejecutar en un nuevo hilo
  * @param data parámetro adicional opcional para la función
@@ -86,6 +372,112 @@ TcpServer *tcp_server_new_full(uint32_t addr, uint16_t port, int max_conn, int m
  */
 void tcp_server_run(TcpServer *server, TcpServerFunc func, void *data, GError **error);
 
+/**
+ * Agrega datos a la respuesta de una solicitud.
+ *
+ * @param reply respuesta de la solicitud
+ * @param data datos a agregar
+ * @param length longitud de los datos
+ */
+void tcp_server_reply_append(TcpServerReply *reply, const char *data, size_t length);
+
+/**
+ * Agrega datos con formato a la respuesta de una solicitud.
+ *
+ * @param reply respuesta de la solicitud
+ * @param format formato al estilo printf()
+ */
+void tcp_server_reply_printf(TcpServerReply *reply, const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+/**
+ * Termina una parte de la respuesta, para enviar respuestas de cualquier
+ * tamaño sin guardarlas completas en memoria.
+ *
+ * Cada parte se delimita como un mensaje aparte (sin delimitar, como una
+ * línea), y las partes acumuladas se envían al cliente sin esperar a que
+ * termine la función. Si el cliente no las lee, la función espera aquí hasta
+ * que haya lugar (control de flujo). Con TCP_FRAMING_MUX las partes llevan el
+ * identificador de la solicitud, y el cliente debe leerlas en orden.
+ *
+ * @param reply respuesta de la solicitud
+ * @return false si la conexión se cerró, para dejar de generar la respuesta
+ */
+bool tcp_server_reply_flush(TcpServerReply *reply);
+
+/**
+ * Crea una respuesta vacía, para ejecutar una función del servidor fuera de
+ * tcp_server_run() (por ejemplo, en pruebas de rendimiento).
+ *
+ * @return la respuesta, que debe liberarse con tcp_server_reply_free()
+ */
+TcpServerReply *tcp_server_reply_new(void);
+
+/**
+ * Obtiene los datos agregados a una respuesta.
+ *
+ * @param reply respuesta de la solicitud
+ * @param length puntero donde guardar la longitud de los datos, o NULL
+ * @return los datos de la respuesta, terminados en '\0'
+ */
+const char *tcp_server_reply_get_data(TcpServerReply *reply, size_t *length);
+
+/**
+ * Obtiene la hora en que se empezó a recibir la solicitud de una respuesta,
+ * incluida la espera en cola de la conexión o de la solicitud. Sirve para
+ * descartar las solicitudes que llegan a la función cuando ya vencieron.
+ *
+ * @param reply respuesta de la solicitud
+ * @return la hora, como la devuelve g_get_monotonic_time(); con una respuesta
+ * creada con tcp_server_reply_new(), la hora actual
+ */
+gint64 tcp_server_reply_get_received(TcpServerReply *reply);
+
+/**
+ * Descarta los datos de una respuesta, para reutilizarla en otra solicitud.
+ *
+ * @param reply respuesta de la solicitud
+ */
+void tcp_server_reply_clear(TcpServerReply *reply);
+
+/**
+ * Libera una respuesta creada con tcp_server_reply_new().
+ *
+ * @param reply respuesta de la solicitud
+ */
+void tcp_server_reply_free(TcpServerReply *reply);
+
+/**
+ * Obtiene el modo de servidor a partir de su nombre ("threads", "epoll" o
+ * "uring").
+ *
+ * @param name nombre del modo
+ * @param mode puntero donde guardar el modo
+ * @return true si el nombre es válido, false en caso contrario
+ */
+bool tcp_server_mode_parse(const char *name, TcpServerMode *mode);
+
+/**
+ * Obtiene los plazos de lectura, escritura y total a partir de un texto con
+ * los tres valores en milisegundos separados por comas ("R,W,T").
+ *
+ * @see tcp_server_set_deadlines()
+ * @param text texto con los plazos
+ * @param read_timeout puntero donde guardar el plazo de lectura
+ * @param write_timeout puntero donde guardar el plazo de escritura
+ * @param total_timeout puntero donde guardar el plazo total
+ * @return true si el texto es válido, false en caso contrario
+ */
+bool tcp_server_deadlines_parse(const char *text, unsigned int *read_timeout, unsigned int *write_timeout, unsigned int *total_timeout);
+
+/**
+ * Obtiene la política de afinidad a partir de su nombre ("none" o "core").
+ *
+ * @param name nombre de la política
+ * @param affinity puntero donde guardar la política
+ * @return true si el nombre es válido, false en caso contrario
+ */
+bool tcp_server_affinity_parse(const char *name, TcpServerAffinity *affinity);
+
 /**
  * Libera los recursos asociados a una configuración TcpServer.
  *
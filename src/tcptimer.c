@@ -0,0 +1,273 @@
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tcptimer.h"
+
+/* Duración de una ranura del primer nivel (microsegundos) */
+#define TICK      1000
+/* Cantidad de niveles de la rueda */
+#define LEVELS    4
+/* Cantidad de ranuras por nivel (potencia de 2, una por bit de ocupación) */
+#define SLOT_BITS 6
+#define SLOTS     (1 << SLOT_BITS)
+#define SLOT_MASK (SLOTS - 1)
+/* Alcance de la rueda: los vencimientos posteriores se reprograman */
+#define SPAN      ((uint64_t)1 << (SLOT_BITS * LEVELS))
+/* Nivel de los temporizadores vencidos, todavía no devueltos */
+#define EXPIRED   LEVELS
+
+/** Rueda de temporizadores jerárquica */
+struct TcpTimerWheel
+{
+  /** @privatesection */
+  gint64    origin;
+  uint64_t  now;
+  TcpTimer *slots[LEVELS][SLOTS];
+  uint64_t  occupied[LEVELS];
+  TcpTimer *expired;
+};
+
+TcpTimerWheel *tcp_timer_wheel_new(gint64 now)
+{
+  TcpTimerWheel *wheel = g_new0(TcpTimerWheel, 1);
+
+  wheel->origin = now;
+
+  return wheel;
+}
+
+static int first_bit(uint64_t bits)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll(bits);
+#else
+  int n = 0;
+
+  while (!(bits & 1)) {
+    bits >>= 1;
+    n++;
+  }
+
+  return n;
+#endif
+}
+
+static TcpTimer **timer_list(TcpTimerWheel *wheel, TcpTimer *timer)
+{
+  if (timer->level == EXPIRED) {
+    return &wheel->expired;
+  }
+
+  return &wheel->slots[timer->level][timer->slot];
+}
+
+static void timer_push(TcpTimerWheel *wheel, TcpTimer *timer)
+{
+  TcpTimer **list = timer_list(wheel, timer);
+
+  timer->prev = NULL;
+  timer->next = *list;
+  if (*list != NULL) {
+    (*list)->prev = timer;
+  }
+  *list = timer;
+
+  if (timer->level != EXPIRED) {
+    wheel->occupied[timer->level] |= (uint64_t)1 << timer->slot;
+  }
+}
+
+static void timer_unlink(TcpTimerWheel *wheel, TcpTimer *timer)
+{
+  TcpTimer **list = timer_list(wheel, timer);
+
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  } else {
+    *list = timer->next;
+  }
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+
+  if (*list == NULL && timer->level != EXPIRED) {
+    wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+  }
+}
+
+static void timer_place(TcpTimerWheel *wheel, TcpTimer *timer)
+{
+  uint64_t expires = timer->expires;
+  uint64_t delta;
+  int level = 0;
+
+  if (expires <= wheel->now) {
+    timer->level = EXPIRED;
+    timer_push(wheel, timer);
+    return;
+  }
+
+  /* Nivel según la distancia al vencimiento, ranura según el vencimiento */
+  delta = expires - wheel->now;
+  while (level < LEVELS - 1
+         && delta >= (uint64_t)1 << (SLOT_BITS * (level + 1))) {
+    level++;
+  }
+  if (delta >= SPAN) {
+    expires = wheel->now + SPAN - 1;
+  }
+
+  timer->level = level;
+  timer->slot = (expires >> (SLOT_BITS * level)) & SLOT_MASK;
+  timer_push(wheel, timer);
+}
+
+void tcp_timer_wheel_add(TcpTimerWheel *wheel,
+                         TcpTimer      *timer,
+                         gint64         expires,
+                         void          *data)
+{
+  g_return_if_fail(wheel != NULL);
+  g_return_if_fail(timer != NULL);
+
+  if (timer->pending) {
+    timer_unlink(wheel, timer);
+  }
+
+  /* Redondear hacia arriba, para no vencer nunca antes de tiempo */
+  timer->expires = expires <= wheel->origin
+                 ? 0
+                 : (expires - wheel->origin + TICK - 1) / TICK;
+  timer->data = data;
+  timer->pending = true;
+  timer_place(wheel, timer);
+}
+
+void tcp_timer_wheel_remove(TcpTimerWheel *wheel, TcpTimer *timer)
+{
+  g_return_if_fail(wheel != NULL);
+  g_return_if_fail(timer != NULL);
+
+  if (timer->pending) {
+    timer_unlink(wheel, timer);
+    timer->pending = false;
+  }
+}
+
+static uint64_t wheel_next_tick(TcpTimerWheel *wheel)
+{
+  uint64_t next = UINT64_MAX;
+  uint64_t bits, current, tick;
+  int start, shift;
+
+  for (int level = 0; level < LEVELS; level++) {
+    if (wheel->occupied[level] == 0) {
+      continue;
+    }
+
+    /* Primera ranura ocupada luego de la actual, dando la vuelta */
+    shift = SLOT_BITS * level;
+    current = wheel->now >> shift;
+    start = (current + 1) & SLOT_MASK;
+    bits = wheel->occupied[level];
+    if (start != 0) {
+      bits = bits >> start | bits << (SLOTS - start);
+    }
+
+    tick = (current + 1 + first_bit(bits)) << shift;
+    next = MIN(next, tick);
+  }
+
+  return next;
+}
+
+static void wheel_advance(TcpTimerWheel *wheel, uint64_t target)
+{
+  TcpTimer *timer, *next;
+  uint64_t tick;
+  int shift, slot;
+
+  /* Saltar directamente a las ranuras ocupadas */
+  while ((tick = wheel_next_tick(wheel)) <= target) {
+    wheel->now = tick;
+
+    /* Bajar de nivel los temporizadores que ya están cerca de vencer */
+    for (int level = LEVELS - 1; level > 0; level--) {
+      shift = SLOT_BITS * level;
+      if (tick & (((uint64_t)1 << shift) - 1)) {
+        continue;
+      }
+
+      slot = (tick >> shift) & SLOT_MASK;
+      timer = wheel->slots[level][slot];
+      wheel->slots[level][slot] = NULL;
+      wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+      for (; timer != NULL; timer = next) {
+        next = timer->next;
+        timer_place(wheel, timer);
+      }
+    }
+
+    /* Las ranuras del primer nivel vencen completas */
+    slot = tick & SLOT_MASK;
+    while ((timer = wheel->slots[0][slot]) != NULL) {
+      timer_unlink(wheel, timer);
+      timer->level = EXPIRED;
+      timer_push(wheel, timer);
+    }
+  }
+
+  wheel->now = MAX(wheel->now, target);
+}
+
+void *tcp_timer_wheel_expire(TcpTimerWheel *wheel, gint64 now)
+{
+  TcpTimer *timer;
+  uint64_t target;
+
+  g_return_val_if_fail(wheel != NULL, NULL);
+
+  target = now <= wheel->origin ? 0 : (now - wheel->origin) / TICK;
+  if (target > wheel->now) {
+    wheel_advance(wheel, target);
+  }
+
+  timer = wheel->expired;
+  if (timer == NULL) {
+    return NULL;
+  }
+
+  timer_unlink(wheel, timer);
+  timer->pending = false;
+
+  return timer->data;
+}
+
+int tcp_timer_wheel_timeout(TcpTimerWheel *wheel, gint64 now)
+{
+  uint64_t tick;
+  gint64 wait;
+
+  g_return_val_if_fail(wheel != NULL, -1);
+
+  if (wheel->expired != NULL) {
+    return 0;
+  }
+
+  tick = wheel_next_tick(wheel);
+  if (tick == UINT64_MAX) {
+    return -1;
+  }
+
+  /* Puede despertar antes de un vencimiento, para bajar de nivel */
+  wait = wheel->origin + (gint64)(tick * TICK) - now;
+
+  return wait > 0 ? (int)MIN((wait + 999) / 1000, G_MAXINT) : 0;
+}
+
+void tcp_timer_wheel_free(TcpTimerWheel *wheel)
+{
+  g_free(wheel);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file tcptimer.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Rueda de temporizadores jerárquica para plazos de conexiones
+ * @version 0.1
+ * @date 2023-04-12
+ *
+ * Cada conexión abierta tiene un plazo (de lectura, de escritura, de
+ * inactividad o total) que se reprograma con cada cambio de estado. Una rueda
+ * jerárquica agrega, quita y vence temporizadores en tiempo constante, sin
+ * importar cuántas conexiones haya abiertas: el primer nivel tiene una ranura
+ * por milisegundo y cada nivel siguiente cubre 64 veces más tiempo. Los
+ * temporizadores de los niveles superiores bajan de nivel a medida que se
+ * acerca su vencimiento.
+ *
+ * La rueda no es segura entre hilos: cada reactor tiene la suya, y en modo
+ * TCP_SERVER_MODE_THREADS se protege con un mutex.
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Temporizador, embebido en la estructura que se quiere vencer */
+typedef struct TcpTimer TcpTimer;
+
+struct TcpTimer
+{
+  /** @privatesection */
+  TcpTimer *prev;
+  TcpTimer *next;
+  int64_t   expires;
+  uint8_t   level;
+  uint8_t   slot;
+  bool      pending;
+  void     *data;
+};
+
+/** Rueda de temporizadores jerárquica */
+typedef struct TcpTimerWheel TcpTimerWheel;
+
+/**
+ * Crea una nueva rueda de temporizadores.
+ *
+ * @see tcp_timer_wheel_free()
+ * @param now tiempo actual (g_get_monotonic_time())
+ * @return puntero a TcpTimerWheel (debe liberarse con tcp_timer_wheel_free()
+ * cuando ya no se utilice)
+ */
+TcpTimerWheel *tcp_timer_wheel_new(gint64 now);
+
+/**
+ * Programa un temporizador para que venza en el tiempo expires. Si el
+ * temporizador ya estaba programado, se reprograma.
+ *
+ * @param wheel rueda de temporizadores
+ * @param timer temporizador (debe estar inicializado a cero)
+ * @param expires tiempo de vencimiento (microsegundos, como
+ * g_get_monotonic_time())
+ * @param data dato que devuelve tcp_timer_wheel_expire() al vencer
+ */
+void tcp_timer_wheel_add(TcpTimerWheel *wheel, TcpTimer *timer, gint64 expires, void *data);
+
+/**
+ * Cancela un temporizador programado. Si no está programado, no hace nada.
+ *
+ * @param wheel rueda de temporizadores
+ * @param timer temporizador
+ */
+void tcp_timer_wheel_remove(TcpTimerWheel *wheel, TcpTimer *timer);
+
+/**
+ * Avanza la rueda hasta el tiempo now y quita uno de los temporizadores
+ * vencidos. Se debe llamar hasta que devuelva NULL.
+ *
+ * @param wheel rueda de temporizadores
+ * @param now tiempo actual (g_get_monotonic_time())
+ * @return dato del temporizador vencido, o NULL si no hay más vencidos
+ */
+void *tcp_timer_wheel_expire(TcpTimerWheel *wheel, gint64 now);
+
+/**
+ * Devuelve el tiempo hasta que se deba volver a llamar a
+ * tcp_timer_wheel_expire(), para utilizar como tiempo de espera de poll(),
+ * epoll_wait() o io_uring.
+ *
+ * @param wheel rueda de temporizadores
+ * @param now tiempo actual (g_get_monotonic_time())
+ * @return milisegundos hasta el próximo vencimiento, o -1 si no hay
+ * temporizadores programados
+ */
+int tcp_timer_wheel_timeout(TcpTimerWheel *wheel, gint64 now);
+
+/**
+ * Libera los recursos asignados por tcp_timer_wheel_new(). Los temporizadores
+ * programados no se vencen.
+ *
+ * @param wheel puntero a TcpTimerWheel
+ */
+void tcp_timer_wheel_free(TcpTimerWheel *wheel);
@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tcplog.h"
+#include "tcptrace.h"
+
+/* Cantidad máxima de etapas de una traza */
+#define TRACE_MAX_SPANS 16
+
+/** @private Etapa de una solicitud */
+typedef struct TcpTraceSpan
+{
+  const char *name;
+  gint64      start;
+  gint64      end;
+} TcpTraceSpan;
+
+/** Etapas de una solicitud en un servicio */
+struct TcpTrace
+{
+  /** @privatesection */
+  char         id[TCP_TRACE_ID_LEN];
+  gint64       start;
+  int          n_spans;
+  TcpTraceSpan spans[TRACE_MAX_SPANS];
+};
+
+/* Archivo de trazas, nombre del servicio y duración de una solicitud lenta */
+static GMutex  trace_lock;
+static FILE   *trace_file;
+static char   *trace_service;
+static gint64  trace_slow;
+static gint    trace_enabled;
+
+/* Traza de la solicitud que atiende el hilo actual */
+static GPrivate trace_current;
+
+bool tcp_trace_set_output(const char *service, const char *path, unsigned int slow)
+{
+  FILE *file;
+
+  g_return_val_if_fail(service != NULL, false);
+  g_return_val_if_fail(path != NULL, false);
+
+  file = fopen(path, "a");
+  if (file == NULL) {
+    tcp_log(TCP_LOG_ERROR, "Error al abrir el archivo de trazas %s: %s", path,
+            g_strerror(errno));
+    return false;
+  }
+
+  g_mutex_lock(&trace_lock);
+  if (trace_file != NULL) {
+    fclose(trace_file);
+  }
+  g_free(trace_service);
+  trace_file = file;
+  trace_service = g_strdup(service);
+  trace_slow = (gint64)slow * 1000;
+  g_mutex_unlock(&trace_lock);
+
+  g_atomic_int_set(&trace_enabled, TRUE);
+
+  return true;
+}
+
+void tcp_trace_new_id(char id[TCP_TRACE_ID_LEN])
+{
+  g_snprintf(id, TCP_TRACE_ID_LEN, "%08x%08x",
+             g_random_int(), g_random_int());
+}
+
+TcpTrace *tcp_trace_begin(gint64 start)
+{
+  TcpTrace *trace;
+
+  if (G_LIKELY(!g_atomic_int_get(&trace_enabled))) {
+    return NULL;
+  }
+
+  trace = g_new(TcpTrace, 1);
+  trace->id[0] = '\0';
+  trace->start = start;
+  trace->n_spans = 0;
+
+  return trace;
+}
+
+void tcp_trace_add(TcpTrace *trace, const char *name, gint64 start, gint64 end)
+{
+  TcpTraceSpan *span;
+
+  if (trace == NULL || trace->n_spans == TRACE_MAX_SPANS) {
+    return;
+  }
+
+  span = &trace->spans[trace->n_spans++];
+  span->name = name;
+  span->start = start;
+  span->end = end;
+}
+
+static void write_trace(TcpTrace *trace, gint64 now)
+{
+  GString *out = g_string_new(NULL);
+  TcpTraceSpan *span;
+  gint64 offset;
+
+  /* Las horas se pasan al reloj del sistema para comparar entre procesos */
+  offset = g_get_real_time() - now;
+
+  for (int i = 0; i < trace->n_spans; i++) {
+    span = &trace->spans[i];
+    g_string_append_printf(out, "{\"id\":\"%s\",\"servicio\":\"%s\","
+                           "\"etapa\":\"%s\",\"inicio\":%" PRId64 ","
+                           "\"duracion\":%" PRId64 "}\n",
+                           trace->id, trace_service, span->name,
+                           span->start + offset, span->end - span->start);
+  }
+
+  /* Una sola escritura por traza, para no mezclar las de otros procesos */
+  g_mutex_lock(&trace_lock);
+  fwrite(out->str, 1, out->len, trace_file);
+  fflush(trace_file);
+  g_mutex_unlock(&trace_lock);
+
+  g_string_free(out, TRUE);
+}
+
+void tcp_trace_end(TcpTrace *trace)
+{
+  gint64 now;
+
+  if (trace == NULL) {
+    return;
+  }
+
+  now = g_get_monotonic_time();
+
+  /* Las etapas sin terminar, como el envío de la respuesta, terminan ahora */
+  for (int i = 0; i < trace->n_spans; i++) {
+    if (trace->spans[i].end == 0) {
+      trace->spans[i].end = now;
+    }
+  }
+
+  if (now - trace->start >= trace_slow) {
+    write_trace(trace, now);
+  }
+
+  g_free(trace);
+}
+
+void tcp_trace_set_id(TcpTrace *trace, const char *id)
+{
+  if (trace != NULL && id != NULL) {
+    g_strlcpy(trace->id, id, sizeof(trace->id));
+  }
+}
+
+void tcp_trace_attach(TcpTrace *trace)
+{
+  if (G_UNLIKELY(g_atomic_int_get(&trace_enabled))) {
+    g_private_set(&trace_current, trace);
+  }
+}
+
+TcpTrace *tcp_trace_current(void)
+{
+  if (G_LIKELY(!g_atomic_int_get(&trace_enabled))) {
+    return NULL;
+  }
+
+  return g_private_get(&trace_current);
+}
+
+void tcp_trace_span(const char *name, gint64 start)
+{
+  TcpTrace *trace = tcp_trace_current();
+
+  if (trace != NULL) {
+    tcp_trace_add(trace, name, start, g_get_monotonic_time());
+  }
+}
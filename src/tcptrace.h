@@ -0,0 +1,115 @@
+/**
+ * @file tcptrace.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Etapas de las solicitudes entre servicios, identificadas por solicitud
+ * @version 0.1
+ * @date 2023-04-17
+ *
+ * Cada servicio registra una traza por solicitud, con la hora y la duración de
+ * sus etapas (recv, parse, cache, serialize y send, o las consultas a otros
+ * servidores). El servidor principal genera un identificador por solicitud y
+ * lo reenvía a los demás servidores en el miembro "id" del JSON, de modo que
+ * las trazas de todos los servicios se pueden unir por identificador y ordenar
+ * por hora para reconstruir la solicitud completa.
+ *
+ * Las trazas de las solicitudes lentas se agregan a un archivo, una etapa por
+ * línea en formato JSON:
+ *
+ * @code{.unparsed}
+ * {"id":"9f2c4e01a7b3d855","servicio":"server","etapa":"recv","inicio":1681747200123456,"duracion":41}
+ * @endcode
+ *
+ * donde "inicio" es la hora de inicio de la etapa en microsegundos desde el
+ * 1 de enero de 1970 y "duracion" está en microsegundos. Sin un archivo, las
+ * trazas no se registran y cada función cuesta una comparación.
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+
+/** Longitud de un identificador de solicitud, con el '\0' final */
+#define TCP_TRACE_ID_LEN 17
+
+/** Etapas de una solicitud en un servicio */
+typedef struct TcpTrace TcpTrace;
+
+/**
+ * Habilita las trazas y abre el archivo donde se agregan las lentas.
+ *
+ * @param service nombre del servicio en las trazas (por ejemplo, "weather")
+ * @param path ruta del archivo, que se abre para agregar al final
+ * @param slow duración mínima de una solicitud en el servicio para registrar
+ * su traza (milisegundos), o 0 para registrar todas
+ * @return true si se abrió el archivo, false en caso contrario
+ */
+bool tcp_trace_set_output(const char *service, const char *path, unsigned int slow);
+
+/**
+ * Genera un identificador de solicitud aleatorio, de 16 dígitos
+ * hexadecimales.
+ *
+ * @param id buffer donde guardar el identificador
+ */
+void tcp_trace_new_id(char id[TCP_TRACE_ID_LEN]);
+
+/**
+ * Inicia la traza de una solicitud.
+ *
+ * @param start hora en que se empezó a recibir la solicitud, como la devuelve
+ * g_get_monotonic_time()
+ * @return la traza, o NULL si las trazas no están habilitadas (las funciones
+ * de TcpTrace aceptan NULL y no hacen nada)
+ */
+TcpTrace *tcp_trace_begin(gint64 start);
+
+/**
+ * Agrega una etapa a una traza.
+ *
+ * @param trace traza de la solicitud
+ * @param name nombre de la etapa, que debe ser una cadena constante
+ * @param start hora de inicio de la etapa (ver g_get_monotonic_time())
+ * @param end hora de fin de la etapa, o 0 si termina con la traza
+ */
+void tcp_trace_add(TcpTrace *trace, const char *name, gint64 start, gint64 end);
+
+/**
+ * Termina una traza: la registra en el archivo si la solicitud es lenta, y la
+ * libera.
+ *
+ * @param trace traza de la solicitud
+ */
+void tcp_trace_end(TcpTrace *trace);
+
+/**
+ * Establece el identificador de una traza, recibido en la solicitud o
+ * generado con tcp_trace_new_id(). Se recorta a TCP_TRACE_ID_LEN - 1
+ * caracteres.
+ *
+ * @param trace traza de la solicitud
+ * @param id identificador de la solicitud, o NULL
+ */
+void tcp_trace_set_id(TcpTrace *trace, const char *id);
+
+/**
+ * Establece la traza de la solicitud que atiende el hilo actual. El servidor
+ * la establece antes de ejecutar la función del servidor (ver TcpServerFunc).
+ *
+ * @param trace traza de la solicitud, o NULL para quitarla
+ */
+void tcp_trace_attach(TcpTrace *trace);
+
+/**
+ * Obtiene la traza de la solicitud que atiende el hilo actual.
+ *
+ * @return la traza, o NULL si no hay una
+ */
+TcpTrace *tcp_trace_current(void);
+
+/**
+ * Agrega una etapa a la traza del hilo actual, que termina en este momento.
+ *
+ * @param name nombre de la etapa, que debe ser una cadena constante
+ * @param start hora de inicio de la etapa (ver g_get_monotonic_time())
+ */
+void tcp_trace_span(const char *name, gint64 start);
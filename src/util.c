@@ -1,6 +1,7 @@
 #include <glib.h>
 #include <json-glib/json-glib.h>
 
+#include "tcplog.h"
 #include "util.h"
 
 JsonNode *parse_json(const char *data, int length, JsonParser *parser)
@@ -12,7 +13,8 @@ JsonNode *parse_json(const char *data, int length, JsonParser *parser)
   json_parser_load_from_data(parser, data, length, &error);
 
   if (error != NULL) {
-    g_print("Error al obtener JSON `%s`: %s\n", data, error->message);
+    tcp_log(TCP_LOG_WARNING, "Error al obtener JSON `%s`: %s", data,
+            error->message);
     g_error_free(error);
     return NULL;
   }
@@ -8,7 +8,41 @@
  * Programa del servidor del clima, que recibe consultas por fechas, válidas a
  * partir de la fecha actual, hasta siete días en adelante. Los datos del clima
  * se guardan en memoria por 1 hora. Si se consulta luego de 1 hora generado los
- * datos, se actualizan.
+ * datos, se actualizan. Cada respuesta indica en el miembro "ttl" cuántos
+ * segundos más son válidos sus datos, para que el servidor principal pueda
+ * guardarla en su caché hasta entonces. Si la solicitud indica en el miembro
+ * "deadline" cuántos milisegundos espera la respuesta el servidor principal, y
+ * ese plazo vence mientras espera en cola, se responde con un error sin
+ * buscar los datos.
+ *
+ * El servidor principal puede pedir varias fechas en una sola solicitud, con
+ * el miembro "fechas" (hasta 128); se responde un arreglo con los datos de
+ * cada fecha en el mismo orden, buscados con una sola toma de la caché.
+ *
+ * Las mismas consultas pueden llegar en el protocolo binario (ver wire.h), con
+ * las fechas en campos de tamaño fijo, que se responden en ese protocolo sin
+ * analizar ni generar JSON. Como los mensajes binarios pueden contener saltos
+ * de línea, requieren delimitar los mensajes por longitud o con mux.
+ *
+ * Con el miembro "exportar":true se envían los datos de todos los días, un
+ * registro JSON por línea o por mensaje ({"clima":{...}}) a medida que se
+ * generan, terminados por {"fin":true,"registros":N}. La respuesta no tiene
+ * límite de tamaño ni se guarda completa en memoria: si el cliente no la lee,
+ * el servidor espera.
+ *
+ * Por defecto, cada conexión lleva una sola consulta y su respuesta, sin
+ * delimitar los mensajes. Con -F length, ndjson o mux, la conexión queda
+ * abierta para las consultas siguientes hasta el tiempo máximo de inactividad,
+ * y los clientes (el servidor principal con la opción -B, loadgen o client con
+ * -F) deben delimitar los mensajes de la misma forma. En modo threads, cada
+ * conexión abierta ocupa uno de los hilos del servidor, y las consultas de
+ * las demás conexiones esperan en cola hasta que se cierra; con conexiones
+ * persistentes conviene el modo epoll o uring.
+ *
+ * Al recibir la señal SIGUSR2, el servidor se reinicia sin cortes: ejecuta una
+ * nueva copia del programa con los mismos parámetros, le traspasa el socket de
+ * escucha y la caché de datos del clima, y termina luego de atender las
+ * conexiones abiertas.
  *
  * A continuación se detallan las opciones por parámetros que toma el servidor,
  * que también puede verse al ejecutar el programa con el parámetro -h o --help:
@@ -24,11 +58,22 @@
  *   weather_server [OPTION?] - Servidor del clima
  *
  * Opciones de ayuda:
- *   -h, --help       Muestra ayuda de opciones
+ *   -h, --help             Muestra ayuda de opciones
  *
  * Opciones de aplicación:
- *   -a, --addr=A     Direccion A (0 = INADDR_ANY por defecto)
- *   -p, --port=P     Puerto P > 1024 del servidor (24001 por defecto)
+ *   -a, --addr=A           Direccion A (0 = INADDR_ANY por defecto)
+ *   -p, --port=P           Puerto P > 1024 del servidor (24001 por defecto)
+ *   -u, --unix=U           Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)
+ *   -m, --mode=M           Modo M del servidor: threads, epoll o uring (threads por defecto)
+ *   -F, --framing=F        Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)
+ *   -L, --max-inflight=L   Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)
+ *   -D, --deadlines=R,W,T  Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)
+ *   -k, --workers=K        Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)
+ *   -v, --log-level=V      Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)
+ *   -l, --log-sample=N     Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)
+ *   -M, --admin-port=AP    Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)
+ *   -T, --trace=ARCHIVO    Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)
+ *   -R, --trace-slow=MS    Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)
  * @endcode
  */
 #include <glib.h>
@@ -53,24 +98,52 @@
 #include <ws2tcpip.h>
 #endif
 
+#include "tcplog.h"
+#include "tcpmetrics.h"
 #include "tcpserver.h"
+#include "tcptrace.h"
 #include "types.h"
 #include "util.h"
+#include "wire.h"
 
 /** Nombre del servidor */
-#define SRV_NAME     "Servidor del clima"
+#define SRV_NAME         "Servidor del clima"
 /** Descripción del programa */
-#define SRV_INFO     "- Servidor del clima"
+#define SRV_INFO         "- Servidor del clima"
 /** Dirección del servidor por defecto */
-#define SRV_ADDR     INADDR_ANY
+#define SRV_ADDR         INADDR_ANY
 /** Puerto del servidor por defecto */
-#define SRV_PORT     24001
+#define SRV_PORT         24001
+/** Ruta del socket Unix por defecto (NULL = escuchar en TCP) */
+#define SRV_UNIX_PATH    NULL
+/** Modo del servidor por defecto */
+#define SRV_MODE         "threads"
+/** Forma de delimitar mensajes por defecto */
+#define SRV_FRAMING      "none"
+/** Tiempo máximo de inactividad de una conexión (milisegundos) */
+#define SRV_IDLE_TIMEOUT 30000
+/** Máximo del límite de solicitudes en curso por defecto (0 = sin límite) */
+#define SRV_MAX_INFLIGHT 1024
+/** Plazos de lectura, escritura y total por defecto (milisegundos) */
+#define SRV_DEADLINES    "10000,10000,0"
+/** Procesos de trabajo por defecto (0 = un único proceso) */
+#define SRV_WORKERS      0
+/** Nivel de registro por defecto */
+#define SRV_LOG_LEVEL    "info"
+/** Registrar el contenido de una de cada N solicitudes (0 = ninguna) */
+#define SRV_LOG_SAMPLE   0
+/** Puerto de métricas por defecto (0 = no exponerlas) */
+#define SRV_ADMIN_PORT   0
+/** Archivo de trazas por defecto (NULL = no registrar trazas) */
+#define SRV_TRACE_PATH   NULL
+/** Duración mínima de las solicitudes registradas en las trazas (milisegundos) */
+#define SRV_TRACE_SLOW   0
 /** Cantidad máxima para envío de bytes */
-#define SRV_SEND_MAX 1024
-/** Cantidad máxima para recepción de bytes */
-#define SRV_RECV_MAX 1024
+#define SRV_SEND_MAX     1024
 /** TTL para datos del clima (segundos) */
-#define SRV_DATA_TTL 3600
+#define SRV_DATA_TTL     3600
+/** Cantidad máxima de fechas por solicitud */
+#define SRV_BATCH_MAX    128
 
 /** Mímino de días para el clima, a partir de la fecha actual */
 #define W_MIN_DAYS    0
@@ -87,13 +160,57 @@
 static uint32_t addr = SRV_ADDR;
 
 /* Puerto del servidor */
-static uint16_t port = SRV_PORT;
+static int port = SRV_PORT;
+
+/* Ruta del socket Unix */
+static char *unix_path = SRV_UNIX_PATH;
+
+/* Modo del servidor */
+static char *mode_name = SRV_MODE;
+
+/* Forma de delimitar mensajes */
+static char *framing_name = SRV_FRAMING;
+
+/* Máximo del límite de solicitudes en curso */
+static int max_inflight = SRV_MAX_INFLIGHT;
+
+/* Plazos de lectura, escritura y total de las conexiones */
+static char *deadlines_text = SRV_DEADLINES;
+
+/* Cantidad de procesos de trabajo */
+static int workers = SRV_WORKERS;
+
+/* Nivel de registro */
+static char *log_level_name = SRV_LOG_LEVEL;
+
+/* Muestreo del contenido de las solicitudes en el registro */
+static int log_sample = SRV_LOG_SAMPLE;
+
+/* Puerto de métricas */
+static int admin_port = SRV_ADMIN_PORT;
+
+/* Archivo de trazas */
+static char *trace_path = SRV_TRACE_PATH;
+
+/* Duración mínima de las solicitudes registradas en las trazas */
+static int trace_slow = SRV_TRACE_SLOW;
 
 /* Opciones de línea de comandos */
 static GOptionEntry options[] =
 {
   { "addr", 'a', 0, G_OPTION_ARG_INT, &addr, "Direccion A (0 = INADDR_ANY por defecto)", "A" },
   { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Puerto P > 1024 del servidor (24001 por defecto)", "P" },
+  { "unix", 'u', 0, G_OPTION_ARG_FILENAME, &unix_path, "Escuchar en el socket Unix U en lugar de la dirección y el puerto (ninguno por defecto)", "U" },
+  { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "Modo M del servidor: threads, epoll o uring (threads por defecto)", "M" },
+  { "framing", 'F', 0, G_OPTION_ARG_STRING, &framing_name, "Delimitar mensajes con F: none, length, ndjson o mux (none por defecto)", "F" },
+  { "max-inflight", 'L', 0, G_OPTION_ARG_INT, &max_inflight, "Rechazar solicitudes sobre un límite adaptativo de hasta L en curso o 0 sin límite (1024 por defecto)", "L" },
+  { "deadlines", 'D', 0, G_OPTION_ARG_STRING, &deadlines_text, "Cerrar conexiones que no completan la lectura, la escritura o el total en R,W,T milisegundos, 0 sin plazo (10000,10000,0 por defecto)", "R,W,T" },
+  { "workers", 'k', 0, G_OPTION_ARG_INT, &workers, "Atender con K procesos de trabajo (pre-fork), -1 uno por núcleo o 0 un único proceso (0 por defecto)", "K" },
+  { "log-level", 'v', 0, G_OPTION_ARG_STRING, &log_level_name, "Registrar mensajes de nivel V: error, warning, info o debug (info por defecto)", "V" },
+  { "log-sample", 'l', 0, G_OPTION_ARG_INT, &log_sample, "Registrar el contenido de una de cada N solicitudes o 0 de ninguna (0 por defecto)", "N" },
+  { "admin-port", 'M', 0, G_OPTION_ARG_INT, &admin_port, "Exponer métricas en el puerto AP de 127.0.0.1 o 0 para no exponerlas (0 por defecto)", "AP" },
+  { "trace", 'T', 0, G_OPTION_ARG_FILENAME, &trace_path, "Agregar las etapas de las solicitudes lentas al ARCHIVO de trazas (ninguno por defecto)", "ARCHIVO" },
+  { "trace-slow", 'R', 0, G_OPTION_ARG_INT, &trace_slow, "Registrar en las trazas las solicitudes de al menos MS milisegundos o 0 todas (0 por defecto)", "MS" },
   { NULL }
 };
 
@@ -101,21 +218,24 @@ static GOptionEntry options[] =
 static JsonParser *json_parser = NULL;
 
 /* Caché de datos del clima */
-static WeatherInfo weather_data[W_MAX_DAYS] = { 0 };
+static WeatherInfo weather_data[W_MAX_DAYS + 1] = { 0 };
 
 /* Marcas de tiempo de la caché */
-static time_t weather_cache[W_MAX_DAYS] = { 0 };
+static time_t weather_cache[W_MAX_DAYS + 1] = { 0 };
+
+/* Exclusión mutua de la caché */
+static GMutex weather_mutex;
+
+/* Aciertos y fallos de la caché */
+static TcpCounter *weather_hits;
+static TcpCounter *weather_misses;
 
-/* Condiciones del tiempo */
-static const char *conditions[N_CONDITIONS] =
+/* Caché traspasada al nuevo proceso en un reinicio sin cortes */
+typedef struct
 {
-  [W_CLEAR]   = "Despejado",
-  [W_CLOUD]   = "Nublado",
-  [W_MIST]    = "Neblina",
-  [W_RAIN]    = "Lluvia",
-  [W_SHOWERS] = "Chubascos",
-  [W_SNOW]    = "Nieve"
-};
+  WeatherInfo data[W_MAX_DAYS + 1];
+  time_t      cache[W_MAX_DAYS + 1];
+} WeatherState;
 
 static void create_weather(WeatherInfo *weather_info, int day)
 {
@@ -137,44 +257,96 @@ static void create_weather(WeatherInfo *weather_info, int day)
   g_free(date);
 }
 
-static void get_weather(WeatherInfo *weather_info, int day)
+static time_t lookup_weather(WeatherInfo *weather_info, int day, time_t now)
+{
+  /* Se llama con weather_mutex tomado */
+  if ((now - weather_cache[day]) > SRV_DATA_TTL) {
+    create_weather(&weather_data[day], day);
+    weather_cache[day] = now;
+    tcp_counter_add(weather_misses, 1);
+  } else {
+    tcp_counter_add(weather_hits, 1);
+  }
+
+  memcpy(weather_info, &weather_data[day], sizeof(WeatherInfo));
+
+  return weather_cache[day] + SRV_DATA_TTL - now;
+}
+
+static time_t get_weather(WeatherInfo *weather_info, int day)
 {
-  static GMutex mutex;
   struct timeval time;
+  time_t ttl;
 
-  g_return_if_fail(weather_info != NULL);
-  g_return_if_fail(day >= W_MIN_DAYS && day <= W_MAX_DAYS);
+  g_return_val_if_fail(weather_info != NULL, 0);
+  g_return_val_if_fail(day >= W_MIN_DAYS && day <= W_MAX_DAYS, 0);
 
-  g_mutex_lock(&mutex);
+  g_mutex_lock(&weather_mutex);
   gettimeofday(&time, NULL);
+  ttl = lookup_weather(weather_info, day, time.tv_sec);
+  g_mutex_unlock(&weather_mutex);
 
-  if ((time.tv_sec - weather_cache[day]) > SRV_DATA_TTL) {
-    create_weather(&weather_data[day], day);
-    weather_cache[day] = time.tv_sec;
+  return ttl;
+}
+
+static void get_weather_all(WeatherInfo *weather_info,
+                            time_t      *ttl,
+                            const int   *days,
+                            size_t       n_days)
+{
+  struct timeval time;
+
+  g_return_if_fail(weather_info != NULL);
+  g_return_if_fail(ttl != NULL);
+  g_return_if_fail(days != NULL);
+
+  /* Todas las fechas de una solicitud con una sola toma de la caché */
+  g_mutex_lock(&weather_mutex);
+  gettimeofday(&time, NULL);
+  for (size_t i = 0; i < n_days; i++) {
+    if (days[i] != -1) {
+      ttl[i] = lookup_weather(&weather_info[i], days[i], time.tv_sec);
+    }
   }
+  g_mutex_unlock(&weather_mutex);
+}
 
-  memcpy(weather_info, &weather_data[day], sizeof(WeatherInfo));
-  g_mutex_unlock(&mutex);
+static GBytes *save_weather(void *data)
+{
+  WeatherState state;
+
+  g_mutex_lock(&weather_mutex);
+  memcpy(state.data, weather_data, sizeof(weather_data));
+  memcpy(state.cache, weather_cache, sizeof(weather_cache));
+  g_mutex_unlock(&weather_mutex);
+
+  return g_bytes_new(&state, sizeof(state));
 }
 
-static void get_client_args(const char *data, int *arg_day)
+static void restore_weather(GBytes *bytes)
 {
-  g_return_if_fail(data != NULL);
-  g_return_if_fail(arg_day != NULL);
+  const WeatherState *state;
+  gsize size;
+
+  /* Descartar la caché de una versión con otro formato */
+  state = g_bytes_get_data(bytes, &size);
+  if (size != sizeof(WeatherState)) {
+    return;
+  }
 
+  g_mutex_lock(&weather_mutex);
+  memcpy(weather_data, state->data, sizeof(weather_data));
+  memcpy(weather_cache, state->cache, sizeof(weather_cache));
+  g_mutex_unlock(&weather_mutex);
+}
+
+static int days_from_today(GDate *date)
+{
   struct timeval time;
   int day = -1;
-  const char *date_str = NULL;
-  GDate *date = NULL;
   GDate *today = NULL;
-  JsonNode *json_node = NULL;
-  JsonObject *json_object = NULL;
-
-  json_node = parse_json(data, strlen(data), json_parser);
-  json_object = json_node_get_object(json_node);
-  date_str = json_object_get_string_member(json_object, "fecha");
-  date = parse_date(date_str);
 
+  /* Se libera la fecha recibida */
   if (date != NULL) {
     today = g_date_new();
     gettimeofday(&time, NULL);
@@ -185,57 +357,346 @@ static void get_client_args(const char *data, int *arg_day)
     g_date_free(today);
   }
 
-  *arg_day = day >= W_MIN_DAYS && day <= W_MAX_DAYS ? day : -1;
+  return day >= W_MIN_DAYS && day <= W_MAX_DAYS ? day : -1;
 }
 
-static char *weather_to_json(WeatherInfo *weather_info)
+static int date_to_day(const char *date_str)
 {
-  g_return_val_if_fail(weather_info != NULL, NULL);
+  return days_from_today(date_str != NULL ? parse_date(date_str) : NULL);
+}
 
-  return g_strdup_printf("{\"fecha\":\"%s\",\"temperatura\":%.1f,\"condicion\":\"%s\"}",
-                         weather_info->date,
-                         weather_info->temp,
-                         conditions[(int)weather_info->cond]);
+static void get_request_meta(JsonObject *json_object, gint64 *arg_deadline)
+{
+  /* Identificador de la solicitud enviado por el servidor principal */
+  if (json_object_has_member(json_object, "id")) {
+    tcp_trace_set_id(tcp_trace_current(),
+                     json_object_get_string_member(json_object, "id"));
+  }
+
+  /* Tiempo que el servidor principal espera la respuesta (milisegundos) */
+  *arg_deadline = 0;
+  if (json_object_has_member(json_object, "deadline")) {
+    *arg_deadline = json_object_get_int_member(json_object, "deadline");
+  }
 }
 
-static void serve_weather(int connfd, void *data)
+static bool get_export_arg(const char *data, size_t length)
 {
-  g_return_if_fail(connfd != -1);
+  g_return_val_if_fail(data != NULL, false);
+
+  JsonNode *json_node = NULL;
+  JsonNode *member = NULL;
+  bool export = false;
+
+  /* Solo se analizan las solicitudes que pueden pedir la exportación */
+  if (g_strstr_len(data, length, "\"exportar\"") == NULL) {
+    return false;
+  }
+
+  /* Con "exportar":true en el objeto principal, no en otro miembro */
+  json_node = parse_json(data, length, json_parser);
+  if (json_node != NULL && JSON_NODE_HOLDS_OBJECT(json_node)) {
+    member = json_object_get_member(json_node_get_object(json_node),
+                                    "exportar");
+    export = member != NULL
+          && JSON_NODE_HOLDS_VALUE(member)
+          && json_node_get_value_type(member) == G_TYPE_BOOLEAN
+          && json_node_get_boolean(member);
+  }
+
+  if (json_node != NULL) {
+    json_node_free(json_node);
+  }
+
+  return export;
+}
+
+static void get_client_args(const char *data,
+                            int        *arg_day,
+                            gint64     *arg_deadline)
+{
+  g_return_if_fail(data != NULL);
+  g_return_if_fail(arg_day != NULL);
+  g_return_if_fail(arg_deadline != NULL);
+
+  JsonNode *json_node = NULL;
+  JsonObject *json_object = NULL;
+
+  json_node = parse_json(data, strlen(data), json_parser);
+  json_object = json_node_get_object(json_node);
+
+  get_request_meta(json_object, arg_deadline);
+  *arg_day = date_to_day(json_object_get_string_member(json_object, "fecha"));
+
+  if (json_node != NULL) {
+    json_node_free(json_node);
+  }
+}
+
+static gssize get_batch_args(const char *data,
+                             int        *arg_days,
+                             gint64     *arg_deadline)
+{
+  g_return_val_if_fail(data != NULL, -1);
+  g_return_val_if_fail(arg_days != NULL, -1);
+  g_return_val_if_fail(arg_deadline != NULL, -1);
+
+  JsonNode *json_node = NULL;
+  JsonObject *json_object = NULL;
+  JsonArray *json_array = NULL;
+  JsonNode *element;
+  gssize n_days = -1;
+
+  json_node = parse_json(data, strlen(data), json_parser);
+  if (json_node != NULL && JSON_NODE_HOLDS_OBJECT(json_node)) {
+    json_object = json_node_get_object(json_node);
+    get_request_meta(json_object, arg_deadline);
+
+    if (json_object_has_member(json_object, "fechas")) {
+      json_array = json_object_get_array_member(json_object, "fechas");
+    }
+  }
+
+  /* Un día por fecha, -1 si la fecha no es válida */
+  if (json_array != NULL && json_array_get_length(json_array) <= SRV_BATCH_MAX) {
+    n_days = json_array_get_length(json_array);
+    for (gssize i = 0; i < n_days; i++) {
+      element = json_array_get_element(json_array, i);
+      arg_days[i] = JSON_NODE_HOLDS_VALUE(element)
+                    ? date_to_day(json_node_get_string(element))
+                    : -1;
+    }
+  }
+
+  if (json_node != NULL) {
+    json_node_free(json_node);
+  }
+
+  return n_days;
+}
+
+static void serve_weather_batch(const char     *request,
+                                size_t          length,
+                                TcpServerReply *reply,
+                                bool            sampled)
+{
+  WeatherInfo weather[SRV_BATCH_MAX];
+  time_t ttl[SRV_BATCH_MAX];
+  int days[SRV_BATCH_MAX];
+  gint64 arg_deadline = 0;
+  gssize n_days;
+  char *weather_json;
+  gint64 start;
+
+  /* Analizar datos recibidos */
+  start = g_get_monotonic_time();
+  n_days = get_batch_args(request, days, &arg_deadline);
+  tcp_trace_span("parse", start);
+
+  if (arg_deadline > 0
+      && start - tcp_server_reply_get_received(reply) >= arg_deadline * 1000) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Plazo vencido");
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+    return;
+  }
+
+  if (n_days < 0) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Fechas incorrectas");
+    return;
+  }
+
+  memset(weather, 0, sizeof(WeatherInfo) * n_days);
+  start = g_get_monotonic_time();
+  get_weather_all(weather, ttl, days, n_days);
+  tcp_trace_span("cache", start);
+
+  /* Un elemento por fecha, en el orden de la solicitud */
+  start = g_get_monotonic_time();
+  tcp_server_reply_append(reply, "[", 1);
+  for (gssize i = 0; i < n_days; i++) {
+    if (i > 0) {
+      tcp_server_reply_append(reply, ",", 1);
+    }
+    if (days[i] != -1) {
+      weather_json = weather_to_json(&weather[i], ttl[i]);
+      tcp_server_reply_append(reply, weather_json, strlen(weather_json));
+      g_free(weather_json);
+    } else {
+      tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Fecha incorrecta");
+    }
+  }
+  tcp_server_reply_append(reply, "]", 1);
+  tcp_trace_span("serialize", start);
+
+  if (sampled) {
+    tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s",
+            tcp_server_reply_get_data(reply, NULL));
+  }
+}
+
+static void serve_weather_wire(const char     *request,
+                               size_t          length,
+                               TcpServerReply *reply)
+{
+  WeatherInfo weather[SRV_BATCH_MAX];
+  time_t ttl[SRV_BATCH_MAX];
+  int days[SRV_BATCH_MAX];
+  char head[WIRE_HEADER_SIZE];
+  char item[WIRE_WEATHER_SIZE];
+  WireHeader header;
+  WireQuery query;
+  gint64 start;
+
+  /* Analizar datos recibidos: campos de tamaño fijo, sin JSON */
+  start = g_get_monotonic_time();
+  if (!wire_header_unpack(request, length, &header)
+      || header.type != WIRE_WEATHER_QUERY
+      || header.count > SRV_BATCH_MAX) {
+    memset(&header, 0, sizeof(WireHeader));
+    header.status = WIRE_BAD_REQUEST;
+  } else {
+    if (header.id[0] != '\0') {
+      tcp_trace_set_id(tcp_trace_current(), header.id);
+    }
+    for (unsigned int i = 0; i < header.count; i++) {
+      wire_query_unpack(request + WIRE_HEADER_SIZE + i * WIRE_QUERY_SIZE,
+                        &query);
+      days[i] = days_from_today(wire_query_date(&query));
+    }
+  }
+  tcp_trace_span("parse", start);
+
+  if (header.status == WIRE_OK && header.deadline > 0
+      && start - tcp_server_reply_get_received(reply)
+         >= (gint64)header.deadline * 1000) {
+    header.status = WIRE_EXPIRED;
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+  }
+
+  /* Con un error, la respuesta es solo la cabecera */
+  if (header.status != WIRE_OK) {
+    header.count = 0;
+  }
+  header.type = WIRE_WEATHER_REPLY;
+  header.deadline = 0;
+  wire_header_pack(head, &header);
+  tcp_server_reply_append(reply, head, sizeof(head));
+  if (header.status != WIRE_OK) {
+    return;
+  }
+
+  start = g_get_monotonic_time();
+  get_weather_all(weather, ttl, days, header.count);
+  tcp_trace_span("cache", start);
+
+  /* Un elemento por fecha, en el orden de la solicitud */
+  start = g_get_monotonic_time();
+  for (unsigned int i = 0; i < header.count; i++) {
+    wire_weather_pack(item, days[i] != -1 ? WIRE_OK : WIRE_BAD_QUERY,
+                      &weather[i], ttl[i]);
+    tcp_server_reply_append(reply, item, sizeof(item));
+  }
+  tcp_trace_span("serialize", start);
+}
+
+static void serve_weather_export(TcpServerReply *reply)
+{
+  WeatherInfo weather;
+  char *weather_json;
+  time_t ttl;
+
+  /* Un registro por día, enviado a medida que se genera */
+  for (int day = W_MIN_DAYS; day <= W_MAX_DAYS; day++) {
+    memset(&weather, 0, sizeof(WeatherInfo));
+    ttl = get_weather(&weather, day);
+    weather_json = weather_to_json(&weather, ttl);
+    tcp_server_reply_printf(reply, "{\"clima\":%s}", weather_json);
+    g_free(weather_json);
+
+    if (!tcp_server_reply_flush(reply)) {
+      tcp_log(TCP_LOG_DEBUG, "Exportación interrumpida por el cliente");
+      return;
+    }
+  }
+
+  tcp_server_reply_printf(reply, "{\"fin\":true,\"registros\":%d}",
+                          W_MAX_DAYS - W_MIN_DAYS + 1);
+}
+
+static void serve_weather(const char     *request,
+                          size_t          length,
+                          TcpServerReply *reply,
+                          void           *data)
+{
+  g_return_if_fail(request != NULL);
 
   int arg_day = -1;
-  int send_len = SRV_SEND_MAX;
-  char recv_buff[SRV_RECV_MAX+1];
-  char send_buff[SRV_SEND_MAX+1];
+  gint64 arg_deadline = 0;
+  bool sampled = tcp_log_sample();
+  gint64 start;
+
+  /* Consultas del servidor principal en el protocolo binario */
+  if (wire_is_binary(request, length)) {
+    serve_weather_wire(request, length, reply);
+    return;
+  }
+
+  if (sampled) {
+    tcp_log(TCP_LOG_INFO, "Mensaje recibido:\n%s", request);
+  }
 
-  memset(recv_buff, 0, sizeof(recv_buff));
-  memset(send_buff, 0, sizeof(send_buff));
+  /* Todos los días, en una respuesta en partes */
+  if (get_export_arg(request, length)) {
+    serve_weather_export(reply);
+    return;
+  }
 
-  /* Leer solicitud del cliente */
-  recv(connfd, recv_buff, SRV_RECV_MAX, 0);
-  printf("Mensaje recibido:\n%s\n", recv_buff);
+  /* Varias fechas en una sola solicitud del servidor principal */
+  if (g_strstr_len(request, length, "\"fechas\"") != NULL) {
+    serve_weather_batch(request, length, reply, sampled);
+    return;
+  }
 
   /* Analizar datos recibidos */
-  get_client_args(recv_buff, &arg_day);
+  start = g_get_monotonic_time();
+  get_client_args(request, &arg_day, &arg_deadline);
+  tcp_trace_span("parse", start);
+
+  /* Si venció el plazo mientras esperaba en cola, ya nadie espera los datos */
+  if (arg_deadline > 0
+      && start - tcp_server_reply_get_received(reply) >= arg_deadline * 1000) {
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Plazo vencido");
+    tcp_log(TCP_LOG_DEBUG, "Solicitud descartada por plazo vencido");
+    return;
+  }
 
   /* Preparar datos para el envío */
   if (arg_day != -1) {
     WeatherInfo weather;
     char *weather_json;
+    time_t ttl;
 
     memset(&weather, 0, sizeof(WeatherInfo));
-    get_weather(&weather, arg_day);
-    weather_json = weather_to_json(&weather);
-    send_len = MIN(SRV_SEND_MAX, strlen(weather_json));
-    memcpy(send_buff, weather_json, send_len);
+    start = g_get_monotonic_time();
+    ttl = get_weather(&weather, arg_day);
+    tcp_trace_span("cache", start);
+    start = g_get_monotonic_time();
+    weather_json = weather_to_json(&weather, ttl);
+    tcp_trace_span("serialize", start);
+    tcp_server_reply_append(reply,
+                            weather_json,
+                            MIN(SRV_SEND_MAX, strlen(weather_json)));
+    if (sampled) {
+      tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s", weather_json);
+    }
 
     g_free(weather_json);
   } else {
-    send_len = sprintf(send_buff, "{\"error\":\"%s\"}", "Fecha incorrecta");
+    tcp_server_reply_printf(reply, "{\"error\":\"%s\"}", "Fecha incorrecta");
+    if (sampled) {
+      tcp_log(TCP_LOG_INFO, "Mensaje enviado:\n%s", "Fecha incorrecta");
+    }
   }
-
-  /* Enviar datos al cliente */
-  send(connfd, send_buff, send_len, 0);
-  printf("Mensaje enviado:\n%s\n", send_buff);
 }
 
 int main(int argc, char **argv)
@@ -243,7 +704,15 @@ int main(int argc, char **argv)
   GError         *error = NULL;
   GOptionContext *context;
   TcpServer      *server;
-
+  TcpServerMode   mode;
+  TcpFraming      framing;
+  TcpLogLevel     log_level;
+  unsigned int    read_timeout, write_timeout, total_timeout;
+  GBytes         *state;
+  char          **restart_argv;
+
+  /* Argumentos originales, para ejecutar el nuevo proceso al reiniciar */
+  restart_argv = g_strdupv(argv);
   context = g_option_context_new(SRV_INFO);
   g_option_context_add_main_entries(context, options, NULL);
   g_option_context_parse(context, &argc, &argv, &error);
@@ -255,20 +724,94 @@ int main(int argc, char **argv)
     return EXIT_FAILURE;
   }
 
-  if (port <= 1024) {
+  if (port <= 1024 || port > G_MAXUINT16) {
     fprintf(stderr, "El puerto debe ser mayor a 1024\n");
     return EXIT_FAILURE;
   }
 
-  printf("Iniciando %s...\n", SRV_NAME);
+  if (!tcp_server_mode_parse(mode_name, &mode)) {
+    fprintf(stderr, "Modo de servidor desconocido: %s\n", mode_name);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_framing_parse(framing_name, &framing)) {
+    fprintf(stderr, "Forma de delimitar mensajes desconocida: %s\n",
+            framing_name);
+    return EXIT_FAILURE;
+  }
+
+  if (max_inflight < 0) {
+    fprintf(stderr, "El límite de solicitudes en curso debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_server_deadlines_parse(deadlines_text, &read_timeout,
+                                  &write_timeout, &total_timeout)) {
+    fprintf(stderr, "Plazos de conexión inválidos: %s\n", deadlines_text);
+    return EXIT_FAILURE;
+  }
+
+  if (!tcp_log_level_parse(log_level_name, &log_level)) {
+    fprintf(stderr, "Nivel de registro desconocido: %s\n", log_level_name);
+    return EXIT_FAILURE;
+  }
+
+  if (log_sample < 0) {
+    fprintf(stderr, "El muestreo del registro debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (admin_port != 0 && (admin_port <= 1024 || admin_port > G_MAXUINT16)) {
+    fprintf(stderr, "El puerto de métricas debe ser 0 o mayor a 1024\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_slow < 0) {
+    fprintf(stderr, "La duración mínima de las trazas debe ser mayor o igual a 0\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_path != NULL
+      && !tcp_trace_set_output("weather", trace_path, trace_slow)) {
+    return EXIT_FAILURE;
+  }
+
+  tcp_log_set_level(log_level);
+  tcp_log_set_sampling(log_sample);
+
+  tcp_log(TCP_LOG_INFO, "Iniciando %s...", SRV_NAME);
+  weather_hits = tcp_metrics_counter("cache.weather.hits");
+  weather_misses = tcp_metrics_counter("cache.weather.misses");
+  tcp_metrics_ratio("cache.weather.hit_ratio", weather_hits, weather_misses);
   json_parser = json_parser_new();
   server = tcp_server_new(addr, port);
+  tcp_server_set_unix_path(server, unix_path);
+  tcp_server_set_restart(server, restart_argv, save_weather, NULL);
+  g_strfreev(restart_argv);
+
+  /* Recuperar la caché si el proceso viene de un reinicio sin cortes */
+  state = tcp_server_inherit(server, &error);
+  if (error != NULL) {
+    fprintf(stderr, "%s\n", error->message);
+    g_clear_error(&error);
+  }
+  if (state != NULL) {
+    restore_weather(state);
+    g_bytes_unref(state);
+  }
+
+  tcp_server_set_mode(server, mode);
+  tcp_server_set_framing(server, framing, SRV_IDLE_TIMEOUT);
+  tcp_server_set_deadlines(server, read_timeout, write_timeout, total_timeout);
+  tcp_server_set_workers(server, workers);
+  tcp_server_set_limit(server, max_inflight);
+  tcp_server_set_admin_port(server, admin_port);
   tcp_server_run(server, serve_weather, NULL, &error);
   tcp_server_free(server);
   g_object_unref(json_parser);
 
   if (error != NULL) {
-    fprintf(stderr, "%s\n", error->message);
+    tcp_log(TCP_LOG_ERROR, "%s", error->message);
     g_error_free(error);
     return EXIT_FAILURE;
   }
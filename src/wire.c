@@ -0,0 +1,317 @@
+#include <glib.h>
+#include <string.h>
+
+#include "wire.h"
+
+/* Signos */
+const char *astro_signs[N_SIGNS] =
+{
+  [S_ARIES]       = "aries",
+  [S_TAURUS]      = "tauro",
+  [S_GEMINI]      = "geminis",
+  [S_CANCER]      = "cancer",
+  [S_LEO]         = "leo",
+  [S_VIRGO]       = "virgo",
+  [S_LIBRA]       = "libra",
+  [S_SCORPIO]     = "escorpio",
+  [S_SAGITTARIUS] = "sagitario",
+  [S_CAPRICORN]   = "capricornio",
+  [S_AQUARIUS]    = "acuario",
+  [S_PISCES]      = "piscis"
+};
+
+/* Condiciones del tiempo */
+static const char *conditions[N_CONDITIONS] =
+{
+  [W_CLEAR]   = "Despejado",
+  [W_CLOUD]   = "Nublado",
+  [W_MIST]    = "Neblina",
+  [W_RAIN]    = "Lluvia",
+  [W_SHOWERS] = "Chubascos",
+  [W_SNOW]    = "Nieve"
+};
+
+static void put_u16(char *out, uint16_t value)
+{
+  value = GUINT16_TO_LE(value);
+  memcpy(out, &value, sizeof(value));
+}
+
+static void put_u32(char *out, uint32_t value)
+{
+  value = GUINT32_TO_LE(value);
+  memcpy(out, &value, sizeof(value));
+}
+
+static uint16_t get_u16(const char *data)
+{
+  uint16_t value;
+
+  memcpy(&value, data, sizeof(value));
+
+  return GUINT16_FROM_LE(value);
+}
+
+static uint32_t get_u32(const char *data)
+{
+  uint32_t value;
+
+  memcpy(&value, data, sizeof(value));
+
+  return GUINT32_FROM_LE(value);
+}
+
+static size_t item_size(WireType type)
+{
+  switch (type) {
+    case WIRE_WEATHER_QUERY:
+    case WIRE_ASTRO_QUERY:
+    case WIRE_QUERY:
+      return WIRE_QUERY_SIZE;
+    case WIRE_WEATHER_REPLY:
+      return WIRE_WEATHER_SIZE;
+    case WIRE_ASTRO_REPLY:
+      return WIRE_ASTRO_SIZE;
+    case WIRE_REPLY:
+      return WIRE_RESULT_SIZE;
+  }
+
+  return 0;
+}
+
+/* Mes y día de una fecha "MM-DD", como las que generan los servidores */
+static void put_month_day(char *out, const char *date)
+{
+  out[0] = (char)g_ascii_strtoull(date, NULL, 10);
+  out[1] = (char)g_ascii_strtoull(date + 3, NULL, 10);
+}
+
+bool wire_is_binary(const char *data, size_t length)
+{
+  return length > 0 && (uint8_t)data[0] == WIRE_MAGIC;
+}
+
+void wire_header_pack(char *out, const WireHeader *header)
+{
+  g_return_if_fail(out != NULL);
+  g_return_if_fail(header != NULL);
+
+  memset(out, 0, WIRE_HEADER_SIZE);
+  out[0] = (char)WIRE_MAGIC;
+  out[1] = WIRE_VERSION;
+  out[2] = (char)header->type;
+  out[3] = (char)header->status;
+  put_u16(out + 4, header->count);
+  put_u32(out + 8, header->deadline);
+  memcpy(out + 16, header->id, strnlen(header->id, WIRE_ID_LEN));
+}
+
+bool wire_header_unpack(const char *data, size_t length, WireHeader *header)
+{
+  g_return_val_if_fail(data != NULL, false);
+  g_return_val_if_fail(header != NULL, false);
+
+  if (length < WIRE_HEADER_SIZE
+      || (uint8_t)data[0] != WIRE_MAGIC
+      || data[1] != WIRE_VERSION) {
+    return false;
+  }
+
+  header->type = (uint8_t)data[2];
+  header->status = (uint8_t)data[3];
+  header->count = get_u16(data + 4);
+  header->deadline = get_u32(data + 8);
+  memcpy(header->id, data + 16, WIRE_ID_LEN);
+  header->id[WIRE_ID_LEN] = '\0';
+
+  /* Los elementos son de tamaño fijo: el mensaje tiene una sola longitud */
+  return item_size(header->type) > 0
+    && length == WIRE_HEADER_SIZE + header->count * item_size(header->type);
+}
+
+void wire_query_pack(char *out, const WireQuery *query)
+{
+  g_return_if_fail(out != NULL);
+  g_return_if_fail(query != NULL);
+
+  memset(out, 0, WIRE_QUERY_SIZE);
+  put_u16(out, query->year);
+  out[2] = (char)query->month;
+  out[3] = (char)query->day;
+  out[4] = (char)query->sign;
+}
+
+void wire_query_unpack(const char *data, WireQuery *query)
+{
+  g_return_if_fail(data != NULL);
+  g_return_if_fail(query != NULL);
+
+  query->year = get_u16(data);
+  query->month = (uint8_t)data[2];
+  query->day = (uint8_t)data[3];
+  query->sign = (uint8_t)data[4];
+}
+
+GDate *wire_query_date(const WireQuery *query)
+{
+  g_return_val_if_fail(query != NULL, NULL);
+
+  if (!g_date_valid_dmy(query->day, query->month, query->year)) {
+    return NULL;
+  }
+
+  return g_date_new_dmy(query->day, query->month, query->year);
+}
+
+void wire_weather_pack(char              *out,
+                       WireStatus         status,
+                       const WeatherInfo *weather_info,
+                       time_t             ttl)
+{
+  uint32_t temp;
+
+  g_return_if_fail(out != NULL);
+
+  memset(out, 0, WIRE_WEATHER_SIZE);
+  out[0] = (char)status;
+  if (status != WIRE_OK || weather_info == NULL) {
+    return;
+  }
+
+  out[1] = weather_info->cond;
+  put_u16(out + 2, (uint16_t)g_ascii_strtoull(weather_info->date, NULL, 10));
+  put_month_day(out + 4, weather_info->date + 5);
+  memcpy(&temp, &weather_info->temp, sizeof(temp));
+  put_u32(out + 8, temp);
+  put_u32(out + 12, (uint32_t)MAX(ttl, 0));
+}
+
+WireStatus wire_weather_unpack(const char  *data,
+                               WeatherInfo *weather_info,
+                               time_t      *ttl)
+{
+  uint32_t temp;
+
+  g_return_val_if_fail(data != NULL, WIRE_BAD_REQUEST);
+  g_return_val_if_fail(weather_info != NULL, WIRE_BAD_REQUEST);
+  g_return_val_if_fail(ttl != NULL, WIRE_BAD_REQUEST);
+
+  if (data[0] != WIRE_OK) {
+    return (uint8_t)data[0];
+  }
+
+  /* Una condición desconocida no debe indexar fuera de la tabla */
+  if ((uint8_t)data[1] >= N_CONDITIONS) {
+    return WIRE_BAD_REQUEST;
+  }
+
+  weather_info->cond = data[1];
+  g_snprintf(weather_info->date, sizeof(weather_info->date), "%04u-%02u-%02u",
+             get_u16(data + 2), (uint8_t)data[4], (uint8_t)data[5]);
+  temp = get_u32(data + 8);
+  memcpy(&weather_info->temp, &temp, sizeof(temp));
+  *ttl = get_u32(data + 12);
+
+  return WIRE_OK;
+}
+
+void wire_astro_pack(char            *out,
+                     WireStatus       status,
+                     const AstroInfo *astro_info,
+                     time_t           ttl)
+{
+  size_t mood_len;
+
+  g_return_if_fail(out != NULL);
+
+  memset(out, 0, WIRE_ASTRO_SIZE);
+  out[0] = (char)status;
+  if (status != WIRE_OK || astro_info == NULL) {
+    return;
+  }
+
+  mood_len = strnlen(astro_info->mood, sizeof(astro_info->mood));
+  out[1] = (char)astro_info->sign;
+  out[2] = (char)astro_info->sign_compat;
+  out[3] = (char)mood_len;
+  put_month_day(out + 4, astro_info->date_range[0]);
+  put_month_day(out + 6, astro_info->date_range[1]);
+  put_u32(out + 8, (uint32_t)MAX(ttl, 0));
+  memcpy(out + 12, astro_info->mood, mood_len);
+}
+
+WireStatus wire_astro_unpack(const char *data,
+                             AstroInfo  *astro_info,
+                             time_t     *ttl)
+{
+  size_t mood_len;
+
+  g_return_val_if_fail(data != NULL, WIRE_BAD_REQUEST);
+  g_return_val_if_fail(astro_info != NULL, WIRE_BAD_REQUEST);
+  g_return_val_if_fail(ttl != NULL, WIRE_BAD_REQUEST);
+
+  if (data[0] != WIRE_OK) {
+    return (uint8_t)data[0];
+  }
+
+  /* Un signo desconocido no debe indexar fuera de la tabla */
+  mood_len = (uint8_t)data[3];
+  if ((uint8_t)data[1] >= N_SIGNS || (uint8_t)data[2] >= N_SIGNS
+      || mood_len >= sizeof(astro_info->mood)) {
+    return WIRE_BAD_REQUEST;
+  }
+
+  astro_info->sign = (uint8_t)data[1];
+  astro_info->sign_compat = (uint8_t)data[2];
+  for (int i = 0; i < 2; i++) {
+    g_snprintf(astro_info->date_range[i], sizeof(astro_info->date_range[i]),
+               "%02u-%02u", (uint8_t)data[4 + 2 * i], (uint8_t)data[5 + 2 * i]);
+  }
+  memcpy(astro_info->mood, data + 12, mood_len);
+  astro_info->mood[mood_len] = '\0';
+  *ttl = get_u32(data + 8);
+
+  return WIRE_OK;
+}
+
+int parse_sign(const char *data)
+{
+  g_return_val_if_fail(data != NULL, -1);
+
+  int sign = -1;
+  int length = strlen(data);
+
+  for (int i = 0; i < N_SIGNS; i++) {
+    if (g_ascii_strncasecmp(astro_signs[i], data, length) == 0) {
+      sign = i;
+      break;
+    }
+  }
+
+  return sign;
+}
+
+char *weather_to_json(const WeatherInfo *weather_info, time_t ttl)
+{
+  g_return_val_if_fail(weather_info != NULL, NULL);
+
+  return g_strdup_printf("{\"fecha\":\"%s\",\"temperatura\":%.1f,\"condicion\":\"%s\",\"ttl\":%ld}",
+                         weather_info->date,
+                         weather_info->temp,
+                         conditions[(int)weather_info->cond],
+                         (long)ttl);
+}
+
+char *astro_to_json(const AstroInfo *astro_info, time_t ttl)
+{
+  g_return_val_if_fail(astro_info != NULL, NULL);
+
+  return g_strdup_printf("{\"signo\":\"%s\",\"compatible\":\"%s\",\"periodo\":[\"%s\",\"%s\"],\"estado\":\"%.*s\",\"ttl\":%ld}",
+                         astro_signs[astro_info->sign],
+                         astro_signs[astro_info->sign_compat],
+                         astro_info->date_range[0],
+                         astro_info->date_range[1],
+                         (int)sizeof(astro_info->mood),
+                         astro_info->mood,
+                         (long)ttl);
+}
@@ -0,0 +1,244 @@
+/**
+ * @file wire.h
+ * @author Diego Pablo Matias Baltar (diego.baltar@est.fi.uncoma.edu.ar)
+ * @brief Protocolo binario entre los servidores
+ * @version 0.1
+ * @date 2023-04-25
+ *
+ * Mensajes binarios de tamaño fijo, alternativos al JSON, para las consultas
+ * del servidor principal a los servidores del clima y del horóscopo, y
+ * opcionalmente de los clientes al servidor principal. Los servidores
+ * reconocen cada mensaje por su primer byte (WIRE_MAGIC, que no puede iniciar
+ * un texto JSON) y responden en el mismo protocolo de la solicitud, por lo que
+ * el JSON sigue siendo el protocolo por defecto.
+ *
+ * Todos los enteros van en little-endian, y la temperatura como float IEEE 754
+ * de 32 bits. Cada mensaje tiene una cabecera de WIRE_HEADER_SIZE bytes,
+ * seguida de tantos elementos de tamaño fijo como indica la cabecera:
+ *
+ * @code{.unparsed}
+ * Cabecera (32 bytes)          Consulta (8 bytes)
+ *   0  u8   WIRE_MAGIC           0  u16  año
+ *   1  u8   WIRE_VERSION         2  u8   mes
+ *   2  u8   tipo (WireType)      3  u8   día
+ *   3  u8   estado (WireStatus)  4  u8   signo (WIRE_NO_SIGN si no aplica)
+ *   4  u16  elementos            5  -    reservado
+ *   6  -    reservado
+ *   8  u32  plazo (ms, 0 = sin plazo)
+ *  12  -    reservado
+ *  16  char identificador (sin terminar en 0 si ocupa los 16 bytes)
+ *
+ * Clima (16 bytes)             Horóscopo (256 bytes)
+ *   0  u8   estado               0  u8   estado
+ *   1  u8   condición            1  u8   signo
+ *   2  u16  año                  2  u8   signo compatible
+ *   4  u8   mes                  3  u8   longitud del estado de ánimo
+ *   5  u8   día                  4  u8   mes y día del inicio del período
+ *   6  -    reservado            6  u8   mes y día del fin del período
+ *   8  f32  temperatura          8  u32  ttl (segundos)
+ *  12  u32  ttl (segundos)      12  char estado de ánimo (242 bytes)
+ *                              254  -    reservado
+ * @endcode
+ *
+ * La respuesta a una consulta WIRE_QUERY de un cliente tiene, por cada
+ * consulta, un elemento del clima seguido de uno del horóscopo.
+ */
+#pragma once
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "types.h"
+
+/** Primer byte de los mensajes binarios */
+#define WIRE_MAGIC        0xB7
+/** Versión del protocolo */
+#define WIRE_VERSION      1
+/** Tamaño de la cabecera (bytes) */
+#define WIRE_HEADER_SIZE  32
+/** Tamaño de una consulta (bytes) */
+#define WIRE_QUERY_SIZE   8
+/** Tamaño de los datos del clima (bytes) */
+#define WIRE_WEATHER_SIZE 16
+/** Tamaño de los datos del horóscopo (bytes) */
+#define WIRE_ASTRO_SIZE   256
+/** Tamaño del resultado de una consulta de un cliente (bytes) */
+#define WIRE_RESULT_SIZE  (WIRE_WEATHER_SIZE + WIRE_ASTRO_SIZE)
+/** Longitud máxima del identificador de la solicitud */
+#define WIRE_ID_LEN       16
+/** Signo de las consultas que no lo necesitan */
+#define WIRE_NO_SIGN      0xFF
+
+/** Tipos de mensaje */
+typedef enum
+{
+  WIRE_WEATHER_QUERY = 0x01, /**< Fechas al servidor del clima */
+  WIRE_ASTRO_QUERY   = 0x02, /**< Fechas y signos al servidor del horóscopo */
+  WIRE_QUERY         = 0x03, /**< Fechas y signos al servidor principal */
+  WIRE_WEATHER_REPLY = 0x81, /**< Datos del clima por fecha */
+  WIRE_ASTRO_REPLY   = 0x82, /**< Datos del horóscopo por fecha y signo */
+  WIRE_REPLY         = 0x83  /**< Clima y horóscopo por fecha y signo */
+} WireType;
+
+/** Estado de un mensaje o de cada uno de sus datos */
+typedef enum
+{
+  WIRE_OK,          /**< Datos válidos */
+  WIRE_BAD_QUERY,   /**< Fecha y/o signo incorrectos */
+  WIRE_EXPIRED,     /**< Plazo vencido mientras esperaba en cola */
+  WIRE_UNAVAILABLE, /**< El servidor del clima u horóscopo no respondió */
+  WIRE_BAD_REQUEST  /**< Mensaje incorrecto */
+} WireStatus;
+
+/** Cabecera de un mensaje */
+typedef struct
+{
+  WireType     type;
+  WireStatus   status;
+  unsigned int count;
+  uint32_t     deadline;
+  char         id[WIRE_ID_LEN + 1];
+} WireHeader;
+
+/** Consulta por fecha y signo */
+typedef struct
+{
+  uint16_t year;
+  uint8_t  month;
+  uint8_t  day;
+  uint8_t  sign;
+} WireQuery;
+
+/** Signos, como los espera el servidor del horóscopo */
+extern const char *astro_signs[N_SIGNS];
+
+/**
+ * Indica si un mensaje está en el protocolo binario.
+ *
+ * @param data datos del mensaje
+ * @param length longitud de los datos
+ * @return true si empieza con WIRE_MAGIC
+ */
+bool wire_is_binary(const char *data, size_t length);
+
+/**
+ * Escribe una cabecera.
+ *
+ * @param out WIRE_HEADER_SIZE bytes de destino
+ * @param header cabecera
+ */
+void wire_header_pack(char *out, const WireHeader *header);
+
+/**
+ * Lee la cabecera de un mensaje y comprueba que el mensaje tenga exactamente
+ * los elementos que indica.
+ *
+ * @param data datos del mensaje
+ * @param length longitud de los datos
+ * @param header cabecera leída
+ * @return true si el mensaje es válido
+ */
+bool wire_header_unpack(const char *data, size_t length, WireHeader *header);
+
+/**
+ * Escribe una consulta.
+ *
+ * @param out WIRE_QUERY_SIZE bytes de destino
+ * @param query consulta
+ */
+void wire_query_pack(char *out, const WireQuery *query);
+
+/**
+ * Lee una consulta.
+ *
+ * @param data WIRE_QUERY_SIZE bytes de la consulta
+ * @param query consulta leída
+ */
+void wire_query_unpack(const char *data, WireQuery *query);
+
+/**
+ * Transforma una consulta a la fecha que indica.
+ *
+ * @param query consulta
+ * @return una instancia de GDate, o NULL si la fecha no es válida. Una vez
+ * utilizado el resultado, debe liberarse con g_date_free().
+ */
+GDate *wire_query_date(const WireQuery *query);
+
+/**
+ * Escribe los datos del clima.
+ *
+ * @param out WIRE_WEATHER_SIZE bytes de destino
+ * @param status estado de los datos (con un error, solo se escribe el estado)
+ * @param weather_info datos del clima
+ * @param ttl segundos de validez de los datos
+ */
+void wire_weather_pack(char              *out,
+                       WireStatus         status,
+                       const WeatherInfo *weather_info,
+                       time_t             ttl);
+
+/**
+ * Lee los datos del clima.
+ *
+ * @param data WIRE_WEATHER_SIZE bytes de los datos
+ * @param weather_info datos del clima leídos
+ * @param ttl segundos de validez de los datos
+ * @return estado de los datos
+ */
+WireStatus wire_weather_unpack(const char  *data,
+                               WeatherInfo *weather_info,
+                               time_t      *ttl);
+
+/**
+ * Escribe los datos del horóscopo.
+ *
+ * @param out WIRE_ASTRO_SIZE bytes de destino
+ * @param status estado de los datos (con un error, solo se escribe el estado)
+ * @param astro_info datos del horóscopo
+ * @param ttl segundos de validez de los datos
+ */
+void wire_astro_pack(char            *out,
+                     WireStatus       status,
+                     const AstroInfo *astro_info,
+                     time_t           ttl);
+
+/**
+ * Lee los datos del horóscopo.
+ *
+ * @param data WIRE_ASTRO_SIZE bytes de los datos
+ * @param astro_info datos del horóscopo leídos
+ * @param ttl segundos de validez de los datos
+ * @return estado de los datos
+ */
+WireStatus wire_astro_unpack(const char *data,
+                             AstroInfo  *astro_info,
+                             time_t     *ttl);
+
+/**
+ * Busca un signo por su nombre, sin distinguir mayúsculas.
+ *
+ * @param data nombre del signo, o su comienzo
+ * @return número de signo (0-11), o -1 si no existe
+ */
+int parse_sign(const char *data);
+
+/**
+ * Transforma los datos del clima a JSON.
+ *
+ * @param weather_info datos del clima
+ * @param ttl segundos de validez de los datos
+ * @return texto JSON (debe liberarse con g_free())
+ */
+char *weather_to_json(const WeatherInfo *weather_info, time_t ttl);
+
+/**
+ * Transforma los datos del horóscopo a JSON.
+ *
+ * @param astro_info datos del horóscopo
+ * @param ttl segundos de validez de los datos
+ * @return texto JSON (debe liberarse con g_free())
+ */
+char *astro_to_json(const AstroInfo *astro_info, time_t ttl);